@@ -64,6 +64,7 @@
 #define atomic_fetch_sub __sync_fetch_and_sub
 #define atomic_fetch_add __sync_fetch_and_add
 #define atomic_compare_exchange __sync_bool_compare_and_swap
+#define atomic_exchange __sync_lock_test_and_set
 #define atomic_store_release(ptr, value) \
 	do {                             \
 		__sync_synchronize();    \
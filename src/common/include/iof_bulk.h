@@ -51,6 +51,19 @@ bool iof_bulk_alloc(crt_context_t ctx, void *ptr, off_t bulk_offset, size_t len,
 		    bool read_only);
 void iof_bulk_free(void *ptr, off_t bulk_offset);
 
+/* Return a read-only bulk handle for len bytes of memory at buf, which is
+ * owned by the calling thread.  The most recent registration is cached per
+ * thread and reused if called again for the same buffer, and released when
+ * the thread exits, so the buffer must remain valid for the life of the thread.
+ */
+bool iof_bulk_thread_register(crt_context_t ctx, void *buf, size_t len,
+			      crt_bulk_t *handle);
+
+/* Release the registration cached by the calling thread, if any, so that the
+ * next call to iof_bulk_thread_register() creates a new one.
+ */
+void iof_bulk_thread_deregister(void);
+
 #define IOF_BULK_ALLOC(ctx, ptr, field, len, read_only)			\
 	iof_bulk_alloc((ctx), (ptr), offsetof(__typeof__(*ptr), field),	\
 		       (len), (read_only))
@@ -49,6 +49,12 @@
 
 #define QUERY_PSR_OP	(0x201)
 #define DETACH_OP	(0x202)
+/* As QUERY_PSR_OP, but the reply also carries the fields of iof_psr_query
+ * which were added after the original format.  IONSS which do not register
+ * it fail the RPC with -DER_UNREG, in which case clients fall back to
+ * QUERY_PSR_OP.
+ */
+#define QUERY_EXT_OP	(0x203)
 
 #define IOF_DEFAULT_SET "IONSS"
 
@@ -85,6 +91,9 @@
 #define IOF_CNSS_MT			0x080UL
 #define IOF_FUSE_READ_BUF		0x100UL
 #define IOF_FUSE_WRITE_BUF		0x200UL
+#define IOF_CACHE_READDIR		0x400UL
+#define IOF_WRITEBACK_CACHE		0x800UL
+#define IOF_POOL_THREAD			0x1000UL
 
 enum iof_projection_mode {
 	/* Private Access Mode */
@@ -133,12 +142,32 @@ struct iof_fs_info {
 	uint32_t htable_size;
 };
 
+/* Per-projection options which were added after iof_fs_info, sent in the
+ * reply to QUERY_EXT_OP as an array in the same order as the iof_fs_info
+ * array.
+ */
+struct iof_fs_ext {
+	/* Kernel cache timeouts, in milliseconds */
+	uint32_t entry_timeout;
+	uint32_t attr_timeout;
+	uint32_t negative_timeout;
+	uint32_t pad;
+};
+
 /* The response to the initial query RPC.
+ *
+ * The reply to QUERY_PSR_OP only contains query_list and count, followed by
+ * a single byte which is taken from poll_interval, so that older clients
+ * decode it as before.  The remaining fields are only valid in the reply to
+ * QUERY_EXT_OP.
  */
 struct iof_psr_query {
 	d_iov_t		query_list;
 	uint32_t	count;
 	uint32_t	poll_interval;
+	uint32_t	ctx_count;	/* Number of contexts on each IONSS */
+	uint32_t	proto_version;	/* IOF_PROTO_VERSION of IONSS */
+	d_iov_t		fs_ext;		/* Array of iof_fs_ext */
 	bool		progress_callback;
 };
 
@@ -166,6 +195,86 @@ struct iof_entry_out {
 	int err;
 };
 
+/* Resolve a relative path of several components in one RPC.
+ *
+ * The IONSS walks the path from gah one component at a time, stopping at
+ * the first error, symlink or non-directory, and returns one
+ * iof_path_entry per resolved component in entries.  Each returned GAH
+ * holds a reference on the IONSS in the same way as a lookup reply.
+ * rc is set to the errno of the component which could not be resolved, if
+ * any.
+ */
+struct iof_lookup_path_in {
+	struct ios_gah gah;
+	d_string_t path;
+};
+
+struct iof_path_entry {
+	struct ios_gah gah;
+	struct stat stat;
+};
+
+struct iof_lookup_path_out {
+	d_iov_t entries;
+	int rc;
+	int err;
+};
+
+/* Maximum number of components resolved by a single lookup_path RPC */
+#define IOF_LOOKUP_PATH_MAX 32
+
+/* Wait for changes made on the IONSS after seq, which should be zero for the
+ * first request of a client.  client is from iof_watch_client() so that the
+ * client is not sent changes which it made itself, or zero.
+ */
+struct iof_watch_in {
+	struct ios_gah gah;
+	uint64_t seq;
+	uint64_t client;
+};
+
+/* A change made on the IONSS.  If name is set then the entry name in the
+ * directory ino has been created, removed or renamed, otherwise the
+ * attributes or contents of ino have changed.  origin is the
+ * iof_watch_client() of the client which made the change, or zero if not
+ * known.
+ */
+struct iof_watch_event {
+	uint64_t ino;
+	uint64_t origin;
+	struct ios_name name;
+};
+
+/* Identify a client for watch events.  Ranks are only unique within a CNSS
+ * group, so combine a hash of the group name with the rank plus one.
+ */
+static inline uint64_t
+iof_watch_client(const char *group, d_rank_t rank)
+{
+	uint32_t hash = 2166136261U;
+
+	while (group && *group)
+		hash = (hash ^ (uint8_t)*group++) * 16777619U;
+
+	return ((uint64_t)hash << 32) | (uint32_t)(rank + 1);
+}
+
+/* The reply to a watch RPC.  events holds an array of struct iof_watch_event
+ * and seq is the value to use in the next request.  If lost is set then
+ * events have been missed and the client should drop everything it has
+ * cached.
+ */
+struct iof_watch_out {
+	d_iov_t events;
+	uint64_t seq;
+	int lost;
+	int rc;
+	int err;
+};
+
+/* Maximum number of events in a single watch reply */
+#define IOF_WATCH_MAX 16
+
 struct iof_create_out {
 	struct ios_gah gah;
 	struct ios_gah igah;
@@ -221,27 +330,159 @@ struct iof_attr_out {
 	int err;
 };
 
+/* The token is derived from the ctime of the directory when it was opened,
+ * and changes whenever the directory is modified.  Zero if unknown.  It is
+ * only sent in the reply to opendir_token, which requires
+ * IOF_OPENDIR_TOKEN_VERSION.
+ */
 struct iof_opendir_out {
 	struct ios_gah gah;
 	int rc;
 	int err;
+	uint64_t token;
 };
 
+/* Flags for iof_readdir_in, which are only sent with readdir_packed */
+
+/* Reply using the packed encoding below rather than an array of
+ * struct iof_readdir_entry.  Implied by readdir_packed, which requires
+ * IOF_READDIR_PACKED_VERSION.
+ */
+#define IOF_READDIR_PACKED		0x01
+
+/* Only the name, inode number and file type of each entry are required,
+ * so the server may skip fetching attributes.  The rest of the stat is
+ * zero in replies.
+ */
+#define IOF_READDIR_NO_ATTR		0x02
+
+/* Return a GAH for each entry, as for a lookup, so that the client can
+ * reply to READDIRPLUS.  Requires
+ * IOF_READDIRPLUS_VERSION.  The client owns a reference on each GAH
+ * returned.
+ */
+#define IOF_READDIR_GAH			0x04
+
 struct iof_readdir_in {
 	struct ios_gah gah;
 	crt_bulk_t bulk;
 	uint64_t offset;
+	uint32_t flags;		/* readdir_packed only */
 };
 
 /* Each READDIR rpc contains an array of these */
+struct iof_readdir_entry {
+	char d_name[NAME_MAX + 1];
+	struct stat stat;
+	off_t nextoff;
+	int read_rc;
+	int stat_rc;
+};
+
+/* A directory entry as decoded from either reply format */
 struct iof_readdir_reply {
 	char d_name[NAME_MAX + 1];
 	struct stat stat;
 	off_t nextoff;
 	int read_rc;
 	int stat_rc;
+	struct ios_gah gah;
+	int gah_valid;
+};
+
+/* Packed readdir encoding.
+ *
+ * The reply is a sequence of variable length records, each 8 byte aligned
+ * and starting with this header, followed by:
+ *
+ * uint64_t nextoff		Unless IOF_RDP_OFF_DELTA is set, in which
+ *				case nextoff is one more than the previous
+ *				entry, or than the requested offset for the
+ *				first entry.
+ * struct iof_readdir_attr	If IOF_RDP_ATTR is set.
+ * struct iof_readdir_type	If IOF_RDP_TYPE is set.
+ * uint64_t rdev		If IOF_RDP_RDEV is set.
+ * struct ios_gah gah		If IOF_RDP_GAH is set.
+ * char name[name_len]		Not NUL terminated.
+ *
+ * If IOF_RDP_READ_ERR is set then the record reports a readdir() failure
+ * in rc and carries no name, otherwise rc is the stat_rc of the entry.
+ */
+#define IOF_RDP_OFF_DELTA	0x01
+#define IOF_RDP_ATTR		0x02
+#define IOF_RDP_RDEV		0x04
+#define IOF_RDP_READ_ERR	0x08
+#define IOF_RDP_TYPE		0x10
+#define IOF_RDP_GAH		0x20
+
+struct iof_readdir_packed {
+	uint16_t rec_len;
+	uint8_t name_len;
+	uint8_t flags;
+	int32_t rc;
 };
 
+/* The subset of struct stat which is sent with each packed entry */
+struct iof_readdir_attr {
+	uint64_t ino;
+	uint64_t size;
+	uint64_t blocks;
+	int64_t atime;
+	int64_t mtime;
+	int64_t ctime;
+	uint32_t atime_ns;
+	uint32_t mtime_ns;
+	uint32_t ctime_ns;
+	uint32_t mode;
+	uint32_t nlink;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t blksize;
+};
+
+/* Used in place of iof_readdir_attr for IOF_READDIR_NO_ATTR */
+struct iof_readdir_type {
+	uint64_t ino;
+	uint32_t mode;
+	uint32_t padding;
+};
+
+_Static_assert(sizeof(struct iof_readdir_packed) == 8,
+	       "iof_readdir_packed size unexpected");
+_Static_assert(sizeof(struct iof_readdir_attr) % 8 == 0,
+	       "iof_readdir_attr size unexpected");
+
+/* Smallest possible packed record, used to size reply arrays */
+#define IOF_READDIR_PACKED_MIN (sizeof(struct iof_readdir_packed) + 8)
+
+/* Return the length of the packed record for reply, where prev_off is the
+ * nextoff of the previous entry and flags are from iof_readdir_in.
+ */
+size_t iof_readdir_packed_size(const struct iof_readdir_reply *reply,
+			       off_t prev_off, uint32_t flags);
+
+/* Pack up to count replies into buf, starting from offset.  Stops at the
+ * first entry which does not fit in len bytes.  Returns the number of
+ * entries packed and sets used to the number of bytes written.
+ */
+int iof_readdir_pack(const struct iof_readdir_reply *replies, int count,
+		     off_t offset, uint32_t flags, void *buf, size_t len,
+		     size_t *used);
+
+/* Decode count packed records from buf into replies, where offset is the
+ * offset from which the entries were requested.
+ *
+ * Returns -DER_SUCCESS, or -DER_PROTO if the buffer is malformed.
+ */
+int iof_readdir_unpack(const void *buf, size_t len, int count, off_t offset,
+		       struct iof_readdir_reply *replies);
+
+/* Convert between a reply and the entry sent by readdir */
+void iof_readdir_entry_set(struct iof_readdir_entry *entry,
+			   const struct iof_readdir_reply *reply);
+void iof_readdir_entry_get(const struct iof_readdir_entry *entry,
+			   struct iof_readdir_reply *reply);
+
 struct iof_readdir_out {
 	d_iov_t replies;
 	int last;
@@ -256,6 +497,16 @@ struct iof_open_out {
 	int err;
 };
 
+/* Maximum number of extents which can be described by a single xtvec list.
+ *
+ * If xtvec_len is non-zero for a readx or writex RPC then xtvec is ignored
+ * and the extents are instead fetched from xtvec_bulk, which holds an array
+ * of xtvec_len struct iof_xtvec entries.  The data for all extents is
+ * packed, in list order, in data_bulk and bulk_len is the total length of
+ * all extents.
+ */
+#define IOF_XTVEC_MAX 1024
+
 struct iof_readx_in {
 	struct ios_gah gah;
 	struct iof_xtvec xtvec;
@@ -314,9 +565,25 @@ struct iof_setattr_in {
 };
 
 extern struct crt_req_format QUERY_RPC_FMT;
+extern struct crt_req_format QUERY_EXT_RPC_FMT;
 
 #define IOF_PROTO_BASE 0x01000000
 
+/* Version of the RPC protocol features, reported in the extended query
+ * reply so that clients only use features which the IONSS supports.  This is
+ * separate from the CaRT protocol version, which does not change, so new
+ * features must be added as new RPCs or fields which older peers do not
+ * decode.  Zero for an IONSS which does not support the extended query.
+ */
+#define IOF_PROTO_VERSION 5
+
+/* Minimum protocol version for each feature */
+#define IOF_READDIR_PACKED_VERSION 1
+#define IOF_LOOKUP_PATH_VERSION 2
+#define IOF_READDIRPLUS_VERSION 3
+#define IOF_OPENDIR_TOKEN_VERSION 4
+#define IOF_WATCH_VERSION 5
+
 #define DEF_RPC_TYPE(TYPE) IOF_OPI_##TYPE
 
 #define IOF_RPCS_LIST					\
@@ -339,7 +606,11 @@ extern struct crt_req_format QUERY_RPC_FMT;
 	X(statfs,	gah_in,		iov_pair)	\
 	X(lookup,	gah_string_in,	entry_out)	\
 	X(setattr,	setattr_in,	attr_out)	\
-	X(imigrate,	imigrate_in,	entry_out)
+	X(imigrate,	imigrate_in,	entry_out)	\
+	X(lookup_path,	lookup_path_in,	lookup_path_out)	\
+	X(watch,	watch_in,	watch_out)	\
+	X(readdir_packed, readdir_packed_in, readdir_out)	\
+	X(opendir_token, gah_in,	opendir_out)
 
 #define X(a, b, c) DEF_RPC_TYPE(a),
 
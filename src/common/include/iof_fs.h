@@ -50,9 +50,24 @@ struct iof_service_group {
 	crt_endpoint_t		psr_ep;    /* Server PSR endpoint */
 	ATOMIC uint32_t		pri_srv_rank;  /* Primary Service Rank */
 	uint32_t		grp_id;    /* CNSS defined ionss id */
+	uint32_t		ctx_count; /* Server contexts per rank */
+	uint32_t		proto_version; /* IOF_PROTO_VERSION of server */
 	bool			enabled;   /* Indicates group is available */
 };
 
+/* Select the server context (endpoint tag) to use for a GAH.
+ *
+ * The IONSS runs one CaRT context per progress thread, so spread RPCs over
+ * them by file id, this keeps all RPCs for a given file on the same context.
+ */
+static inline uint32_t
+iof_gah_tag(struct iof_service_group *grp, struct ios_gah *gah)
+{
+	if (grp->ctx_count <= 1)
+		return 0;
+	return gah->fid % grp->ctx_count;
+}
+
 /** Projection specific information held on the client.
  *
  * Shared between CNSS and IL.
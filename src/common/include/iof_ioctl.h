@@ -43,6 +43,7 @@
 
 #define IOF_IOCTL_TYPE 0xA3       /* Arbitrary "unique" type of the IOCTL */
 #define IOF_IOCTL_GAH_NUMBER 0xC1 /* Number of the GAH IOCTL.  Also arbitrary */
+#define IOF_IOCTL_LOOKUP_PATH_NUMBER 0xC2 /* Number of the lookup IOCTL */
 #define IOF_IOCTL_VERSION 3       /* Version of ioctl protocol */
 
 struct iof_gah_info {
@@ -56,4 +57,26 @@ struct iof_gah_info {
 #define IOF_IOCTL_GAH ((int)_IOR(IOF_IOCTL_TYPE, IOF_IOCTL_GAH_NUMBER, \
 				 struct iof_gah_info))
 
+/* Maximum length of a path passed to IOF_IOCTL_LOOKUP_PATH */
+#define IOF_IOCTL_PATH_LEN 1024
+
+struct iof_lookup_path_info {
+	int version;
+	char path[IOF_IOCTL_PATH_LEN];
+};
+
+/* Defines the IOCTL command to resolve a path relative to an open directory
+ * in a single RPC.  The components resolved are cached so that the lookups
+ * which follow when the path is accessed do not need to contact the IONSS.
+ * Returns the number of components resolved.
+ *
+ * The interception library issues this on the projection root before open,
+ * creat, fopen and freopen of an absolute path.  Other calls, such as stat,
+ * are not intercepted so applications which walk trees that way should
+ * issue it themselves.
+ */
+#define IOF_IOCTL_LOOKUP_PATH ((int)_IOW(IOF_IOCTL_TYPE,		\
+					 IOF_IOCTL_LOOKUP_PATH_NUMBER,	\
+					 struct iof_lookup_path_info))
+
 #endif
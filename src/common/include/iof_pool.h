@@ -43,6 +43,8 @@
 #include <pthread.h>
 #include <gurt/list.h>
 
+#include "iof_atomic.h"
+
 /* A datastructure used to describe and register a type */
 struct iof_pool_reg {
 	/* Perform any one-time setup or assigning constants.
@@ -65,6 +67,14 @@ struct iof_pool_reg {
 	int	max_desc;
 	/* Maximum number of descriptors to exist on the free_list */
 	int	max_free_desc;
+	/* Maximum number of descriptors held on each side of a per-thread
+	 * magazine, 0 for IOF_POOL_MAG_SIZE
+	 */
+	int	max_mag_desc;
+	/* Maximum number of descriptors held in the magazines of all threads
+	 * together, 0 for IOF_POOL_MAG_TOTAL
+	 */
+	int	max_mag_total;
 };
 
 /* If max_desc is non-zero then at most max_desc descriptors can exist
@@ -77,6 +87,17 @@ struct iof_pool_reg {
 		.offset = offsetof(struct itype, imember),		\
 		.name = #itype,
 
+/* Maximum number of objects held on each side of a per-thread magazine.
+ *
+ * Each thread keeps a magazine per type in front of the free and pending
+ * lists so that acquire() and release() do not normally need the type lock,
+ * see iof_pool.c.
+ */
+#define IOF_POOL_MAG_SIZE 8
+
+/* Default maximum number of objects of a type held in all magazines */
+#define IOF_POOL_MAG_TOTAL 128
+
 /* A datastructure used to manage a type.  Includes both the
  * registration data and any live state
  */
@@ -85,13 +106,21 @@ struct iof_pool_type {
 	d_list_t		type_list;
 	d_list_t		free_list;
 	d_list_t		pending_list;
+	/* Per-thread magazines holding objects of this type */
+	d_list_t		mags;
 	pthread_mutex_t		lock;
 	struct iof_pool		*pool;
 
-	/* Counters for current number of objects */
+	/* Counters for current number of objects.  Objects held in
+	 * magazines are not included in free_count or pending_count.
+	 */
 	int			count; /* Total currently created */
 	int			free_count; /* Number currently free */
 	int			pending_count; /* Number currently created */
+	ATOMIC int		in_use; /* Number currently acquired */
+	ATOMIC int		mag_count; /* Number held in magazines */
+	int			mag_size; /* Magazine size for this type */
+	int			mag_total; /* Limit of mag_count */
 
 	/* Statistics counters */
 	int			init_count;
@@ -101,15 +130,30 @@ struct iof_pool_type {
 	/* Performance metrics */
 	int			op_init; /* Number of on-path init calls */
 	int			op_reset; /* Number of on-path reset calls */
-	/* Number of sequental calls to acquire() without a call to restock() */
-	int			no_restock; /* Current count */
+	/* Number of sequental calls to acquire() without a call to restock(),
+	 * or without a background restock if the pool has a restock thread.
+	 */
+	ATOMIC int		no_restock; /* Current count */
 	int			no_restock_hwm; /* High water mark */
+	/* High water mark of objects acquired at once */
+	ATOMIC int		in_use_hwm;
+	/* Number of restocks done by the pool thread */
+	int			thread_restock;
+	/* Set when restock() has asked the pool thread to restock this type */
+	ATOMIC int		restock_wanted;
 };
 
 struct iof_pool {
 	d_list_t	list;
 	void		*arg;
 	pthread_mutex_t	lock;
+	/* Optional restock thread, see iof_pool_start_thread() */
+	pthread_t	thread;
+	pthread_mutex_t	thread_lock;
+	pthread_cond_t	thread_cond;
+	bool		thread_active;
+	bool		thread_wake;
+	bool		thread_stop;
 	bool		init;
 };
 
@@ -120,6 +164,22 @@ struct iof_pool {
 int iof_pool_init(struct iof_pool *, void *arg)
 	__attribute((warn_unused_result, nonnull(1)));
 
+/* Start a thread to restock all types in the pool.
+ *
+ * Once this is running restock() no longer resets or allocates objects on
+ * the calling thread, it just wakes the pool thread which does the work for
+ * any type where restock() has been called.  acquire() and release() also
+ * wake the thread when the free list runs low or objects are waiting to be
+ * reset.  The thread returns objects released into the magazines of all
+ * threads, resets them and refills the magazines.  Should be called after
+ * init and before any objects are acquired, the thread is stopped by
+ * iof_pool_destroy().
+ *
+ * Returns a CaRT error code.
+ */
+int iof_pool_start_thread(struct iof_pool *)
+	__attribute((warn_unused_result, nonnull));
+
 /* Destroy a pool, called once at shutdown */
 void iof_pool_destroy(struct iof_pool *);
 
@@ -136,7 +196,9 @@ void iof_pool_release(struct iof_pool_type *, void *);
 /* Pre-allocate datastructures
  * This should be called off the critical path, after previous acquire/release
  * calls and will do memory allocation as required.  Only 1 call is needed after
- * transitions so it does not need calling in progress loops.
+ * transitions so it does not need calling in progress loops.  Also refills the
+ * magazine of the calling thread.  If the pool has a restock thread then this
+ * only wakes that thread.
  */
 void iof_pool_restock(struct iof_pool_type *);
 
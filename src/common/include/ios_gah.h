@@ -50,11 +50,14 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include <gurt/list.h>
 #include <gurt/errno.h>
 #include <gurt/common.h>
 
+#include "iof_atomic.h"
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
 /**
@@ -83,39 +86,61 @@ struct ios_gah {
 };
 #pragma GCC diagnostic pop
 
+/** Number of shards in a GAH store, must be a power of two */
+#define IOS_GAH_SHARDS 16
+
 /**
  * Server side datatype for tracking allocation.
  *
  * Server has a number of these, one per fid which it uses to track in-use
  * handles and create new ones.
+ *
+ * The revision and in-use flag are packed into a single atomic state word,
+ * (revision << 1) | in_use, so that lookups can validate a GAH without
+ * holding a lock.
  */
 struct ios_gah_ent {
 	/** User pointer.  If fid is valid then this contains a user pointer */
-	void		*arg;
+	void *ATOMIC	arg;
 	d_list_t	list;
-	uint64_t	revision;	/**< The latest used revision number */
+	ATOMIC uint64_t	state;		/**< Latest revision and in-use flag */
 	uint64_t	fid;		/**< The ID of this entity */
-	bool		in_use;		/**< Is this fid currently in-use */
+	uint32_t	shard;		/**< Shard owning this entity */
 };
 
+/**
+ * A shard of the GAH store.
+ *
+ * Each shard has its own free list and lock, threads allocate from a shard
+ * selected per-thread so concurrent allocations do not contend.
+ */
+struct ios_gah_shard {
+	pthread_mutex_t	lock;
+	/** list of available file entries */
+	d_list_t	free_list;
+	/** number of fids currently in use from this shard */
+	int		size;
+} __attribute__((aligned(64)));
+
 /**
  * Structure with dynamically-sized storage to keep the file metadata.
  *
- * This is used on the server only, and is used for allocating
+ * This is used on the server only, and is used for allocating.  Entries are
+ * allocated in fixed size chunks, the chunk directory itself is never
+ * resized so lookups are lock-free, only allocation and deallocation take
+ * the lock of the shard owning the entry.
  */
 struct ios_gah_store {
-	/** number of fids currently in used */
-	int size;
-	/** total number of fids, whether used and unused */
-	int capacity;
 	/** local rank */
 	d_rank_t rank;
-	/** storage for the actual file entries */
-	struct ios_gah_ent *data;
-	/** array of pointers to file entries */
-	struct ios_gah_ent **ptr_array;
-	/** list of available file entries */
-	d_list_t free_list;
+	/** number of chunks allocated, and claimed */
+	ATOMIC uint32_t chunk_count;
+	/** used to assign a shard to each allocating thread */
+	ATOMIC uint32_t next_shard;
+	/** directory of entry chunks, indexed by fid */
+	struct ios_gah_ent *ATOMIC *chunks;
+	/** per-shard free lists */
+	struct ios_gah_shard shards[IOS_GAH_SHARDS];
 };
 
 /**
@@ -136,6 +161,8 @@ int ios_gah_destroy(struct ios_gah_store *ios_gah_store);
 /**
  * Allocates a new Global Access Handle
  *
+ * Safe to call concurrently with any other GAH store function.
+ *
  * \param[in] ios_gah_store	Global access handle data structure.
  * \param[out] gah		On return, *gah contains a global access handle.
  * \param[in] arg		User pointer.  This an be retrieved by
@@ -177,6 +204,10 @@ int ios_gah_deallocate(struct ios_gah_store *ios_gah_store,
 /**
  * Retrieve opaque data structure corresponding to a given global access handle.
  *
+ * Does not take any locks.  If the GAH is deallocated concurrently then
+ * either the old user pointer or -DER_NONEXIST is returned, so callers must
+ * ensure the user pointer remains valid, and re-validate it if required.
+ *
  * \param[in] gah_store		Global access handle data structure
  * \param[in] gah		Global access handle
  * \param[out] arg		On success, *arg contains the opaque
@@ -39,6 +39,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include "iof_bulk.h"
 #include "log.h"
 
@@ -127,3 +128,102 @@ void iof_bulk_free(void *ptr, off_t bulk_offset)
 	bulk->len = 0;
 }
 
+/* Registration of memory owned by a thread, see iof_bulk_thread_register() */
+struct thread_reg {
+	crt_context_t	ctx;
+	void		*buf;
+	size_t		len;
+	crt_bulk_t	handle;
+};
+
+static pthread_key_t reg_key;
+static int reg_key_rc;
+static pthread_once_t reg_once = PTHREAD_ONCE_INIT;
+
+static void thread_reg_free(void *arg)
+{
+	struct thread_reg *reg = arg;
+	int rc;
+
+	rc = crt_bulk_free(reg->handle);
+	if (rc != 0)
+		IOF_TRACE_DEBUG(reg, "Bulk free failed: %p, rc = %d",
+				reg->buf, rc);
+	D_FREE(reg);
+}
+
+static void thread_reg_key_init(void)
+{
+	reg_key_rc = pthread_key_create(&reg_key, thread_reg_free);
+}
+
+bool iof_bulk_thread_register(crt_context_t ctx, void *buf, size_t len,
+			      crt_bulk_t *handle)
+{
+	struct thread_reg *reg;
+	d_sg_list_t sgl = {0};
+	d_iov_t iov = {0};
+	int rc;
+
+	pthread_once(&reg_once, thread_reg_key_init);
+	if (reg_key_rc != 0)
+		return false;
+
+	reg = pthread_getspecific(reg_key);
+	if (reg && reg->ctx == ctx && reg->buf == buf && reg->len >= len) {
+		*handle = reg->handle;
+		return true;
+	}
+
+	if (reg) {
+		pthread_setspecific(reg_key, NULL);
+		thread_reg_free(reg);
+	}
+
+	D_ALLOC_PTR(reg);
+	if (!reg)
+		return false;
+
+	iov.iov_len = len;
+	iov.iov_buf = buf;
+	iov.iov_buf_len = len;
+	sgl.sg_iovs = &iov;
+	sgl.sg_nr = 1;
+
+	rc = crt_bulk_create(ctx, &sgl, CRT_BULK_RO, &reg->handle);
+	if (rc) {
+		D_FREE(reg);
+		return false;
+	}
+	reg->ctx = ctx;
+	reg->buf = buf;
+	reg->len = len;
+
+	rc = pthread_setspecific(reg_key, reg);
+	if (rc != 0) {
+		thread_reg_free(reg);
+		return false;
+	}
+
+	IOF_TRACE_DEBUG(reg, "registered bulk range: %p-%p", buf,
+			buf + len - 1);
+
+	*handle = reg->handle;
+	return true;
+}
+
+void iof_bulk_thread_deregister(void)
+{
+	struct thread_reg *reg;
+
+	pthread_once(&reg_once, thread_reg_key_init);
+	if (reg_key_rc != 0)
+		return;
+
+	reg = pthread_getspecific(reg_key);
+	if (!reg)
+		return;
+
+	pthread_setspecific(reg_key, NULL);
+	thread_reg_free(reg);
+}
@@ -46,6 +46,242 @@
 #include "iof_pool.h"
 #include "log.h"
 
+/* Per-thread magazines.
+ *
+ * Each thread keeps a magazine per type holding a few objects ready for use,
+ * and a few released objects waiting to be reset.  acquire() and release()
+ * only take the lock of the calling thread's magazine, which is uncontended
+ * other than while the pool is being reclaimed, and only fall back to the
+ * type lock when the magazine is empty or full.  Objects move between a
+ * magazine and the type lists in bulk, and restock() refills the magazine
+ * of the calling thread off the critical path.
+ *
+ * Magazines are created on first restock() or on a magazine miss, are
+ * returned to the type lists when the thread exits and are detached from a
+ * type when the pool is destroyed.
+ *
+ * Locks are taken in the order mag_list_lock, pool lock, type lock and then
+ * magazine lock, so a thread must not take the type lock while holding the
+ * lock of its own magazine.
+ */
+struct iof_pool_mag {
+	/* Entry on the type list, protected by the type lock */
+	d_list_t		type_link;
+	/* Entry on the thread list */
+	d_list_t		thread_link;
+	struct iof_pool_type	*type;
+	pthread_mutex_t		lock;
+	int			free_count;
+	int			pending_count;
+	void			*free[IOF_POOL_MAG_SIZE];
+	void			*pending[IOF_POOL_MAG_SIZE];
+};
+
+/* Magazines of one thread */
+struct mag_thread {
+	d_list_t		mags;
+};
+
+static pthread_key_t mag_key;
+static int mag_key_rc;
+static pthread_once_t mag_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mag_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void thread_stop(struct iof_pool *pool);
+static void thread_wake(struct iof_pool_type *type);
+
+/* Move the released objects in a magazine to the pending list.
+ *
+ * Called with the type lock and the magazine lock held.
+ */
+static void
+mag_flush(struct iof_pool_type *type, struct iof_pool_mag *mag)
+{
+	while (mag->pending_count > 0) {
+		void *ptr = mag->pending[--mag->pending_count];
+
+		d_list_add_tail(ptr + type->reg.offset, &type->pending_list);
+		type->pending_count++;
+		atomic_add(&type->mag_count, -1);
+	}
+}
+
+/* Move all objects in a magazine to the type lists.
+ *
+ * Called with the type lock and the magazine lock held.
+ */
+static void
+mag_drain(struct iof_pool_type *type, struct iof_pool_mag *mag)
+{
+	while (mag->free_count > 0) {
+		void *ptr = mag->free[--mag->free_count];
+
+		d_list_add(ptr + type->reg.offset, &type->free_list);
+		type->free_count++;
+		atomic_add(&type->mag_count, -1);
+	}
+
+	mag_flush(type, mag);
+}
+
+/* Move up to count objects from the free list into a magazine, without
+ * exceeding the limit of objects held in magazines for the type.
+ *
+ * Called with the type lock and the magazine lock held.
+ */
+static void
+mag_fill(struct iof_pool_type *type, struct iof_pool_mag *mag, int count)
+{
+	int room = type->mag_total - atomic_load_consume(&type->mag_count);
+
+	if (count > room)
+		count = room;
+
+	while (count-- > 0 && mag->free_count < type->mag_size &&
+	       !d_list_empty(&type->free_list)) {
+		d_list_t *entry = type->free_list.next;
+
+		d_list_del(entry);
+		entry->next = NULL;
+		entry->prev = NULL;
+		type->free_count--;
+		mag->free[mag->free_count++] = (void *)entry - type->reg.offset;
+		atomic_inc(&type->mag_count);
+	}
+}
+
+/* Return the objects in all magazines of a type to the type lists, and
+ * detach the magazines from the type if detach is set.
+ *
+ * Called with the type lock held, and mag_list_lock if detach is set.
+ */
+static void
+mag_reclaim(struct iof_pool_type *type, bool detach)
+{
+	struct iof_pool_mag *mag, *next;
+
+	d_list_for_each_entry_safe(mag, next, &type->mags, type_link) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_drain(type, mag);
+		if (detach)
+			mag->type = NULL;
+		D_MUTEX_UNLOCK(&mag->lock);
+		if (detach)
+			d_list_del_init(&mag->type_link);
+	}
+}
+
+/* Called on thread exit to return any objects held by the thread */
+static void
+mag_thread_fini(void *arg)
+{
+	struct mag_thread *mt = arg;
+	struct iof_pool_mag *mag, *next;
+
+	D_MUTEX_LOCK(&mag_list_lock);
+	d_list_for_each_entry_safe(mag, next, &mt->mags, thread_link) {
+		struct iof_pool_type *type = mag->type;
+
+		if (type) {
+			D_MUTEX_LOCK(&type->lock);
+			D_MUTEX_LOCK(&mag->lock);
+			mag_drain(type, mag);
+			D_MUTEX_UNLOCK(&mag->lock);
+			d_list_del(&mag->type_link);
+			D_MUTEX_UNLOCK(&type->lock);
+		}
+		d_list_del(&mag->thread_link);
+		pthread_mutex_destroy(&mag->lock);
+		D_FREE(mag);
+	}
+	D_MUTEX_UNLOCK(&mag_list_lock);
+	D_FREE(mt);
+}
+
+static void
+mag_key_init(void)
+{
+	mag_key_rc = pthread_key_create(&mag_key, mag_thread_fini);
+}
+
+/* Return the magazine of the calling thread for a type, or NULL */
+static struct iof_pool_mag *
+mag_get(struct iof_pool_type *type)
+{
+	struct mag_thread *mt;
+	struct iof_pool_mag *mag;
+
+	if (pthread_once(&mag_once, mag_key_init) != 0 || mag_key_rc != 0)
+		return NULL;
+
+	mt = pthread_getspecific(mag_key);
+	if (!mt)
+		return NULL;
+
+	d_list_for_each_entry(mag, &mt->mags, thread_link) {
+		if (mag->type == type)
+			return mag;
+	}
+	return NULL;
+}
+
+/* Create a magazine for a type for the calling thread, reusing one which
+ * has been detached from a destroyed type if possible.
+ *
+ * Returns NULL on failure, in which case the shared lists are used instead.
+ */
+static struct iof_pool_mag *
+mag_create(struct iof_pool_type *type)
+{
+	struct mag_thread *mt;
+	struct iof_pool_mag *mag;
+	bool found = false;
+
+	if (mag_key_rc != 0)
+		return NULL;
+
+	mt = pthread_getspecific(mag_key);
+	if (!mt) {
+		D_ALLOC_PTR(mt);
+		if (!mt)
+			return NULL;
+		D_INIT_LIST_HEAD(&mt->mags);
+		if (pthread_setspecific(mag_key, mt) != 0) {
+			D_FREE(mt);
+			return NULL;
+		}
+	}
+
+	D_MUTEX_LOCK(&mag_list_lock);
+	d_list_for_each_entry(mag, &mt->mags, thread_link) {
+		if (!mag->type) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		D_ALLOC_PTR(mag);
+		if (!mag)
+			D_GOTO(out, 0);
+		if (D_MUTEX_INIT(&mag->lock, NULL) != -DER_SUCCESS) {
+			D_FREE(mag);
+			D_GOTO(out, 0);
+		}
+		D_INIT_LIST_HEAD(&mag->type_link);
+		d_list_add(&mag->thread_link, &mt->mags);
+	}
+
+	D_MUTEX_LOCK(&type->lock);
+	mag->type = type;
+	d_list_add(&mag->type_link, &type->mags);
+	D_MUTEX_UNLOCK(&type->lock);
+
+out:
+	D_MUTEX_UNLOCK(&mag_list_lock);
+	return mag;
+}
+
 static void
 debug_dump(struct iof_pool_type *type)
 {
@@ -61,6 +297,11 @@ debug_dump(struct iof_pool_type *type)
 			type->op_reset);
 	IOF_TRACE_DEBUG(type, "No restock: current %d hwm %d", type->no_restock,
 			type->no_restock_hwm);
+	IOF_TRACE_DEBUG(type, "In use: current %d hwm %d", type->in_use,
+			type->in_use_hwm);
+	IOF_TRACE_DEBUG(type, "Thread restocks %d", type->thread_restock);
+	IOF_TRACE_DEBUG(type, "In magazines: current %d limit %d",
+			type->mag_count, type->mag_total);
 }
 
 /* Create an object pool */
@@ -77,6 +318,7 @@ iof_pool_init(struct iof_pool *pool, void *arg)
 		return rc;
 
 	pool->init = true;
+	pool->thread_active = false;
 	pool->arg = arg;
 	return -DER_SUCCESS;
 }
@@ -92,9 +334,21 @@ iof_pool_destroy(struct iof_pool *pool)
 	if (!pool->init)
 		return;
 
+	thread_stop(pool);
+
+	/* Detach the magazines of all threads from the types, returning
+	 * any objects in them to the type lists.
+	 */
+	D_MUTEX_LOCK(&mag_list_lock);
+	D_MUTEX_LOCK(&pool->lock);
 	d_list_for_each_entry(type, &pool->list, type_list) {
+		D_MUTEX_LOCK(&type->lock);
+		mag_reclaim(type, true);
+		D_MUTEX_UNLOCK(&type->lock);
 		debug_dump(type);
 	}
+	D_MUTEX_UNLOCK(&pool->lock);
+	D_MUTEX_UNLOCK(&mag_list_lock);
 
 	in_use = iof_pool_reclaim(pool);
 	if (in_use)
@@ -197,6 +451,8 @@ iof_pool_reclaim(struct iof_pool *pool)
 
 		D_MUTEX_LOCK(&type->lock);
 
+		mag_reclaim(type, false);
+
 		/* Reclaim any pending objects.  Count here just needs to be
 		 * larger than pending_count + free_count however simply
 		 * using count is adequate as is guaranteed to be larger.
@@ -261,14 +517,14 @@ create(struct iof_pool_type *type)
 
 /* Populate the free list
  *
- * Create objects and add them to the free list.  Creates one more object
- * than is needed to ensure that if the HWM of no-restock calls is reached
- * there will be no on-path allocations.
+ * Create objects and add them to the free list until there are count free
+ * objects.  Callers pass one more than the HWM of no-restock calls to ensure
+ * that if it is reached there will be no on-path allocations.
  */
 static void
-create_many(struct iof_pool_type *type)
+create_many(struct iof_pool_type *type, int count)
 {
-	while (type->free_count < (type->no_restock_hwm + 1)) {
+	while (type->free_count < count) {
 		void *ptr;
 		d_list_t *entry;
 
@@ -311,12 +567,20 @@ iof_pool_register(struct iof_pool *pool, struct iof_pool_reg *reg)
 
 	D_INIT_LIST_HEAD(&type->free_list);
 	D_INIT_LIST_HEAD(&type->pending_list);
+	D_INIT_LIST_HEAD(&type->mags);
 	type->pool = pool;
 
 	type->count = 0;
 	type->reg = *reg;
 
-	create_many(type);
+	type->mag_size = IOF_POOL_MAG_SIZE;
+	if (reg->max_mag_desc > 0 && reg->max_mag_desc < IOF_POOL_MAG_SIZE)
+		type->mag_size = reg->max_mag_desc;
+	type->mag_total = IOF_POOL_MAG_TOTAL;
+	if (reg->max_mag_total > 0)
+		type->mag_total = reg->max_mag_total;
+
+	create_many(type, type->no_restock_hwm + 1);
 
 	D_MUTEX_LOCK(&pool->lock);
 	d_list_add_tail(&type->type_list, &pool->list);
@@ -325,21 +589,11 @@ iof_pool_register(struct iof_pool *pool, struct iof_pool_reg *reg)
 	return type;
 }
 
-/* Acquire a new object.
- *
- * This is to be considered on the critical path so should be as lightweight
- * as posslble.
- */
-void *
-iof_pool_acquire(struct iof_pool_type *type)
+/* Take an object from the type lists, called with the type lock held */
+static void *
+acquire_locked(struct iof_pool_type *type, bool *at_limit)
 {
-	void		*ptr = NULL;
-	d_list_t	*entry;
-	bool		at_limit = false;
-
-	D_MUTEX_LOCK(&type->lock);
-
-	type->no_restock++;
+	d_list_t *entry;
 
 	if (type->free_count == 0) {
 		int count = restock(type, 1);
@@ -353,24 +607,93 @@ iof_pool_acquire(struct iof_pool_type *type)
 		entry->next = NULL;
 		entry->prev = NULL;
 		type->free_count--;
-		ptr = (void *)entry - type->reg.offset;
+		return (void *)entry - type->reg.offset;
+	}
+
+	if (!type->reg.max_desc || type->count < type->reg.max_desc) {
+		type->op_init++;
+		return create(type);
+	}
+
+	*at_limit = true;
+	return NULL;
+}
+
+/* Acquire a new object.
+ *
+ * This is to be considered on the critical path so should be as lightweight
+ * as posslble.
+ */
+void *
+iof_pool_acquire(struct iof_pool_type *type)
+{
+	struct iof_pool_mag	*mag = mag_get(type);
+	void			*ptr = NULL;
+	bool			at_limit = false;
+	bool			wake = false;
+	int			in_use;
+	int			hwm;
+
+	atomic_inc(&type->no_restock);
+
+	if (mag) {
+		D_MUTEX_LOCK(&mag->lock);
+		if (mag->free_count > 0) {
+			ptr = mag->free[--mag->free_count];
+			atomic_add(&type->mag_count, -1);
+		}
+		D_MUTEX_UNLOCK(&mag->lock);
 	} else {
-		if (!type->reg.max_desc || type->count < type->reg.max_desc) {
-			type->op_init++;
-			ptr = create(type);
-		} else {
-			at_limit = true;
+		mag = mag_create(type);
+	}
+
+	if (!ptr) {
+		D_MUTEX_LOCK(&type->lock);
+
+		ptr = acquire_locked(type, &at_limit);
+
+		/* If the limit has been hit then there may be objects held in
+		 * the magazines of other threads so reclaim those and retry.
+		 */
+		if (at_limit) {
+			mag_reclaim(type, false);
+			at_limit = false;
+			ptr = acquire_locked(type, &at_limit);
 		}
+
+		/* Refill the magazine with objects which are already reset */
+		if (ptr && mag) {
+			D_MUTEX_LOCK(&mag->lock);
+			mag_fill(type, mag, (type->mag_size + 1) / 2);
+			D_MUTEX_UNLOCK(&mag->lock);
+		}
+
+		/* Have the pool thread restock before the free list runs out,
+		 * rather than waiting for the next restock() call.
+		 */
+		if (type->pool->thread_active &&
+		    type->free_count < type->mag_size)
+			wake = true;
+
+		D_MUTEX_UNLOCK(&type->lock);
+
+		if (wake)
+			thread_wake(type);
 	}
 
-	D_MUTEX_UNLOCK(&type->lock);
+	if (ptr) {
+		in_use = atomic_fetch_add(&type->in_use, 1) + 1;
+		hwm = atomic_load_consume(&type->in_use_hwm);
+		while (in_use > hwm &&
+		       !atomic_compare_exchange(&type->in_use_hwm, hwm, in_use))
+			hwm = atomic_load_consume(&type->in_use_hwm);
 
-	if (ptr)
 		IOF_TRACE_DEBUG(ptr, "Type %p Using %p", type, ptr);
-	else if (at_limit)
+	} else if (at_limit) {
 		IOF_TRACE_INFO(type, "Descriptor limit hit");
-	else
+	} else {
 		IOF_TRACE_WARNING(type, "Failed to allocate for type");
+	}
 	return ptr;
 }
 
@@ -379,17 +702,47 @@ iof_pool_acquire(struct iof_pool_type *type)
  * This is sometimes on the critical path, sometimes not so assume that
  * for all cases it is.
  *
+ * Objects are held in the magazine of the calling thread until it is full,
+ * or the magazines of all threads hold as many objects as allowed for the
+ * type, then all of them are moved to the pending list.
  */
 void
 iof_pool_release(struct iof_pool_type *type, void *ptr)
 {
+	struct iof_pool_mag *mag = mag_get(type);
 	d_list_t *entry = ptr + type->reg.offset;
+	bool wake;
 
 	IOF_TRACE_DOWN(ptr);
+	atomic_fetch_sub(&type->in_use, 1);
+
+	if (mag) {
+		D_MUTEX_LOCK(&mag->lock);
+		if (mag->pending_count < type->mag_size &&
+		    atomic_fetch_add(&type->mag_count, 1) < type->mag_total) {
+			mag->pending[mag->pending_count++] = ptr;
+			D_MUTEX_UNLOCK(&mag->lock);
+			return;
+		}
+		if (mag->pending_count < type->mag_size)
+			atomic_add(&type->mag_count, -1);
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
+
 	D_MUTEX_LOCK(&type->lock);
+	if (mag) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_flush(type, mag);
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
 	type->pending_count++;
 	d_list_add_tail(entry, &type->pending_list);
+	wake = type->pool->thread_active &&
+		type->pending_count >= type->mag_size;
 	D_MUTEX_UNLOCK(&type->lock);
+
+	if (wake)
+		thread_wake(type);
 }
 
 /* Re-stock an object type.
@@ -406,21 +759,217 @@ iof_pool_release(struct iof_pool_type *type, void *ptr)
 void
 iof_pool_restock(struct iof_pool_type *type)
 {
-	IOF_TRACE_DEBUG(type, "Count (%d/%d/%d)", type->pending_count,
-			type->free_count, type->count);
+	struct iof_pool_mag	*mag;
+	int			no_restock;
+	int			fill = 0;
+
+	/* Leave the work to the pool thread if there is one */
+	if (type->pool->thread_active) {
+		thread_wake(type);
+		return;
+	}
+
+	mag = mag_get(type);
+	if (!mag)
+		mag = mag_create(type);
 
 	D_MUTEX_LOCK(&type->lock);
 
+	IOF_TRACE_DEBUG(type, "Count (%d/%d/%d)", type->pending_count,
+			type->free_count, type->count);
+
 	/* Update restock hwm metrics */
-	if (type->no_restock > type->no_restock_hwm)
-		type->no_restock_hwm = type->no_restock;
-	type->no_restock = 0;
+	no_restock = atomic_exchange(&type->no_restock, 0);
+	if (no_restock > type->no_restock_hwm)
+		type->no_restock_hwm = no_restock;
+
+	/* Return objects released by this thread so they can be reset, and
+	 * work out how many are needed to fill the magazine.
+	 */
+	if (mag) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_flush(type, mag);
+		fill = type->no_restock_hwm + 1 - mag->free_count;
+		if (fill > type->mag_size - mag->free_count)
+			fill = type->mag_size - mag->free_count;
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
 
 	/* Move from pending to free list */
-	restock(type, type->no_restock_hwm + 1);
+	restock(type, type->no_restock_hwm + 1 + fill);
+
+	if (fill > 0) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_fill(type, mag, fill);
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
 
 	if (!type->reg.max_desc)
-		create_many(type);
+		create_many(type, type->no_restock_hwm + 1);
 
 	D_MUTEX_UNLOCK(&type->lock);
 }
+
+/* Ask the pool thread to restock a type.  The thread only needs waking
+ * once however many calls there are before it runs.
+ */
+static void
+thread_wake(struct iof_pool_type *type)
+{
+	int wanted = 0;
+
+	if (atomic_load_consume(&type->restock_wanted))
+		return;
+
+	if (!atomic_compare_exchange(&type->restock_wanted, wanted, 1))
+		return;
+
+	D_MUTEX_LOCK(&type->pool->thread_lock);
+	type->pool->thread_wake = true;
+	pthread_cond_signal(&type->pool->thread_cond);
+	D_MUTEX_UNLOCK(&type->pool->thread_lock);
+}
+
+/* Restock a type from the pool thread.
+ *
+ * Returns the objects released into the magazines of all threads, as
+ * threads which only release objects would otherwise hold on to them until
+ * their magazine is full, and resets every pending object so that none are
+ * reset on the critical path.  The number of acquire() calls between runs
+ * of the thread depends on how often it is scheduled so the free list is
+ * sized to the most objects ever in use at once if that is lower, and the
+ * magazines of all threads are then refilled from it.
+ */
+static void
+thread_restock(struct iof_pool_type *type)
+{
+	struct iof_pool_mag	*mag;
+	int			no_restock;
+	int			target;
+	int			hwm;
+
+	D_MUTEX_LOCK(&type->lock);
+
+	no_restock = atomic_exchange(&type->no_restock, 0);
+	if (no_restock > type->no_restock_hwm)
+		type->no_restock_hwm = no_restock;
+
+	target = type->no_restock_hwm;
+	hwm = atomic_load_consume(&type->in_use_hwm);
+	if (target > hwm)
+		target = hwm;
+	target++;
+
+	/* Also allow for filling the magazine of each thread */
+	d_list_for_each_entry(mag, &type->mags, type_link) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_flush(type, mag);
+		D_MUTEX_UNLOCK(&mag->lock);
+		target += type->mag_size;
+	}
+
+	/* Count is larger than pending_count + free_count so this resets
+	 * all pending objects.
+	 */
+	restock(type, type->count);
+
+	if (!type->reg.max_desc)
+		create_many(type, target);
+
+	d_list_for_each_entry(mag, &type->mags, type_link) {
+		D_MUTEX_LOCK(&mag->lock);
+		mag_fill(type, mag, type->mag_size);
+		D_MUTEX_UNLOCK(&mag->lock);
+	}
+
+	type->thread_restock++;
+	IOF_TRACE_DEBUG(type, "Count (%d/%d/%d)", type->pending_count,
+			type->free_count, type->count);
+
+	D_MUTEX_UNLOCK(&type->lock);
+}
+
+static void *
+pool_thread(void *arg)
+{
+	struct iof_pool		*pool = arg;
+	struct iof_pool_type	*type;
+	int			wanted;
+
+	D_MUTEX_LOCK(&pool->thread_lock);
+	while (!pool->thread_stop) {
+		if (!pool->thread_wake) {
+			pthread_cond_wait(&pool->thread_cond,
+					  &pool->thread_lock);
+			continue;
+		}
+		pool->thread_wake = false;
+		D_MUTEX_UNLOCK(&pool->thread_lock);
+
+		D_MUTEX_LOCK(&pool->lock);
+		d_list_for_each_entry(type, &pool->list, type_list) {
+			wanted = atomic_exchange(&type->restock_wanted, 0);
+			if (wanted)
+				thread_restock(type);
+		}
+		D_MUTEX_UNLOCK(&pool->lock);
+
+		D_MUTEX_LOCK(&pool->thread_lock);
+	}
+	D_MUTEX_UNLOCK(&pool->thread_lock);
+
+	return NULL;
+}
+
+/* Start the restock thread for a pool */
+int
+iof_pool_start_thread(struct iof_pool *pool)
+{
+	int rc;
+
+	if (pool->thread_active)
+		return -DER_SUCCESS;
+
+	rc = D_MUTEX_INIT(&pool->thread_lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	rc = pthread_cond_init(&pool->thread_cond, NULL);
+	if (rc != 0) {
+		D_MUTEX_DESTROY(&pool->thread_lock);
+		return -DER_MISC;
+	}
+
+	pool->thread_wake = false;
+	pool->thread_stop = false;
+
+	rc = pthread_create(&pool->thread, NULL, pool_thread, pool);
+	if (rc != 0) {
+		IOF_TRACE_ERROR(pool, "Could not start restock thread %d", rc);
+		pthread_cond_destroy(&pool->thread_cond);
+		D_MUTEX_DESTROY(&pool->thread_lock);
+		return -DER_MISC;
+	}
+
+	pool->thread_active = true;
+	IOF_TRACE_DEBUG(pool, "Started restock thread");
+	return -DER_SUCCESS;
+}
+
+/* Stop the restock thread, if running */
+static void
+thread_stop(struct iof_pool *pool)
+{
+	if (!pool->thread_active)
+		return;
+
+	D_MUTEX_LOCK(&pool->thread_lock);
+	pool->thread_stop = true;
+	pthread_cond_signal(&pool->thread_cond);
+	D_MUTEX_UNLOCK(&pool->thread_lock);
+
+	pthread_join(pool->thread, NULL);
+	pthread_cond_destroy(&pool->thread_cond);
+	D_MUTEX_DESTROY(&pool->thread_lock);
+	pool->thread_active = false;
+}
@@ -0,0 +1,315 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "iof_common.h"
+
+#define RDP_ALIGN(len) (((len) + 7) & ~7UL)
+
+static uint8_t
+rdp_flags(const struct iof_readdir_reply *reply, off_t prev_off,
+	  uint32_t flags_in)
+{
+	uint8_t flags = 0;
+
+	if (reply->read_rc)
+		return IOF_RDP_READ_ERR;
+
+	if (reply->nextoff == prev_off + 1)
+		flags |= IOF_RDP_OFF_DELTA;
+
+	if (flags_in & IOF_READDIR_NO_ATTR) {
+		if (reply->stat_rc == 0)
+			flags |= IOF_RDP_TYPE;
+	} else if (reply->stat_rc == 0) {
+		flags |= IOF_RDP_ATTR;
+		if (S_ISCHR(reply->stat.st_mode) ||
+		    S_ISBLK(reply->stat.st_mode))
+			flags |= IOF_RDP_RDEV;
+	}
+
+	if (reply->gah_valid)
+		flags |= IOF_RDP_GAH;
+	return flags;
+}
+
+static size_t
+rdp_size(const struct iof_readdir_reply *reply, uint8_t flags)
+{
+	size_t len = sizeof(struct iof_readdir_packed);
+
+	if (flags & IOF_RDP_READ_ERR)
+		return len;
+
+	if (!(flags & IOF_RDP_OFF_DELTA))
+		len += sizeof(uint64_t);
+	if (flags & IOF_RDP_ATTR)
+		len += sizeof(struct iof_readdir_attr);
+	if (flags & IOF_RDP_TYPE)
+		len += sizeof(struct iof_readdir_type);
+	if (flags & IOF_RDP_RDEV)
+		len += sizeof(uint64_t);
+	if (flags & IOF_RDP_GAH)
+		len += sizeof(struct ios_gah);
+
+	return RDP_ALIGN(len + strnlen(reply->d_name, NAME_MAX));
+}
+
+size_t iof_readdir_packed_size(const struct iof_readdir_reply *reply,
+			       off_t prev_off, uint32_t flags)
+{
+	return rdp_size(reply, rdp_flags(reply, prev_off, flags));
+}
+
+int iof_readdir_pack(const struct iof_readdir_reply *replies, int count,
+		     off_t offset, uint32_t flags_in, void *buf, size_t len,
+		     size_t *used)
+{
+	const struct iof_readdir_reply *reply;
+	struct iof_readdir_packed *rec;
+	struct iof_readdir_attr *attr;
+	struct iof_readdir_type *type;
+	char *pos = buf;
+	uint64_t val;
+	size_t rec_len;
+	size_t name_len;
+	uint8_t flags;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		reply = &replies[i];
+		flags = rdp_flags(reply, offset, flags_in);
+		rec_len = rdp_size(reply, flags);
+
+		if (pos + rec_len > (char *)buf + len)
+			break;
+
+		rec = (struct iof_readdir_packed *)pos;
+		memset(pos, 0, rec_len);
+		rec->rec_len = rec_len;
+		rec->flags = flags;
+		pos += sizeof(*rec);
+
+		if (flags & IOF_RDP_READ_ERR) {
+			rec->rc = reply->read_rc;
+			i++;
+			break;
+		}
+
+		rec->rc = reply->stat_rc;
+
+		if (!(flags & IOF_RDP_OFF_DELTA)) {
+			val = reply->nextoff;
+			memcpy(pos, &val, sizeof(val));
+			pos += sizeof(val);
+		}
+
+		if (flags & IOF_RDP_ATTR) {
+			attr = (struct iof_readdir_attr *)pos;
+			attr->ino = reply->stat.st_ino;
+			attr->size = reply->stat.st_size;
+			attr->blocks = reply->stat.st_blocks;
+			attr->atime = reply->stat.st_atim.tv_sec;
+			attr->mtime = reply->stat.st_mtim.tv_sec;
+			attr->ctime = reply->stat.st_ctim.tv_sec;
+			attr->atime_ns = reply->stat.st_atim.tv_nsec;
+			attr->mtime_ns = reply->stat.st_mtim.tv_nsec;
+			attr->ctime_ns = reply->stat.st_ctim.tv_nsec;
+			attr->mode = reply->stat.st_mode;
+			attr->nlink = reply->stat.st_nlink;
+			attr->uid = reply->stat.st_uid;
+			attr->gid = reply->stat.st_gid;
+			attr->blksize = reply->stat.st_blksize;
+			pos += sizeof(*attr);
+		}
+
+		if (flags & IOF_RDP_TYPE) {
+			type = (struct iof_readdir_type *)pos;
+			type->ino = reply->stat.st_ino;
+			type->mode = reply->stat.st_mode;
+			pos += sizeof(*type);
+		}
+
+		if (flags & IOF_RDP_RDEV) {
+			val = reply->stat.st_rdev;
+			memcpy(pos, &val, sizeof(val));
+			pos += sizeof(val);
+		}
+
+		if (flags & IOF_RDP_GAH) {
+			memcpy(pos, &reply->gah, sizeof(reply->gah));
+			pos += sizeof(reply->gah);
+		}
+
+		name_len = strnlen(reply->d_name, NAME_MAX);
+		rec->name_len = name_len;
+		memcpy(pos, reply->d_name, name_len);
+
+		pos = (char *)rec + rec_len;
+		offset = reply->nextoff;
+	}
+
+	*used = pos - (char *)buf;
+	return i;
+}
+
+int iof_readdir_unpack(const void *buf, size_t len, int count, off_t offset,
+		       struct iof_readdir_reply *replies)
+{
+	const struct iof_readdir_packed *rec;
+	const struct iof_readdir_attr *attr;
+	const struct iof_readdir_type *type;
+	struct iof_readdir_reply *reply;
+	const char *pos = buf;
+	const char *end = pos + len;
+	const char *rec_end;
+	uint64_t val;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		reply = &replies[i];
+		memset(reply, 0, sizeof(*reply));
+
+		rec = (const struct iof_readdir_packed *)pos;
+		if (pos + sizeof(*rec) > end)
+			return -DER_PROTO;
+
+		rec_end = pos + rec->rec_len;
+		if (rec->rec_len < sizeof(*rec) || rec_end > end ||
+		    rec->rec_len != RDP_ALIGN(rec->rec_len))
+			return -DER_PROTO;
+
+		pos += sizeof(*rec);
+
+		if (rec->flags & IOF_RDP_READ_ERR) {
+			reply->read_rc = rec->rc;
+			pos = rec_end;
+			continue;
+		}
+
+		reply->stat_rc = rec->rc;
+
+		if (rec->flags & IOF_RDP_OFF_DELTA) {
+			reply->nextoff = offset + 1;
+		} else {
+			if (pos + sizeof(val) > rec_end)
+				return -DER_PROTO;
+			memcpy(&val, pos, sizeof(val));
+			reply->nextoff = val;
+			pos += sizeof(val);
+		}
+
+		if (rec->flags & IOF_RDP_ATTR) {
+			if (pos + sizeof(*attr) > rec_end)
+				return -DER_PROTO;
+			attr = (const struct iof_readdir_attr *)pos;
+			reply->stat.st_ino = attr->ino;
+			reply->stat.st_size = attr->size;
+			reply->stat.st_blocks = attr->blocks;
+			reply->stat.st_atim.tv_sec = attr->atime;
+			reply->stat.st_mtim.tv_sec = attr->mtime;
+			reply->stat.st_ctim.tv_sec = attr->ctime;
+			reply->stat.st_atim.tv_nsec = attr->atime_ns;
+			reply->stat.st_mtim.tv_nsec = attr->mtime_ns;
+			reply->stat.st_ctim.tv_nsec = attr->ctime_ns;
+			reply->stat.st_mode = attr->mode;
+			reply->stat.st_nlink = attr->nlink;
+			reply->stat.st_uid = attr->uid;
+			reply->stat.st_gid = attr->gid;
+			reply->stat.st_blksize = attr->blksize;
+			pos += sizeof(*attr);
+		}
+
+		if (rec->flags & IOF_RDP_TYPE) {
+			if (pos + sizeof(*type) > rec_end)
+				return -DER_PROTO;
+			type = (const struct iof_readdir_type *)pos;
+			reply->stat.st_ino = type->ino;
+			reply->stat.st_mode = type->mode;
+			pos += sizeof(*type);
+		}
+
+		if (rec->flags & IOF_RDP_RDEV) {
+			if (pos + sizeof(val) > rec_end)
+				return -DER_PROTO;
+			memcpy(&val, pos, sizeof(val));
+			reply->stat.st_rdev = val;
+			pos += sizeof(val);
+		}
+
+		if (rec->flags & IOF_RDP_GAH) {
+			if (pos + sizeof(reply->gah) > rec_end)
+				return -DER_PROTO;
+			memcpy(&reply->gah, pos, sizeof(reply->gah));
+			reply->gah_valid = 1;
+			pos += sizeof(reply->gah);
+		}
+
+		if (pos + rec->name_len > rec_end)
+			return -DER_PROTO;
+		memcpy(reply->d_name, pos, rec->name_len);
+
+		offset = reply->nextoff;
+		pos = rec_end;
+	}
+
+	return -DER_SUCCESS;
+}
+
+void iof_readdir_entry_set(struct iof_readdir_entry *entry,
+			   const struct iof_readdir_reply *reply)
+{
+	memcpy(entry->d_name, reply->d_name, sizeof(entry->d_name));
+	entry->stat = reply->stat;
+	entry->nextoff = reply->nextoff;
+	entry->read_rc = reply->read_rc;
+	entry->stat_rc = reply->stat_rc;
+}
+
+void iof_readdir_entry_get(const struct iof_readdir_entry *entry,
+			   struct iof_readdir_reply *reply)
+{
+	memset(reply, 0, sizeof(*reply));
+	memcpy(reply->d_name, entry->d_name, sizeof(reply->d_name));
+	reply->d_name[NAME_MAX] = '\0';
+	reply->stat = entry->stat;
+	reply->nextoff = entry->nextoff;
+	reply->read_rc = entry->read_rc;
+	reply->stat_rc = entry->stat_rc;
+}
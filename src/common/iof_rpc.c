@@ -90,6 +90,31 @@ struct crt_msg_field *string_out[] = {
 	&CMF_INT,
 };
 
+struct crt_msg_field *lookup_path_in[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_STRING,	/* path */
+};
+
+struct crt_msg_field *lookup_path_out[] = {
+	&CMF_IOVEC,	/* entries */
+	&CMF_INT,	/* rc */
+	&CMF_INT,	/* err */
+};
+
+struct crt_msg_field *watch_in[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_UINT64,	/* seq */
+	&CMF_UINT64,	/* client */
+};
+
+struct crt_msg_field *watch_out[] = {
+	&CMF_IOVEC,	/* events */
+	&CMF_UINT64,	/* seq */
+	&CMF_INT,	/* lost */
+	&CMF_INT,	/* rc */
+	&CMF_INT,	/* err */
+};
+
 struct crt_msg_field *entry_out[] = {
 	&CMF_GAH,	/* gah */
 	&CMF_IOF_STAT,	/* struct stat */
@@ -155,12 +180,26 @@ struct crt_msg_field *gah_pair[] = {
 	&CMF_INT
 };
 
+struct crt_msg_field *opendir_out[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_INT,	/* rc */
+	&CMF_INT,	/* err */
+	&CMF_UINT64,	/* token */
+};
+
 struct crt_msg_field *readdir_in[] = {
 	&CMF_GAH,
 	&CMF_BULK,
 	&CMF_UINT64,
 };
 
+struct crt_msg_field *readdir_packed_in[] = {
+	&CMF_GAH,	/* gah */
+	&CMF_BULK,	/* bulk */
+	&CMF_UINT64,	/* offset */
+	&CMF_UINT32,	/* flags */
+};
+
 struct crt_msg_field *readdir_out[] = {
 	&CMF_IOVEC,
 	&CMF_INT,
@@ -169,12 +208,23 @@ struct crt_msg_field *readdir_out[] = {
 	&CMF_INT,
 };
 
+/* The original query reply, which must not change */
 struct crt_msg_field *psr_out[] = {
 	&CMF_IOVEC,
 	&CMF_UINT32,
 	&CMF_BOOL,
 };
 
+struct crt_msg_field *psr_ext_out[] = {
+	&CMF_IOVEC,	/* query_list */
+	&CMF_UINT32,	/* count */
+	&CMF_UINT32,	/* poll_interval */
+	&CMF_UINT32,	/* ctx_count */
+	&CMF_UINT32,	/* proto_version */
+	&CMF_IOVEC,	/* fs_ext */
+	&CMF_BOOL,	/* progress_callback */
+};
+
 struct crt_msg_field *readx_in[] = {
 	&CMF_GAH,	/* gah */
 	&CMF_UINT64,	/* base */
@@ -231,6 +281,10 @@ struct crt_msg_field *setattr_in[] = {
 struct crt_req_format QUERY_RPC_FMT = DEFINE_CRT_REQ_FMT("psr_query", NULL,
 							 psr_out);
 
+struct crt_req_format QUERY_EXT_RPC_FMT = DEFINE_CRT_REQ_FMT("psr_query_ext",
+							     NULL,
+							     psr_ext_out);
+
 #define X(a, b, c)					\
 	static struct crt_req_format IOF_CRF_##a =	\
 		DEFINE_CRT_REQ_FMT(#a, b, c);
@@ -253,6 +307,9 @@ static struct crt_proto_rpc_format iof_rpc_types[] = {
 
 static struct crt_proto_format iof_protocol_registry = {
 	.cpf_name = "IOF_PRIVATE",
+	/* Fixed, so that clients and servers of different versions can
+	 * still communicate.  See IOF_PROTO_VERSION.
+	 */
 	.cpf_ver = 2,
 	.cpf_count = ARRAY_SIZE(iof_rpc_types),
 	.cpf_prf = iof_rpc_types,
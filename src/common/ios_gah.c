@@ -46,55 +46,81 @@
 
 #include "include/ios_gah.h"
 
-#define IOS_GAH_STORE_INIT_CAPACITY (1024 * 8)
-#define IOS_GAH_STORE_DELTA (1024 * 8)
+/* Entries are allocated in chunks of this many fids, and the chunk directory
+ * is sized to cover the full 24 bit fid space.
+ */
+#define IOS_GAH_CHUNK_BITS 10
+#define IOS_GAH_CHUNK_SIZE (1 << IOS_GAH_CHUNK_BITS)
+#define IOS_GAH_MAX_CHUNKS ((1 << 24) >> IOS_GAH_CHUNK_BITS)
 #define IOS_GAH_VERSION 1
 
+#define GAH_STATE(REVISION, IN_USE) (((uint64_t)(REVISION) << 1) | (IN_USE))
+#define GAH_STATE_IN_USE(STATE) ((STATE) & 1)
+#define GAH_STATE_REVISION(STATE) ((STATE) >> 1)
+
+/* The shard each thread allocates from, assigned on first use */
+static __thread int gah_shard_hint = -1;
+
 /**
- * Increase the totoal capacity of the gah store by "delta" slots
+ * Add a new chunk of entries to a shard.
+ *
+ * Called with the shard lock held.  The chunk is fully initialized before
+ * being published in the directory so lock-free readers never observe a
+ * partially constructed chunk.
  *
  * \param gah_store	[IN/OUT]	pointer to the gah_store
- * \param delta		[IN]		number of entries to add
+ * \param shard		[IN]		index of the shard to add to
  */
 static int
-ios_gah_store_increase_capacity(struct ios_gah_store *gah_store, int delta)
+ios_gah_store_add_chunk(struct ios_gah_store *gah_store, int shard)
 {
-	void *new_array;
+	struct ios_gah_ent *chunk;
+	uint32_t idx;
 	int ii;
 
-	/* allocate more space and copy old data over */
-	struct ios_gah_ent *new_data;
-	int new_cap = gah_store->capacity + delta;
-
-	D_ALLOC_ARRAY(new_data, delta);
-	if (new_data == NULL)
+	idx = atomic_fetch_add(&gah_store->chunk_count, 1);
+	if (idx >= IOS_GAH_MAX_CHUNKS) {
+		atomic_fetch_sub(&gah_store->chunk_count, 1);
 		return -DER_NOMEM;
+	}
 
-	D_REALLOC(new_array,
-		  gah_store->ptr_array,
-		  new_cap * sizeof(struct ios_gah_ent));
-	if (!new_array) {
-		D_FREE(new_data);
+	D_ALLOC_ARRAY(chunk, IOS_GAH_CHUNK_SIZE);
+	if (chunk == NULL) {
+		/* The index is not reused, however the fid space is large
+		 * enough that this is not a concern.
+		 */
 		return -DER_NOMEM;
 	}
 
-	gah_store->ptr_array = new_array;
-	/* setup the pointer array */
-	for (ii = 0; ii < delta; ii++)
-		gah_store->ptr_array[gah_store->capacity + ii] = &new_data[ii];
-
-	for (ii = gah_store->capacity; ii < gah_store->capacity + delta; ii++) {
-		gah_store->ptr_array[ii]->fid = ii;
-
-		/* point tail to the new tail */
-		d_list_add_tail(&gah_store->ptr_array[ii]->list,
-				&gah_store->free_list);
+	for (ii = 0; ii < IOS_GAH_CHUNK_SIZE; ii++) {
+		chunk[ii].fid = (idx << IOS_GAH_CHUNK_BITS) + ii;
+		chunk[ii].shard = shard;
+		d_list_add_tail(&chunk[ii].list,
+				&gah_store->shards[shard].free_list);
 	}
-	gah_store->capacity = new_cap;
+
+	atomic_store_release(&gah_store->chunks[idx], chunk);
 
 	return -DER_SUCCESS;
 }
 
+/* Lock-free lookup of the entry for a fid */
+static struct ios_gah_ent *
+ios_gah_lookup(struct ios_gah_store *gah_store, uint64_t fid)
+{
+	struct ios_gah_ent *chunk;
+
+	if ((fid >> IOS_GAH_CHUNK_BITS) >= IOS_GAH_MAX_CHUNKS)
+		return NULL;
+
+	chunk = atomic_load_consume(&gah_store->chunks[fid >>
+							IOS_GAH_CHUNK_BITS]);
+	if (!chunk)
+		return NULL;
+
+	return &chunk[fid & (IOS_GAH_CHUNK_SIZE - 1)];
+}
+
 /**
  * CRC-8-CCITT, x^8 + x^2 + x + 1, 0x07
  *
@@ -123,101 +149,145 @@ static uint8_t my_crc8(uint8_t *data, size_t len)
 }
 
 /*
- * Initialize the gah store. Allocate storage, initialize the pointer array, and
- * setup the linked-lists.
+ * Initialize the gah store. Allocate the chunk directory, and one chunk of
+ * entries per shard.
  *
  */
 struct ios_gah_store *ios_gah_init(d_rank_t rank)
 {
 	struct ios_gah_store *gah_store;
+	int rc;
 	int ii;
 
 	D_ALLOC_PTR(gah_store);
 	if (gah_store == NULL)
 		return NULL;
 
-	gah_store->size = 0;
 	gah_store->rank = rank;
-	gah_store->capacity = IOS_GAH_STORE_INIT_CAPACITY;
-	D_ALLOC_ARRAY(gah_store->data, IOS_GAH_STORE_INIT_CAPACITY);
-	if (gah_store->data == NULL) {
+	D_ALLOC_ARRAY(gah_store->chunks, IOS_GAH_MAX_CHUNKS);
+	if (gah_store->chunks == NULL) {
 		D_FREE(gah_store);
 		return NULL;
 	}
-	D_ALLOC_ARRAY(gah_store->ptr_array, IOS_GAH_STORE_INIT_CAPACITY);
-	if (gah_store->ptr_array == NULL) {
-		D_FREE(gah_store->data);
-		D_FREE(gah_store);
-		return NULL;
-	}
-
-	D_INIT_LIST_HEAD(&gah_store->free_list);
 
-	/* setup the pointer array */
-	for (ii = 0; ii < IOS_GAH_STORE_INIT_CAPACITY; ii++) {
-		gah_store->ptr_array[ii] = &gah_store->data[ii];
-		gah_store->ptr_array[ii]->fid = ii;
+	for (ii = 0; ii < IOS_GAH_SHARDS; ii++) {
+		struct ios_gah_shard *shard = &gah_store->shards[ii];
 
-		/* setup the linked list */
-		d_list_add_tail(&gah_store->ptr_array[ii]->list,
-				&gah_store->free_list);
+		rc = D_MUTEX_INIT(&shard->lock, NULL);
+		if (rc != -DER_SUCCESS)
+			D_GOTO(err, 0);
+		D_INIT_LIST_HEAD(&shard->free_list);
+		rc = ios_gah_store_add_chunk(gah_store, ii);
+		if (rc != -DER_SUCCESS) {
+			D_MUTEX_DESTROY(&shard->lock);
+			D_GOTO(err, 0);
+		}
 	}
 
 	return gah_store;
+
+err:
+	while (ii-- > 0)
+		D_MUTEX_DESTROY(&gah_store->shards[ii].lock);
+	for (ii = 0; ii < IOS_GAH_MAX_CHUNKS; ii++)
+		D_FREE(gah_store->chunks[ii]);
+	D_FREE(gah_store->chunks);
+	D_FREE(gah_store);
+	return NULL;
 }
 
 int ios_gah_destroy(struct ios_gah_store *ios_gah_store)
 {
-	int ii = 0;
+	uint32_t count;
+	int ii;
 
 	if (ios_gah_store == NULL)
 		return -DER_INVAL;
 	/* check for active handles */
-	if (ios_gah_store->size != 0)
-		return -DER_BUSY;
-
-	for (ii = 0; ii < ios_gah_store->capacity; ii++)
-		if (ios_gah_store->ptr_array[ii]->in_use)
+	for (ii = 0; ii < IOS_GAH_SHARDS; ii++)
+		if (ios_gah_store->shards[ii].size != 0)
 			return -DER_BUSY;
 
-	/* free the chunck allocated on init */
-	D_FREE(ios_gah_store->ptr_array[0]);
-	/* walk down the pointer array, free all memory chuncks */
-	for (ii = IOS_GAH_STORE_INIT_CAPACITY; ii < ios_gah_store->capacity;
-	    ii += IOS_GAH_STORE_DELTA) {
-		D_FREE(ios_gah_store->ptr_array[ii]);
-	}
-	D_FREE(ios_gah_store->ptr_array);
+	count = atomic_load_consume(&ios_gah_store->chunk_count);
+	if (count > IOS_GAH_MAX_CHUNKS)
+		count = IOS_GAH_MAX_CHUNKS;
+
+	/* walk down the chunk directory, free all memory chunks */
+	for (ii = 0; ii < count; ii++)
+		D_FREE(ios_gah_store->chunks[ii]);
+
+	for (ii = 0; ii < IOS_GAH_SHARDS; ii++)
+		D_MUTEX_DESTROY(&ios_gah_store->shards[ii].lock);
+
+	D_FREE(ios_gah_store->chunks);
 	D_FREE(ios_gah_store);
 
 	return -DER_SUCCESS;
 }
 
+/* Take an entry from the free list of a shard, growing the store if
+ * permitted.  Returns NULL if no entry is available.
+ */
+static struct ios_gah_ent *
+ios_gah_shard_take(struct ios_gah_store *gah_store, int idx, bool grow)
+{
+	struct ios_gah_shard *shard = &gah_store->shards[idx];
+	struct ios_gah_ent *ent = NULL;
+	int rc;
+
+	D_MUTEX_LOCK(&shard->lock);
+	if (d_list_empty(&shard->free_list)) {
+		if (!grow)
+			D_GOTO(out, 0);
+		rc = ios_gah_store_add_chunk(gah_store, idx);
+		if (rc != -DER_SUCCESS)
+			D_GOTO(out, 0);
+	}
+
+	/* take one gah from the head of the list */
+	ent = d_list_entry(shard->free_list.next, struct ios_gah_ent, list);
+	d_list_del(&ent->list);
+	shard->size++;
+out:
+	D_MUTEX_UNLOCK(&shard->lock);
+	return ent;
+}
+
 int ios_gah_allocate_base(struct ios_gah_store *gah_store,
 			  struct ios_gah *gah, d_rank_t base,
 			  void *arg)
 {
 	struct ios_gah_ent *ent;
-	int rc = -DER_SUCCESS;
+	uint64_t revision;
+	int ii;
 
 	if (gah == NULL)
 		return -DER_INVAL;
-	if (d_list_empty(&gah_store->free_list)) {
-		rc = ios_gah_store_increase_capacity(gah_store,
-						     IOS_GAH_STORE_DELTA);
-		if (rc != -DER_SUCCESS)
-			return rc;
-	}
 
-	/* take one gah from the head of the list */
-	ent = d_list_entry(gah_store->free_list.next, struct ios_gah_ent, list);
-	d_list_del(&ent->list);
+	if (gah_shard_hint < 0)
+		gah_shard_hint = atomic_fetch_add(&gah_store->next_shard, 1) %
+			IOS_GAH_SHARDS;
+
+	/* Allocate from the shard for this thread, and only if the store
+	 * cannot grow fall back to the other shards.
+	 */
+	ent = ios_gah_shard_take(gah_store, gah_shard_hint, true);
+	for (ii = 1; !ent && ii < IOS_GAH_SHARDS; ii++)
+		ent = ios_gah_shard_take(gah_store,
+					 (gah_shard_hint + ii) % IOS_GAH_SHARDS,
+					 false);
+	if (!ent)
+		return -DER_NOMEM;
 
-	ent->in_use = true;
-	ent->arg = arg;
+	/* The entry is owned by this thread until the state is published,
+	 * the user pointer has to be visible before the new revision.
+	 */
+	revision = GAH_STATE_REVISION(atomic_load_consume(&ent->state)) + 1;
+	atomic_store_release(&ent->arg, arg);
+	atomic_store_release(&ent->state, GAH_STATE(revision, 1));
 
 	gah->fid = ent->fid;
-	gah->revision = ++ent->revision;
+	gah->revision = revision;
 	gah->reserved = 0;
 	/* setup the gah */
 	gah->version = IOS_GAH_VERSION;
@@ -225,8 +295,6 @@ int ios_gah_allocate_base(struct ios_gah_store *gah_store,
 	gah->base = base;
 	gah->crc = my_crc8((uint8_t *)gah, 120 / 8);
 
-	gah_store->size++;
-
 	return -DER_SUCCESS;
 }
 
@@ -239,6 +307,9 @@ int ios_gah_allocate(struct ios_gah_store *gah_store,
 int ios_gah_deallocate(struct ios_gah_store *gah_store,
 		       struct ios_gah *gah)
 {
+	struct ios_gah_shard *shard;
+	struct ios_gah_ent *ent;
+	uint64_t state;
 	int ret;
 
 	if (!gah_store)
@@ -251,20 +322,28 @@ int ios_gah_deallocate(struct ios_gah_store *gah_store,
 	ret = ios_gah_check_version(gah);
 	if (ret != -DER_SUCCESS)
 		return ret;
-	if (gah->fid >= gah_store->capacity)
+	ent = ios_gah_lookup(gah_store, gah->fid);
+	if (!ent)
 		return -DER_OVERFLOW;
-	if (!(gah_store->ptr_array[gah->fid]->in_use))
-		return -DER_NONEXIST;
-	if (gah_store->ptr_array[gah->fid]->revision != gah->revision)
-		return -DER_NONEXIST;
 
-	gah_store->ptr_array[gah->fid]->in_use = false;
+	/* Clear the in-use flag atomically so that only one caller can
+	 * deallocate a given revision.
+	 */
+	do {
+		state = atomic_load_consume(&ent->state);
+		if (!GAH_STATE_IN_USE(state) ||
+		    GAH_STATE_REVISION(state) != gah->revision)
+			return -DER_NONEXIST;
+	} while (!atomic_compare_exchange(&ent->state, state,
+					  GAH_STATE(gah->revision, 0)));
 
-	/* append the reclaimed entry to the list of available entires */
-	d_list_add(&gah_store->ptr_array[gah->fid]->list,
-		   &gah_store->free_list);
+	shard = &gah_store->shards[ent->shard];
 
-	gah_store->size--;
+	/* append the reclaimed entry to the list of available entires */
+	D_MUTEX_LOCK(&shard->lock);
+	d_list_add(&ent->list, &shard->free_list);
+	shard->size--;
+	D_MUTEX_UNLOCK(&shard->lock);
 
 	return -DER_SUCCESS;
 }
@@ -272,6 +351,9 @@ int ios_gah_deallocate(struct ios_gah_store *gah_store,
 int ios_gah_get_info(struct ios_gah_store *gah_store,
 		     struct ios_gah *gah, void **arg)
 {
+	struct ios_gah_ent *ent;
+	uint64_t state;
+	void *value;
 	int ret;
 
 	if (!arg)
@@ -289,13 +371,21 @@ int ios_gah_get_info(struct ios_gah_store *gah_store,
 		return ret;
 	if (gah_store->rank != gah->root)
 		return -DER_INVAL;
-	if (gah->fid >= gah_store->capacity)
+	ent = ios_gah_lookup(gah_store, gah->fid);
+	if (!ent)
 		return -DER_OVERFLOW;
-	if (!(gah_store->ptr_array[gah->fid]->in_use))
+
+	/* Read the user pointer between two loads of the state, if the
+	 * state has not changed then the pointer belongs to this revision.
+	 */
+	state = atomic_load_consume(&ent->state);
+	if (!GAH_STATE_IN_USE(state) ||
+	    GAH_STATE_REVISION(state) != gah->revision)
 		return -DER_NONEXIST;
-	if (gah_store->ptr_array[gah->fid]->revision != gah->revision)
+	value = atomic_load_consume(&ent->arg);
+	if (atomic_load_consume(&ent->state) != state)
 		return -DER_NONEXIST;
-	*arg = (void *)(gah_store->ptr_array[gah->fid]->arg);
+	*arg = value;
 
 	return -DER_SUCCESS;
 }
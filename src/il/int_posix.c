@@ -72,6 +72,22 @@ static struct iof_projection *projections;
 static uint32_t projection_count;
 static struct crt_proto_format *iof_proto;
 
+/* Mount point of a projection, used to resolve paths before they are
+ * opened, see lookup_path().  fd is the projection root, opened on first
+ * use.
+ */
+struct ioil_mount {
+	char	*path;
+	size_t	len;
+	int	fd;
+	bool	disabled;
+};
+
+static struct ioil_mount *mounts;
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The directory most recently resolved by this thread */
+static __thread char lookup_path_last[IOF_IOCTL_PATH_LEN];
+
 #define BLOCK_SIZE 1024
 
 #define SAVE_ERRNO(is_error)                 \
@@ -203,6 +219,14 @@ static int find_projections(void)
 		}
 		grp_info->psr_ep.ep_tag = tag;
 
+		/* Older CNSS versions do not export this so default to a
+		 * single context.
+		 */
+		snprintf(tmp, BUFSIZE, "iof/ionss/%d/ctx_count", i);
+		rc = iof_ctrl_read_uint32(&grp_info->ctx_count, tmp);
+		if (rc != 0 || grp_info->ctx_count == 0)
+			grp_info->ctx_count = 1;
+
 		grp_info->enabled = true;
 	}
 
@@ -218,6 +242,12 @@ static int find_projections(void)
 		return 1;
 	}
 
+	mounts = calloc(projection_count, sizeof(*mounts));
+	if (mounts == NULL) {
+		IOF_LOG_ERROR("Could not allocate memory");
+		return 1;
+	}
+
 	for (i = 0; i < projection_count; i++) {
 		struct iof_projection *proj = &projections[i];
 
@@ -252,6 +282,20 @@ static int find_projections(void)
 
 		proj->grp = &ionss_grps[proj->grp_id];
 		proj->enabled = true;
+
+		/* Paths are only resolved in advance if the mount point is
+		 * known, so this is not fatal.
+		 */
+		mounts[i].fd = -1;
+		snprintf(tmp, BUFSIZE, "iof/projections/%d/mount_point", i);
+		rc = iof_ctrl_read_str(buf, IOF_CTRL_MAX_LEN, tmp);
+		if (rc == 0)
+			mounts[i].path = strdup(buf);
+		if (mounts[i].path)
+			mounts[i].len = strlen(mounts[i].path);
+		else
+			IOF_LOG_INFO("Could not read mount point, rc = %d",
+				     rc);
 	}
 
 	return 0;
@@ -413,6 +457,16 @@ static __attribute__((destructor)) void ioil_fini(void)
 		free(ionss_grps);
 		free(projections);
 	}
+
+	if (mounts) {
+		for (i = 0; i < projection_count; i++) {
+			if (mounts[i].fd != -1)
+				__real_close(mounts[i].fd);
+			free(mounts[i].path);
+		}
+		free(mounts);
+		mounts = NULL;
+	}
 	ioil_initialized = false;
 
 	__sync_synchronize();
@@ -453,6 +507,8 @@ static bool check_ioctl_on_open(int fd, struct fd_entry *entry, int flags,
 	entry->common.gah = gah_info.gah;
 	entry->common.projection = &projections[gah_info.cli_fs_id];
 	entry->common.ep = entry->common.projection->grp->psr_ep;
+	entry->common.ep.ep_tag = iof_gah_tag(entry->common.projection->grp,
+					      &entry->common.gah);
 	entry->pos = 0;
 	entry->flags = flags;
 	entry->status = IOF_IO_BYPASS;
@@ -477,6 +533,86 @@ static bool drop_reference_if_disabled(struct fd_entry *entry)
 	return true;
 }
 
+/* Resolve the directories of a path within a projection, and the final
+ * component if it exists, with a single IOF_IOCTL_LOOKUP_PATH ioctl on the
+ * projection root.  The CNSS caches the result, so the kernel lookups made
+ * by the call which follows do not each need a RPC to the IONSS.
+ *
+ * Only absolute paths with at least one directory below the mount point
+ * are resolved, and not if the directory is the one last resolved by this
+ * thread.  Any failure is ignored as the call which follows will report it.
+ */
+static void lookup_path(const char *pathname)
+{
+	struct iof_lookup_path_info info = {0};
+	struct ioil_mount *mount = NULL;
+	const char *rel;
+	const char *last;
+	size_t dir_len;
+	int errcode;
+	int fd;
+	int rc;
+	int i;
+
+	if (!ioil_initialized || !mounts || !pathname || pathname[0] != '/')
+		return;
+
+	for (i = 0; i < projection_count; i++) {
+		if (mounts[i].path && !mounts[i].disabled &&
+		    strncmp(pathname, mounts[i].path, mounts[i].len) == 0 &&
+		    pathname[mounts[i].len] == '/') {
+			mount = &mounts[i];
+			break;
+		}
+	}
+	if (!mount)
+		return;
+
+	rel = pathname + mount->len + 1;
+	last = strrchr(rel, '/');
+	if (!last || last == rel || strlen(rel) >= IOF_IOCTL_PATH_LEN)
+		return;
+
+	dir_len = last - pathname;
+	if (strncmp(lookup_path_last, pathname, dir_len) == 0 &&
+	    lookup_path_last[dir_len] == '\0')
+		return;
+
+	errcode = errno;
+
+	pthread_mutex_lock(&mounts_lock);
+	if (mount->fd == -1) {
+		mount->fd = __real_open(mount->path,
+					O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (mount->fd == -1)
+			mount->disabled = true;
+	}
+	fd = mount->fd;
+	pthread_mutex_unlock(&mounts_lock);
+
+	if (fd == -1)
+		goto out;
+
+	info.version = IOF_IOCTL_VERSION;
+	strncpy(info.path, rel, sizeof(info.path) - 1);
+
+	rc = ioctl(fd, IOF_IOCTL_LOOKUP_PATH, &info);
+	if (rc > 0) {
+		memcpy(lookup_path_last, pathname, dir_len);
+		lookup_path_last[dir_len] = '\0';
+	} else if (rc == -1 && (errno == ENOTSUP || errno == ENOTTY)) {
+		IOF_LOG_INFO("Path lookup not supported by %s", mount->path);
+		pthread_mutex_lock(&mounts_lock);
+		mount->disabled = true;
+		pthread_mutex_unlock(&mounts_lock);
+	}
+
+	IOF_LOG_DEBUG("lookup_path(%s) = %d", pathname, rc);
+
+out:
+	errno = errcode;
+}
+
 IOF_PUBLIC int iof_open(const char *pathname, int flags, ...)
 {
 	struct fd_entry entry = {0};
@@ -486,6 +622,8 @@ IOF_PUBLIC int iof_open(const char *pathname, int flags, ...)
 			    * for va_arg routine
 			    */
 
+	lookup_path(pathname);
+
 	if (flags & O_CREAT) {
 		va_list ap;
 
@@ -530,6 +668,8 @@ IOF_PUBLIC int iof_creat(const char *pathname, mode_t mode)
 	struct fd_entry entry = {0};
 	int fd;
 
+	lookup_path(pathname);
+
 	/* Same as open with O_CREAT|O_WRONLY|O_TRUNC */
 	fd = __real_open(pathname, O_CREAT | O_WRONLY | O_TRUNC, mode);
 
@@ -1068,6 +1208,8 @@ IOF_PUBLIC FILE * iof_fopen(const char *path, const char *mode)
 
 	pthread_once(&init_links_flag, init_links);
 
+	lookup_path(path);
+
 	fp = __real_fopen(path, mode);
 
 	if (!ioil_initialized || fp == NULL)
@@ -1107,6 +1249,8 @@ IOF_PUBLIC FILE * iof_freopen(const char *path, const char *mode, FILE *stream)
 	if (oldfd == -1)
 		return __real_freopen(path, mode, stream);
 
+	lookup_path(path);
+
 	newstream = __real_freopen(path, mode, stream);
 	if (newstream == NULL)
 		return NULL;
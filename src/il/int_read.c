@@ -96,25 +96,31 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 	iof_tracker_signal(&reply->tracker);
 }
 
-static ssize_t read_bulk(char *buff, size_t len, off_t position,
+/* Issue a single readx RPC for the extents in xtvec, with the data for all
+ * extents packed in order into the buffers described by sgl.
+ *
+ * A single extent is sent inline in the request, otherwise the extent list
+ * is sent to the IONSS via bulk.
+ */
+static ssize_t read_bulk(d_sg_list_t *sgl, size_t len,
+			 struct iof_xtvec *xtvec, int xt_count,
 			 struct iof_file_common *f_info, int *errcode)
 {
 	struct iof_projection *fs_handle;
-	struct iof_service_group *grp;
 	struct iof_readx_in *in;
 	struct iof_readx_out *out;
 	struct read_bulk_cb_r reply = {0};
 	crt_rpc_t *rpc = NULL;
 	crt_bulk_t bulk;
+	crt_bulk_t xtvec_bulk = NULL;
 	ssize_t read_len = 0;
-	d_sg_list_t sgl = {0};
-	d_iov_t iov = {0};
+	d_sg_list_t xtvec_sgl = {0};
+	d_iov_t xtvec_iov = {0};
 	int rc;
 
 	fs_handle = f_info->projection;
-	grp = fs_handle->grp;
 
-	rc = crt_req_create(fs_handle->crt_ctx, &grp->psr_ep,
+	rc = crt_req_create(fs_handle->crt_ctx, &f_info->ep,
 			    CRT_PROTO_OPC(fs_handle->proto->cpf_base,
 					  fs_handle->proto->cpf_ver,
 					  DEF_RPC_TYPE(readx)),
@@ -128,21 +134,35 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 
 	in = crt_req_get(rpc);
 	in->gah = f_info->gah;
-	in->xtvec.xt_off = position;
-	in->xtvec.xt_len = len;
 
-	iov.iov_len = len;
-	iov.iov_buf_len = len;
-	iov.iov_buf = (void *)buff;
-	sgl.sg_iovs = &iov;
-	sgl.sg_nr = 1;
+	if (xt_count == 1) {
+		in->xtvec = xtvec[0];
+	} else {
+		xtvec_iov.iov_len = xt_count * sizeof(*xtvec);
+		xtvec_iov.iov_buf_len = xtvec_iov.iov_len;
+		xtvec_iov.iov_buf = xtvec;
+		xtvec_sgl.sg_iovs = &xtvec_iov;
+		xtvec_sgl.sg_nr = 1;
+
+		rc = crt_bulk_create(fs_handle->crt_ctx, &xtvec_sgl,
+				     CRT_BULK_RO, &in->xtvec_bulk);
+		if (rc) {
+			IOF_LOG_ERROR("Failed to make xtvec bulk handle %d",
+				      rc);
+			*errcode = EIO;
+			return -1;
+		}
+		xtvec_bulk = in->xtvec_bulk;
+		in->xtvec_len = xt_count;
+		in->bulk_len = len;
+	}
 
-	rc = crt_bulk_create(fs_handle->crt_ctx, &sgl, CRT_BULK_RW,
+	rc = crt_bulk_create(fs_handle->crt_ctx, sgl, CRT_BULK_RW,
 			     &in->data_bulk);
 	if (rc) {
 		IOF_LOG_ERROR("Failed to make local bulk handle %d", rc);
 		*errcode = EIO;
-		return -1;
+		goto free_xtvec;
 	}
 
 	iof_tracker_init(&reply.tracker, 1);
@@ -154,10 +174,18 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 	if (rc) {
 		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
 		*errcode = EIO;
-		return -1;
+		crt_bulk_free(bulk);
+		goto free_xtvec;
 	}
 	iof_fs_wait(fs_handle, &reply.tracker);
 
+	if (xtvec_bulk) {
+		rc = crt_bulk_free(xtvec_bulk);
+		if (rc)
+			IOF_LOG_ERROR("Failed to free xtvec bulk handle %d",
+				      rc);
+	}
+
 	if (reply.err) {
 		*errcode = reply.err;
 		return -1;
@@ -170,7 +198,7 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 
 	out = reply.out;
 	if (out->iov_len > 0) {
-		if (out->data.iov_len != out->iov_len) {
+		if (out->data.iov_len != out->iov_len || sgl->sg_nr != 1) {
 			/* TODO: This is a resource leak */
 			IOF_LOG_ERROR("Missing IOV %d", out->iov_len);
 			*errcode = EIO;
@@ -178,7 +206,8 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 		}
 		read_len = out->data.iov_len;
 		IOF_LOG_INFO("Received %#zx via immediate", read_len);
-		memcpy(buff + out->bulk_len, out->data.iov_buf, read_len);
+		memcpy(sgl->sg_iovs[0].iov_buf + out->bulk_len,
+		       out->data.iov_buf, read_len);
 	}
 	if (out->bulk_len > 0) {
 		IOF_LOG_INFO("Received %#zx via bulk", out->bulk_len);
@@ -196,40 +225,99 @@ static ssize_t read_bulk(char *buff, size_t len, off_t position,
 	IOF_LOG_INFO("Read complete %#zx", read_len);
 
 	return read_len;
+
+free_xtvec:
+	if (xtvec_bulk) {
+		rc = crt_bulk_free(xtvec_bulk);
+		if (rc)
+			IOF_LOG_ERROR("Failed to free xtvec bulk handle %d",
+				      rc);
+	}
+	return -1;
 }
 
 ssize_t ioil_do_pread(char *buff, size_t len, off_t position,
 		      struct iof_file_common *f_info, int *errcode)
 {
+	struct iof_xtvec xtvec = {.xt_off = position, .xt_len = len};
+	d_sg_list_t sgl = {0};
+	d_iov_t iov = {0};
+
 	IOF_LOG_INFO("%#zx-%#zx " GAH_PRINT_STR, position, position + len - 1,
 		     GAH_PRINT_VAL(f_info->gah));
 
-	return read_bulk(buff, len, position, f_info, errcode);
+	iov.iov_len = len;
+	iov.iov_buf_len = len;
+	iov.iov_buf = (void *)buff;
+	sgl.sg_iovs = &iov;
+	sgl.sg_nr = 1;
+
+	return read_bulk(&sgl, len, &xtvec, 1, f_info, errcode);
 }
 
-/* TODO: This could be optimized to send multiple RPCs at once rather than
- * sending them serially.   Get it working first.
+/* Send the iovecs as an extent list, one extent per non-empty iovec, so that
+ * up to IOF_XTVEC_MAX iovecs are read with a single RPC.
  */
 ssize_t ioil_do_preadv(const struct iovec *iov, int count, off_t position,
 		       struct iof_file_common *f_info, int *errcode)
 {
+	struct iof_xtvec *xtvec;
+	d_iov_t *diov;
+	d_sg_list_t sgl = {0};
 	ssize_t bytes_read;
 	ssize_t total_read = 0;
-	int i;
+	size_t len;
+	int xt_count;
+	int i = 0;
+
+	D_ALLOC_ARRAY(xtvec, IOF_XTVEC_MAX);
+	D_ALLOC_ARRAY(diov, IOF_XTVEC_MAX);
+	if (!xtvec || !diov) {
+		D_FREE(xtvec);
+		D_FREE(diov);
+		*errcode = ENOMEM;
+		return -1;
+	}
 
-	for (i = 0; i < count; i++) {
-		bytes_read = read_bulk(iov[i].iov_base, iov[i].iov_len,
-				       position, f_info, errcode);
+	while (i < count) {
+		xt_count = 0;
+		len = 0;
+
+		for (; i < count && xt_count < IOF_XTVEC_MAX; i++) {
+			if (iov[i].iov_len == 0)
+				continue;
+
+			xtvec[xt_count].xt_off = position + len;
+			xtvec[xt_count].xt_len = iov[i].iov_len;
+			diov[xt_count].iov_buf = iov[i].iov_base;
+			diov[xt_count].iov_buf_len = iov[i].iov_len;
+			diov[xt_count].iov_len = iov[i].iov_len;
+			len += iov[i].iov_len;
+			xt_count++;
+		}
 
-		if (bytes_read == -1)
-			return (ssize_t)-1;
+		if (xt_count == 0)
+			break;
 
-		if (bytes_read == 0)
-			return total_read;
+		sgl.sg_iovs = diov;
+		sgl.sg_nr = xt_count;
+
+		bytes_read = read_bulk(&sgl, len, xtvec, xt_count, f_info,
+				       errcode);
+		if (bytes_read == -1) {
+			total_read = -1;
+			break;
+		}
 
 		position += bytes_read;
 		total_read += bytes_read;
+
+		if (bytes_read < len)
+			break;
 	}
 
+	D_FREE(xtvec);
+	D_FREE(diov);
+
 	return total_read;
 }
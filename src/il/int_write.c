@@ -91,7 +91,6 @@ ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
 		       struct iof_file_common *f_info, int *errcode)
 {
 	struct iof_projection *fs_handle;
-	struct iof_service_group *grp;
 	struct iof_writex_in *in;
 	struct write_cb_r reply = {0};
 	crt_rpc_t *rpc = NULL;
@@ -106,9 +105,8 @@ ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
 		     position + len - 1, GAH_PRINT_VAL(f_info->gah));
 
 	fs_handle = f_info->projection;
-	grp = fs_handle->grp;
 
-	rc = crt_req_create(fs_handle->crt_ctx, &grp->psr_ep,
+	rc = crt_req_create(fs_handle->crt_ctx, &f_info->ep,
 			    CRT_PROTO_OPC(fs_handle->proto->cpf_base,
 					  fs_handle->proto->cpf_ver,
 					  DEF_RPC_TYPE(writex)),
@@ -186,29 +184,181 @@ ssize_t ioil_do_writex(const char *buff, size_t len, off_t position,
 	return reply.len;
 }
 
-/* TODO: This could be optimized to send multiple RPCs at once rather than
- * sending them serially.   Get it working first.
+/* Write the data described by sgl to the extents in xtvec with a single RPC,
+ * both the extent list and the packed data are sent via bulk.
+ */
+static ssize_t writex_xtvec(d_sg_list_t *sgl, size_t len,
+			    struct iof_xtvec *xtvec, int xt_count,
+			    struct iof_file_common *f_info, int *errcode)
+{
+	struct iof_projection *fs_handle;
+	struct iof_writex_in *in;
+	struct write_cb_r reply = {0};
+	crt_rpc_t *rpc = NULL;
+	crt_bulk_t bulk;
+	crt_bulk_t xtvec_bulk;
+	d_sg_list_t xtvec_sgl = {0};
+	d_iov_t xtvec_iov = {0};
+	int rc;
+
+	fs_handle = f_info->projection;
+
+	rc = crt_req_create(fs_handle->crt_ctx, &f_info->ep,
+			    CRT_PROTO_OPC(fs_handle->proto->cpf_base,
+					  fs_handle->proto->cpf_ver,
+					  DEF_RPC_TYPE(writex)),
+			    &rpc);
+	if (rc || !rpc) {
+		IOF_LOG_ERROR("Could not create request, rc = %d",
+			      rc);
+		*errcode = EIO;
+		return -1;
+	}
+
+	in = crt_req_get(rpc);
+	in->gah = f_info->gah;
+	in->xtvec_len = xt_count;
+	in->bulk_len = len;
+
+	xtvec_iov.iov_len = xt_count * sizeof(*xtvec);
+	xtvec_iov.iov_buf_len = xtvec_iov.iov_len;
+	xtvec_iov.iov_buf = xtvec;
+	xtvec_sgl.sg_iovs = &xtvec_iov;
+	xtvec_sgl.sg_nr = 1;
+
+	rc = crt_bulk_create(fs_handle->crt_ctx, &xtvec_sgl, CRT_BULK_RO,
+			     &in->xtvec_bulk);
+	if (rc) {
+		IOF_LOG_ERROR("Failed to make xtvec bulk handle %d", rc);
+		crt_req_decref(rpc);
+		*errcode = EIO;
+		return -1;
+	}
+	xtvec_bulk = in->xtvec_bulk;
+
+	rc = crt_bulk_create(fs_handle->crt_ctx, sgl, CRT_BULK_RO,
+			     &in->data_bulk);
+	if (rc) {
+		IOF_LOG_ERROR("Failed to make local bulk handle %d", rc);
+		crt_req_decref(rpc);
+		*errcode = EIO;
+		goto free_xtvec;
+	}
+	bulk = in->data_bulk;
+
+	iof_tracker_init(&reply.tracker, 1);
+	reply.f_info = f_info;
+
+	rc = crt_req_send(rpc, write_cb, &reply);
+	if (rc) {
+		IOF_LOG_ERROR("Could not send rpc, rc = %d", rc);
+		*errcode = EIO;
+		crt_bulk_free(bulk);
+		goto free_xtvec;
+	}
+	iof_fs_wait(fs_handle, &reply.tracker);
+
+	rc = crt_bulk_free(xtvec_bulk);
+	if (rc)
+		IOF_LOG_ERROR("Failed to free xtvec bulk handle %d", rc);
+
+	rc = crt_bulk_free(bulk);
+	if (rc) {
+		*errcode = EIO;
+		return -1;
+	}
+
+	if (reply.err) {
+		*errcode = reply.err;
+		return -1;
+	}
+
+	if (reply.rc != 0) {
+		*errcode = reply.rc;
+		return -1;
+	}
+
+	return reply.len;
+
+free_xtvec:
+	rc = crt_bulk_free(xtvec_bulk);
+	if (rc)
+		IOF_LOG_ERROR("Failed to free xtvec bulk handle %d", rc);
+	return -1;
+}
+
+/* Send the iovecs as an extent list, one extent per non-empty iovec, so that
+ * up to IOF_XTVEC_MAX iovecs are written with a single RPC.
  */
 ssize_t ioil_do_pwritev(const struct iovec *iov, int count, off_t position,
 			struct iof_file_common *f_info, int *errcode)
 {
+	struct iof_xtvec *xtvec;
+	d_iov_t *diov;
+	d_sg_list_t sgl = {0};
 	ssize_t bytes_written;
 	ssize_t total_write = 0;
-	int i;
+	size_t len;
+	int xt_count;
+	int i = 0;
 
-	for (i = 0; i < count; i++) {
-		bytes_written = ioil_do_writex(iov[i].iov_base, iov[i].iov_len,
-					       position, f_info, errcode);
+	D_ALLOC_ARRAY(xtvec, IOF_XTVEC_MAX);
+	D_ALLOC_ARRAY(diov, IOF_XTVEC_MAX);
+	if (!xtvec || !diov) {
+		D_FREE(xtvec);
+		D_FREE(diov);
+		*errcode = ENOMEM;
+		return -1;
+	}
 
-		if (bytes_written == -1)
-			return (ssize_t)-1;
+	while (i < count) {
+		xt_count = 0;
+		len = 0;
 
-		if (bytes_written == 0)
-			return total_write;
+		for (; i < count && xt_count < IOF_XTVEC_MAX; i++) {
+			if (iov[i].iov_len == 0)
+				continue;
+
+			xtvec[xt_count].xt_off = position + len;
+			xtvec[xt_count].xt_len = iov[i].iov_len;
+			diov[xt_count].iov_buf = iov[i].iov_base;
+			diov[xt_count].iov_buf_len = iov[i].iov_len;
+			diov[xt_count].iov_len = iov[i].iov_len;
+			len += iov[i].iov_len;
+			xt_count++;
+		}
+
+		if (xt_count == 0)
+			break;
+
+		/* A single buffer can use the plain writex path, which can
+		 * send small writes as immediate data.
+		 */
+		if (xt_count == 1) {
+			bytes_written = ioil_do_writex(diov[0].iov_buf, len,
+						       position, f_info,
+						       errcode);
+		} else {
+			sgl.sg_iovs = diov;
+			sgl.sg_nr = xt_count;
+			bytes_written = writex_xtvec(&sgl, len, xtvec,
+						     xt_count, f_info,
+						     errcode);
+		}
+		if (bytes_written == -1) {
+			total_write = -1;
+			break;
+		}
 
 		position += bytes_written;
 		total_write += bytes_written;
+
+		if (bytes_written < len)
+			break;
 	}
 
+	D_FREE(xtvec);
+	D_FREE(diov);
+
 	return total_write;
 }
@@ -149,6 +149,29 @@ drop_ino_ref(struct iof_projection_info *fs_handle, ino_t ino)
 	d_hash_rec_ndecref(&fs_handle->inode_ht, 2, rlink);
 }
 
+void
+ioc_fh_ino_add(struct iof_file_handle *fh)
+{
+	struct iof_projection_info *fs_handle = fh->fs_handle;
+	struct ioc_inode_entry *ie;
+	ino_t ino = fh->inode_no;
+	d_list_t *rlink;
+
+	rlink = d_hash_rec_find(&fs_handle->inode_ht, &ino, sizeof(ino));
+	if (!rlink) {
+		IOF_TRACE_WARNING(fh, "Could not find entry %lu", ino);
+		return;
+	}
+
+	ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
+
+	D_MUTEX_LOCK(&fs_handle->of_lock);
+	d_list_add(&fh->fh_ino_list, &ie->ie_fh_list);
+	D_MUTEX_UNLOCK(&fs_handle->of_lock);
+
+	d_hash_rec_decref(&fs_handle->inode_ht, rlink);
+}
+
 static void ie_close_cb(struct ioc_request *request)
 {
 	struct TYPE_NAME	*desc = CONTAINER(request);
@@ -175,10 +198,12 @@ void ie_close(struct iof_projection_info *fs_handle, struct ioc_inode_entry *ie)
 	D_MUTEX_LOCK(&fs_handle->gah_lock);
 
 	/* Check that all files opened for this inode have been released */
+	D_MUTEX_LOCK(&fs_handle->of_lock);
 	d_list_for_each_entry_safe(fh, fh2, &ie->ie_fh_list, fh_ino_list) {
 		IOF_TRACE_WARNING(ie, "open file %p", fh);
 		d_list_del_init(&fh->fh_ino_list);
 	}
+	D_MUTEX_UNLOCK(&fs_handle->of_lock);
 
 	d_list_for_each_entry_safe(iec, ie2, &ie->ie_ie_children, ie_ie_list) {
 		IOF_TRACE_WARNING(ie, "child inode %p", iec);
@@ -221,3 +246,151 @@ out:
 	if (desc)
 		iof_pool_release(fs_handle->close_pool, desc);
 }
+
+/* Release a name cache entry, dropping the inode reference it holds.
+ * Must be called without nc_lock held as this may close the inode.
+ */
+static void
+nc_free(struct iof_projection_info *fs_handle, struct ioc_name_entry *ne)
+{
+	IOF_TRACE_DEBUG(fs_handle, "Dropping %lu '%s' ino %lu", ne->parent,
+			ne->name, ne->ie->stat.st_ino);
+	d_hash_rec_decref(&fs_handle->inode_ht, &ne->ie->ie_htl);
+	D_FREE(ne);
+}
+
+static bool
+nc_expired(struct ioc_name_entry *ne, struct timespec *now)
+{
+	if (now->tv_sec != ne->expires.tv_sec)
+		return now->tv_sec > ne->expires.tv_sec;
+	return now->tv_nsec > ne->expires.tv_nsec;
+}
+
+/* Remove matching and expired entries from the name cache, moving them to
+ * the list dead.  If name is NULL then every entry is removed.  Returns the
+ * matching entry, if any, which is not added to dead.
+ *
+ * Entries are added to the tail of the list, so expired entries are always
+ * at the head.
+ */
+static struct ioc_name_entry *
+nc_remove_locked(struct iof_projection_info *fs_handle, fuse_ino_t parent,
+		 const char *name, d_list_t *dead)
+{
+	struct ioc_name_entry *ne, *ne2;
+	struct ioc_name_entry *found = NULL;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	d_list_for_each_entry_safe(ne, ne2, &fs_handle->nc_list, list) {
+		if (name && !found && ne->parent == parent &&
+		    strncmp(ne->name, name, NAME_MAX) == 0) {
+			d_list_del(&ne->list);
+			fs_handle->nc_count--;
+			found = ne;
+			continue;
+		}
+		if (!name || nc_expired(ne, &now)) {
+			d_list_move_tail(&ne->list, dead);
+			fs_handle->nc_count--;
+		}
+	}
+	return found;
+}
+
+void
+ioc_nc_add(struct iof_projection_info *fs_handle, fuse_ino_t parent,
+	   const char *name, struct ioc_inode_entry *ie)
+{
+	struct ioc_name_entry *ne, *ne2;
+	d_list_t dead;
+
+	D_INIT_LIST_HEAD(&dead);
+
+	D_ALLOC_PTR(ne);
+	if (!ne) {
+		d_hash_rec_decref(&fs_handle->inode_ht, &ie->ie_htl);
+		return;
+	}
+
+	ne->parent = parent;
+	ne->ie = ie;
+	strncpy(ne->name, name, NAME_MAX);
+	clock_gettime(CLOCK_MONOTONIC, &ne->expires);
+	ne->expires.tv_sec += IOC_NC_TIMEOUT;
+
+	D_MUTEX_LOCK(&fs_handle->nc_lock);
+	ne2 = nc_remove_locked(fs_handle, parent, name, &dead);
+	if (ne2)
+		d_list_add_tail(&ne2->list, &dead);
+	if (fs_handle->nc_count >= IOC_NC_MAX) {
+		ne2 = d_list_entry(fs_handle->nc_list.next,
+				   struct ioc_name_entry, list);
+		d_list_move_tail(&ne2->list, &dead);
+		fs_handle->nc_count--;
+	}
+	d_list_add_tail(&ne->list, &fs_handle->nc_list);
+	fs_handle->nc_count++;
+	D_MUTEX_UNLOCK(&fs_handle->nc_lock);
+
+	d_list_for_each_entry_safe(ne, ne2, &dead, list)
+		nc_free(fs_handle, ne);
+}
+
+struct ioc_inode_entry *
+ioc_nc_take(struct iof_projection_info *fs_handle, fuse_ino_t parent,
+	    const char *name)
+{
+	struct ioc_name_entry *ne, *ne2;
+	struct ioc_inode_entry *ie = NULL;
+	d_list_t dead;
+
+	D_INIT_LIST_HEAD(&dead);
+
+	D_MUTEX_LOCK(&fs_handle->nc_lock);
+	if (fs_handle->nc_count == 0) {
+		D_MUTEX_UNLOCK(&fs_handle->nc_lock);
+		return NULL;
+	}
+	ne = nc_remove_locked(fs_handle, parent, name, &dead);
+	D_MUTEX_UNLOCK(&fs_handle->nc_lock);
+
+	if (ne) {
+		ie = ne->ie;
+		D_FREE(ne);
+		if (!H_GAH_IS_VALID(ie)) {
+			d_hash_rec_decref(&fs_handle->inode_ht, &ie->ie_htl);
+			ie = NULL;
+		}
+	}
+
+	d_list_for_each_entry_safe(ne, ne2, &dead, list)
+		nc_free(fs_handle, ne);
+
+	return ie;
+}
+
+void
+ioc_nc_drop(struct iof_projection_info *fs_handle, fuse_ino_t parent,
+	    const char *name)
+{
+	struct ioc_name_entry *ne, *ne2;
+	d_list_t dead;
+
+	D_INIT_LIST_HEAD(&dead);
+
+	D_MUTEX_LOCK(&fs_handle->nc_lock);
+	if (fs_handle->nc_count == 0) {
+		D_MUTEX_UNLOCK(&fs_handle->nc_lock);
+		return;
+	}
+	ne = nc_remove_locked(fs_handle, parent, name, &dead);
+	if (ne)
+		d_list_add_tail(&ne->list, &dead);
+	D_MUTEX_UNLOCK(&fs_handle->nc_lock);
+
+	d_list_for_each_entry_safe(ne, ne2, &dead, list)
+		nc_free(fs_handle, ne);
+}
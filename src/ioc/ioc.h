@@ -61,6 +61,7 @@
 struct iof_stats {
 	ATOMIC unsigned int opendir;
 	ATOMIC unsigned int readdir;
+	ATOMIC unsigned int readdirplus;
 	ATOMIC unsigned int closedir;
 	ATOMIC unsigned int getattr;
 	ATOMIC unsigned int create;
@@ -79,9 +80,20 @@ struct iof_stats {
 	ATOMIC uint64_t write_bytes;
 	ATOMIC unsigned int il_ioctl;
 	ATOMIC unsigned int fsync;
+	ATOMIC unsigned int flush;
 	ATOMIC unsigned int lookup;
 	ATOMIC unsigned int forget;
 	ATOMIC unsigned int setattr;
+	ATOMIC unsigned int lookup_path;
+	ATOMIC unsigned int lookup_cached;
+	ATOMIC unsigned int lookup_negative;
+	ATOMIC unsigned int watch_events;
+	ATOMIC unsigned int ra_hit;
+	ATOMIC unsigned int ra_miss;
+	ATOMIC unsigned int ra_blocks;
+	ATOMIC unsigned int write_merged;
+	ATOMIC unsigned int write_back;
+	ATOMIC unsigned int write_direct;
 };
 
 /**
@@ -179,9 +191,37 @@ struct iof_wb {
 	struct iof_local_bulk		lb;
 	crt_rpc_t			*rpc;
 	fuse_req_t			req;
+	/** Bulk handle of a buffer supplied by FUSE, used instead of lb */
+	crt_bulk_t			bulk;
+	/** Thread waiting for a zero-copy write to complete, see write.c */
+	struct ioc_write_wait		*wait;
+	struct iof_pool_type		*pt;
+	/** Extent of a write-back in flight, on the sent list of the handle */
+	d_list_t			wb_list;
+	off_t				wb_offset;
+	size_t				wb_len;
+	size_t				buf_size;
 	bool				failure;
 };
 
+/* Number of size classes of read and write buffers.  Classes are powers of
+ * two from 4K, with the last class sized to max_read or max_write.
+ */
+#define IOC_POOL_CLASSES 10
+
+/* Bytes of buffers of each class held in the per-thread magazines of the
+ * pool, for each thread and for all threads together.  Classes of larger
+ * buffers hold fewer, but always at least one.
+ */
+#define IOC_POOL_MAG_BYTES (256 * 1024)
+#define IOC_POOL_MAG_TOTAL_BYTES (8 * 1024 * 1024)
+
+/** A size class of read or write buffers */
+struct ioc_pool_class {
+	struct iof_pool_type		*pt;
+	size_t				size;
+};
+
 enum iof_failover_state {
 	iof_failover_running,
 	iof_failover_offline,
@@ -217,12 +257,16 @@ struct iof_projection_info {
 	struct iof_pool_type		*fsh_pool;
 	struct iof_pool_type		*close_pool;
 	struct iof_pool_type		*lookup_pool;
+	struct iof_pool_type		*lookup_path_pool;
 	struct iof_pool_type		*mkdir_pool;
 	struct iof_pool_type		*symlink_pool;
 	struct iof_pool_type		*fh_pool;
-	struct iof_pool_type		*rb_pool_page;
-	struct iof_pool_type		*rb_pool_large;
-	struct iof_pool_type		*write_pool;
+	/** Read buffers by size class, see ioc_rb_acquire() */
+	struct ioc_pool_class		rb_pool[IOC_POOL_CLASSES];
+	int				rb_classes;
+	/** Write buffers by size class, see ioc_wb_acquire() */
+	struct ioc_pool_class		wb_pool[IOC_POOL_CLASSES];
+	int				wb_classes;
 	uint32_t			max_read;
 	uint32_t			max_iov_read;
 	uint32_t			readdir_size;
@@ -230,6 +274,37 @@ struct iof_projection_info {
 	int				offline_reason;
 	/** Hash table of open inodes */
 	struct d_hash_table		inode_ht;
+	/** Number of open files holding readahead blocks, so that writes
+	 * can skip invalidating readahead when there is none.
+	 */
+	ATOMIC int			ra_active;
+	/** Change token of the root directory, as ioc_inode_entry.dir_token
+	 * for the root which is not in inode_ht.
+	 */
+	uint64_t			root_dir_token;
+
+	/** Kernel cache timeouts in seconds, from iof_fs_info */
+	double				entry_timeout;
+	double				attr_timeout;
+	double				negative_timeout;
+
+	/** Change notification from the IONSS, see ioc_watch_start() */
+	pthread_t			watch_thread;
+	pthread_mutex_t			watch_lock;
+	pthread_cond_t			watch_cond;
+	/** The watch RPC in flight, protected by watch_lock */
+	crt_rpc_t			*watch_rpc;
+	/** From iof_watch_client() for this node, or zero */
+	uint64_t			watch_client;
+	bool				watch_started;
+	bool				watch_stop;
+
+	/** Names resolved by lookup_path but not yet looked up by the
+	 * kernel, see ioc_nc_add()
+	 */
+	pthread_mutex_t			nc_lock;
+	d_list_t			nc_list;
+	int				nc_count;
 
 	pthread_mutex_t			od_lock;
 	/** List of directory handles owned by FUSE */
@@ -384,11 +459,22 @@ struct fuse_lowlevel_ops *iof_get_fuse_ops(uint64_t);
 		IOF_TRACE_DOWN(req);					\
 	} while (0)
 
+/* With the write-back cache the kernel may read pages of files opened
+ * write-only to fill in partial pages, and handles O_APPEND itself, so adjust
+ * the flags files are opened with on the server to match.
+ */
+#define IOC_OPEN_FLAGS(FS_HANDLE, FLAGS)				\
+	(((FS_HANDLE)->flags & IOF_WRITEBACK_CACHE) ?			\
+	 (((FLAGS) & ~(O_ACCMODE | O_APPEND)) |				\
+	  (((FLAGS) & O_ACCMODE) == O_WRONLY ?				\
+	   O_RDWR : (FLAGS) & O_ACCMODE)) : (FLAGS))
+
 #define IOC_REPLY_ATTR(ioc_req, attr)					\
 	do {								\
 		int __rc;						\
 		IOF_TRACE_DEBUG(ioc_req, "Returning attr");		\
-		__rc = fuse_reply_attr(ioc_req->req, attr, 0);		\
+		__rc = fuse_reply_attr(ioc_req->req, attr,		\
+				       (ioc_req)->fsh->attr_timeout);	\
 		if (__rc != 0)						\
 			IOF_TRACE_ERROR(ioc_req,			\
 					"fuse_reply_attr returned %d:%s", \
@@ -432,6 +518,13 @@ struct fuse_lowlevel_ops *iof_get_fuse_ops(uint64_t);
 		IOF_TRACE_DOWN(req);					\
 	} while (0)
 
+/* Set the kernel cache timeouts of a struct fuse_entry_param */
+#define IOC_ENTRY_TIMEOUTS(fs_handle, entry)				\
+	do {								\
+		(entry).entry_timeout = (fs_handle)->entry_timeout;	\
+		(entry).attr_timeout = (fs_handle)->attr_timeout;	\
+	} while (0)
+
 #define IOF_FUSE_REPLY_ENTRY(req, entry)				\
 	do {								\
 		int __rc;						\
@@ -652,7 +745,7 @@ struct ioc_inode_entry {
 	d_list_t	ie_ie_children;
 
 	/** List of open file handles for this inode.
-	 * Populated during failover only.
+	 * Protected by the projection of_lock.
 	 */
 	d_list_t	ie_fh_list;
 
@@ -665,8 +758,38 @@ struct ioc_inode_entry {
 	 * Set to true during failover if this inode should be migrated
 	 */
 	bool		failover;
+
+	/** Change token of the directory from the last opendir, used to
+	 * decide if the kernel may keep cached contents.
+	 * Protected by gah_lock.
+	 */
+	uint64_t	dir_token;
 };
 
+/**
+ * Name cache entry.
+ *
+ * Records a name which has been resolved by a lookup_path RPC, so that the
+ * following lookup from the kernel can be answered locally.  Each entry
+ * holds a reference on the inode in the inode hash table which is passed to
+ * the kernel on use, or dropped if the entry expires unused.
+ */
+struct ioc_name_entry {
+	d_list_t			list;
+	fuse_ino_t			parent;
+	struct ioc_inode_entry		*ie;
+	struct timespec			expires;
+	char				name[256];
+};
+
+/** Maximum number of entries in the name cache */
+#define IOC_NC_MAX 256
+
+/** Time in seconds before an unused name cache entry is dropped */
+#define IOC_NC_TIMEOUT 5
+
+struct iof_readdir_fetch;
+
 /**
  * Directory handle.
  *
@@ -679,8 +802,6 @@ struct iof_dir_handle {
 	struct ioc_request		close_req;
 	/** The GAH to use when accessing the directory */
 	struct ios_gah			gah;
-	/** Any RPC reference held across readdir() calls */
-	crt_rpc_t			*rpc;
 	/** Pointer to any retreived data from readdir() RPCs */
 	struct iof_readdir_reply	*replies;
 	int				reply_count;
@@ -697,6 +818,22 @@ struct iof_dir_handle {
 	crt_endpoint_t			ep;
 	/** List of directory handles */
 	d_list_t			dh_od_list;
+	/** Protects the readdir state below, and the replies above, as
+	 * readdir requests are completed from RPC callbacks.
+	 */
+	pthread_mutex_t			rd_lock;
+	/** The readdir RPC in flight, or completed and not yet used */
+	struct iof_readdir_fetch	*rd_fetch;
+	/** FUSE request waiting for rd_fetch to complete */
+	fuse_req_t			rd_req;
+	/** Reply buffer for rd_req */
+	char				*rd_buf;
+	size_t				rd_size;
+	size_t				rd_used;
+	/** Offset of the next entry to be returned */
+	off_t				rd_offset;
+	/** Set if rd_req is a READDIRPLUS request */
+	bool				rd_plus;
 };
 
 /**
@@ -704,6 +841,64 @@ struct iof_dir_handle {
  *
  * Describes a file open for reading/writing.
  */
+/**
+ * Client readahead state of an open file, see read.c
+ *
+ * Once a file is being read sequentially, blocks of max_read bytes following
+ * the reader are fetched ahead of time and later reads are served from them.
+ */
+struct ioc_readahead {
+	pthread_mutex_t			lock;
+	/** Signalled when inflight drops to zero */
+	pthread_cond_t			cond;
+	/** Prefetched blocks, in offset order */
+	d_list_t			blocks;
+	/** Number of blocks with a RPC in flight */
+	int				inflight;
+	/** Number of consecutive sequential reads */
+	uint32_t			streak;
+	/** Offset following the furthest read */
+	off_t				next_offset;
+	/** Offset to prefetch from next */
+	off_t				fetch_offset;
+	/** Set once a prefetch has reached the end of the file */
+	bool				eof;
+	/** Set if counted in ra_active of the projection */
+	bool				active;
+	/** Average time to fetch a block, and between reads, in ns */
+	uint64_t			rtt;
+	uint64_t			gap;
+	uint64_t			last_read;
+};
+
+/**
+ * Client write-back state of an open file, see write.c
+ *
+ * Only used if the projection has IOF_WRITEBACK_CACHE set.
+ */
+struct ioc_writeback {
+	pthread_mutex_t			lock;
+	/** Signalled when inflight drops */
+	pthread_cond_t			cond;
+	/** Buffer holding the dirty extent, if any */
+	struct iof_wb			*dirty;
+	/** Offset and length of the dirty extent */
+	off_t				offset;
+	size_t				len;
+	/** Number of write-back RPCs in flight */
+	int				inflight;
+	/** Extents detached for sending and not yet complete, oldest first */
+	d_list_t			sent;
+	/** Number of other threads syncing this handle, which release waits
+	 * for, see ioc_wb_sync_ino()
+	 */
+	int				users;
+	/** First error from a write-back RPC, to be reported to the
+	 * application on the next write, flush or fsync.
+	 */
+	int				error;
+};
+
 struct iof_file_handle {
 	/** The projection this file belongs to */
 	struct iof_projection_info	*fs_handle;
@@ -739,6 +934,10 @@ struct iof_file_handle {
 	 * function to reply to a FUSE request
 	 */
 	fuse_req_t			open_req;
+	/** Readahead state */
+	struct ioc_readahead		ra;
+	/** Write-back state */
+	struct ioc_writeback		wb;
 };
 
 /* GAH ok manipulation macros. gah_ok is defined as a int but we're
@@ -827,6 +1026,26 @@ find_inode(struct iof_projection_info *fs_handle, ino_t ino,
 
 void ie_close(struct iof_projection_info *, struct ioc_inode_entry *);
 
+/* Add an open file to the list of handles for its inode */
+void ioc_fh_ino_add(struct iof_file_handle *);
+
+/* Add a resolved name to the name cache, consuming a reference on ie */
+void ioc_nc_add(struct iof_projection_info *, fuse_ino_t, const char *,
+		struct ioc_inode_entry *);
+
+/* Remove a name from the name cache, returning the inode with a reference
+ * held, or NULL if there is no valid entry.
+ */
+struct ioc_inode_entry *
+ioc_nc_take(struct iof_projection_info *, fuse_ino_t, const char *);
+
+/* Drop a name from the name cache, or all names if name is NULL */
+void ioc_nc_drop(struct iof_projection_info *, fuse_ino_t, const char *);
+
+/* Resolve a path relative to a directory, see IOF_IOCTL_LOOKUP_PATH */
+void ioc_lookup_path(fuse_req_t, struct iof_projection_info *, fuse_ino_t,
+		     const char *);
+
 int iof_fs_send(struct ioc_request *request);
 
 int ioc_simple_resend(struct ioc_request *request);
@@ -835,6 +1054,17 @@ void ioc_ll_gen_cb(const struct crt_cb_info *);
 
 void ioc_ll_lookup(fuse_req_t, fuse_ino_t, const char *);
 
+/* Start a thread which waits for changes made on the IONSS and invalidates
+ * them in the kernel, if the projection allows the kernel to cache.
+ */
+void ioc_watch_start(struct iof_projection_info *);
+
+/* Stop the watch thread, before the FUSE session is torn down */
+void ioc_watch_stop(struct iof_projection_info *);
+
+/* Invalidate every entry the kernel holds for the projection */
+void ioc_flush_inodes(struct iof_projection_info *);
+
 void ioc_ll_forget(fuse_req_t, fuse_ino_t, uint64_t);
 
 void ioc_ll_forget_multi(fuse_req_t, size_t, struct fuse_forget_data *);
@@ -852,6 +1082,24 @@ void ioc_ll_open(fuse_req_t, fuse_ino_t, struct fuse_file_info *);
 void ioc_ll_create(fuse_req_t, fuse_ino_t, const char *, mode_t,
 		   struct fuse_file_info *);
 
+/* Acquire a read or write buffer of at least len bytes from the smallest
+ * size class that fits, up to max_read or max_write.  The pool type the
+ * buffer came from is saved in pt for releasing it.
+ */
+struct iof_rb *ioc_rb_acquire(struct iof_projection_info *, size_t len);
+struct iof_wb *ioc_wb_acquire(struct iof_projection_info *, size_t len);
+
+/* Discard any prefetched data for a file */
+void ioc_ra_invalidate(struct iof_file_handle *);
+
+/* Discard any prefetched data for all open handles of an inode */
+void ioc_ra_invalidate_ino(struct iof_projection_info *, fuse_ino_t);
+
+/* Discard any prefetched data for a file, and wait for prefetches in flight
+ * to complete.
+ */
+void ioc_ra_fini(struct iof_file_handle *);
+
 void ioc_ll_read(fuse_req_t, fuse_ino_t, size_t, off_t,
 		 struct fuse_file_info *);
 
@@ -865,6 +1113,11 @@ void ioc_ll_rmdir(fuse_req_t, fuse_ino_t, const char *);
 
 void ioc_ll_opendir(fuse_req_t, fuse_ino_t, struct fuse_file_info *);
 
+void ioc_ll_readdirplus(fuse_req_t, fuse_ino_t, size_t, off_t,
+			struct fuse_file_info *);
+
+void ioc_readdir_release(struct iof_dir_handle *);
+
 void ioc_ll_readdir(fuse_req_t, fuse_ino_t, size_t, off_t,
 		    struct fuse_file_info *);
 
@@ -881,6 +1134,27 @@ void ioc_ll_write(fuse_req_t, fuse_ino_t, const char *,	size_t, off_t,
 void ioc_ll_write_buf(fuse_req_t, fuse_ino_t, struct fuse_bufvec *,
 		      off_t, struct fuse_file_info *);
 
+void ioc_ll_flush(fuse_req_t, fuse_ino_t, struct fuse_file_info *);
+
+/* Send any cached writes for a file and wait for them to complete.
+ *
+ * Returns the first error from a cached write since the last call with
+ * report set, or 0.
+ */
+int ioc_wb_sync(struct iof_file_handle *, bool report);
+
+/* Send any cached writes for a file which overlap a range and wait for them,
+ * and any earlier overlapping writes, to complete.  Errors are left to be
+ * reported by ioc_wb_sync().
+ */
+void ioc_wb_sync_range(struct iof_file_handle *, off_t, size_t);
+
+/* Send any cached writes for all open handles of an inode and wait for them
+ * to complete.  Errors are only returned for handle, which may be NULL.
+ */
+int ioc_wb_sync_ino(struct iof_projection_info *, fuse_ino_t,
+		    struct iof_file_handle *handle, bool report);
+
 void ioc_ll_ioctl(fuse_req_t, fuse_ino_t, int, void *, struct fuse_file_info *,
 		  unsigned int, const void *, size_t, size_t);
 
@@ -113,6 +113,10 @@ ioc_fuse_init(void *arg, struct fuse_conn_info *conn)
 	conn->want |= FUSE_CAP_BIG_WRITES;
 #endif
 
+	if ((fs_handle->flags & IOF_WRITEBACK_CACHE) &&
+	    (conn->capable & FUSE_CAP_WRITEBACK_CACHE))
+		conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+
 	IOF_TRACE_INFO(fs_handle, "Capability requested %#x", conn->want);
 
 	ioc_show_flags(fs_handle, conn->want);
@@ -226,6 +230,7 @@ struct fuse_lowlevel_ops *iof_get_fuse_ops(uint64_t flags)
 	fuse_ops->opendir = ioc_ll_opendir;
 	fuse_ops->releasedir = ioc_ll_releasedir;
 	fuse_ops->readdir = ioc_ll_readdir;
+	fuse_ops->readdirplus = ioc_ll_readdirplus;
 	fuse_ops->ioctl = ioc_ll_ioctl;
 	fuse_ops->destroy = ioc_fuse_destroy;
 
@@ -246,5 +251,8 @@ struct fuse_lowlevel_ops *iof_get_fuse_ops(uint64_t flags)
 	if (flags & IOF_FUSE_WRITE_BUF)
 		fuse_ops->write_buf = ioc_ll_write_buf;
 
+	if (flags & IOF_WRITEBACK_CACHE)
+		fuse_ops->flush = ioc_ll_flush;
+
 	return fuse_ops;
 }
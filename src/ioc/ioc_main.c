@@ -225,7 +225,8 @@ static void mark_fh_inode(struct iof_file_handle *fh)
 	}
 	ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
 
-	d_list_add(&fh->fh_ino_list, &ie->ie_fh_list);
+	/* Open files are normally already on the list for the inode */
+	d_list_move(&fh->fh_ino_list, &ie->ie_fh_list);
 	ie->failover = true;
 
 	mark_inode_tree(fh->fs_handle, ie);
@@ -854,14 +855,19 @@ int iof_fs_send(struct ioc_request *request)
 	ep.ep_grp = fs_handle->proj.grp->dest_grp;
 
 	/* Pick an appropiate rank, for most cases this is the root of the GAH
-	 * however if that is not known then send to the PSR
+	 * however if that is not known then send to the PSR.  The tag selects
+	 * the server context so is derived from the GAH as well.
 	 */
-	if (request->ir_ht == RHS_INODE)
+	if (request->ir_ht == RHS_INODE) {
 		ep.ep_rank = request->ir_inode->gah.root;
-	else if (request->ir_ht == RHS_ROOT)
+		ep.ep_tag = iof_gah_tag(fs_handle->proj.grp,
+					&request->ir_inode->gah);
+	} else if (request->ir_ht == RHS_ROOT) {
 		ep.ep_rank = fs_handle->gah.root;
-	else
+		ep.ep_tag = iof_gah_tag(fs_handle->proj.grp, &fs_handle->gah);
+	} else {
 		ep.ep_rank = atomic_load_consume(&fs_handle->proj.grp->pri_srv_rank);
+	}
 
 	/* Defer clean up until the output is copied. */
 	crt_req_addref(request->rpc);
@@ -892,13 +898,14 @@ query_cb(const struct crt_cb_info *cb_info)
 }
 
 /*
- * Send RPC to PSR to get information about projected filesystems
+ * Send RPC to PSR to get information about projected filesystems, opc is
+ * either QUERY_EXT_OP or QUERY_PSR_OP.
  *
  * Returns CaRT error code.
  */
 static int
 get_info(struct iof_state *iof_state, struct iof_group_info *group,
-	 crt_rpc_t **query_rpc)
+	 crt_opcode_t opc, crt_rpc_t **query_rpc)
 {
 	struct query_cb_r reply = {0};
 	crt_rpc_t *rpc = NULL;
@@ -909,7 +916,7 @@ get_info(struct iof_state *iof_state, struct iof_group_info *group,
 	iof_tracker_init(&reply.tracker, 1);
 
 	rc = crt_req_create(iof_state->iof_ctx.crt_ctx, &group->grp.psr_ep,
-			    QUERY_PSR_OP, &rpc);
+			    opc, &rpc);
 	if (rc != -DER_SUCCESS || !rpc) {
 		IOF_TRACE_ERROR(iof_state,
 				"failed to create query rpc request, rc = %d",
@@ -1019,6 +1026,8 @@ attach_group(struct iof_state *iof_state, struct iof_group_info *group)
 	atomic_store_release(&group->grp.pri_srv_rank, psr_list->rl_ranks[0]);
 	group->grp.psr_ep.ep_rank = psr_list->rl_ranks[0];
 	group->grp.psr_ep.ep_tag = 0;
+	group->grp.ctx_count = 1;
+	group->grp.proto_version = 0;
 	d_rank_list_free(psr_list);
 	IOF_TRACE_INFO(group, "Primary Service Rank: %d",
 		       atomic_load_consume(&group->grp.pri_srv_rank));
@@ -1036,6 +1045,11 @@ attach_group(struct iof_state *iof_state, struct iof_group_info *group)
 					  group->grp.psr_ep.ep_rank);
 	cb->register_ctrl_constant_uint64(ionss_dir, "psr_tag",
 					  group->grp.psr_ep.ep_tag);
+	/* Updated from the query reply, so register as a variable */
+	cb->register_ctrl_variable(ionss_dir, "ctx_count", iof_uint_read,
+				   NULL, NULL, &group->grp.ctx_count);
+	cb->register_ctrl_variable(ionss_dir, "proto_version", iof_uint_read,
+				   NULL, NULL, &group->grp.proto_version);
 	/* Fix this when we actually have multiple IONSS apps */
 	cb->register_ctrl_constant(ionss_dir, "name", group->grp_name);
 
@@ -1103,23 +1117,21 @@ dh_init(void *arg, void *handle)
 
 	IOC_REQUEST_INIT(&dh->open_req, handle);
 	IOC_REQUEST_INIT(&dh->close_req, handle);
-	dh->rpc = NULL;
+	dh->rd_fetch = NULL;
+	D_MUTEX_INIT(&dh->rd_lock, NULL);
 }
 
 static bool
 dh_reset(void *arg)
 {
 	struct iof_dir_handle *dh = arg;
+	crt_opcode_t opc;
 	int rc;
 
 	dh->reply_count = 0;
-
-	/* If there has been an error on the local handle, or readdir() is not
-	 * exhausted then ensure that all resources are freed correctly
-	 */
-	if (dh->rpc)
-		crt_req_decref(dh->rpc);
-	dh->rpc = NULL;
+	dh->last_replies = 0;
+	dh->rd_offset = 0;
+	dh->rd_req = NULL;
 
 	if (dh->open_req.rpc)
 		crt_req_decref(dh->open_req.rpc);
@@ -1127,8 +1139,14 @@ dh_reset(void *arg)
 	if (dh->close_req.rpc)
 		crt_req_decref(dh->close_req.rpc);
 
-	rc = crt_req_create(dh->open_req.fsh->proj.crt_ctx, NULL,
-			    FS_TO_OP(dh->open_req.fsh, opendir),
+	/* Request the change token if the IONSS supports it */
+	if (dh->open_req.fsh->proj.grp->proto_version >=
+	    IOF_OPENDIR_TOKEN_VERSION)
+		opc = FS_TO_OP(dh->open_req.fsh, opendir_token);
+	else
+		opc = FS_TO_OP(dh->open_req.fsh, opendir);
+
+	rc = crt_req_create(dh->open_req.fsh->proj.crt_ctx, NULL, opc,
 			    &dh->open_req.rpc);
 	if (rc || !dh->open_req.rpc)
 		return false;
@@ -1154,6 +1172,7 @@ dh_release(void *arg)
 
 	crt_req_decref(dh->open_req.rpc);
 	crt_req_decref(dh->close_req.rpc);
+	D_MUTEX_DESTROY(&dh->rd_lock);
 }
 
 /* Create a getattr descriptor for use with mempool.
@@ -1172,6 +1191,12 @@ fh_init(void *arg, void *handle)
 	fh->creat_rpc = NULL;
 	fh->release_rpc = NULL;
 	fh->ie = NULL;
+	D_MUTEX_INIT(&fh->ra.lock, NULL);
+	pthread_cond_init(&fh->ra.cond, NULL);
+	D_INIT_LIST_HEAD(&fh->ra.blocks);
+	D_MUTEX_INIT(&fh->wb.lock, NULL);
+	pthread_cond_init(&fh->wb.cond, NULL);
+	D_INIT_LIST_HEAD(&fh->wb.sent);
 }
 
 static bool
@@ -1222,7 +1247,8 @@ fh_reset(void *arg)
 		return false;
 	}
 
-	rc = crt_req_create(fh->fs_handle->proj.crt_ctx, &fh->common.ep,
+	/* The endpoint for close depends on the GAH so is set at release */
+	rc = crt_req_create(fh->fs_handle->proj.crt_ctx, NULL,
 			    FS_TO_OP(fh->fs_handle, close), &fh->release_rpc);
 	if (rc || !fh->release_rpc) {
 		D_FREE(fh->ie);
@@ -1235,6 +1261,21 @@ fh_reset(void *arg)
 	crt_req_addref(fh->creat_rpc);
 	crt_req_addref(fh->release_rpc);
 	D_INIT_LIST_HEAD(&fh->fh_ino_list);
+	fh->ra.inflight = 0;
+	fh->ra.streak = 0;
+	fh->ra.next_offset = 0;
+	fh->ra.fetch_offset = 0;
+	fh->ra.eof = false;
+	fh->ra.active = false;
+	fh->ra.rtt = 0;
+	fh->ra.gap = 0;
+	fh->ra.last_read = 0;
+	fh->wb.dirty = NULL;
+	fh->wb.offset = 0;
+	fh->wb.len = 0;
+	fh->wb.inflight = 0;
+	fh->wb.users = 0;
+	fh->wb.error = 0;
 	return true;
 }
 
@@ -1250,6 +1291,10 @@ fh_release(void *arg)
 	crt_req_decref(fh->release_rpc);
 	crt_req_decref(fh->release_rpc);
 	D_FREE(fh->ie);
+	pthread_cond_destroy(&fh->ra.cond);
+	D_MUTEX_DESTROY(&fh->ra.lock);
+	pthread_cond_destroy(&fh->wb.cond);
+	D_MUTEX_DESTROY(&fh->wb.lock);
 }
 
 #define COMMON_INIT(type)						\
@@ -1313,6 +1358,7 @@ common_release(void *arg)
 ENTRY_INIT(lookup);
 ENTRY_INIT(mkdir);
 ENTRY_INIT(symlink);
+ENTRY_INIT(lookup_path);
 
 static bool
 entry_reset(void *arg)
@@ -1377,12 +1423,12 @@ entry_release(void *arg)
 }
 
 static void
-rb_page_init(void *arg, void *handle)
+rb_init(void *arg, void *handle, int class)
 {
 	struct iof_rb *rb = arg;
 
 	rb->fs_handle = handle;
-	rb->buf_size = 4096;
+	rb->buf_size = rb->fs_handle->rb_pool[class].size;
 	rb->fbuf.count = 1;
 	rb->fbuf.buf[0].fd = -1;
 	rb->rpc = NULL;
@@ -1390,15 +1436,6 @@ rb_page_init(void *arg, void *handle)
 	rb->lb.buf = NULL;
 }
 
-static void
-rb_large_init(void *arg, void *handle)
-{
-	struct iof_rb *rb = arg;
-
-	rb_page_init(arg, handle);
-	rb->buf_size = rb->fs_handle->max_read;
-}
-
 static bool
 rb_reset(void *arg)
 {
@@ -1449,14 +1486,18 @@ rb_release(void *arg)
 }
 
 static void
-wb_init(void *arg, void *handle)
+wb_init(void *arg, void *handle, int class)
 {
 	struct iof_wb *wb = arg;
 
 	wb->fs_handle = handle;
+	wb->buf_size = wb->fs_handle->wb_pool[class].size;
 	wb->rpc = NULL;
 	wb->failure = false;
 	wb->lb.buf = NULL;
+	wb->bulk = NULL;
+	wb->wait = NULL;
+	D_INIT_LIST_HEAD(&wb->wb_list);
 }
 
 static bool
@@ -1466,6 +1507,8 @@ wb_reset(void *arg)
 	int rc;
 
 	wb->req = 0;
+	wb->bulk = NULL;
+	wb->wait = NULL;
 
 	if (wb->rpc) {
 		crt_req_decref(wb->rpc);
@@ -1480,7 +1523,7 @@ wb_reset(void *arg)
 
 	if (!wb->lb.buf) {
 		IOF_BULK_ALLOC(wb->fs_handle->proj.crt_ctx, wb, lb,
-			       wb->fs_handle->proj.max_write, true);
+			       wb->buf_size, true);
 		if (!wb->lb.buf)
 			return false;
 	}
@@ -1508,6 +1551,110 @@ wb_release(void *arg)
 	IOF_BULK_FREE(wb, lb);
 }
 
+/* The pool registration API only passes the projection to init() so use a
+ * separate function for each size class.
+ */
+#define POOL_CLASS_INIT(N)					\
+	static void rb_init_##N(void *arg, void *handle)	\
+	{							\
+		rb_init(arg, handle, N);			\
+	}							\
+	static void wb_init_##N(void *arg, void *handle)	\
+	{							\
+		wb_init(arg, handle, N);			\
+	}
+POOL_CLASS_INIT(0);
+POOL_CLASS_INIT(1);
+POOL_CLASS_INIT(2);
+POOL_CLASS_INIT(3);
+POOL_CLASS_INIT(4);
+POOL_CLASS_INIT(5);
+POOL_CLASS_INIT(6);
+POOL_CLASS_INIT(7);
+POOL_CLASS_INIT(8);
+POOL_CLASS_INIT(9);
+
+static void (*rb_class_init[IOC_POOL_CLASSES])(void *, void *) = {
+	rb_init_0, rb_init_1, rb_init_2, rb_init_3, rb_init_4,
+	rb_init_5, rb_init_6, rb_init_7, rb_init_8, rb_init_9,
+};
+
+static void (*wb_class_init[IOC_POOL_CLASSES])(void *, void *) = {
+	wb_init_0, wb_init_1, wb_init_2, wb_init_3, wb_init_4,
+	wb_init_5, wb_init_6, wb_init_7, wb_init_8, wb_init_9,
+};
+
+/* Set the buffer size of each class for buffers of up to max bytes, and
+ * return the number of classes.
+ */
+static int
+pool_classes_init(struct ioc_pool_class *classes, size_t max)
+{
+	size_t size = 4096;
+	int i = 0;
+
+	while (size < max && i < IOC_POOL_CLASSES - 1) {
+		classes[i++].size = size;
+		size <<= 1;
+	}
+	classes[i++].size = max;
+
+	return i;
+}
+
+/* Limit the buffers of a class held in pool magazines */
+static void
+pool_class_limits(struct iof_pool_reg *reg, size_t size)
+{
+	reg->max_mag_desc = IOC_POOL_MAG_BYTES / size;
+	if (reg->max_mag_desc == 0)
+		reg->max_mag_desc = 1;
+
+	reg->max_mag_total = IOC_POOL_MAG_TOTAL_BYTES / size;
+	if (reg->max_mag_total == 0)
+		reg->max_mag_total = 1;
+}
+
+/* Return the smallest class holding len bytes */
+static int
+pool_class(int classes, size_t len)
+{
+	int class = 0;
+
+	if (len > 4096)
+		class = 64 - __builtin_clzl(len - 1) - 12;
+	if (class >= classes)
+		class = classes - 1;
+
+	return class;
+}
+
+struct iof_rb *
+ioc_rb_acquire(struct iof_projection_info *fs_handle, size_t len)
+{
+	struct iof_pool_type *pt;
+	struct iof_rb *rb;
+
+	pt = fs_handle->rb_pool[pool_class(fs_handle->rb_classes, len)].pt;
+	rb = iof_pool_acquire(pt);
+	if (rb)
+		rb->pt = pt;
+	return rb;
+}
+
+struct iof_wb *
+ioc_wb_acquire(struct iof_projection_info *fs_handle, size_t len)
+{
+	struct iof_pool_type *pt;
+	struct iof_wb *wb;
+
+	pt = fs_handle->wb_pool[pool_class(fs_handle->wb_classes, len)].pt;
+	wb = iof_pool_acquire(pt);
+	if (wb)
+		wb->pt = pt;
+	return wb;
+}
+
 static int
 iof_check_complete(void *arg)
 {
@@ -1746,6 +1893,13 @@ static int iof_reg(void *arg, struct cnss_plugin_cb *cb, size_t cb_size)
 		return 1;
 	}
 
+	ret = crt_rpc_register(QUERY_EXT_OP, 0, &QUERY_EXT_RPC_FMT);
+	if (ret) {
+		IOF_TRACE_ERROR(iof_state, "Query rpc registration failed with "
+				"ret: %d", ret);
+		return 1;
+	}
+
 	ret = crt_rpc_register(DETACH_OP, CRT_RPC_FEAT_NO_TIMEOUT, NULL);
 	if (ret) {
 		IOF_TRACE_ERROR(iof_state, "Detach registration failed with "
@@ -1830,6 +1984,7 @@ static bool
 initialize_projection(struct iof_state *iof_state,
 		      struct iof_group_info *group,
 		      struct iof_fs_info *fs_info,
+		      struct iof_fs_ext *fs_ext,
 		      struct iof_psr_query *query,
 		      int id)
 {
@@ -1838,7 +1993,10 @@ initialize_projection(struct iof_state *iof_state,
 	struct fuse_args		args = {0};
 	bool				writeable = false;
 	int				ret;
+	int				i;
 	struct fuse_lowlevel_ops	*fuse_ops = NULL;
+	struct ctrl_dir			*pools_dir = NULL;
+	char				name[NAME_MAX];
 
 	struct iof_pool_reg pt = {.init = dh_init,
 				  .reset = dh_reset,
@@ -1858,18 +2016,11 @@ initialize_projection(struct iof_state *iof_state,
 				       .release = entry_release,
 				       POOL_TYPE_INIT(entry_req, list)};
 
-	struct iof_pool_reg rb_page = {.init = rb_page_init,
-				       .reset = rb_reset,
-				       .release = rb_release,
-				       POOL_TYPE_INIT(iof_rb, list)};
-
-	struct iof_pool_reg rb_large = {.init = rb_large_init,
-					.reset = rb_reset,
-					.release = rb_release,
-					POOL_TYPE_INIT(iof_rb, list)};
+	struct iof_pool_reg rb = {.reset = rb_reset,
+				  .release = rb_release,
+				  POOL_TYPE_INIT(iof_rb, list)};
 
-	struct iof_pool_reg wb = {.init = wb_init,
-				  .reset = wb_reset,
+	struct iof_pool_reg wb = {.reset = wb_reset,
 				  .release = wb_release,
 				  POOL_TYPE_INIT(iof_wb, list)};
 
@@ -1896,6 +2047,12 @@ initialize_projection(struct iof_state *iof_state,
 
 	IOF_TRACE_UP(&fs_handle->pool, fs_handle, "iof_pool");
 
+	if (fs_info->flags & IOF_POOL_THREAD) {
+		ret = iof_pool_start_thread(&fs_handle->pool);
+		if (ret != -DER_SUCCESS)
+			D_GOTO(err, 0);
+	}
+
 	fs_handle->iof_state = iof_state;
 	fs_handle->flags = fs_info->flags;
 	fs_handle->proj.proto = iof_state->proto;
@@ -1909,11 +2066,15 @@ initialize_projection(struct iof_state *iof_state,
 			fs_handle->flags & IOF_FAILOVER
 					 ? "Enabled" : "Disabled");
 	IOF_TRACE_INFO(fs_handle, "FUSE: %sthreaded | API => "
-			"Write: ioc_ll_write%s, Read: fuse_reply_%s",
+			"Write: ioc_ll_write%s, Read: fuse_reply_%s%s%s",
 			fs_handle->flags & IOF_CNSS_MT
 					 ? "Single " : "Multi-",
 			fs_handle->flags & IOF_FUSE_WRITE_BUF ? "_buf" : "",
-			fs_handle->flags & IOF_FUSE_READ_BUF ? "buf" : "data");
+			fs_handle->flags & IOF_FUSE_READ_BUF ? "buf" : "data",
+			fs_handle->flags & IOF_WRITEBACK_CACHE
+					 ? " | Write-back" : "",
+			fs_handle->flags & IOF_POOL_THREAD
+					 ? " | Pool thread" : "");
 
 	ret = d_hash_table_create_inplace(D_HASH_FT_RWLOCK |
 					  D_HASH_FT_EPHEMERAL,
@@ -1936,6 +2097,10 @@ initialize_projection(struct iof_state *iof_state,
 	 */
 	D_INIT_LIST_HEAD(&fs_handle->opendir_list);
 	ret = D_MUTEX_INIT(&fs_handle->od_lock, NULL);
+	if (ret != 0)
+		D_GOTO(err, 0);
+	D_INIT_LIST_HEAD(&fs_handle->nc_list);
+	ret = D_MUTEX_INIT(&fs_handle->nc_lock, NULL);
 	if (ret != 0)
 		D_GOTO(err, 0);
 	D_INIT_LIST_HEAD(&fs_handle->openfile_list);
@@ -1949,6 +2114,13 @@ initialize_projection(struct iof_state *iof_state,
 	if (ret != 0)
 		D_GOTO(err, 0);
 
+	ret = D_MUTEX_INIT(&fs_handle->watch_lock, NULL);
+	if (ret != 0)
+		D_GOTO(err, 0);
+	ret = pthread_cond_init(&fs_handle->watch_cond, NULL);
+	if (ret != 0)
+		D_GOTO(err, 0);
+
 	ret = D_MUTEX_INIT(&fs_handle->p_request_lock, NULL);
 	if (ret != 0)
 		D_GOTO(err, 0);
@@ -1962,6 +2134,11 @@ initialize_projection(struct iof_state *iof_state,
 	fs_handle->proj.max_iov_write = fs_info->max_iov_write;
 	fs_handle->readdir_size = fs_info->readdir_size;
 	fs_handle->gah = fs_info->gah;
+	if (fs_ext) {
+		fs_handle->entry_timeout = fs_ext->entry_timeout / 1000.0;
+		fs_handle->attr_timeout = fs_ext->attr_timeout / 1000.0;
+		fs_handle->negative_timeout = fs_ext->negative_timeout / 1000.0;
+	}
 
 	strncpy(fs_handle->mnt_dir.name, fs_info->dir_name.name, NAME_MAX);
 
@@ -2045,6 +2222,7 @@ initialize_projection(struct iof_state *iof_state,
 
 	REGISTER_STAT(opendir);
 	REGISTER_STAT(readdir);
+	REGISTER_STAT(readdirplus);
 	REGISTER_STAT(closedir);
 	REGISTER_STAT(getattr);
 	REGISTER_STAT(readlink);
@@ -2056,6 +2234,16 @@ initialize_projection(struct iof_state *iof_state,
 	REGISTER_STAT(il_ioctl);
 	REGISTER_STAT(lookup);
 	REGISTER_STAT(forget);
+	REGISTER_STAT(lookup_path);
+	REGISTER_STAT(lookup_cached);
+	REGISTER_STAT(lookup_negative);
+	REGISTER_STAT(watch_events);
+	REGISTER_STAT(ra_hit);
+	REGISTER_STAT(ra_miss);
+	REGISTER_STAT(ra_blocks);
+	REGISTER_STAT(write_merged);
+	REGISTER_STAT(write_back);
+	REGISTER_STAT(write_direct);
 	REGISTER_STAT64(read_bytes);
 
 	if (writeable) {
@@ -2066,6 +2254,7 @@ initialize_projection(struct iof_state *iof_state,
 		REGISTER_STAT(rename);
 		REGISTER_STAT(write);
 		REGISTER_STAT(fsync);
+		REGISTER_STAT(flush);
 		REGISTER_STAT(setattr);
 		REGISTER_STAT64(write_bytes);
 	}
@@ -2165,6 +2354,12 @@ initialize_projection(struct iof_state *iof_state,
 	if (!fs_handle->lookup_pool)
 		D_GOTO(err, 0);
 
+	entry_t.init = lookup_path_entry_init;
+	fs_handle->lookup_path_pool = iof_pool_register(&fs_handle->pool,
+							&entry_t);
+	if (!fs_handle->lookup_path_pool)
+		D_GOTO(err, 0);
+
 	entry_t.init = mkdir_entry_init;
 	fs_handle->mkdir_pool = iof_pool_register(&fs_handle->pool, &entry_t);
 	if (!fs_handle->mkdir_pool)
@@ -2179,17 +2374,43 @@ initialize_projection(struct iof_state *iof_state,
 	if (!fs_handle->fh_pool)
 		D_GOTO(err, 0);
 
-	fs_handle->rb_pool_page = iof_pool_register(&fs_handle->pool, &rb_page);
-	if (!fs_handle->rb_pool_page)
-		D_GOTO(err, 0);
+	/* Read and write buffers are pooled by size class, with the high
+	 * water mark of buffers in use from each class reported in the pools
+	 * directory.
+	 */
+	cb->create_ctrl_subdir(fs_handle->fs_dir, "pools", &pools_dir);
 
-	fs_handle->rb_pool_large = iof_pool_register(&fs_handle->pool, &rb_large);
-	if (!fs_handle->rb_pool_large)
-		D_GOTO(err, 0);
+	fs_handle->rb_classes = pool_classes_init(fs_handle->rb_pool,
+						  fs_handle->max_read);
+	for (i = 0; i < fs_handle->rb_classes; i++) {
+		struct ioc_pool_class *class = &fs_handle->rb_pool[i];
 
-	fs_handle->write_pool = iof_pool_register(&fs_handle->pool, &wb);
-	if (!fs_handle->write_pool)
-		D_GOTO(err, 0);
+		rb.init = rb_class_init[i];
+		pool_class_limits(&rb, class->size);
+		class->pt = iof_pool_register(&fs_handle->pool, &rb);
+		if (!class->pt)
+			D_GOTO(err, 0);
+
+		snprintf(name, NAME_MAX, "read_%zu", class->size);
+		cb->register_ctrl_variable(pools_dir, name, iof_uint_read,
+					   NULL, NULL, &class->pt->in_use_hwm);
+	}
+
+	fs_handle->wb_classes = pool_classes_init(fs_handle->wb_pool,
+						  fs_handle->proj.max_write);
+	for (i = 0; i < fs_handle->wb_classes; i++) {
+		struct ioc_pool_class *class = &fs_handle->wb_pool[i];
+
+		wb.init = wb_class_init[i];
+		pool_class_limits(&wb, class->size);
+		class->pt = iof_pool_register(&fs_handle->pool, &wb);
+		if (!class->pt)
+			D_GOTO(err, 0);
+
+		snprintf(name, NAME_MAX, "write_%zu", class->size);
+		cb->register_ctrl_variable(pools_dir, name, iof_uint_read,
+					   NULL, NULL, &class->pt->in_use_hwm);
+	}
 
 	if (!cb->register_fuse_fs(cb->handle,
 				  NULL,
@@ -2208,6 +2429,8 @@ initialize_projection(struct iof_state *iof_state,
 	IOF_TRACE_DEBUG(fs_handle, "Fuse mount installed at: '%s'",
 			fs_handle->mnt_dir.name);
 
+	ioc_watch_start(fs_handle);
+
 	d_list_add_tail(&fs_handle->link, &iof_state->fs_list);
 
 	return true;
@@ -2224,8 +2447,10 @@ query_projections(struct iof_state *iof_state,
 		  int *total, int *active)
 {
 	struct iof_fs_info *tmp;
+	struct iof_fs_ext *ext = NULL;
 	crt_rpc_t *query_rpc = NULL;
 	struct iof_psr_query *query;
+	crt_opcode_t opc = QUERY_EXT_OP;
 	int rc;
 	int i;
 
@@ -2239,7 +2464,15 @@ query_projections(struct iof_state *iof_state,
 	 * server side-state or RPCs created at this point.
 	 */
 	do {
-		rc = get_info(iof_state, group, &query_rpc);
+		rc = get_info(iof_state, group, opc, &query_rpc);
+
+		/* Older IONSS only support the original query */
+		if (rc == -DER_UNREG && opc == QUERY_EXT_OP) {
+			IOF_TRACE_INFO(iof_state,
+				       "Extended query not supported");
+			opc = QUERY_PSR_OP;
+			continue;
+		}
 
 		if (rc == -DER_OOG || rc == -DER_EVICTED) {
 			d_rank_list_t *psr_list = NULL;
@@ -2275,11 +2508,28 @@ query_projections(struct iof_state *iof_state,
 	query = crt_reply_get(query_rpc);
 
 	iof_state->iof_ctx.poll_interval = query->poll_interval;
-	iof_state->iof_ctx.callback_fn = query->progress_callback ?
-					 iof_check_complete : NULL;
+
+	/* The original reply has no further fields, so use the defaults for
+	 * an IONSS which does not support the extended query.
+	 */
+	if (opc == QUERY_EXT_OP) {
+		iof_state->iof_ctx.callback_fn = query->progress_callback ?
+						 iof_check_complete : NULL;
+		group->grp.ctx_count = query->ctx_count ? query->ctx_count : 1;
+		group->grp.proto_version = query->proto_version;
+	} else {
+		iof_state->iof_ctx.callback_fn = NULL;
+		group->grp.ctx_count = 1;
+		group->grp.proto_version = 0;
+	}
+
 	IOF_TRACE_INFO(iof_state, "Poll Interval: %u microseconds; "
-				  "Progress Callback: %s", query->poll_interval,
-		       query->progress_callback ? "Enabled" : "Disabled");
+				  "Progress Callback: %s",
+		       iof_state->iof_ctx.poll_interval,
+		       iof_state->iof_ctx.callback_fn ? "Enabled" : "Disabled");
+	IOF_TRACE_INFO(iof_state, "IONSS contexts: %u", group->grp.ctx_count);
+	IOF_TRACE_INFO(iof_state, "IONSS protocol version: %u",
+		       group->grp.proto_version);
 
 	if (query->count != query->query_list.iov_len / sizeof(struct iof_fs_info)) {
 		IOF_TRACE_ERROR(iof_state,
@@ -2292,8 +2542,20 @@ query_projections(struct iof_state *iof_state,
 
 	tmp = query->query_list.iov_buf;
 
+	if (opc == QUERY_EXT_OP) {
+		if (query->fs_ext.iov_len !=
+		    query->count * sizeof(struct iof_fs_ext)) {
+			IOF_TRACE_ERROR(iof_state,
+					"Invalid response from IONSS %d",
+					query->count);
+			return false;
+		}
+		ext = query->fs_ext.iov_buf;
+	}
+
 	for (i = 0; i < query->count; i++) {
-		if (!initialize_projection(iof_state, group, &tmp[i], query,
+		if (!initialize_projection(iof_state, group, &tmp[i],
+					   ext ? &ext[i] : NULL, query,
 					   (*total)++)) {
 			IOF_TRACE_ERROR(iof_state,
 					"Could not initialize projection '%s' from %s",
@@ -2405,10 +2667,8 @@ ino_flush(d_list_t *rlink, void *arg)
 	return -DER_SUCCESS;
 }
 
-/* Called once per projection, before the FUSE filesystem has been torn down */
-static void iof_flush_fuse(void *arg)
+void ioc_flush_inodes(struct iof_projection_info *fs_handle)
 {
-	struct iof_projection_info *fs_handle = arg;
 	int rc;
 
 	IOF_TRACE_INFO(fs_handle, "Flushing inode table");
@@ -2419,6 +2679,16 @@ static void iof_flush_fuse(void *arg)
 	IOF_TRACE_INFO(fs_handle, "Flush complete: %d", rc);
 }
 
+/* Called once per projection, before the FUSE filesystem has been torn down */
+static void iof_flush_fuse(void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+
+	ioc_watch_stop(fs_handle);
+
+	ioc_flush_inodes(fs_handle);
+}
+
 /* Called once per projection, after the FUSE filesystem has been torn down */
 static int iof_deregister_fuse(void *arg)
 {
@@ -2431,6 +2701,14 @@ static int iof_deregister_fuse(void *arg)
 	int rc;
 	int rcp = 0;
 
+	/* The watch thread should have been stopped already by
+	 * iof_flush_fuse(), this is a no-op if so.
+	 */
+	ioc_watch_stop(fs_handle);
+
+	/* Drop any references held by the name cache first */
+	ioc_nc_drop(fs_handle, 0, NULL);
+
 	IOF_TRACE_INFO(fs_handle, "Draining inode table");
 	do {
 		struct ioc_inode_entry *ie;
@@ -2499,6 +2777,14 @@ static int iof_deregister_fuse(void *arg)
 		rcp = rc;
 	}
 
+	rc = pthread_mutex_destroy(&fs_handle->nc_lock);
+	if (rc != 0) {
+		IOF_TRACE_ERROR(fs_handle,
+				"Failed to destroy lock %d %s",
+				rc, strerror(rc));
+		rcp = rc;
+	}
+
 	rc = pthread_mutex_destroy(&fs_handle->of_lock);
 	if (rc != 0) {
 		IOF_TRACE_ERROR(fs_handle,
@@ -2515,6 +2801,15 @@ static int iof_deregister_fuse(void *arg)
 		rcp = rc;
 	}
 
+	rc = pthread_mutex_destroy(&fs_handle->watch_lock);
+	if (rc != 0) {
+		IOF_TRACE_ERROR(fs_handle,
+				"Failed to destroy lock %d %s",
+				rc, strerror(rc));
+		rcp = rc;
+	}
+	pthread_cond_destroy(&fs_handle->watch_cond);
+
 	rc = pthread_mutex_destroy(&fs_handle->p_request_lock);
 	if (rc != 0) {
 		IOF_TRACE_ERROR(fs_handle,
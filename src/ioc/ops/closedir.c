@@ -83,6 +83,8 @@ void ioc_releasedir_priv(fuse_req_t req, struct iof_dir_handle *dh)
 	d_list_del(&dh->dh_od_list);
 	D_MUTEX_UNLOCK(&fs_handle->od_lock);
 
+	ioc_readdir_release(dh);
+
 	IOC_REQ_INIT_LL(dh, fs_handle, api, in, req, rc);
 	if (rc)
 		D_GOTO(err, rc);
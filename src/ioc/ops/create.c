@@ -72,9 +72,12 @@ ioc_create_ll_cb(const struct crt_cb_info *cb_info)
 	memcpy(&entry.attr, &out->stat, sizeof(struct stat));
 	entry.generation = 1;
 	entry.ino = entry.attr.st_ino;
+	IOC_ENTRY_TIMEOUTS(handle->fs_handle, entry);
 
 	fi.fh = (uint64_t)handle;
 	handle->common.gah = out->gah;
+	handle->common.ep.ep_tag = iof_gah_tag(handle->fs_handle->proj.grp,
+					       &out->gah);
 	H_GAH_SET_VALID(handle);
 	handle->inode_no = entry.ino;
 
@@ -125,6 +128,8 @@ ioc_create_ll_cb(const struct crt_cb_info *cb_info)
 		ie_close(handle->fs_handle, handle->ie);
 	}
 
+	ioc_fh_ino_add(handle);
+
 	IOF_FUSE_REPLY_CREATE(req, entry, fi);
 	return;
 
@@ -202,7 +207,7 @@ void ioc_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 
 	strncpy(in->common.name.name, name, NAME_MAX);
 	in->mode = mode;
-	in->flags = fi->flags;
+	in->flags = IOC_OPEN_FLAGS(fs_handle, fi->flags);
 
 	strncpy(handle->ie->name, name, NAME_MAX);
 	handle->ie->parent = parent;
@@ -69,6 +69,10 @@ ioc_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
 	if (!F_GAH_IS_VALID(handle))
 		D_GOTO(out, rc = EIO);
 
+	rc = ioc_wb_sync_ino(fs_handle, ino, handle, true);
+	if (rc)
+		D_GOTO(out, rc);
+
 	if (datasync)
 		opcode = FS_TO_OP(fs_handle, fdatasync);
 	else
@@ -66,15 +66,54 @@ handle_gah_ioctl(int cmd, struct iof_file_handle *handle,
 	gah_info->cli_fs_id = handle->fs_handle->proj.cli_fs_id;
 }
 
+/* Resolve a path relative to a directory.  This is the only ioctl which
+ * is supported on directories.
+ */
+static void
+handle_lookup_path_ioctl(fuse_req_t req, struct iof_projection_info *fs_handle,
+			 fuse_ino_t ino, const void *in_buf, size_t in_bufsz)
+{
+	const struct iof_lookup_path_info *info = in_buf;
+	char path[IOF_IOCTL_PATH_LEN];
+
+	if (in_bufsz < sizeof(*info) || info->version != IOF_IOCTL_VERSION) {
+		IOF_FUSE_REPLY_ERR(req, EINVAL);
+		return;
+	}
+
+	strncpy(path, info->path, sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+
+	ioc_lookup_path(req, fs_handle, ino, path);
+}
+
 void ioc_ll_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
 		  struct fuse_file_info *fi, unsigned int flags,
 		  const void *in_buf, size_t in_bufsz, size_t out_bufsz)
 {
-	struct iof_file_handle *handle = (void *)fi->fh;
-	struct iof_projection_info *fs_handle = handle->fs_handle;
+	struct iof_projection_info *fs_handle = fuse_req_userdata(req);
+	struct iof_file_handle *handle;
 	struct iof_gah_info gah_info = {0};
 	int ret = EIO;
 
+	if (flags & FUSE_IOCTL_DIR) {
+		IOF_TRACE_UP(req, fs_handle, "ioctl_fuse_req");
+		IOF_TRACE_INFO(req, "dir ioctl cmd=%#x ino %lu", cmd, ino);
+
+		STAT_ADD(fs_handle->stats, ioctl);
+
+		if (FS_IS_OFFLINE(fs_handle))
+			D_GOTO(out_err, ret = fs_handle->offline_reason);
+
+		if (cmd != IOF_IOCTL_LOOKUP_PATH)
+			D_GOTO(out_err, ret = ENOTTY);
+
+		handle_lookup_path_ioctl(req, fs_handle, ino, in_buf, in_bufsz);
+		return;
+	}
+
+	handle = (void *)fi->fh;
+
 	IOF_TRACE_UP(req, handle, "ioctl_fuse_req");
 
 	IOF_TRACE_INFO(req, "ioctl cmd=%#x " GAH_PRINT_STR, cmd,
@@ -62,6 +62,7 @@ void iof_entry_cb(struct ioc_request *request)
 	entry.attr = out->stat;
 	entry.generation = 1;
 	entry.ino = entry.attr.st_ino;
+	IOC_ENTRY_TIMEOUTS(fs_handle, entry);
 
 	desc->ie->gah = out->gah;
 	desc->ie->stat = out->stat;
@@ -95,6 +96,31 @@ out:
 	iof_pool_release(desc->pool, desc);
 }
 
+/* As iof_entry_cb(), but if the entry does not exist and negative caching is
+ * enabled then reply with a zero inode number, which the kernel caches as a
+ * negative entry for negative_timeout.
+ */
+static void
+lookup_cb(struct ioc_request *request)
+{
+	struct TYPE_NAME		*desc = CONTAINER(request);
+	struct iof_projection_info	*fs_handle = desc->request.fsh;
+	struct iof_entry_out		*out = crt_reply_get(request->rpc);
+	struct fuse_entry_param		entry = {0};
+
+	IOC_REQUEST_RESOLVE(request, out);
+	if (request->rc != ENOENT || fs_handle->negative_timeout == 0) {
+		iof_entry_cb(request);
+		return;
+	}
+
+	STAT_ADD(fs_handle->stats, lookup_negative);
+	entry.entry_timeout = fs_handle->negative_timeout;
+	drop_ino_ref(fs_handle, desc->ie->parent);
+	IOF_FUSE_REPLY_ENTRY(request->req, entry);
+	iof_pool_release(desc->pool, desc);
+}
+
 static int
 lookup_presend(struct ioc_request *request)
 {
@@ -126,7 +152,7 @@ out:
 
 static const struct ioc_request_api api = {
 	.on_send	= post_send,
-	.on_result	= iof_entry_cb,
+	.on_result	= lookup_cb,
 	.on_evict	= ioc_simple_resend,
 	.on_presend	= lookup_presend,
 };
@@ -139,9 +165,30 @@ ioc_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	struct iof_projection_info	*fs_handle = fuse_req_userdata(req);
 	struct TYPE_NAME		*desc = NULL;
 	struct iof_gah_string_in	*in;
+	struct ioc_inode_entry		*ie;
 	int rc;
 
 	IOF_TRACE_INFO(req, "Parent:%lu '%s'", parent, name);
+
+	/* Check for a name resolved by a previous lookup_path RPC, in which
+	 * case the reference held by the cache is passed to the kernel.
+	 */
+	ie = ioc_nc_take(fs_handle, parent, name);
+	if (ie) {
+		struct fuse_entry_param entry = {0};
+
+		STAT_ADD(fs_handle->stats, lookup_cached);
+		IOF_TRACE_UP(req, fs_handle, "lookup_fuse_req");
+		IOF_TRACE_INFO(req, "Cached %lu " GAH_PRINT_STR,
+			       ie->stat.st_ino, GAH_PRINT_VAL(ie->gah));
+		entry.attr = ie->stat;
+		entry.generation = 1;
+		entry.ino = entry.attr.st_ino;
+		IOC_ENTRY_TIMEOUTS(fs_handle, entry);
+		IOF_FUSE_REPLY_ENTRY(req, entry);
+		return;
+	}
+
 	IOC_REQ_INIT_LL(desc, fs_handle, api, in, req, rc);
 	if (rc)
 		D_GOTO(err, rc);
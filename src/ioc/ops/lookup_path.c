@@ -0,0 +1,254 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+#include "iof_ioctl.h"
+
+#define REQ_NAME request
+#define POOL_NAME lookup_path_pool
+#define TYPE_NAME entry_req
+#define RESTOCK_ON_SEND
+#include "ioc_ops.h"
+
+#define STAT_KEY lookup_path
+
+/* Release the GAHs of components which were returned by the IONSS but not
+ * added to the inode table, so that the IONSS does not hold them forever.
+ */
+static void
+lookup_path_release(struct iof_projection_info *fs_handle,
+		    struct iof_path_entry *entries, int start, int count)
+{
+	struct ioc_inode_entry	ie = {0};
+	int			i;
+
+	D_INIT_LIST_HEAD(&ie.ie_fh_list);
+	D_INIT_LIST_HEAD(&ie.ie_ie_children);
+	D_INIT_LIST_HEAD(&ie.ie_ie_list);
+
+	for (i = start; i < count; i++) {
+		ie.gah = entries[i].gah;
+		ie.stat = entries[i].stat;
+		H_GAH_SET_VALID(&ie);
+		ie_close(fs_handle, &ie);
+	}
+}
+
+/* Add the components resolved by the IONSS to the inode table and the name
+ * cache.
+ *
+ * The name cache entry for each component holds the reference which would
+ * have been taken by a kernel lookup, and every new inode holds a reference
+ * on its parent, as with normal lookups.  The reference on the starting
+ * directory taken by ioc_lookup_path() is used for the first component.
+ */
+static void
+lookup_path_cb(struct ioc_request *request)
+{
+	struct entry_req		*desc = CONTAINER(request);
+	struct iof_projection_info	*fs_handle = request->fsh;
+	struct iof_lookup_path_out	*out = crt_reply_get(request->rpc);
+	struct iof_path_entry		*entries;
+	struct ioc_inode_entry		*ie;
+	d_list_t			*rlink;
+	fuse_ino_t			parent;
+	char				*name;
+	char				*saveptr = NULL;
+	int				count = 0;
+	int				i = 0;
+	int				rc;
+
+	if (request->ir_ht == RHS_ROOT)
+		parent = 1;
+	else
+		parent = request->ir_inode->stat.st_ino;
+
+	IOC_REQUEST_RESOLVE(request, out);
+	if (request->rc)
+		D_GOTO(out, 0);
+
+	entries = out->entries.iov_buf;
+	count = out->entries.iov_len / sizeof(*entries);
+
+	for (name = strtok_r(desc->dest, "/", &saveptr);
+	     name && i < count;
+	     name = strtok_r(NULL, "/", &saveptr), i++) {
+		D_ALLOC_PTR(ie);
+		if (!ie)
+			break;
+		atomic_fetch_add(&ie->ie_ref, 1);
+
+		ie->gah = entries[i].gah;
+		ie->stat = entries[i].stat;
+		strncpy(ie->name, name, NAME_MAX);
+		ie->parent = parent;
+		D_INIT_LIST_HEAD(&ie->ie_fh_list);
+		D_INIT_LIST_HEAD(&ie->ie_ie_children);
+		D_INIT_LIST_HEAD(&ie->ie_ie_list);
+		H_GAH_SET_VALID(ie);
+
+		rlink = d_hash_rec_find_insert(&fs_handle->inode_ht,
+					       &ie->stat.st_ino,
+					       sizeof(ie->stat.st_ino),
+					       &ie->ie_htl);
+		if (rlink != &ie->ie_htl) {
+			IOF_TRACE_DEBUG(request, "Existing inode %lu '%s'",
+					ie->stat.st_ino, name);
+			drop_ino_ref(fs_handle, parent);
+			ie_close(fs_handle, ie);
+			D_FREE(ie);
+			ie = container_of(rlink, struct ioc_inode_entry,
+					  ie_htl);
+		}
+
+		/* Take the reference for the next component before passing
+		 * this one to the name cache.
+		 */
+		if (i + 1 < count)
+			d_hash_rec_addref(&fs_handle->inode_ht, rlink);
+
+		ioc_nc_add(fs_handle, parent, name, ie);
+		parent = entries[i].stat.st_ino;
+	}
+
+	if (i < count) {
+		IOF_TRACE_ERROR(request, "Only cached %d of %d entries",
+				i, count);
+		lookup_path_release(fs_handle, entries, i, count);
+	}
+
+	IOF_TRACE_INFO(request, "Cached %d components", i);
+
+out:
+	/* Drop the reference held for the next component, if unused */
+	if (i < count || count == 0 || request->rc)
+		drop_ino_ref(fs_handle, parent);
+
+	if (request->rc) {
+		IOF_FUSE_REPLY_ERR(request->req, request->rc);
+	} else {
+		rc = fuse_reply_ioctl(request->req, i, NULL, 0);
+		if (rc != 0)
+			IOF_TRACE_ERROR(request->req,
+					"fuse_reply_ioctl returned %d:%s",
+					rc, strerror(-rc));
+		IOF_TRACE_DOWN(request->req);
+	}
+	iof_pool_release(desc->pool, desc);
+}
+
+static int
+lookup_path_presend(struct ioc_request *request)
+{
+	struct iof_lookup_path_in *in = crt_req_get(request->rpc);
+	int rc = 0;
+
+	D_MUTEX_LOCK(&request->fsh->gah_lock);
+
+	if (request->ir_ht == RHS_ROOT) {
+		in->gah = request->fsh->gah;
+	} else {
+		D_ASSERT(request->ir_ht == RHS_INODE);
+		if (!H_GAH_IS_VALID(request->ir_inode))
+			D_GOTO(out, rc = EHOSTDOWN);
+
+		in->gah = request->ir_inode->gah;
+	}
+
+	IOF_TRACE_DEBUG(request, GAH_PRINT_STR, GAH_PRINT_VAL(in->gah));
+
+out:
+	D_MUTEX_UNLOCK(&request->fsh->gah_lock);
+
+	return rc;
+}
+
+static const struct ioc_request_api api = {
+	.on_send	= post_send,
+	.on_result	= lookup_path_cb,
+	.on_presend	= lookup_path_presend,
+};
+
+void
+ioc_lookup_path(fuse_req_t req, struct iof_projection_info *fs_handle,
+		fuse_ino_t ino, const char *path)
+{
+	struct TYPE_NAME		*desc = NULL;
+	struct iof_lookup_path_in	*in;
+	int rc;
+
+	IOF_TRACE_INFO(req, "Dir:%lu '%s'", ino, path);
+
+	if (fs_handle->proj.grp->proto_version < IOF_LOOKUP_PATH_VERSION)
+		D_GOTO(err, rc = ENOTSUP);
+
+	IOC_REQ_INIT_LL(desc, fs_handle, api, in, req, rc);
+	if (rc)
+		D_GOTO(err, rc);
+
+	if (ino == 1) {
+		desc->request.ir_ht = RHS_ROOT;
+	} else {
+		rc = find_inode(fs_handle, ino, &desc->request.ir_inode);
+		if (rc != 0)
+			D_GOTO(err, 0);
+
+		desc->request.ir_ht = RHS_INODE;
+	}
+
+	desc->pool = fs_handle->lookup_path_pool;
+
+	D_STRNDUP(desc->dest, path, IOF_IOCTL_PATH_LEN);
+	if (!desc->dest)
+		D_GOTO(release, rc = ENOMEM);
+	in->path = desc->dest;
+
+	rc = iof_fs_send(&desc->request);
+	if (rc != 0)
+		D_GOTO(release, 0);
+	return;
+
+release:
+	drop_ino_ref(fs_handle, ino);
+err:
+	if (desc)
+		iof_pool_release(fs_handle->lookup_path_pool, desc);
+	IOF_FUSE_REPLY_ERR(req, rc);
+}
@@ -70,7 +70,10 @@ ioc_open_ll_cb(const struct crt_cb_info *cb_info)
 
 	fi.fh = (uint64_t)handle;
 	handle->common.gah = out->gah;
+	handle->common.ep.ep_tag = iof_gah_tag(handle->fs_handle->proj.grp,
+					       &out->gah);
 	H_GAH_SET_VALID(handle);
+	ioc_fh_ino_add(handle);
 	D_MUTEX_LOCK(&handle->fs_handle->of_lock);
 	d_list_add_tail(&handle->fh_of_list, &handle->fs_handle->openfile_list);
 	D_MUTEX_UNLOCK(&handle->fs_handle->of_lock);
@@ -150,8 +153,8 @@ void ioc_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 	if (rc != 0)
 		D_GOTO(out_err, ret = rc);
 
-	in->flags = fi->flags;
-	IOF_TRACE_INFO(req, "flags 0%o", fi->flags);
+	in->flags = IOC_OPEN_FLAGS(fs_handle, fi->flags);
+	IOF_TRACE_INFO(req, "flags 0%o", in->flags);
 
 	crt_req_addref(handle->open_rpc);
 	rc = crt_req_send(handle->open_rpc, ioc_open_ll_cb, handle);
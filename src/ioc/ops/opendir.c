@@ -49,6 +49,72 @@
 
 #define STAT_KEY opendir
 
+/* Save the change token of a directory and return the previous one, or 0 if
+ * the directory has not been opened before.
+ */
+static uint64_t
+opendir_token_swap(struct iof_projection_info *fs_handle, fuse_ino_t ino,
+		   uint64_t token)
+{
+	struct ioc_inode_entry	*ie;
+	d_list_t		*rlink = NULL;
+	uint64_t		*last;
+	uint64_t		old;
+
+	if (ino == 1) {
+		last = &fs_handle->root_dir_token;
+	} else {
+		rlink = d_hash_rec_find(&fs_handle->inode_ht, &ino,
+					sizeof(ino));
+		if (!rlink)
+			return 0;
+		ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
+		last = &ie->dir_token;
+	}
+
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	old = *last;
+	*last = token;
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+
+	if (rlink)
+		d_hash_rec_decref(&fs_handle->inode_ht, rlink);
+
+	return old;
+}
+
+/* Allow the kernel to cache the contents of the directory if the projection
+ * is configured for it.  Cached contents are kept only if the directory is
+ * unchanged since the last open, otherwise they are invalidated along with
+ * the cached attributes.
+ */
+static void
+opendir_set_cache(struct iof_dir_handle *dh, uint64_t token,
+		  struct fuse_file_info *fi)
+{
+	struct iof_projection_info *fs_handle = dh->open_req.fsh;
+	uint64_t old;
+	int rc;
+
+	if (!(fs_handle->flags & IOF_CACHE_READDIR) || token == 0)
+		return;
+
+	old = opendir_token_swap(fs_handle, dh->inode_no, token);
+
+	fi->cache_readdir = 1;
+	fi->keep_cache = (old == token);
+
+	if (old == 0 || old == token)
+		return;
+
+	IOF_TRACE_DEBUG(dh, "Directory changed, invalidating %lu",
+			dh->inode_no);
+	rc = fuse_lowlevel_notify_inval_inode(fs_handle->session, dh->inode_no,
+					      0, 0);
+	if (rc != 0)
+		IOF_TRACE_WARNING(dh, "inval_inode returned %d", rc);
+}
+
 static void
 opendir_ll_cb(struct ioc_request *request)
 {
@@ -58,6 +124,10 @@ opendir_ll_cb(struct ioc_request *request)
 
 	IOC_REQUEST_RESOLVE(request, out);
 	if (request->rc == 0) {
+		/* Only the reply to opendir_token carries the token */
+		if (request->rpc->cr_opc ==
+		    FS_TO_OP(dh->open_req.fsh, opendir_token))
+			opendir_set_cache(dh, out->token, &fi);
 		dh->gah = out->gah;
 		H_GAH_SET_VALID(dh);
 		dh->handle_valid = 1;
@@ -41,6 +41,486 @@
 #include "log.h"
 #include "ios_gah.h"
 
+/* Reply to a read with data.
+ *
+ * It's not clear without benchmarking which approach is better here,
+ * fuse_reply_buf() is a small wrapper around writev() which is a much shorter
+ * code-path however fuse_reply_data() attempts to use splice which may well be
+ * faster.
+ *
+ * For now it's easy to pick between them, and both of them are passing
+ * valgrind tests.
+ */
+static void
+read_reply(struct iof_projection_info *fs_handle, void *trace, fuse_req_t req,
+	   struct fuse_bufvec *fbuf, void *buff, size_t len)
+{
+	int rc;
+
+	STAT_ADD_COUNT(fs_handle->stats, read_bytes, len);
+
+	if (fs_handle->flags & IOF_FUSE_READ_BUF) {
+		rc = fuse_reply_buf(req, buff, len);
+		if (rc != 0)
+			IOF_TRACE_ERROR(trace, "fuse_reply_buf returned %d:%s",
+					rc, strerror(-rc));
+	} else {
+		fbuf->buf[0].size = len;
+		fbuf->buf[0].mem = buff;
+		rc = fuse_reply_data(req, fbuf, 0);
+		if (rc != 0)
+			IOF_TRACE_ERROR(trace, "fuse_reply_data returned %d:%s",
+					rc, strerror(-rc));
+	}
+}
+
+/* Readahead.
+ *
+ * Once IOC_RA_STREAK consecutive reads of a file handle have been sequential
+ * the client starts fetching blocks of max_read bytes beyond the furthest read
+ * and serves later reads from them, either directly if the block has already
+ * arrived or by queueing the read on the block if it's still in flight.
+ *
+ * The number of blocks kept in flight is sized from the time a block takes to
+ * arrive and the rate the application is consuming data, so that a reader
+ * which keeps up with the network never has to wait for a round trip, capped
+ * at IOC_RA_MAX blocks.  Any non-sequential read or a write through the handle
+ * discards the prefetched data.
+ *
+ * Blocks are reference counted, the list holds one reference, a RPC in flight
+ * holds another and each reply being sent from the block holds one, the last
+ * reference returns the buffer to the pool.  All fields other than the data
+ * buffer are protected by the readahead lock of the file handle.
+ */
+#define IOC_RA_STREAK 2
+#define IOC_RA_MAX 8
+
+struct ioc_ra_waiter {
+	d_list_t			list;
+	fuse_req_t			req;
+	off_t				offset;
+	size_t				len;
+};
+
+struct ioc_ra_block {
+	d_list_t			list;
+	struct iof_file_handle		*handle;
+	struct iof_rb			*rb;
+	/** Reads waiting for the block to arrive */
+	d_list_t			waiters;
+	off_t				offset;
+	size_t				len;
+	/** Number of bytes read, valid once done is set */
+	size_t				bytes;
+	uint64_t			start;
+	int				ref;
+	int				rc;
+	bool				done;
+};
+
+static uint64_t
+ra_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Exponentially weighted moving average, 1/8 weight to new samples */
+static uint64_t
+ra_ewma(uint64_t avg, uint64_t sample)
+{
+	if (avg == 0)
+		return sample;
+	return (avg * 7 + sample) / 8;
+}
+
+/* Drop a reference on a block, called with the readahead lock held */
+static void
+ra_block_put(struct ioc_ra_block *block)
+{
+	if (--block->ref > 0)
+		return;
+
+	if (block->rc)
+		block->rb->failure = true;
+	iof_pool_release(block->rb->pt, block->rb);
+	D_FREE(block);
+}
+
+/* Remove a block from the list, called with the readahead lock held */
+static void
+ra_block_drop(struct ioc_ra_block *block)
+{
+	d_list_del_init(&block->list);
+	ra_block_put(block);
+}
+
+/* Update the count of handles holding readahead blocks, called with the
+ * readahead lock held.  Handles are counted before the first prefetch is sent
+ * so that a write which completes after it always invalidates.
+ */
+static void
+ra_set_active(struct iof_file_handle *handle, bool active)
+{
+	struct ioc_readahead *ra = &handle->ra;
+
+	if (ra->active == active)
+		return;
+
+	ra->active = active;
+	if (active)
+		atomic_fetch_add(&handle->fs_handle->ra_active, 1);
+	else
+		atomic_fetch_sub(&handle->fs_handle->ra_active, 1);
+}
+
+static void
+ra_drop_all(struct ioc_readahead *ra)
+{
+	struct ioc_ra_block *block, *next;
+
+	d_list_for_each_entry_safe(block, next, &ra->blocks, list)
+		ra_block_drop(block);
+	ra->fetch_offset = 0;
+	ra->eof = false;
+}
+
+/* Reply to a read from a block which has arrived, called without the
+ * readahead lock but with a reference held on the block.
+ */
+static void
+ra_serve(struct ioc_ra_block *block, fuse_req_t req, off_t offset, size_t len)
+{
+	struct iof_file_handle *handle = block->handle;
+	struct fuse_bufvec fbuf = {0};
+	size_t skip = offset - block->offset;
+	size_t avail = 0;
+
+	if (block->rc) {
+		IOC_REPLY_ERR_RAW(handle, req, block->rc);
+		return;
+	}
+
+	if (block->bytes > skip)
+		avail = block->bytes - skip;
+	if (len > avail)
+		len = avail;
+
+	fbuf.count = 1;
+	fbuf.buf[0].fd = -1;
+	read_reply(handle->fs_handle, handle, req, &fbuf,
+		   (char *)block->rb->lb.buf + skip, len);
+}
+
+static void
+ra_cb(const struct crt_cb_info *cb_info)
+{
+	struct ioc_ra_block *block = cb_info->cci_arg;
+	struct iof_file_handle *handle = block->handle;
+	struct ioc_readahead *ra = &handle->ra;
+	struct iof_readx_out *out = crt_reply_get(cb_info->cci_rpc);
+	struct ioc_ra_waiter *waiter, *next;
+	d_list_t waiters;
+	size_t bytes = 0;
+	int rc = 0;
+
+	if (cb_info->cci_rc != 0) {
+		IOF_TRACE_INFO(block->rb, "Bad RPC reply %d", cb_info->cci_rc);
+		D_GOTO(out, rc = EIO);
+	}
+
+	if (out->err) {
+		IOF_TRACE_ERROR(block->rb, "Error from target %d", out->err);
+		if (out->err == -DER_NONEXIST)
+			H_GAH_SET_INVALID(handle);
+		D_GOTO(out, rc = EIO);
+	}
+
+	if (out->rc)
+		D_GOTO(out, rc = out->rc);
+
+	if (out->iov_len > 0) {
+		if (out->data.iov_len != out->iov_len ||
+		    out->iov_len > block->len)
+			D_GOTO(out, rc = EIO);
+		memcpy(block->rb->lb.buf, out->data.iov_buf, out->iov_len);
+		bytes = out->iov_len;
+	} else if (out->bulk_len > 0) {
+		bytes = out->bulk_len;
+	}
+
+out:
+	D_INIT_LIST_HEAD(&waiters);
+
+	D_MUTEX_LOCK(&ra->lock);
+	block->rc = rc;
+	block->bytes = bytes;
+	block->done = true;
+	ra->rtt = ra_ewma(ra->rtt, ra_now() - block->start);
+	if (rc || bytes < block->len)
+		ra->eof = true;
+	d_list_splice_init(&block->waiters, &waiters);
+	D_MUTEX_UNLOCK(&ra->lock);
+
+	d_list_for_each_entry_safe(waiter, next, &waiters, list) {
+		ra_serve(block, waiter->req, waiter->offset, waiter->len);
+		d_list_del(&waiter->list);
+		D_FREE(waiter);
+	}
+
+	D_MUTEX_LOCK(&ra->lock);
+	ra_block_put(block);
+	if (--ra->inflight == 0)
+		pthread_cond_broadcast(&ra->cond);
+	D_MUTEX_UNLOCK(&ra->lock);
+}
+
+/* Send a prefetch for the block at offset, called with the readahead lock
+ * held.
+ */
+static int
+ra_fetch_block(struct iof_file_handle *handle, off_t offset)
+{
+	struct iof_projection_info *fs_handle = handle->fs_handle;
+	struct ioc_readahead *ra = &handle->ra;
+	struct ioc_ra_block *block;
+	struct iof_readx_in *in;
+	struct iof_rb *rb;
+	int rc;
+
+	rb = ioc_rb_acquire(fs_handle, fs_handle->max_read);
+	if (!rb)
+		return ENOMEM;
+
+	D_ALLOC_PTR(block);
+	if (!block) {
+		iof_pool_release(rb->pt, rb);
+		return ENOMEM;
+	}
+	IOF_TRACE_UP(rb, handle, "readahead");
+
+	rb->req = NULL;
+	rb->handle = handle;
+
+	D_INIT_LIST_HEAD(&block->waiters);
+	block->handle = handle;
+	block->rb = rb;
+	block->offset = offset;
+	block->len = rb->buf_size;
+	block->start = ra_now();
+	block->ref = 2;
+
+	rc = crt_req_set_endpoint(rb->rpc, &handle->common.ep);
+	if (rc)
+		D_GOTO(err, rc = EIO);
+
+	in = crt_req_get(rb->rpc);
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	in->gah = handle->common.gah;
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+	in->xtvec.xt_off = offset;
+	in->xtvec.xt_len = block->len;
+	in->data_bulk = rb->lb.handle;
+
+	ra_set_active(handle, true);
+
+	crt_req_addref(rb->rpc);
+	rc = crt_req_send(rb->rpc, ra_cb, block);
+	if (rc) {
+		crt_req_decref(rb->rpc);
+		D_GOTO(err, rc = EIO);
+	}
+
+	d_list_add_tail(&block->list, &ra->blocks);
+	ra->inflight++;
+	STAT_ADD(fs_handle->stats, ra_blocks);
+	return 0;
+
+err:
+	iof_pool_release(rb->pt, rb);
+	D_FREE(block);
+	return rc;
+}
+
+/* Keep the readahead window full, called with the readahead lock held */
+static void
+ra_fetch(struct iof_file_handle *handle, off_t from, size_t len)
+{
+	struct ioc_readahead *ra = &handle->ra;
+	struct ioc_ra_block *block;
+	uint64_t block_size = handle->fs_handle->max_read;
+	uint64_t window = 1;
+	uint64_t count = 0;
+
+	/* Enough blocks to cover one round trip at the current read rate */
+	if (ra->rtt && ra->gap)
+		window += (ra->rtt * len) / (ra->gap * block_size);
+	if (window > IOC_RA_MAX)
+		window = IOC_RA_MAX;
+
+	if (ra->fetch_offset < from)
+		ra->fetch_offset = from;
+
+	d_list_for_each_entry(block, &ra->blocks, list)
+		count++;
+
+	while (!ra->eof && count < window) {
+		if (ra_fetch_block(handle, ra->fetch_offset) != 0)
+			break;
+		ra->fetch_offset += block_size;
+		count++;
+	}
+}
+
+/* Try to serve a read from readahead, and start any new prefetches.
+ *
+ * Returns true if the request has been, or will be, replied to.
+ */
+static bool
+ra_read(struct iof_file_handle *handle, fuse_req_t req, size_t len,
+	off_t position)
+{
+	struct iof_projection_info *fs_handle = handle->fs_handle;
+	struct ioc_readahead *ra = &handle->ra;
+	struct ioc_ra_block *block, *next, *found = NULL;
+	struct ioc_ra_waiter *waiter;
+	bool serve = false;
+	uint64_t now = ra_now();
+	off_t end = position + len;
+
+	if (fs_handle->max_read == 0 || len > fs_handle->max_read)
+		return false;
+
+	D_MUTEX_LOCK(&ra->lock);
+
+	/* FUSE may issue concurrent reads slightly out of order so anything
+	 * within one block of the previous read counts as sequential.
+	 */
+	if (position + (off_t)fs_handle->max_read < ra->next_offset ||
+	    position > ra->next_offset + (off_t)fs_handle->max_read) {
+		if (ra->streak)
+			IOF_TRACE_DEBUG(handle, "Random access at %#zx",
+					position);
+		ra_drop_all(ra);
+		ra->streak = 0;
+		ra->gap = 0;
+	} else {
+		ra->streak++;
+		if (ra->last_read)
+			ra->gap = ra_ewma(ra->gap, now - ra->last_read);
+	}
+	ra->last_read = now;
+	if (end > ra->next_offset || ra->streak == 0)
+		ra->next_offset = end;
+
+	d_list_for_each_entry_safe(block, next, &ra->blocks, list) {
+		if ((off_t)(block->offset + block->len) <= position) {
+			ra_block_drop(block);
+			continue;
+		}
+		if (block->offset <= position &&
+		    end <= (off_t)(block->offset + block->len)) {
+			found = block;
+			break;
+		}
+	}
+
+	if (found) {
+		if (found->done) {
+			found->ref++;
+			serve = true;
+		} else {
+			D_ALLOC_PTR(waiter);
+			if (waiter) {
+				waiter->req = req;
+				waiter->offset = position;
+				waiter->len = len;
+				d_list_add_tail(&waiter->list,
+						&found->waiters);
+			} else {
+				found = NULL;
+			}
+		}
+	}
+
+	if (found) {
+		STAT_ADD(fs_handle->stats, ra_hit);
+		if (end >= (off_t)(found->offset + found->len))
+			ra_block_drop(found);
+	} else if (ra->streak >= IOC_RA_STREAK) {
+		STAT_ADD(fs_handle->stats, ra_miss);
+	}
+
+	if (ra->streak >= IOC_RA_STREAK)
+		ra_fetch(handle, end, len);
+
+	ra_set_active(handle, !d_list_empty(&ra->blocks));
+
+	D_MUTEX_UNLOCK(&ra->lock);
+
+	if (serve) {
+		ra_serve(found, req, position, len);
+		D_MUTEX_LOCK(&ra->lock);
+		ra_block_put(found);
+		D_MUTEX_UNLOCK(&ra->lock);
+	}
+
+	return found != NULL;
+}
+
+void
+ioc_ra_invalidate(struct iof_file_handle *handle)
+{
+	struct ioc_readahead *ra = &handle->ra;
+
+	D_MUTEX_LOCK(&ra->lock);
+	ra_drop_all(ra);
+	ra->streak = 0;
+	ra_set_active(handle, false);
+	D_MUTEX_UNLOCK(&ra->lock);
+}
+
+void
+ioc_ra_invalidate_ino(struct iof_projection_info *fs_handle, fuse_ino_t ino)
+{
+	struct ioc_inode_entry *ie;
+	struct iof_file_handle *fh;
+	d_list_t *rlink;
+
+	/* Nothing to drop if no file of the projection is being read ahead */
+	if (atomic_load_consume(&fs_handle->ra_active) == 0)
+		return;
+
+	rlink = d_hash_rec_find(&fs_handle->inode_ht, &ino, sizeof(ino));
+	if (!rlink)
+		return;
+
+	ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
+
+	D_MUTEX_LOCK(&fs_handle->of_lock);
+	d_list_for_each_entry(fh, &ie->ie_fh_list, fh_ino_list)
+		ioc_ra_invalidate(fh);
+	D_MUTEX_UNLOCK(&fs_handle->of_lock);
+
+	d_hash_rec_decref(&fs_handle->inode_ht, rlink);
+}
+
+void
+ioc_ra_fini(struct iof_file_handle *handle)
+{
+	struct ioc_readahead *ra = &handle->ra;
+
+	D_MUTEX_LOCK(&ra->lock);
+	ra_drop_all(ra);
+	ra->streak = 0;
+	ra_set_active(handle, false);
+	while (ra->inflight > 0)
+		pthread_cond_wait(&ra->cond, &ra->lock);
+	D_MUTEX_UNLOCK(&ra->lock);
+}
+
 static void
 read_bulk_cb(const struct crt_cb_info *cb_info)
 {
@@ -78,36 +558,11 @@ read_bulk_cb(const struct crt_cb_info *cb_info)
 	}
 
 out:
-	if (rc) {
+	if (rc)
 		IOC_REPLY_ERR_RAW(rb, rb->req, rc);
-	} else {
-		STAT_ADD_COUNT(rb->fs_handle->stats, read_bytes, bytes_read);
-
-		/* It's not clear without benchmarking which approach is better
-		 * here, fuse_reply_buf() is a small wrapper around writev()
-		 * which is a much shorter code-path however fuse_reply_data()
-		 * attempts to use splice which may well be faster.
-		 *
-		 * For now it's easy to pick between them, and both of them are
-		 * passing valgrind tests.
-		 */
-		if (rb->fs_handle->flags & IOF_FUSE_READ_BUF) {
-			rc = fuse_reply_buf(rb->req, buff, bytes_read);
-			if (rc != 0)
-				IOF_TRACE_ERROR(rb,
-						"fuse_reply_buf returned %d:%s",
-						rc, strerror(-rc));
-
-		} else {
-			rb->fbuf.buf[0].size = bytes_read;
-			rb->fbuf.buf[0].mem = buff;
-			rc = fuse_reply_data(rb->req, &rb->fbuf, 0);
-			if (rc != 0)
-				IOF_TRACE_ERROR(rb,
-						"fuse_reply_data returned %d:%s",
-						rc, strerror(-rc));
-		}
-	}
+	else
+		read_reply(rb->fs_handle, rb, rb->req, &rb->fbuf, buff,
+			   bytes_read);
 	iof_pool_release(rb->pt, rb);
 }
 
@@ -150,7 +605,6 @@ void ioc_ll_read(fuse_req_t req, fuse_ino_t ino, size_t len,
 {
 	struct iof_file_handle *handle = (void *)fi->fh;
 	struct iof_projection_info *fs_handle = handle->fs_handle;
-	struct iof_pool_type *pt;
 	struct iof_rb *rb = NULL;
 	int rc;
 
@@ -162,19 +616,23 @@ void ioc_ll_read(fuse_req_t req, fuse_ino_t ino, size_t len,
 	if (FS_IS_OFFLINE(fs_handle))
 		D_GOTO(out_err, rc = fs_handle->offline_reason);
 
-	if (len <= 4096)
-		pt = fs_handle->rb_pool_page;
-	else
-		pt = fs_handle->rb_pool_large;
+	/* Make sure any cached writes which overlap the read reach the IONSS
+	 * first.  Include the readahead window, as the read may start
+	 * prefetches of the following blocks.
+	 */
+	ioc_wb_sync_range(handle, position,
+			  len + IOC_RA_MAX * (size_t)fs_handle->max_read);
+
+	if (ra_read(handle, req, len, position))
+		return;
 
-	rb = iof_pool_acquire(pt);
+	rb = ioc_rb_acquire(fs_handle, len);
 	if (!rb)
 		D_GOTO(out_err, rc = ENOMEM);
 	IOF_TRACE_UP(rb, handle, "readbuf");
 
 	rb->req = req;
 	rb->handle = handle;
-	rb->pt = pt;
 
 	ioc_read_bulk(rb, len, position, handle);
 
@@ -41,84 +41,118 @@
 #include "log.h"
 #include "ios_gah.h"
 
-struct readdir_cb_r {
-	crt_rpc_t *rpc;
-	struct iof_tracker tracker;
-	int err;
-	struct iof_readdir_out *out;
-};
-
-/* The callback of the readdir RPC.
+/* A readdir RPC, either one which a FUSE request is waiting on, or a
+ * prefetch of the batch of entries following those currently held.
  *
- * All this function does is take a reference on the data and return.
+ * Readdir is asynchronous, if there are no entries available locally then
+ * the FUSE request is saved in the directory handle and completed from the
+ * RPC callback.  Whenever a batch is received the RPC for the following
+ * batch is sent, so that the kernel draining one batch overlaps with the
+ * transfer of the next.
  */
+struct iof_readdir_fetch {
+	struct iof_dir_handle	*dh;
+	crt_rpc_t		*rpc;
+	struct iof_tracker	tracker;
+	d_iov_t			iov;
+	crt_bulk_t		bulk;
+	off_t			offset;
+	int			err;
+	bool			plus;
+	bool			packed;
+	bool			done;
+};
+
+static void readdir_cb(const struct crt_cb_info *cb_info);
+
 static void
-readdir_cb(const struct crt_cb_info *cb_info)
+readdir_fetch_free(struct iof_readdir_fetch *fetch)
 {
-	struct readdir_cb_r *reply = cb_info->cci_arg;
+	int rc;
 
-	if (cb_info->cci_rc != 0) {
-		/* Error handling, as directory handles are stateful if there
-		 * is any error then we have to disable the local dir_handle
-		 *
-		 */
-		IOF_LOG_ERROR("Error from RPC %d", cb_info->cci_rc);
-		if (cb_info->cci_rc == -DER_EVICTED)
-			reply->err = EHOSTDOWN;
-		else
-			reply->err = EIO;
-		iof_tracker_signal(&reply->tracker);
-		return;
-	}
+	if (fetch->rpc)
+		crt_req_decref(fetch->rpc);
 
-	crt_req_addref(cb_info->cci_rpc);
+	if (fetch->bulk) {
+		rc = crt_bulk_free(fetch->bulk);
+		if (rc)
+			IOF_TRACE_WARNING(fetch->dh, "Failed to free bulk %d",
+					  rc);
+	}
 
-	reply->out = crt_reply_get(cb_info->cci_rpc);
-	reply->rpc = cb_info->cci_rpc;
-	iof_tracker_signal(&reply->tracker);
+	D_FREE(fetch->iov.iov_buf);
+	D_FREE(fetch);
 }
 
 /*
- * Send, and wait for a readdir() RPC.  Populate the dir_handle with the
- * replies, count and rpc which a reference is held on.
- *
- * If this function returns a non-zero status then that status is returned to
- * FUSE and the handle is marked as invalid.
+ * Send a readdir() RPC for entries from offset.  Called with rd_lock held,
+ * the RPC is saved as rd_fetch.
  */
-static int readdir_get_data(struct iof_dir_handle *dir_handle, off_t offset)
+static int
+readdir_fetch_start(struct iof_dir_handle *dir_handle, off_t offset,
+		    bool plus)
 {
 	struct iof_projection_info *fs_handle = dir_handle->open_req.fsh;
+	struct iof_readdir_fetch *fetch;
 	struct iof_readdir_in *in;
-	struct readdir_cb_r reply = {0};
-	crt_rpc_t *rpc = NULL;
-	crt_bulk_t bulk = 0;
-	d_iov_t iov = {0};
 	size_t len = fs_handle->readdir_size;
-	int ret = 0;
+	crt_opcode_t opc;
 	int rc;
 
-	rc = crt_req_create(fs_handle->proj.crt_ctx, &dir_handle->ep,
-			    FS_TO_OP(fs_handle, readdir), &rpc);
-	if (rc || !rpc) {
+	D_ALLOC_PTR(fetch);
+	if (!fetch)
+		return ENOMEM;
+
+	fetch->dh = dir_handle;
+	fetch->offset = offset;
+	fetch->plus = plus;
+	iof_tracker_init(&fetch->tracker, 1);
+
+	/* Use the packed encoding if the IONSS supports it, which is only
+	 * available through readdir_packed.
+	 */
+	fetch->packed = fs_handle->proj.grp->proto_version >=
+		IOF_READDIR_PACKED_VERSION;
+
+	if (fetch->packed)
+		opc = FS_TO_OP(fs_handle, readdir_packed);
+	else
+		opc = FS_TO_OP(fs_handle, readdir);
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx, &dir_handle->ep, opc,
+			    &fetch->rpc);
+	if (rc || !fetch->rpc) {
 		IOF_TRACE_ERROR(dir_handle,
 				"Could not create request, rc = %d", rc);
+		fetch->rpc = NULL;
+		readdir_fetch_free(fetch);
 		return EIO;
 	}
 
-	in = crt_req_get(rpc);
+	in = crt_req_get(fetch->rpc);
 	D_MUTEX_LOCK(&fs_handle->gah_lock);
 	in->gah = dir_handle->gah;
 	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
 	in->offset = offset;
 
-	iov.iov_len = len;
-	iov.iov_buf_len = len;
-	D_ALLOC(iov.iov_buf, len);
+	/* fuse_add_direntry() only uses the inode number and type, but for
+	 * READDIRPLUS request full attributes and a GAH for each entry so
+	 * that the kernel does not need to look them up.
+	 */
+	if (plus && fs_handle->proj.grp->proto_version >=
+	    IOF_READDIRPLUS_VERSION)
+		in->flags = IOF_READDIR_GAH;
+	else if (fetch->packed)
+		in->flags = IOF_READDIR_NO_ATTR;
+
+	fetch->iov.iov_len = len;
+	fetch->iov.iov_buf_len = len;
+	D_ALLOC(fetch->iov.iov_buf, len);
 
-	if (iov.iov_buf) {
+	if (fetch->iov.iov_buf) {
 		d_sg_list_t sgl = {0};
 
-		sgl.sg_iovs = &iov;
+		sgl.sg_iovs = &fetch->iov;
 		sgl.sg_nr = 1;
 		rc = crt_bulk_create(fs_handle->proj.crt_ctx, &sgl, CRT_BULK_RW,
 				     &in->bulk);
@@ -126,79 +160,240 @@ static int readdir_get_data(struct iof_dir_handle *dir_handle, off_t offset)
 			IOF_TRACE_ERROR(dir_handle,
 					"Failed to make local bulk handle %d",
 					rc);
-			D_FREE(iov.iov_buf);
-			crt_req_decref(rpc);
-			D_GOTO(out, ret = EIO);
+			readdir_fetch_free(fetch);
+			return EIO;
 		}
-		bulk = in->bulk;
+		fetch->bulk = in->bulk;
 	}
 
-	iof_tracker_init(&reply.tracker, 1);
-	rc = crt_req_send(rpc, readdir_cb, &reply);
+	/* Keep a reference on the RPC so the reply can be used after the
+	 * callback
+	 */
+	crt_req_addref(fetch->rpc);
+
+	dir_handle->rd_fetch = fetch;
+
+	IOF_TRACE_DEBUG(dir_handle, "Fetching from offset %zi", offset);
+
+	rc = crt_req_send(fetch->rpc, readdir_cb, fetch);
 	if (rc) {
 		IOF_TRACE_ERROR(dir_handle,
 				"Could not send rpc, rc = %d", rc);
+		dir_handle->rd_fetch = NULL;
+		readdir_fetch_free(fetch);
 		return EIO;
 	}
 
-	iof_fs_wait(&fs_handle->proj, &reply.tracker);
+	return 0;
+}
 
-	if (reply.err != 0)
-		D_GOTO(out, ret = reply.err);
+/*
+ * Populate the dir_handle with the replies from a completed RPC, and then
+ * free it.  If prefetch is set then the RPC for the next batch is sent.
+ *
+ * If this function returns a non-zero status then that status is returned to
+ * FUSE and the handle is marked as invalid.
+ */
+static int
+readdir_install(struct iof_dir_handle *dir_handle,
+		struct iof_readdir_fetch *fetch, bool prefetch)
+{
+	struct iof_readdir_out *out;
+	int ret = 0;
+	int rc;
+
+	dir_handle->rd_fetch = NULL;
+	dir_handle->reply_count = 0;
+	dir_handle->replies = NULL;
+	dir_handle->last_replies = 0;
+
+	if (fetch->err != 0)
+		D_GOTO(out, ret = fetch->err);
+
+	out = crt_reply_get(fetch->rpc);
 
-	if (reply.out->err != 0) {
-		if (reply.out->err == -DER_NONEXIST)
+	if (out->err != 0) {
+		if (out->err == -DER_NONEXIST)
 			H_GAH_SET_INVALID(dir_handle);
 		IOF_TRACE_ERROR(dir_handle,
-				"Error from target %d", reply.out->err);
+				"Error from target %d", out->err);
 		D_GOTO(out, ret = EIO);
 	}
 
 	IOF_TRACE_DEBUG(dir_handle,
-			"Reply received iov: %d bulk: %d", reply.out->iov_count,
-			reply.out->bulk_count);
+			"Reply received iov: %d bulk: %d", out->iov_count,
+			out->bulk_count);
+
+	if (fetch->packed && (out->iov_count > 0 || out->bulk_count > 0)) {
+		struct iof_readdir_reply *replies;
+		void *buf = fetch->iov.iov_buf;
+		size_t buf_len = fetch->iov.iov_len;
+		int count = out->bulk_count;
+
+		if (out->iov_count > 0) {
+			buf = out->replies.iov_buf;
+			buf_len = out->replies.iov_len;
+			count = out->iov_count;
+		}
 
-	if (reply.out->iov_count > 0) {
-		dir_handle->reply_count = reply.out->iov_count;
+		/* Check the count from the server before sizing the array on
+		 * it, every entry takes at least IOF_READDIR_PACKED_MIN bytes.
+		 */
+		if (count > buf_len / IOF_READDIR_PACKED_MIN) {
+			IOF_TRACE_ERROR(dir_handle,
+					"Too many entries in reply %d", count);
+			D_GOTO(out, ret = EIO);
+		}
+
+		D_ALLOC_ARRAY(replies, count);
+		if (!replies)
+			D_GOTO(out, ret = ENOMEM);
 
-		if (reply.out->replies.iov_len != reply.out->iov_count *
-			sizeof(struct iof_readdir_reply)) {
-			IOF_TRACE_ERROR(dir_handle, "Incorrect iov reply");
+		rc = iof_readdir_unpack(buf, buf_len, count, fetch->offset,
+					replies);
+		if (rc != -DER_SUCCESS) {
+			IOF_TRACE_ERROR(dir_handle, "Incorrect packed reply");
+			D_FREE(replies);
 			D_GOTO(out, ret = EIO);
 		}
-		dir_handle->replies = reply.out->replies.iov_buf;
-		dir_handle->rpc = reply.rpc;
-		dir_handle->last_replies = reply.out->last;
-		goto out_with_rpc;
-	} else if (reply.out->bulk_count > 0) {
-		dir_handle->reply_count = reply.out->bulk_count;
-		dir_handle->last_replies = reply.out->last;
-		dir_handle->replies = iov.iov_buf;
-		dir_handle->rpc = NULL;
-		dir_handle->replies_base = iov.iov_buf;
-	} else {
-		dir_handle->reply_count = 0;
-		dir_handle->replies = NULL;
-		dir_handle->rpc = NULL;
+
+		dir_handle->reply_count = count;
+		dir_handle->replies = replies;
+		dir_handle->replies_base = replies;
+	} else if (out->iov_count > 0 || out->bulk_count > 0) {
+		struct iof_readdir_entry *entries = fetch->iov.iov_buf;
+		struct iof_readdir_reply *replies;
+		int count = out->bulk_count;
+		int i;
+
+		if (out->iov_count > 0) {
+			if (out->replies.iov_len != out->iov_count *
+			    sizeof(struct iof_readdir_entry)) {
+				IOF_TRACE_ERROR(dir_handle,
+						"Incorrect iov reply");
+				D_GOTO(out, ret = EIO);
+			}
+			entries = out->replies.iov_buf;
+			count = out->iov_count;
+		} else if (count > fetch->iov.iov_len /
+			   sizeof(struct iof_readdir_entry)) {
+			IOF_TRACE_ERROR(dir_handle, "Incorrect bulk reply");
+			D_GOTO(out, ret = EIO);
+		}
+
+		D_ALLOC_ARRAY(replies, count);
+		if (!replies)
+			D_GOTO(out, ret = ENOMEM);
+
+		for (i = 0; i < count; i++)
+			iof_readdir_entry_get(&entries[i], &replies[i]);
+
+		dir_handle->reply_count = count;
+		dir_handle->replies = replies;
+		dir_handle->replies_base = replies;
+	}
+	dir_handle->last_replies = out->last;
+
+	/* Start the fetch of the next batch, unless this batch is the last
+	 * or ended with an error.  Failure here is not fatal, the RPC will
+	 * be sent again when the entries are needed.
+	 */
+	if (prefetch && !dir_handle->last_replies &&
+	    dir_handle->reply_count > 0) {
+		struct iof_readdir_reply *last;
+
+		last = &dir_handle->replies[dir_handle->reply_count - 1];
+		if (last->read_rc == 0)
+			readdir_fetch_start(dir_handle, last->nextoff,
+					    fetch->plus);
 	}
 
 out:
-	if (reply.rpc)
-		crt_req_decref(reply.rpc);
+	readdir_fetch_free(fetch);
+	return ret;
+}
+
+/* Release the GAH of an entry which has not been passed to the kernel */
+static void readdir_drop_gah(struct iof_projection_info *fs_handle,
+			     struct iof_readdir_reply *reply)
+{
+	struct ioc_inode_entry ie = {0};
+
+	ie.gah = reply->gah;
+	ie.stat = reply->stat;
+	D_INIT_LIST_HEAD(&ie.ie_fh_list);
+	D_INIT_LIST_HEAD(&ie.ie_ie_children);
+	D_INIT_LIST_HEAD(&ie.ie_ie_list);
+	H_GAH_SET_VALID(&ie);
+	ie_close(fs_handle, &ie);
+	reply->gah_valid = 0;
+}
+
+/* Populate a READDIRPLUS entry.
+ *
+ * If the server returned a GAH for the entry then add the inode to the
+ * inode table and pass a reference to the kernel, as a lookup would.
+ * Otherwise only the attributes are returned, and the kernel will look the
+ * entry up if it needs it.
+ */
+static void readdir_entry_plus(struct iof_dir_handle *dir_handle,
+			       struct iof_readdir_reply *reply,
+			       struct fuse_entry_param *entry)
+{
+	struct iof_projection_info *fs_handle = dir_handle->open_req.fsh;
+	struct ioc_inode_entry *ie;
+	d_list_t *rlink;
 
-out_with_rpc:
-	if (iov.iov_buf && iov.iov_buf != dir_handle->replies)
-		D_FREE(iov.iov_buf);
+	entry->attr = reply->stat;
 
-	if (bulk) {
-		rc = crt_bulk_free(bulk);
-		if (rc)
-			ret = EIO;
+	if (!reply->gah_valid)
+		return;
+
+	/* Take the reference on the parent held by the new inode */
+	if (dir_handle->inode_no != 1) {
+		rlink = d_hash_rec_find(&fs_handle->inode_ht,
+					&dir_handle->inode_no,
+					sizeof(dir_handle->inode_no));
+		if (!rlink) {
+			readdir_drop_gah(fs_handle, reply);
+			return;
+		}
 	}
 
-	return ret;
+	D_ALLOC_PTR(ie);
+	if (!ie) {
+		drop_ino_ref(fs_handle, dir_handle->inode_no);
+		readdir_drop_gah(fs_handle, reply);
+		return;
+	}
+	atomic_fetch_add(&ie->ie_ref, 1);
+
+	ie->gah = reply->gah;
+	ie->stat = reply->stat;
+	strncpy(ie->name, reply->d_name, NAME_MAX);
+	ie->parent = dir_handle->inode_no;
+	D_INIT_LIST_HEAD(&ie->ie_fh_list);
+	D_INIT_LIST_HEAD(&ie->ie_ie_children);
+	D_INIT_LIST_HEAD(&ie->ie_ie_list);
+	H_GAH_SET_VALID(ie);
+	reply->gah_valid = 0;
+
+	rlink = d_hash_rec_find_insert(&fs_handle->inode_ht,
+				       &ie->stat.st_ino,
+				       sizeof(ie->stat.st_ino),
+				       &ie->ie_htl);
+	if (rlink != &ie->ie_htl) {
+		drop_ino_ref(fs_handle, ie->parent);
+		ie_close(fs_handle, ie);
+		D_FREE(ie);
+	}
+
+	entry->ino = entry->attr.st_ino;
+	entry->generation = 1;
+	IOC_ENTRY_TIMEOUTS(fs_handle, *entry);
 }
 
+
 /* Mark a previously fetched handle complete
  *
  * Returns True if the consumed entry is the last one.
@@ -206,139 +401,122 @@ out_with_rpc:
 static int readdir_next_reply_consume(struct iof_dir_handle *dir_handle)
 {
 	if (dir_handle->reply_count != 0) {
+		if (dir_handle->replies->gah_valid)
+			readdir_drop_gah(dir_handle->open_req.fsh,
+					 dir_handle->replies);
 		dir_handle->replies++;
 		dir_handle->reply_count--;
 	}
 
-	if (dir_handle->reply_count == 0) {
-		if (dir_handle->rpc) {
-			crt_req_decref(dir_handle->rpc);
-			dir_handle->rpc = NULL;
-		} else if (dir_handle->replies_base) {
-			D_FREE(dir_handle->replies_base);
-		}
-	}
+	if (dir_handle->reply_count == 0)
+		D_FREE(dir_handle->replies_base);
 	if (dir_handle->reply_count == 0 && dir_handle->last_replies)
 		return 1;
 	return 0;
 }
 
-/* Fetch a pointer to the next reply entry from the target
+/* Release any fetched entries which were not returned to the kernel.  Called
+ * with rd_lock held.
+ */
+static void readdir_release_batch(struct iof_dir_handle *dir_handle)
+{
+	while (dir_handle->reply_count != 0)
+		readdir_next_reply_consume(dir_handle);
+
+	D_FREE(dir_handle->replies_base);
+}
+
+/* Add entries to the reply buffer of the waiting FUSE request.  Called with
+ * rd_lock held.
  *
  * Replies are read from the server in batches, configurable on the server side,
- * the client keeps a array of received but unprocessed replies.  This function
- * fetches a new reply if possible, either from the from the front of the local
- * array, or if the array is empty by sending a new RPC.
+ * the client keeps a array of received but unprocessed replies, and the RPC
+ * for the following batch.  Entries are taken from the front of the local
+ * array, and when it is empty the RPC is used to refill it.
  *
- * If this function returns a non-zero status then that status is returned to
- * FUSE and the handle is marked as invalid.
+ * Returns -1 if the request is waiting for an RPC to complete, in which case
+ * it will be completed from the RPC callback, otherwise the status to return
+ * to FUSE.
  *
  * There is no caching on the server, and when the server responds to a RPC it
  * can include zero or more replies.
  */
-static int readdir_next_reply(struct iof_dir_handle *dir_handle,
-			      off_t offset,
-			      struct iof_readdir_reply **reply)
-{
-	int rc;
-
-	*reply = NULL;
-
-	/* Check for available data and fetch more if none */
-	if (dir_handle->reply_count == 0) {
-		IOF_TRACE_DEBUG(dir_handle, "Fetching more data");
-		if (dir_handle->rpc) {
-			crt_req_decref(dir_handle->rpc);
-			dir_handle->rpc = NULL;
-		}
-		rc = readdir_get_data(dir_handle, offset);
-		if (rc != 0) {
-			dir_handle->handle_valid = 0;
-			return rc;
-		}
-	}
-
-	if (dir_handle->reply_count == 0) {
-		IOF_TRACE_DEBUG(dir_handle, "No more replies");
-		if (dir_handle->rpc) {
-			crt_req_decref(dir_handle->rpc);
-			dir_handle->rpc = NULL;
-		}
-		return 0;
-	}
-
-	*reply = dir_handle->replies;
-
-	IOF_TRACE_INFO(dir_handle,
-		       "Next offset %zi count %d %s",
-		       (*reply)->nextoff,
-		       dir_handle->reply_count,
-		       dir_handle->last_replies ? "EOF" : "More");
-
-	return 0;
-}
-
-void
-ioc_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
-	       struct fuse_file_info *fi)
+static int readdir_fill_locked(struct iof_dir_handle *dir_handle)
 {
-	struct iof_dir_handle *dir_handle = (struct iof_dir_handle *)fi->fh;
-	struct iof_projection_info *fs_handle = dir_handle->open_req.fsh;
-	off_t next_offset = offset;
-	void *buf = NULL;
-	size_t b_offset = 0;
-	int ret = EIO;
-	int rc;
-
-	STAT_ADD(fs_handle->stats, readdir);
-
-	IOF_TRACE_UP(req, dir_handle, "readdir_fuse_req");
-
-	if (FS_IS_OFFLINE(fs_handle))
-		D_GOTO(out_err, ret = fs_handle->offline_reason);
-
-	IOF_TRACE_INFO(req, GAH_PRINT_STR " offset %zi",
-		       GAH_PRINT_VAL(dir_handle->gah), offset);
-
-	if (!H_GAH_IS_VALID(dir_handle))
-		/* If the server has reported that the GAH is invalid
-		 * then do not send a RPC to close it
-		 */
-		D_GOTO(out_err, ret = EHOSTDOWN);
-
-	/* If the handle has been reported as invalid in the past then do not
-	 * process any more requests at this stage.
-	 */
-	if (!dir_handle->handle_valid)
-		D_GOTO(out_err, ret = EIO);
-
-	D_ALLOC(buf, size);
-	if (!buf)
-		D_GOTO(out_err, ret = ENOMEM);
+	fuse_req_t req = dir_handle->rd_req;
+	struct iof_readdir_fetch *fetch;
+	struct iof_readdir_reply *dir_reply;
+	size_t size = dir_handle->rd_size;
+	size_t remain;
+	char *buf;
+	int ret;
 
 	do {
-		struct iof_readdir_reply *dir_reply;
-
-		rc = readdir_next_reply
-			(dir_handle, next_offset,
-					 &dir_reply);
+		/* Check for available data and fetch more if none */
+		if (dir_handle->reply_count == 0) {
+			if (dir_handle->last_replies) {
+				IOF_TRACE_INFO(dir_handle,
+					       "No more directory contents");
+				return 0;
+			}
+
+			fetch = dir_handle->rd_fetch;
+			if (!fetch) {
+				IOF_TRACE_DEBUG(dir_handle,
+						"Fetching more data");
+				readdir_release_batch(dir_handle);
+				ret = readdir_fetch_start(dir_handle,
+							  dir_handle->rd_offset,
+							  dir_handle->rd_plus);
+				if (ret != 0) {
+					dir_handle->handle_valid = 0;
+					return ret;
+				}
+				return -1;
+			}
+
+			if (!fetch->done)
+				return -1;
+
+			readdir_release_batch(dir_handle);
+
+			/* The kernel has seeked since the fetch was sent so
+			 * discard the entries, releasing any GAHs.
+			 */
+			if (fetch->offset != dir_handle->rd_offset) {
+				IOF_TRACE_DEBUG(dir_handle,
+						"Discarding fetch from %zi",
+						fetch->offset);
+				readdir_install(dir_handle, fetch, false);
+				readdir_release_batch(dir_handle);
+				dir_handle->last_replies = 0;
+				continue;
+			}
+
+			ret = readdir_install(dir_handle, fetch, true);
+			if (ret != 0) {
+				dir_handle->handle_valid = 0;
+				return ret;
+			}
+
+			/* Check for end of directory.  This is the code-path
+			 * taken where a RPC contains 0 replies, either because
+			 * a directory is empty, or where the number of entries
+			 * fits exactly in the last RPC.
+			 */
+			if (dir_handle->reply_count == 0) {
+				IOF_TRACE_DEBUG(dir_handle, "No more replies");
+				return 0;
+			}
+		}
 
-		IOF_TRACE_DEBUG(dir_handle, "err %d buf %p", rc, dir_reply);
+		dir_reply = dir_handle->replies;
 
-		if (rc != 0)
-			D_GOTO(out_err, ret = rc);
-
-		/* Check for end of directory.  This is the code-path taken
-		 * where a RPC contains 0 replies, either because a directory
-		 * is empty, or where the number of entries fits exactly in
-		 * the last RPC.
-		 * In this case there is no next entry to consume.
-		 */
-		if (!dir_reply) {
-			IOF_TRACE_INFO(dir_handle,
-				       "No more directory contents");
-			goto out;
-		}
+		IOF_TRACE_INFO(dir_handle,
+			       "Next offset %zi count %d %s",
+			       dir_reply->nextoff,
+			       dir_handle->reply_count,
+			       dir_handle->last_replies ? "EOF" : "More");
 
 		IOF_TRACE_DEBUG(dir_handle, "reply rc %d stat_rc %d",
 				dir_reply->read_rc,
@@ -350,7 +528,7 @@ ioc_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
 		if (dir_reply->read_rc != 0) {
 			ret = dir_reply->read_rc;
 			readdir_next_reply_consume(dir_handle);
-			goto out_err;
+			return ret;
 		}
 
 		/* Process any new information received in this RPC.  The
@@ -364,47 +542,233 @@ ioc_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
 
 		if (dir_reply->stat_rc != 0) {
 			IOF_TRACE_ERROR(req, "Stat rc is non-zero");
-			D_GOTO(out_err, ret = EIO);
+			return EIO;
 		}
 
-		ret = fuse_add_direntry(req, buf + b_offset, size - b_offset,
-					dir_reply->d_name,
-					&dir_reply->stat,
-					dir_reply->nextoff);
+		buf = dir_handle->rd_buf + dir_handle->rd_used;
+		remain = size - dir_handle->rd_used;
+
+		if (dir_handle->rd_plus) {
+			struct fuse_entry_param entry = {0};
+
+			/* Check for space before passing a reference on the
+			 * inode to the kernel.
+			 */
+			ret = fuse_add_direntry_plus(req, NULL, 0,
+						     dir_reply->d_name, NULL,
+						     0);
+			if (ret <= remain) {
+				readdir_entry_plus(dir_handle, dir_reply,
+						   &entry);
+				ret = fuse_add_direntry_plus(req, buf, remain,
+							     dir_reply->d_name,
+							     &entry,
+							     dir_reply->nextoff);
+			}
+		} else {
+			ret = fuse_add_direntry(req, buf, remain,
+						dir_reply->d_name,
+						&dir_reply->stat,
+						dir_reply->nextoff);
+		}
 
 		IOF_TRACE_DEBUG(dir_handle,
 				"New file '%s' %d next off %zi size %d (%lu)",
 				dir_reply->d_name, ret, dir_reply->nextoff,
-				ret,
-				size - b_offset);
-
-		/* Check for this being the last entry in a directory, this is
-		 * the typical end-of-directory case where readdir() returned
-		 * no more information on the sever
-		 */
+				ret, remain);
 
-		if (ret > size - b_offset) {
+		if (ret > remain) {
 			IOF_TRACE_DEBUG(req,
 					"Output buffer is full");
-			goto out;
+			return 0;
 		}
 
-		next_offset = dir_reply->nextoff;
+		dir_handle->rd_offset = dir_reply->nextoff;
 		readdir_next_reply_consume(dir_handle);
-		b_offset += ret;
+		dir_handle->rd_used += ret;
 
 	} while (1);
+}
 
-out:
-	IOF_TRACE_DEBUG(req, "Returning %zi bytes", b_offset);
+static void
+readdir_reply(fuse_req_t req, char *buf, size_t len, int status)
+{
+	int rc;
+
+	if (status != 0) {
+		IOF_FUSE_REPLY_ERR(req, status);
+		D_FREE(buf);
+		return;
+	}
+
+	IOF_TRACE_DEBUG(req, "Returning %zi bytes", len);
 
-	rc = fuse_reply_buf(req, buf, b_offset);
+	rc = fuse_reply_buf(req, buf, len);
 	if (rc != 0)
 		IOF_TRACE_ERROR(req, "fuse_reply_error returned %d", rc);
 
 	IOF_TRACE_DOWN(req);
 
 	D_FREE(buf);
+}
+
+/* The callback of the readdir RPC.
+ *
+ * If a FUSE request is waiting on this RPC then continue filling it, and
+ * reply if possible.  If the RPC has been detached from the directory handle
+ * then the handle is being released so signal the waiter.
+ */
+static void
+readdir_cb(const struct crt_cb_info *cb_info)
+{
+	struct iof_readdir_fetch *fetch = cb_info->cci_arg;
+	struct iof_dir_handle *dir_handle = fetch->dh;
+	fuse_req_t req = NULL;
+	char *buf = NULL;
+	size_t len = 0;
+	bool detached = false;
+	int rc = 0;
+
+	if (cb_info->cci_rc != 0) {
+		/* Error handling, as directory handles are stateful if there
+		 * is any error then we have to disable the local dir_handle
+		 *
+		 */
+		IOF_LOG_ERROR("Error from RPC %d", cb_info->cci_rc);
+		if (cb_info->cci_rc == -DER_EVICTED)
+			fetch->err = EHOSTDOWN;
+		else
+			fetch->err = EIO;
+	}
+
+	D_MUTEX_LOCK(&dir_handle->rd_lock);
+	fetch->done = true;
+	if (dir_handle->rd_fetch != fetch) {
+		detached = true;
+	} else if (dir_handle->rd_req) {
+		rc = readdir_fill_locked(dir_handle);
+		if (rc != -1) {
+			req = dir_handle->rd_req;
+			buf = dir_handle->rd_buf;
+			len = dir_handle->rd_used;
+			dir_handle->rd_req = NULL;
+			dir_handle->rd_buf = NULL;
+		}
+	}
+	D_MUTEX_UNLOCK(&dir_handle->rd_lock);
+
+	/* The fetch is owned by the waiter once signalled so do not access
+	 * it after this point.
+	 */
+	if (detached)
+		iof_tracker_signal(&fetch->tracker);
+
+	if (req)
+		readdir_reply(req, buf, len, rc);
+}
+
+/* Release any fetched entries which were not returned to the kernel, and
+ * wait for any RPC in flight.
+ */
+void ioc_readdir_release(struct iof_dir_handle *dir_handle)
+{
+	struct iof_projection_info *fs_handle = dir_handle->open_req.fsh;
+	struct iof_readdir_fetch *fetch;
+	bool wait;
+
+	D_MUTEX_LOCK(&dir_handle->rd_lock);
+	readdir_release_batch(dir_handle);
+	fetch = dir_handle->rd_fetch;
+	dir_handle->rd_fetch = NULL;
+	wait = fetch && !fetch->done;
+	D_MUTEX_UNLOCK(&dir_handle->rd_lock);
+
+	if (!fetch)
+		return;
+
+	if (wait)
+		iof_fs_wait(&fs_handle->proj, &fetch->tracker);
+
+	/* Install the entries only to release any GAHs they hold */
+	D_MUTEX_LOCK(&dir_handle->rd_lock);
+	readdir_install(dir_handle, fetch, false);
+	readdir_release_batch(dir_handle);
+	dir_handle->last_replies = 0;
+	D_MUTEX_UNLOCK(&dir_handle->rd_lock);
+}
+
+static void
+readdir_common(fuse_req_t req, size_t size, off_t offset,
+	       struct fuse_file_info *fi, bool plus)
+{
+	struct iof_dir_handle *dir_handle = (struct iof_dir_handle *)fi->fh;
+	struct iof_projection_info *fs_handle = dir_handle->open_req.fsh;
+	char *buf = NULL;
+	size_t len;
+	int ret = EIO;
+
+	if (plus)
+		STAT_ADD(fs_handle->stats, readdirplus);
+	else
+		STAT_ADD(fs_handle->stats, readdir);
+
+	IOF_TRACE_UP(req, dir_handle, plus ? "readdirplus_fuse_req" :
+		     "readdir_fuse_req");
+
+	if (FS_IS_OFFLINE(fs_handle))
+		D_GOTO(out_err, ret = fs_handle->offline_reason);
+
+	IOF_TRACE_INFO(req, GAH_PRINT_STR " offset %zi",
+		       GAH_PRINT_VAL(dir_handle->gah), offset);
+
+	if (!H_GAH_IS_VALID(dir_handle))
+		/* If the server has reported that the GAH is invalid
+		 * then do not send a RPC to close it
+		 */
+		D_GOTO(out_err, ret = EHOSTDOWN);
+
+	/* If the handle has been reported as invalid in the past then do not
+	 * process any more requests at this stage.
+	 */
+	if (!dir_handle->handle_valid)
+		D_GOTO(out_err, ret = EIO);
+
+	D_ALLOC(buf, size);
+	if (!buf)
+		D_GOTO(out_err, ret = ENOMEM);
+
+	D_MUTEX_LOCK(&dir_handle->rd_lock);
+
+	/* If the kernel has seeked then drop the current batch, any fetch in
+	 * flight will be discarded once it completes.
+	 */
+	if (offset != dir_handle->rd_offset) {
+		IOF_TRACE_DEBUG(dir_handle, "Seek from %zi to %zi",
+				dir_handle->rd_offset, offset);
+		readdir_release_batch(dir_handle);
+		dir_handle->last_replies = 0;
+		dir_handle->rd_offset = offset;
+	}
+
+	dir_handle->rd_req = req;
+	dir_handle->rd_buf = buf;
+	dir_handle->rd_size = size;
+	dir_handle->rd_used = 0;
+	dir_handle->rd_plus = plus;
+
+	ret = readdir_fill_locked(dir_handle);
+	if (ret == -1) {
+		/* The reply will be sent from readdir_cb() */
+		D_MUTEX_UNLOCK(&dir_handle->rd_lock);
+		return;
+	}
+
+	len = dir_handle->rd_used;
+	dir_handle->rd_req = NULL;
+	dir_handle->rd_buf = NULL;
+	D_MUTEX_UNLOCK(&dir_handle->rd_lock);
+
+	readdir_reply(req, buf, len, ret);
 	return;
 
 out_err:
@@ -412,3 +776,17 @@ out_err:
 
 	D_FREE(buf);
 }
+
+void
+ioc_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+	       struct fuse_file_info *fi)
+{
+	readdir_common(req, size, offset, fi, false);
+}
+
+void
+ioc_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+		   struct fuse_file_info *fi)
+{
+	readdir_common(req, size, offset, fi, true);
+}
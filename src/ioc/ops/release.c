@@ -50,10 +50,30 @@ void ioc_release_priv(fuse_req_t req, struct iof_file_handle *handle)
 
 	STAT_ADD(fs_handle->stats, release);
 
+	/* Prefetches hold references to the handle so wait for them before
+	 * closing it.
+	 */
+	ioc_ra_fini(handle);
+
+	/* Write out any cached data, there is no way of reporting errors at
+	 * this point so they have to be logged instead.
+	 */
+	rc = ioc_wb_sync(handle, true);
+	if (rc)
+		IOF_TRACE_WARNING(handle, "Cached write failed %d '%s'",
+				  rc, strerror(rc));
+
 	D_MUTEX_LOCK(&handle->fs_handle->of_lock);
 	d_list_del(&handle->fh_of_list);
+	d_list_del_init(&handle->fh_ino_list);
 	D_MUTEX_UNLOCK(&handle->fs_handle->of_lock);
 
+	/* Another file may be syncing this one for fsync, flush or truncate */
+	D_MUTEX_LOCK(&handle->wb.lock);
+	while (handle->wb.users > 0)
+		pthread_cond_wait(&handle->wb.cond, &handle->wb.lock);
+	D_MUTEX_UNLOCK(&handle->wb.lock);
+
 	/* If the projection is off-line then drop the local handle.
 	 *
 	 * This means a resource leak on the IONSS should the projection
@@ -79,6 +99,10 @@ void ioc_release_priv(fuse_req_t req, struct iof_file_handle *handle)
 	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
 	IOF_TRACE_LINK(handle->release_rpc, req, "release_file_rpc");
 
+	rc = crt_req_set_endpoint(handle->release_rpc, &handle->common.ep);
+	if (rc)
+		D_GOTO(out_err, ret = EIO);
+
 	crt_req_addref(handle->release_rpc);
 	rc = crt_req_send(handle->release_rpc, ioc_ll_gen_cb, req);
 	if (rc) {
@@ -86,12 +110,10 @@ void ioc_release_priv(fuse_req_t req, struct iof_file_handle *handle)
 		D_GOTO(out_err, ret = EIO);
 	}
 
-	d_list_del(&handle->fh_ino_list);
 	iof_pool_release(fs_handle->fh_pool, handle);
 	return;
 
 out_err:
-	d_list_del(&handle->fh_ino_list);
 	iof_pool_release(fs_handle->fh_pool, handle);
 	if (req)
 		IOF_FUSE_REPLY_ERR(req, ret);
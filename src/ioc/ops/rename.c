@@ -54,6 +54,9 @@ ioc_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
 
 	STAT_ADD(fs_handle->stats, rename);
 
+	ioc_nc_drop(fs_handle, parent, name);
+	ioc_nc_drop(fs_handle, newparent, newname);
+
 	IOF_TRACE_DEBUG(req, "renaming %s to %s", name, newname);
 
 	if (FS_IS_OFFLINE(fs_handle))
@@ -142,6 +142,9 @@ ioc_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
 
 	IOF_TRACE_INFO(fs_handle, "inode %lu handle %p", ino, handle);
 
+	/* Any data prefetched for this file may now be stale */
+	ioc_ra_invalidate_ino(fs_handle, ino);
+
 	if (handle) {
 		IOC_REQ_INIT_REQ(desc, fs_handle, fsetattr_api, in, req, rc);
 		if (rc)
@@ -150,6 +153,16 @@ ioc_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
 		if (!F_GAH_IS_VALID(handle))
 			D_GOTO(err, rc = EIO);
 
+		/* Cached writes must not land after a truncate, from any
+		 * handle of the file.
+		 */
+		if (to_set & FUSE_SET_ATTR_SIZE)
+			rc = ioc_wb_sync_ino(fs_handle, ino, handle, true);
+		else
+			rc = ioc_wb_sync(handle, true);
+		if (rc)
+			D_GOTO(err, rc);
+
 		D_MUTEX_LOCK(&fs_handle->gah_lock);
 		in->gah = handle->common.gah;
 		D_MUTEX_UNLOCK(&fs_handle->gah_lock);
@@ -158,6 +171,12 @@ ioc_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
 		if (rc)
 			D_GOTO(err, rc);
 
+		if (to_set & FUSE_SET_ATTR_SIZE) {
+			rc = ioc_wb_sync_ino(fs_handle, ino, NULL, false);
+			if (rc)
+				D_GOTO(err, rc);
+		}
+
 		if (ino == 1) {
 			desc->request.ir_ht = RHS_ROOT;
 		} else {
@@ -54,6 +54,8 @@ ioc_ll_remove(fuse_req_t req, fuse_ino_t parent, const char *name, bool dir)
 
 	STAT_ADD(fs_handle->stats, unlink);
 
+	ioc_nc_drop(fs_handle, parent, name);
+
 	if (FS_IS_OFFLINE(fs_handle)) {
 		ret = fs_handle->offline_reason;
 		goto out_err;
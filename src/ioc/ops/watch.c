@@ -0,0 +1,303 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <time.h>
+
+#include "iof_common.h"
+#include "ioc.h"
+#include "log.h"
+
+/* Change notification.
+ *
+ * If the projection allows the kernel to cache entries, attributes or
+ * directory contents then a thread is started which keeps a watch RPC
+ * outstanding to the IONSS, and invalidates anything which the IONSS
+ * reports as changed.  The kernel is notified from this thread rather than
+ * from the RPC callback, as notifications may block on kernel locks held by
+ * FUSE requests which need the progress thread to complete.
+ */
+
+struct watch_cb_r {
+	struct iof_projection_info	*fs_handle;
+	int				err;
+	bool				done;
+};
+
+static void
+watch_cb(const struct crt_cb_info *cb_info)
+{
+	struct watch_cb_r *reply = cb_info->cci_arg;
+	struct iof_projection_info *fs_handle = reply->fs_handle;
+
+	D_MUTEX_LOCK(&fs_handle->watch_lock);
+	reply->err = cb_info->cci_rc;
+	reply->done = true;
+	pthread_cond_broadcast(&fs_handle->watch_cond);
+	D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+}
+
+/* Invalidate a single change in the kernel */
+static void
+watch_event(struct iof_projection_info *fs_handle,
+	    struct iof_watch_event *event)
+{
+	size_t len;
+	int rc;
+
+	STAT_ADD(fs_handle->stats, watch_events);
+
+	len = strnlen(event->name.name, NAME_MAX);
+	if (len) {
+		IOF_TRACE_DEBUG(fs_handle, "Changed %lu '%.*s'", event->ino,
+				(int)len, event->name.name);
+		ioc_nc_drop(fs_handle, event->ino, event->name.name);
+		rc = fuse_lowlevel_notify_inval_entry(fs_handle->session,
+						      event->ino,
+						      event->name.name, len);
+		if (rc != 0 && rc != -ENOENT)
+			IOF_TRACE_WARNING(fs_handle,
+					  "inval_entry returned %d", rc);
+	} else {
+		IOF_TRACE_DEBUG(fs_handle, "Changed %lu", event->ino);
+		ioc_ra_invalidate_ino(fs_handle, event->ino);
+	}
+
+	/* Changes to entries also change the directory, so drop any cached
+	 * contents and attributes of it.
+	 */
+	rc = fuse_lowlevel_notify_inval_inode(fs_handle->session, event->ino,
+					      0, 0);
+	if (rc != 0 && rc != -ENOENT)
+		IOF_TRACE_WARNING(fs_handle, "inval_inode returned %d", rc);
+}
+
+/* Send a watch RPC and wait for the reply, then process the events in it.
+ *
+ * Returns 0 on success, in which case seq is updated and lost is set if
+ * events were missed, or an errno.
+ */
+static int
+watch_once(struct iof_projection_info *fs_handle, uint64_t *seq, bool *lost)
+{
+	struct watch_cb_r reply = {0};
+	struct iof_watch_in *in;
+	struct iof_watch_out *out;
+	struct iof_watch_event *events;
+	crt_rpc_t *rpc = NULL;
+	int count;
+	int ret = 0;
+	int rc;
+	int i;
+
+	rc = crt_req_create(fs_handle->proj.crt_ctx,
+			    &fs_handle->proj.grp->psr_ep,
+			    FS_TO_OP(fs_handle, watch), &rpc);
+	if (rc || !rpc) {
+		IOF_TRACE_ERROR(fs_handle,
+				"Could not create request, rc = %d", rc);
+		return EIO;
+	}
+
+	in = crt_req_get(rpc);
+	D_MUTEX_LOCK(&fs_handle->gah_lock);
+	in->gah = fs_handle->gah;
+	D_MUTEX_UNLOCK(&fs_handle->gah_lock);
+	in->seq = *seq;
+	in->client = fs_handle->watch_client;
+
+	reply.fs_handle = fs_handle;
+
+	/* Keep a reference so the reply can be used after the callback */
+	crt_req_addref(rpc);
+
+	D_MUTEX_LOCK(&fs_handle->watch_lock);
+	if (fs_handle->watch_stop) {
+		D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+		crt_req_decref(rpc);
+		crt_req_decref(rpc);
+		return ESHUTDOWN;
+	}
+	fs_handle->watch_rpc = rpc;
+	D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+
+	rc = crt_req_send(rpc, watch_cb, &reply);
+	if (rc) {
+		D_MUTEX_LOCK(&fs_handle->watch_lock);
+		fs_handle->watch_rpc = NULL;
+		D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+		IOF_TRACE_ERROR(fs_handle, "Could not send rpc, rc = %d", rc);
+		crt_req_decref(rpc);
+		return EIO;
+	}
+
+	D_MUTEX_LOCK(&fs_handle->watch_lock);
+	while (!reply.done)
+		pthread_cond_wait(&fs_handle->watch_cond,
+				  &fs_handle->watch_lock);
+	fs_handle->watch_rpc = NULL;
+	D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+
+	if (reply.err) {
+		IOF_TRACE_INFO(fs_handle, "Error from RPC %d", reply.err);
+		D_GOTO(out, ret = EIO);
+	}
+
+	out = crt_reply_get(rpc);
+	if (out->err || out->rc) {
+		IOF_TRACE_WARNING(fs_handle, "Error from target err %d rc %d",
+				  out->err, out->rc);
+		D_GOTO(out, ret = EIO);
+	}
+
+	events = out->events.iov_buf;
+	count = out->events.iov_len / sizeof(*events);
+	for (i = 0; i < count; i++)
+		watch_event(fs_handle, &events[i]);
+
+	*lost = out->lost;
+	*seq = out->seq;
+
+out:
+	crt_req_decref(rpc);
+	return ret;
+}
+
+/* Wait for up to a second, or until the thread is stopped */
+static void
+watch_sleep(struct iof_projection_info *fs_handle)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 1;
+
+	D_MUTEX_LOCK(&fs_handle->watch_lock);
+	if (!fs_handle->watch_stop)
+		pthread_cond_timedwait(&fs_handle->watch_cond,
+				       &fs_handle->watch_lock, &ts);
+	D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+}
+
+static void *
+watch_thread(void *arg)
+{
+	struct iof_projection_info *fs_handle = arg;
+	uint64_t seq = 0;
+	bool resync = false;
+	bool lost;
+	int rc;
+
+	while (!fs_handle->watch_stop) {
+		lost = false;
+		rc = watch_once(fs_handle, &seq, &lost);
+		if (rc == ESHUTDOWN)
+			break;
+
+		/* On error, such as failover to a new IONSS, start again as a
+		 * new client and drop everything once reconnected.
+		 */
+		if (rc != 0) {
+			seq = 0;
+			resync = true;
+			watch_sleep(fs_handle);
+			continue;
+		}
+
+		if (lost || resync) {
+			IOF_TRACE_INFO(fs_handle,
+				       "Missed changes, invalidating all");
+			ioc_flush_inodes(fs_handle);
+			resync = false;
+		}
+	}
+
+	return NULL;
+}
+
+void ioc_watch_start(struct iof_projection_info *fs_handle)
+{
+	crt_group_t *group;
+	d_rank_t rank;
+	int rc;
+
+	if (fs_handle->proj.grp->proto_version < IOF_WATCH_VERSION)
+		return;
+
+	if (fs_handle->entry_timeout == 0 && fs_handle->attr_timeout == 0 &&
+	    fs_handle->negative_timeout == 0 &&
+	    !(fs_handle->flags & IOF_CACHE_READDIR))
+		return;
+
+	/* Changes made through this node are already known to the kernel, so
+	 * ask for them not to be sent.
+	 */
+	fs_handle->watch_client = 0;
+	group = crt_group_lookup(NULL);
+	if (group && crt_group_rank(NULL, &rank) == 0)
+		fs_handle->watch_client = iof_watch_client(group->cg_grpid,
+							   rank);
+
+	fs_handle->watch_stop = false;
+	rc = pthread_create(&fs_handle->watch_thread, NULL, watch_thread,
+			    fs_handle);
+	if (rc) {
+		IOF_TRACE_ERROR(fs_handle, "Could not start watch thread %d",
+				rc);
+		return;
+	}
+	fs_handle->watch_started = true;
+}
+
+void ioc_watch_stop(struct iof_projection_info *fs_handle)
+{
+	if (!fs_handle->watch_started)
+		return;
+
+	/* Abort the RPC in flight, if any, the IONSS also replies to watch
+	 * RPCs after a timeout so the thread will exit in any case.
+	 */
+	D_MUTEX_LOCK(&fs_handle->watch_lock);
+	fs_handle->watch_stop = true;
+	if (fs_handle->watch_rpc)
+		crt_req_abort(fs_handle->watch_rpc);
+	pthread_cond_broadcast(&fs_handle->watch_cond);
+	D_MUTEX_UNLOCK(&fs_handle->watch_lock);
+
+	pthread_join(fs_handle->watch_thread, NULL);
+	fs_handle->watch_started = false;
+}
@@ -41,12 +41,85 @@
 #include "log.h"
 #include "ios_gah.h"
 
+/* Write-back.
+ *
+ * If the projection has IOF_WRITEBACK_CACHE set then writes are copied into
+ * a per-handle dirty extent and replied to straight away.  Writes which extend
+ * the dirty extent are merged into it until it reaches max_write bytes, any
+ * other write causes the extent to be sent to the IONSS in the background and
+ * a new one started.
+ *
+ * Errors from background writes are saved and returned by the next write,
+ * flush or fsync of the handle.  Reads wait for any cached data of the handle
+ * which they, or the readahead they may start, overlap to reach the IONSS
+ * first.  Release waits for all cached data of the handle, and fsync, flush
+ * and truncate wait for that of every open handle of the inode.  New extents
+ * wait if too many writes are already in flight for the handle, and are not
+ * sent until any earlier extent which they overlap has completed, so that
+ * overlapping writes land in order.
+ */
+#define IOC_WB_INFLIGHT 8
+
+struct wb_extent {
+	struct iof_wb	*wb;
+	off_t		offset;
+	size_t		len;
+};
+
+/* Called when a write-back RPC has completed, with the status, before the
+ * descriptor is released.
+ */
+static void
+wb_complete(struct iof_file_handle *handle, struct iof_wb *wb, int rc)
+{
+	struct ioc_writeback *wbc = &handle->wb;
+
+	D_MUTEX_LOCK(&wbc->lock);
+	if (rc && !wbc->error)
+		wbc->error = rc;
+	d_list_del_init(&wb->wb_list);
+	wbc->inflight--;
+	pthread_cond_broadcast(&wbc->cond);
+	D_MUTEX_UNLOCK(&wbc->lock);
+}
+
+/* Zero-copy writes.
+ *
+ * Rather than copying the data into a pool buffer, register the buffer FUSE
+ * has supplied and let the IONSS pull from it directly.  That buffer is only
+ * valid until the write callback returns so the FUSE thread waits for the RPC
+ * to complete, which is only done if FUSE is multi-threaded so that other
+ * requests can proceed meanwhile.  libfuse receives every request on a
+ * thread into the same buffer so the registration is cached per thread.
+ */
+struct ioc_write_wait {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	bool		done;
+	/* Set if the registration should not be reused */
+	bool		failure;
+};
+
+static void
+write_wake(struct ioc_write_wait *wait)
+{
+	if (!wait)
+		return;
+
+	D_MUTEX_LOCK(&wait->lock);
+	wait->done = true;
+	pthread_cond_signal(&wait->cond);
+	D_MUTEX_UNLOCK(&wait->lock);
+}
+
 static void
 write_cb(const struct crt_cb_info *cb_info)
 {
 	struct iof_wb		*wb = cb_info->cci_arg;
 	struct iof_writex_out	*out = crt_reply_get(cb_info->cci_rpc);
 	struct iof_writex_in	*in = crt_req_get(wb->rpc);
+	struct iof_file_handle	*handle = wb->handle;
+	struct ioc_write_wait	*wait = wb->wait;
 	fuse_req_t		req = wb->req;
 	int rc;
 
@@ -71,11 +144,23 @@ write_cb(const struct crt_cb_info *cb_info)
 	if (out->rc)
 		D_GOTO(err, rc = out->rc);
 
+	/* Write-back, the application has already been told the data was
+	 * written.
+	 */
+	if (!req) {
+		if (out->len != in->xtvec.xt_len)
+			D_GOTO(err, rc = EIO);
+		wb_complete(handle, wb, 0);
+		iof_pool_release(wb->pt, wb);
+		return;
+	}
+
 	IOF_FUSE_REPLY_WRITE(req, out->len);
 
 	STAT_ADD_COUNT(wb->fs_handle->stats, write_bytes, out->len);
 
-	iof_pool_release(wb->fs_handle->write_pool, wb);
+	iof_pool_release(wb->pt, wb);
+	write_wake(wait);
 
 	return;
 
@@ -84,12 +169,18 @@ hard_err:
 	 * returned after submitting the RPC then recreate the bulk handle
 	 * before reuse.
 	 */
-	if (in->data_bulk)
+	if (in->data_bulk && !wb->bulk)
 		wb->failure = true;
+	if (wb->bulk && wait)
+		wait->failure = true;
 err:
-	IOF_FUSE_REPLY_ERR(req, rc);
+	if (!req)
+		wb_complete(handle, wb, rc);
+	iof_pool_release(wb->pt, wb);
 
-	iof_pool_release(wb->fs_handle->write_pool, wb);
+	if (req)
+		IOF_FUSE_REPLY_ERR(req, rc);
+	write_wake(wait);
 }
 
 static void
@@ -97,6 +188,8 @@ ioc_writex(size_t len, off_t position, struct iof_wb *wb,
 	   struct iof_file_handle *handle)
 {
 	struct iof_writex_in *in = crt_req_get(wb->rpc);
+	struct ioc_write_wait *wait = wb->wait;
+	fuse_req_t req = wb->req;
 	int rc;
 
 	IOF_TRACE_LINK(wb->rpc, wb->req, "writex_rpc");
@@ -117,7 +210,7 @@ ioc_writex(size_t len, off_t position, struct iof_wb *wb,
 		d_iov_set(&in->data, wb->lb.buf, len);
 	} else {
 		in->bulk_len = len;
-		in->data_bulk = wb->lb.handle;
+		in->data_bulk = wb->bulk ? wb->bulk : wb->lb.handle;
 	}
 
 	in->xtvec.xt_off = position;
@@ -132,8 +225,354 @@ ioc_writex(size_t len, off_t position, struct iof_wb *wb,
 	return;
 
 err:
-	IOF_FUSE_REPLY_ERR(wb->req, rc);
-	iof_pool_release(handle->fs_handle->write_pool, wb);
+	if (!req)
+		wb_complete(handle, wb, rc);
+	iof_pool_release(wb->pt, wb);
+	if (req)
+		IOF_FUSE_REPLY_ERR(req, rc);
+	write_wake(wait);
+}
+
+/* Send a write from the buffer supplied by FUSE and wait for it to complete.
+ *
+ * Returns false without replying if the buffer cannot be used directly, in
+ * which case the caller should copy the data instead.
+ */
+static bool
+write_direct(struct iof_file_handle *handle, fuse_req_t req,
+	     struct fuse_bufvec *bufv, off_t position)
+{
+	struct iof_projection_info *fs_handle = handle->fs_handle;
+	struct ioc_write_wait wait = {0};
+	size_t len = bufv->buf[0].size;
+	void *buff = bufv->buf[0].mem;
+	crt_bulk_t bulk;
+	struct iof_wb *wb;
+
+	/* Spliced data arrives in a pipe rather than memory so can only be
+	 * copied.
+	 */
+	if (bufv->count != 1 || (bufv->buf[0].flags & FUSE_BUF_IS_FD))
+		return false;
+
+	if (!(fs_handle->flags & IOF_CNSS_MT) ||
+	    len <= fs_handle->proj.max_iov_write)
+		return false;
+
+	if (!iof_bulk_thread_register(fs_handle->proj.crt_ctx, buff, len,
+				      &bulk))
+		return false;
+
+	/* Only the RPC is needed so use the smallest buffer class */
+	wb = ioc_wb_acquire(fs_handle, 0);
+	if (!wb)
+		return false;
+
+	IOF_TRACE_UP(wb, handle, "writedirect");
+	IOF_TRACE_UP(req, wb, "write_direct_fuse_req");
+
+	IOF_TRACE_INFO(req, "%#zx-%#zx " GAH_PRINT_STR, position,
+		       position + len - 1, GAH_PRINT_VAL(handle->common.gah));
+
+	D_MUTEX_INIT(&wait.lock, NULL);
+	pthread_cond_init(&wait.cond, NULL);
+
+	wb->req = req;
+	wb->handle = handle;
+	wb->bulk = bulk;
+	wb->wait = &wait;
+
+	STAT_ADD(fs_handle->stats, write_direct);
+	ioc_writex(len, position, wb, handle);
+
+	D_MUTEX_LOCK(&wait.lock);
+	while (!wait.done)
+		pthread_cond_wait(&wait.cond, &wait.lock);
+	D_MUTEX_UNLOCK(&wait.lock);
+
+	/* As for pooled buffers, do not reuse the registration after any
+	 * non-I/O error.
+	 */
+	if (wait.failure)
+		iof_bulk_thread_deregister();
+
+	pthread_cond_destroy(&wait.cond);
+	D_MUTEX_DESTROY(&wait.lock);
+	return true;
+}
+
+/* Detach the dirty extent so it can be sent, called with the write-back lock
+ * held.
+ */
+static void
+wb_detach(struct ioc_writeback *wbc, struct wb_extent *ext)
+{
+	ext->wb = wbc->dirty;
+	if (!ext->wb)
+		return;
+
+	ext->offset = wbc->offset;
+	ext->len = wbc->len;
+	ext->wb->wb_offset = wbc->offset;
+	ext->wb->wb_len = wbc->len;
+	d_list_add_tail(&ext->wb->wb_list, &wbc->sent);
+	wbc->dirty = NULL;
+	wbc->len = 0;
+	wbc->inflight++;
+}
+
+/* Check if a range overlaps any extent which has been detached, before stop
+ * if set, and has not yet completed.  Called with the write-back lock held.
+ */
+static bool
+wb_sent_overlaps(struct ioc_writeback *wbc, struct iof_wb *stop,
+		 off_t offset, size_t len)
+{
+	struct iof_wb *prev;
+
+	d_list_for_each_entry(prev, &wbc->sent, wb_list) {
+		if (prev == stop)
+			break;
+		if (prev->wb_offset < offset + (off_t)len &&
+		    offset < prev->wb_offset + (off_t)prev->wb_len)
+			return true;
+	}
+	return false;
+}
+
+/* Check if an extent overlaps one detached before it which has not yet
+ * completed, called with the write-back lock held.
+ */
+static bool
+wb_overlaps(struct ioc_writeback *wbc, struct iof_wb *wb)
+{
+	return wb_sent_overlaps(wbc, wb, wb->wb_offset, wb->wb_len);
+}
+
+/* Send a detached extent, called without the write-back lock */
+static void
+wb_send(struct iof_file_handle *handle, struct wb_extent *ext)
+{
+	struct ioc_writeback *wbc = &handle->wb;
+
+	if (!ext->wb)
+		return;
+
+	D_MUTEX_LOCK(&wbc->lock);
+	while (wb_overlaps(wbc, ext->wb))
+		pthread_cond_wait(&wbc->cond, &wbc->lock);
+	D_MUTEX_UNLOCK(&wbc->lock);
+
+	STAT_ADD(handle->fs_handle->stats, write_back);
+	ioc_writex(ext->len, ext->offset, ext->wb, handle);
+}
+
+int
+ioc_wb_sync(struct iof_file_handle *handle, bool report)
+{
+	struct ioc_writeback *wbc = &handle->wb;
+	struct wb_extent ext = {0};
+	int rc = 0;
+
+	if (!(handle->fs_handle->flags & IOF_WRITEBACK_CACHE))
+		return 0;
+
+	D_MUTEX_LOCK(&wbc->lock);
+	wb_detach(wbc, &ext);
+	D_MUTEX_UNLOCK(&wbc->lock);
+
+	wb_send(handle, &ext);
+
+	D_MUTEX_LOCK(&wbc->lock);
+	while (wbc->inflight > 0)
+		pthread_cond_wait(&wbc->cond, &wbc->lock);
+	if (report) {
+		rc = wbc->error;
+		wbc->error = 0;
+	}
+	D_MUTEX_UNLOCK(&wbc->lock);
+
+	return rc;
+}
+
+void
+ioc_wb_sync_range(struct iof_file_handle *handle, off_t offset, size_t len)
+{
+	struct ioc_writeback *wbc = &handle->wb;
+	struct wb_extent ext = {0};
+
+	if (!(handle->fs_handle->flags & IOF_WRITEBACK_CACHE))
+		return;
+
+	D_MUTEX_LOCK(&wbc->lock);
+	if (wbc->dirty && wbc->offset < offset + (off_t)len &&
+	    offset < wbc->offset + (off_t)wbc->len)
+		wb_detach(wbc, &ext);
+	D_MUTEX_UNLOCK(&wbc->lock);
+
+	wb_send(handle, &ext);
+
+	D_MUTEX_LOCK(&wbc->lock);
+	while (wb_sent_overlaps(wbc, NULL, offset, len))
+		pthread_cond_wait(&wbc->cond, &wbc->lock);
+	D_MUTEX_UNLOCK(&wbc->lock);
+}
+
+int
+ioc_wb_sync_ino(struct iof_projection_info *fs_handle, fuse_ino_t ino,
+		struct iof_file_handle *handle, bool report)
+{
+	struct iof_file_handle **fhs = NULL;
+	struct iof_file_handle *fh;
+	struct ioc_inode_entry *ie;
+	d_list_t *rlink;
+	int count = 0;
+	int rc = 0;
+	int i;
+
+	if (!(fs_handle->flags & IOF_WRITEBACK_CACHE))
+		return 0;
+
+	/* Take a reference on the other handles of the inode, so that they
+	 * are not released whilst being synced without holding of_lock.
+	 */
+	rlink = d_hash_rec_find(&fs_handle->inode_ht, &ino, sizeof(ino));
+	if (rlink) {
+		ie = container_of(rlink, struct ioc_inode_entry, ie_htl);
+
+		D_MUTEX_LOCK(&fs_handle->of_lock);
+		d_list_for_each_entry(fh, &ie->ie_fh_list, fh_ino_list)
+			count++;
+
+		if (count) {
+			D_ALLOC_ARRAY(fhs, count);
+			if (!fhs)
+				rc = ENOMEM;
+		}
+
+		count = 0;
+		if (fhs) {
+			d_list_for_each_entry(fh, &ie->ie_fh_list,
+					      fh_ino_list) {
+				if (fh == handle)
+					continue;
+				D_MUTEX_LOCK(&fh->wb.lock);
+				fh->wb.users++;
+				D_MUTEX_UNLOCK(&fh->wb.lock);
+				fhs[count++] = fh;
+			}
+		}
+		D_MUTEX_UNLOCK(&fs_handle->of_lock);
+
+		d_hash_rec_decref(&fs_handle->inode_ht, rlink);
+	}
+
+	for (i = 0; i < count; i++) {
+		fh = fhs[i];
+		ioc_wb_sync(fh, false);
+
+		D_MUTEX_LOCK(&fh->wb.lock);
+		fh->wb.users--;
+		pthread_cond_broadcast(&fh->wb.cond);
+		D_MUTEX_UNLOCK(&fh->wb.lock);
+	}
+	D_FREE(fhs);
+
+	if (handle) {
+		i = ioc_wb_sync(handle, report);
+		if (i)
+			rc = i;
+	}
+
+	return rc;
+}
+
+/* Add a write to the dirty extent of a file and reply to it, the data is
+ * either in buff or bufv.
+ */
+static void
+wb_write(struct iof_file_handle *handle, fuse_req_t req, const char *buff,
+	 struct fuse_bufvec *bufv, size_t len, off_t position)
+{
+	struct iof_projection_info *fs_handle = handle->fs_handle;
+	struct ioc_writeback *wbc = &handle->wb;
+	struct wb_extent ext = {0};
+	struct fuse_bufvec dst = { .count = 1 };
+	char *buf;
+	int rc = 0;
+
+	D_MUTEX_LOCK(&wbc->lock);
+
+retry:
+	if (wbc->error) {
+		rc = wbc->error;
+		wbc->error = 0;
+		D_GOTO(out, 0);
+	}
+
+	if (wbc->dirty && position == wbc->offset + (off_t)wbc->len &&
+	    wbc->len + len <= fs_handle->proj.max_write) {
+		STAT_ADD(fs_handle->stats, write_merged);
+	} else {
+		if (wbc->dirty) {
+			wb_detach(wbc, &ext);
+			D_MUTEX_UNLOCK(&wbc->lock);
+			wb_send(handle, &ext);
+			ext.wb = NULL;
+			D_MUTEX_LOCK(&wbc->lock);
+			goto retry;
+		}
+
+		while (wbc->inflight >= IOC_WB_INFLIGHT)
+			pthread_cond_wait(&wbc->cond, &wbc->lock);
+
+		/* Another write may have started an extent while waiting */
+		if (wbc->dirty)
+			goto retry;
+
+		wbc->dirty = ioc_wb_acquire(fs_handle,
+					    fs_handle->proj.max_write);
+		if (!wbc->dirty)
+			D_GOTO(out, rc = ENOMEM);
+		IOF_TRACE_UP(wbc->dirty, handle, "writeback");
+		wbc->dirty->req = NULL;
+		wbc->dirty->handle = handle;
+		wbc->offset = position;
+		wbc->len = 0;
+	}
+
+	buf = (char *)wbc->dirty->lb.buf + wbc->len;
+	if (bufv) {
+		dst.buf[0].size = len;
+		dst.buf[0].mem = buf;
+		if (fuse_buf_copy(&dst, bufv, 0) != len) {
+			if (wbc->len == 0) {
+				iof_pool_release(wbc->dirty->pt,
+						 wbc->dirty);
+				wbc->dirty = NULL;
+			}
+			D_GOTO(out, rc = EIO);
+		}
+	} else {
+		memcpy(buf, buff, len);
+	}
+	wbc->len += len;
+
+	if (wbc->len == fs_handle->proj.max_write)
+		wb_detach(wbc, &ext);
+
+out:
+	D_MUTEX_UNLOCK(&wbc->lock);
+
+	wb_send(handle, &ext);
+
+	if (rc) {
+		IOF_FUSE_REPLY_ERR(req, rc);
+		return;
+	}
+
+	STAT_ADD_COUNT(fs_handle->stats, write_bytes, len);
+	IOF_FUSE_REPLY_WRITE(req, len);
 }
 
 void ioc_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buff, size_t len,
@@ -145,6 +584,9 @@ void ioc_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buff, size_t len,
 
 	STAT_ADD(handle->fs_handle->stats, write);
 
+	/* Any data prefetched for this file may now be stale */
+	ioc_ra_invalidate_ino(handle->fs_handle, handle->inode_no);
+
 	if (FS_IS_OFFLINE(handle->fs_handle))
 		D_GOTO(err, rc = handle->fs_handle->offline_reason);
 
@@ -154,7 +596,12 @@ void ioc_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buff, size_t len,
 	if (!F_GAH_IS_VALID(handle))
 		D_GOTO(err, rc = EIO);
 
-	wb = iof_pool_acquire(handle->fs_handle->write_pool);
+	if (handle->fs_handle->flags & IOF_WRITEBACK_CACHE) {
+		wb_write(handle, req, buff, NULL, len, position);
+		return;
+	}
+
+	wb = ioc_wb_acquire(handle->fs_handle, len);
 	if (!wb)
 		D_GOTO(err, rc = ENOMEM);
 
@@ -175,7 +622,7 @@ void ioc_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buff, size_t len,
 err:
 	IOF_FUSE_REPLY_ERR(req, rc);
 	if (wb)
-		iof_pool_release(handle->fs_handle->write_pool, wb);
+		iof_pool_release(wb->pt, wb);
 }
 
 /*
@@ -195,6 +642,9 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 
 	STAT_ADD(handle->fs_handle->stats, write);
 
+	/* Any data prefetched for this file may now be stale */
+	ioc_ra_invalidate_ino(handle->fs_handle, handle->inode_no);
+
 	if (FS_IS_OFFLINE(handle->fs_handle))
 		D_GOTO(err, rc = handle->fs_handle->offline_reason);
 
@@ -214,7 +664,18 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 	IOF_TRACE_INFO(handle, "Count %zi [0].flags %#x",
 		       bufv->count, bufv->buf[0].flags);
 
-	wb = iof_pool_acquire(handle->fs_handle->write_pool);
+	if (handle->fs_handle->flags & IOF_WRITEBACK_CACHE) {
+		wb_write(handle, req, NULL, bufv, len, position);
+		return;
+	}
+
+	/* Only write_buf() is used for zero-copy as otherwise libfuse may pass
+	 * a temporary buffer, rather than the one it receives into.
+	 */
+	if (write_direct(handle, req, bufv, position))
+		return;
+
+	wb = ioc_wb_acquire(handle->fs_handle, len);
 	if (!wb)
 		D_GOTO(err, rc = ENOMEM);
 	IOF_TRACE_UP(wb, handle, "writebuf");
@@ -238,5 +699,21 @@ void ioc_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
 err:
 	IOF_FUSE_REPLY_ERR(req, rc);
 	if (wb)
-		iof_pool_release(handle->fs_handle->write_pool, wb);
+		iof_pool_release(wb->pt, wb);
+}
+
+void ioc_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct iof_file_handle *handle = (struct iof_file_handle *)fi->fh;
+	int rc;
+
+	STAT_ADD(handle->fs_handle->stats, flush);
+
+	IOF_TRACE_UP(req, handle, "flush");
+
+	rc = ioc_wb_sync_ino(handle->fs_handle, ino, handle, true);
+	if (rc)
+		IOF_FUSE_REPLY_ERR(req, rc);
+	else
+		IOF_FUSE_REPLY_ZERO(req);
 }
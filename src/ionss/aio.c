@@ -0,0 +1,317 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "iof_common.h"
+#include "ionss.h"
+#include "log.h"
+
+/* Number of submission queue entries, enough for every buffer of every
+ * active descriptor of several projections.
+ */
+#define IOS_AIO_ENTRIES (256)
+
+struct ios_aio {
+#ifdef HAVE_LIBURING
+	struct io_uring		ring;
+	pthread_t		thread;
+#endif
+	/* Protects the submission queue and counters */
+	pthread_mutex_t		lock;
+	uint64_t		submitted;
+	uint64_t		completed;
+	/* Operations performed synchronously as the queue was full */
+	uint64_t		fallback;
+	bool			stop;
+};
+
+/* Perform an operation synchronously and invoke the callback */
+static void
+aio_sync(struct ios_aio_op *op)
+{
+	ssize_t rc;
+
+	errno = 0;
+	switch (op->opcode) {
+	case IOS_AIO_READ:
+		rc = pread(op->fd, op->buf, op->len, op->offset);
+		break;
+	case IOS_AIO_WRITE:
+		rc = pwrite(op->fd, op->buf, op->len, op->offset);
+		break;
+	case IOS_AIO_FSYNC:
+		rc = fsync(op->fd);
+		break;
+	case IOS_AIO_FDATASYNC:
+		rc = fdatasync(op->fd);
+		break;
+	default:
+		rc = -1;
+		errno = EINVAL;
+	}
+
+	if (rc == -1)
+		rc = -errno;
+
+	op->cb(op, rc);
+}
+
+#ifdef HAVE_LIBURING
+
+/* User data for entries which are ignored on completion.  Used to replace an
+ * entry which could not be submitted, as it stays on the submission queue and
+ * will be passed to the kernel by the next submit call.
+ */
+static char aio_ignore;
+
+/* Completion thread
+ *
+ * Waits for completions and invokes the callback for each, until shutdown
+ * has been requested and all submitted operations have completed.
+ */
+static void *
+aio_reaper(void *arg)
+{
+	struct ios_aio *aio = arg;
+	struct io_uring_cqe *cqe;
+	struct ios_aio_op *op;
+	ssize_t res;
+	bool done = false;
+	int rc;
+
+	while (!done) {
+		rc = io_uring_wait_cqe(&aio->ring, &cqe);
+		if (rc == -EINTR)
+			continue;
+		if (rc) {
+			IOF_TRACE_ERROR(aio, "Failed to wait for completion %d",
+					rc);
+			break;
+		}
+
+		op = io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&aio->ring, cqe);
+
+		if (op == (void *)&aio_ignore)
+			continue;
+
+		D_MUTEX_LOCK(&aio->lock);
+		if (op)
+			aio->completed++;
+		else
+			aio->stop = true;
+		done = aio->stop && aio->completed == aio->submitted;
+		D_MUTEX_UNLOCK(&aio->lock);
+
+		if (op)
+			op->cb(op, res);
+	}
+
+	IOF_TRACE_DEBUG(aio, "Completion thread exiting");
+	return NULL;
+}
+
+int ios_aio_init(struct ios_base *base)
+{
+	struct ios_aio *aio;
+	int rc;
+
+	if (!base->io_uring)
+		return -DER_SUCCESS;
+
+	D_ALLOC_PTR(aio);
+	if (!aio)
+		return -DER_NOMEM;
+
+	rc = D_MUTEX_INIT(&aio->lock, NULL);
+	if (rc != -DER_SUCCESS)
+		D_GOTO(free, rc);
+
+	rc = io_uring_queue_init(IOS_AIO_ENTRIES, &aio->ring, 0);
+	if (rc) {
+		/* Not fatal, continue with synchronous i/o */
+		IOF_LOG_WARNING("io_uring not available %d, using sync i/o",
+				rc);
+		D_GOTO(destroy, rc = -DER_SUCCESS);
+	}
+
+	rc = pthread_create(&aio->thread, NULL, aio_reaper, aio);
+	if (rc) {
+		IOF_LOG_ERROR("Could not start completion thread %d", rc);
+		io_uring_queue_exit(&aio->ring);
+		D_GOTO(destroy, rc = -DER_MISC);
+	}
+
+	IOF_TRACE_UP(aio, base, "aio");
+	IOF_TRACE_INFO(aio, "Using io_uring, %d entries", IOS_AIO_ENTRIES);
+	base->aio = aio;
+	return -DER_SUCCESS;
+
+destroy:
+	D_MUTEX_DESTROY(&aio->lock);
+free:
+	D_FREE(aio);
+	return rc;
+}
+
+void ios_aio_fini(struct ios_base *base)
+{
+	struct ios_aio *aio = base->aio;
+	struct io_uring_sqe *sqe;
+
+	if (!aio)
+		return;
+
+	/* Submit an empty operation to wake the completion thread, which
+	 * will exit once any outstanding operations have completed.
+	 */
+	D_MUTEX_LOCK(&aio->lock);
+	sqe = io_uring_get_sqe(&aio->ring);
+	if (!sqe) {
+		io_uring_submit(&aio->ring);
+		sqe = io_uring_get_sqe(&aio->ring);
+	}
+	if (sqe) {
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data(sqe, NULL);
+		io_uring_submit(&aio->ring);
+	}
+	D_MUTEX_UNLOCK(&aio->lock);
+
+	if (sqe)
+		pthread_join(aio->thread, NULL);
+	else
+		IOF_TRACE_ERROR(aio, "Could not stop completion thread");
+
+	IOF_TRACE_INFO(aio, "Submitted %lu completed %lu fallback %lu",
+		       aio->submitted, aio->completed, aio->fallback);
+
+	if (sqe)
+		io_uring_queue_exit(&aio->ring);
+	D_MUTEX_DESTROY(&aio->lock);
+	IOF_TRACE_DOWN(aio);
+	D_FREE(aio);
+	base->aio = NULL;
+}
+
+void ios_aio_submit(struct ios_base *base, struct ios_aio_op *op)
+{
+	struct ios_aio *aio = base->aio;
+	struct io_uring_sqe *sqe;
+	int rc;
+
+	if (!aio) {
+		aio_sync(op);
+		return;
+	}
+
+	D_MUTEX_LOCK(&aio->lock);
+	sqe = io_uring_get_sqe(&aio->ring);
+	if (!sqe) {
+		/* Flush any pending entries and try again */
+		io_uring_submit(&aio->ring);
+		sqe = io_uring_get_sqe(&aio->ring);
+	}
+	if (!sqe) {
+		aio->fallback++;
+		D_MUTEX_UNLOCK(&aio->lock);
+		aio_sync(op);
+		return;
+	}
+
+	switch (op->opcode) {
+	case IOS_AIO_READ:
+		io_uring_prep_read(sqe, op->fd, op->buf, op->len, op->offset);
+		break;
+	case IOS_AIO_WRITE:
+		io_uring_prep_write(sqe, op->fd, op->buf, op->len, op->offset);
+		break;
+	case IOS_AIO_FSYNC:
+		io_uring_prep_fsync(sqe, op->fd, 0);
+		break;
+	case IOS_AIO_FDATASYNC:
+		io_uring_prep_fsync(sqe, op->fd, IORING_FSYNC_DATASYNC);
+		break;
+	}
+	io_uring_sqe_set_data(sqe, op);
+	aio->submitted++;
+
+	rc = io_uring_submit(&aio->ring);
+	if (rc >= 0) {
+		D_MUTEX_UNLOCK(&aio->lock);
+		return;
+	}
+
+	/* The entry was not accepted, so neuter it and perform the operation
+	 * synchronously instead.
+	 */
+	IOF_TRACE_ERROR(aio, "Failed to submit %d, using sync i/o", rc);
+	io_uring_prep_nop(sqe);
+	io_uring_sqe_set_data(sqe, &aio_ignore);
+	aio->submitted--;
+	aio->fallback++;
+	D_MUTEX_UNLOCK(&aio->lock);
+
+	aio_sync(op);
+}
+
+#else /* HAVE_LIBURING */
+
+int ios_aio_init(struct ios_base *base)
+{
+	if (base->io_uring)
+		IOF_LOG_WARNING("Built without io_uring, using sync i/o");
+
+	return -DER_SUCCESS;
+}
+
+void ios_aio_fini(struct ios_base *base)
+{
+}
+
+void ios_aio_submit(struct ios_base *base, struct ios_aio_op *op)
+{
+	aio_sync(op);
+}
+
+#endif /* HAVE_LIBURING */
@@ -72,9 +72,22 @@
 	X(max_read_count, set_decimal)		\
 	X(max_write_count, set_decimal)		\
 	X(inode_htable_size, set_decimal)	\
+	X(readahead_count, set_decimal)		\
+	X(readahead_cache_size, set_size)	\
+	X(io_depth, set_decimal)		\
+	X(meta_threads, set_decimal)		\
+	X(fd_cache_size, set_decimal)		\
+	X(dircache_size, set_size)		\
+	X(dircache_ttl, set_decimal)		\
+	X(entry_timeout, set_decimal)		\
+	X(attr_timeout, set_decimal)		\
+	X(negative_timeout, set_decimal)	\
 	X(cnss_threads, set_flag)		\
 	X(fuse_read_buf, set_flag)		\
 	X(fuse_write_buf, set_flag)		\
+	X(cache_readdir, set_flag)		\
+	X(writeback_cache, set_flag)		\
+	X(pool_thread, set_flag)		\
 	X(failover, set_feature)		\
 	X(writeable, set_feature)
 
@@ -83,7 +96,8 @@
 	X(poll_interval, set_decimal)		\
 	X(cnss_poll_interval, set_decimal)	\
 	X(thread_count, set_decimal)		\
-	X(progress_callback, set_flag)
+	X(progress_callback, set_flag)		\
+	X(io_uring, set_flag)
 
 #define PROJ_OPTIONS				\
 	X(full_path, set_string, false)		\
@@ -100,6 +114,7 @@ const uint32_t	default_thread_count		= 2;
 const uint32_t	default_poll_interval		= (1000 * 1000);
 const uint32_t	default_cnss_poll_interval	= (1);
 const bool	default_progress_callback	= true;
+const bool	default_io_uring		= false;
 const uint32_t	default_readdir_size		= (64 * 1024);
 const uint32_t	default_max_read_size		= (1024 * 1024);
 const uint32_t	default_max_write_size		= (1024 * 1024);
@@ -108,9 +123,22 @@ const uint32_t	default_max_iov_write_size	= 64;
 const uint32_t	default_max_read_count		= 3;
 const uint32_t	default_max_write_count		= 3;
 const uint32_t	default_inode_htable_size	= 5;
+const uint32_t	default_readahead_count		= 2;
+const uint32_t	default_readahead_cache_size	= (16 * 1024 * 1024);
+const uint32_t	default_io_depth		= 2;
+const uint32_t	default_meta_threads		= 4;
+const uint32_t	default_fd_cache_size		= (64 * 1024);
+const uint32_t	default_dircache_size		= (16 * 1024 * 1024);
+const uint32_t	default_dircache_ttl		= 5;
+const uint32_t	default_entry_timeout		= 0;
+const uint32_t	default_attr_timeout		= 0;
+const uint32_t	default_negative_timeout	= 0;
 const bool	default_cnss_threads		= true;
 const bool	default_fuse_read_buf		= true;
 const bool	default_fuse_write_buf		= true;
+const bool	default_cache_readdir		= false;
+const bool	default_writeback_cache		= false;
+const bool	default_pool_thread		= false;
 const bool	default_failover		= true;
 const bool	default_writeable		= true;
 
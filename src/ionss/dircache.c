@@ -0,0 +1,533 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "iof_common.h"
+#include "ionss.h"
+#include "log.h"
+
+enum ios_dir_snap_state {
+	DS_BUILDING,
+	DS_VALID,
+	/* The directory was too large to cache, so readers should stream
+	 * it instead.  Kept in the cache so that repeated opens do not
+	 * rescan up to the limit each time.
+	 */
+	DS_TOO_LARGE,
+};
+
+/* A single cached directory entry.  Names are stored in a separate buffer
+ * so that short names do not pay for NAME_MAX bytes each.
+ */
+struct ios_dir_ent {
+	struct stat		stat;
+	int			stat_rc;
+	uint32_t		name_off;
+};
+
+/* Snapshot of the contents of a directory, plus attributes of each entry.
+ *
+ * Snapshots are immutable once built and are reference counted, with one
+ * reference held by the cache and one by each directory handle reading from
+ * it, so a handle continues to see a consistent view after the snapshot is
+ * replaced or evicted.  The offset used for each entry is its index in the
+ * snapshot, so seeking is simply an array lookup.
+ *
+ * ref and list are protected by the cache lock.
+ */
+struct ios_dir_snap {
+	d_list_t		list;
+	ino_t			inode_no;
+	struct timespec		mtime;
+	struct timespec		ctime;
+	uint64_t		created;
+	uint32_t		ref;
+	enum ios_dir_snap_state	state;
+	bool			cached;
+	/* Set if the directory was modified whilst being scanned */
+	bool			discard;
+	uint32_t		count;
+	uint32_t		ent_max;
+	struct ios_dir_ent	*ents;
+	char			*names;
+	size_t			names_len;
+	size_t			names_max;
+	size_t			size;
+};
+
+static uint64_t
+dc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool
+dc_same_time(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void
+dc_free(struct ios_dir_snap *snap)
+{
+	D_FREE(snap->ents);
+	D_FREE(snap->names);
+	D_FREE(snap);
+}
+
+/* Drop a reference on a snapshot, freeing it if this was the last.
+ *
+ * Should be called with the cache lock held.
+ */
+static void
+dc_decref(struct ios_dir_snap *snap)
+{
+	D_ASSERTF(snap->ref > 0, "snapshot %p ref 0", snap);
+	if (--snap->ref == 0)
+		dc_free(snap);
+}
+
+/* Remove a snapshot from the cache, releasing the cache reference.
+ *
+ * Should be called with the cache lock held.
+ */
+static void
+dc_unlink(struct ios_dir_cache *cache, struct ios_dir_snap *snap)
+{
+	if (!snap->cached)
+		return;
+
+	d_list_del_init(&snap->list);
+	snap->cached = false;
+	cache->bytes -= snap->size;
+	dc_decref(snap);
+}
+
+/* Should be called with the cache lock held */
+static struct ios_dir_snap *
+dc_find(struct ios_dir_cache *cache, ino_t inode_no)
+{
+	struct ios_dir_snap *snap;
+
+	d_list_for_each_entry(snap, &cache->lru, list) {
+		if (snap->inode_no == inode_no)
+			return snap;
+	}
+	return NULL;
+}
+
+/* Evict least recently used snapshots until the cache is within budget.
+ *
+ * Should be called with the cache lock held.
+ */
+static void
+dc_evict(struct ios_dir_cache *cache)
+{
+	struct ios_dir_snap *snap;
+	struct ios_dir_snap *victim;
+
+	while (cache->bytes > cache->max_bytes) {
+		victim = NULL;
+		d_list_for_each_entry_reverse(snap, &cache->lru, list) {
+			if (snap->state != DS_BUILDING) {
+				victim = snap;
+				break;
+			}
+		}
+		if (!victim)
+			break;
+
+		cache->evictions++;
+		dc_unlink(cache, victim);
+	}
+}
+
+static int
+dc_add_entry(struct ios_dir_snap *snap, const char *name, size_t limit)
+{
+	struct ios_dir_ent *ents;
+	char *names;
+	size_t len = strlen(name) + 1;
+	uint32_t ent_max;
+	size_t names_max;
+
+	if (snap->count == snap->ent_max) {
+		ent_max = snap->ent_max ? snap->ent_max * 2 : 64;
+		D_REALLOC(ents, snap->ents, ent_max * sizeof(*ents));
+		if (!ents)
+			return -DER_NOMEM;
+		snap->ents = ents;
+		snap->ent_max = ent_max;
+	}
+
+	if (snap->names_len + len > snap->names_max) {
+		names_max = snap->names_max ? snap->names_max * 2 : 4096;
+		while (names_max < snap->names_len + len)
+			names_max *= 2;
+		D_REALLOC(names, snap->names, names_max);
+		if (!names)
+			return -DER_NOMEM;
+		snap->names = names;
+		snap->names_max = names_max;
+	}
+
+	snap->size = sizeof(*snap) + snap->ent_max * sizeof(*snap->ents) +
+		snap->names_max;
+	if (snap->size > limit)
+		return -DER_OVERFLOW;
+
+	memcpy(snap->names + snap->names_len, name, len);
+	snap->ents[snap->count].name_off = snap->names_len;
+	snap->ents[snap->count].stat_rc = 0;
+	snap->names_len += len;
+	snap->count++;
+	return -DER_SUCCESS;
+}
+
+struct dc_stat_batch {
+	struct ios_dir_snap	*snap;
+	int			fd;
+};
+
+static void
+dc_stat_one(void *arg, int i)
+{
+	struct dc_stat_batch *sb = arg;
+	struct ios_dir_ent *ent = &sb->snap->ents[i];
+
+	if (fstatat(sb->fd, sb->snap->names + ent->name_off, &ent->stat,
+		    AT_SYMLINK_NOFOLLOW) != 0)
+		ent->stat_rc = errno;
+}
+
+/* Read the entire directory, and the attributes of every entry, into the
+ * snapshot.  Attributes are fetched in parallel once all names are known.
+ * The directory stream is left rewound to the start.
+ */
+static int
+dc_scan(struct ionss_dir_handle *handle, struct ios_dir_snap *snap,
+	size_t limit)
+{
+	struct dc_stat_batch sb;
+	struct dirent *dir_entry;
+	int rc = -DER_SUCCESS;
+
+	rewinddir(handle->h_dir);
+
+	while (1) {
+		errno = 0;
+		dir_entry = readdir(handle->h_dir);
+		if (!dir_entry) {
+			if (errno != 0)
+				rc = -DER_MISC;
+			break;
+		}
+
+		if (strncmp(".", dir_entry->d_name, 2) == 0)
+			continue;
+
+		if (strncmp("..", dir_entry->d_name, 3) == 0)
+			continue;
+
+		rc = dc_add_entry(snap, dir_entry->d_name, limit);
+		if (rc != -DER_SUCCESS)
+			break;
+	}
+
+	rewinddir(handle->h_dir);
+	handle->offset = 0;
+
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	sb.snap = snap;
+	sb.fd = handle->fd;
+	ios_meta_parallel(handle->projection, snap->count, dc_stat_one, &sb);
+
+	return -DER_SUCCESS;
+}
+
+int ios_dir_cache_init(struct ios_projection *projection)
+{
+	struct ios_dir_cache *cache = &projection->dir_cache;
+	int rc;
+
+	D_INIT_LIST_HEAD(&cache->lru);
+	cache->bytes = 0;
+	cache->max_bytes = projection->dircache_size;
+	cache->ttl = projection->dircache_ttl * 1000000000ULL;
+
+	rc = D_MUTEX_INIT(&cache->lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	rc = pthread_cond_init(&cache->cond, NULL);
+	if (rc != 0) {
+		pthread_mutex_destroy(&cache->lock);
+		return -DER_NOMEM;
+	}
+
+	IOF_TRACE_INFO(projection, "Directory cache %zi bytes, ttl %us",
+		       cache->max_bytes, projection->dircache_ttl);
+
+	return -DER_SUCCESS;
+}
+
+void ios_dir_cache_fini(struct ios_projection *projection)
+{
+	struct ios_dir_cache *cache = &projection->dir_cache;
+	struct ios_dir_snap *snap, *next;
+
+	IOF_TRACE_INFO(projection,
+		       "Directory cache hits %lu misses %lu waits %lu "
+		       "scans %lu too large %lu evictions %lu "
+		       "invalidations %lu",
+		       cache->hits, cache->misses, cache->waits, cache->scans,
+		       cache->too_large, cache->evictions,
+		       cache->invalidations);
+
+	/* Directory handles still open at shutdown hold references to their
+	 * snapshots and are not closed, so release only the cache reference
+	 * here.
+	 */
+	d_list_for_each_entry_safe(snap, next, &cache->lru, list)
+		dc_unlink(cache, snap);
+
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+struct ios_dir_snap *
+ios_dir_cache_get(struct ionss_dir_handle *handle)
+{
+	struct ios_projection *projection = handle->projection;
+	struct ios_dir_cache *cache = &projection->dir_cache;
+	struct ios_dir_snap *snap;
+	struct stat before;
+	struct stat after;
+	uint64_t now;
+	int rc;
+
+	if (cache->max_bytes == 0)
+		return NULL;
+
+	if (fstat(handle->fd, &before) != 0)
+		return NULL;
+
+	now = dc_now();
+
+	D_MUTEX_LOCK(&cache->lock);
+
+	snap = dc_find(cache, before.st_ino);
+	if (snap && snap->state == DS_BUILDING) {
+		/* Another handle is scanning this directory, so wait for it
+		 * rather than scanning in parallel.
+		 */
+		cache->waits++;
+		snap->ref++;
+		while (snap->state == DS_BUILDING)
+			pthread_cond_wait(&cache->cond, &cache->lock);
+
+		if (snap->state == DS_VALID && !snap->discard) {
+			cache->hits++;
+			D_MUTEX_UNLOCK(&cache->lock);
+			return snap;
+		}
+
+		dc_decref(snap);
+		D_MUTEX_UNLOCK(&cache->lock);
+		return NULL;
+	}
+
+	if (snap) {
+		if (dc_same_time(&snap->mtime, &before.st_mtim) &&
+		    dc_same_time(&snap->ctime, &before.st_ctim) &&
+		    now - snap->created < cache->ttl) {
+			d_list_move(&snap->list, &cache->lru);
+			if (snap->state == DS_TOO_LARGE) {
+				D_MUTEX_UNLOCK(&cache->lock);
+				return NULL;
+			}
+			cache->hits++;
+			snap->ref++;
+			D_MUTEX_UNLOCK(&cache->lock);
+			return snap;
+		}
+		dc_unlink(cache, snap);
+	}
+
+	cache->misses++;
+
+	D_ALLOC_PTR(snap);
+	if (!snap) {
+		D_MUTEX_UNLOCK(&cache->lock);
+		return NULL;
+	}
+
+	snap->inode_no = before.st_ino;
+	snap->mtime = before.st_mtim;
+	snap->ctime = before.st_ctim;
+	snap->created = now;
+	snap->state = DS_BUILDING;
+	snap->size = sizeof(*snap);
+	/* One reference for the cache and one for the caller */
+	snap->ref = 2;
+	snap->cached = true;
+	d_list_add(&snap->list, &cache->lru);
+	cache->scans++;
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	/* A single directory may use up to half of the cache */
+	rc = dc_scan(handle, snap, cache->max_bytes / 2);
+
+	/* If the directory changed during the scan then the snapshot may
+	 * not match either state, so use it for this handle only.
+	 */
+	if (rc == -DER_SUCCESS &&
+	    (fstat(handle->fd, &after) != 0 ||
+	     !dc_same_time(&after.st_mtim, &before.st_mtim) ||
+	     !dc_same_time(&after.st_ctim, &before.st_ctim)))
+		snap->discard = true;
+
+	D_MUTEX_LOCK(&cache->lock);
+
+	if (rc != -DER_SUCCESS) {
+		IOF_TRACE_DEBUG(handle, "Not caching directory %lu, rc %d",
+				before.st_ino, rc);
+		D_FREE(snap->ents);
+		D_FREE(snap->names);
+		snap->count = 0;
+		snap->ent_max = 0;
+		snap->names_max = 0;
+		snap->size = sizeof(*snap);
+		snap->state = DS_TOO_LARGE;
+		if (rc == -DER_OVERFLOW)
+			cache->too_large++;
+		else
+			snap->discard = true;
+	} else {
+		snap->state = DS_VALID;
+		IOF_TRACE_DEBUG(handle, "Cached directory %lu, %u entries "
+				"%zi bytes", before.st_ino, snap->count,
+				snap->size);
+	}
+
+	pthread_cond_broadcast(&cache->cond);
+
+	if (snap->discard) {
+		dc_unlink(cache, snap);
+	} else {
+		cache->bytes += snap->size;
+		dc_evict(cache);
+	}
+
+	if (snap->state != DS_VALID) {
+		dc_decref(snap);
+		snap = NULL;
+	}
+
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	return snap;
+}
+
+void ios_dir_cache_put(struct ios_projection *projection,
+		       struct ios_dir_snap *snap)
+{
+	struct ios_dir_cache *cache = &projection->dir_cache;
+
+	D_MUTEX_LOCK(&cache->lock);
+	dc_decref(snap);
+	D_MUTEX_UNLOCK(&cache->lock);
+}
+
+int ios_dir_cache_fill(struct ios_dir_snap *snap, off_t offset,
+		       struct iof_readdir_reply *replies, int max_replies,
+		       bool *last)
+{
+	struct ios_dir_ent *ent;
+	int reply_idx = 0;
+	uint32_t idx;
+
+	if (offset < 0 || offset >= snap->count) {
+		*last = true;
+		return 0;
+	}
+
+	for (idx = offset; idx < snap->count && reply_idx < max_replies;
+	     idx++, reply_idx++) {
+		ent = &snap->ents[idx];
+		memset(&replies[reply_idx], 0, sizeof(replies[reply_idx]));
+		strncpy(replies[reply_idx].d_name,
+			snap->names + ent->name_off, NAME_MAX);
+		replies[reply_idx].stat = ent->stat;
+		replies[reply_idx].stat_rc = ent->stat_rc;
+		replies[reply_idx].nextoff = idx + 1;
+	}
+
+	*last = (idx >= snap->count);
+	return reply_idx;
+}
+
+void ios_dir_cache_invalidate(struct ios_projection *projection,
+			      ino_t inode_no)
+{
+	struct ios_dir_cache *cache = &projection->dir_cache;
+	struct ios_dir_snap *snap;
+
+	if (cache->max_bytes == 0)
+		return;
+
+	D_MUTEX_LOCK(&cache->lock);
+	snap = dc_find(cache, inode_no);
+	if (snap) {
+		cache->invalidations++;
+		if (snap->state == DS_BUILDING)
+			snap->discard = true;
+		else
+			dc_unlink(cache, snap);
+	}
+	D_MUTEX_UNLOCK(&cache->lock);
+}
@@ -36,6 +36,11 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "iof_common.h"
 #include "ionss.h"
 #include "log.h"
@@ -53,86 +58,112 @@ int ios_fh_alloc(struct ios_projection *projection,
 	if (!fh)
 		return -DER_NOMEM;
 
-	D_RWLOCK_WRLOCK(&base->gah_rwlock);
-
 	rc = ios_gah_allocate(base->gs, &fh->gah, fh);
 	if (rc) {
 		IOF_LOG_ERROR("Failed to acquire GAH %d", rc);
 		iof_pool_release(projection->fh_pool, fh);
-		D_RWLOCK_UNLOCK(&base->gah_rwlock);
 		return -DER_NOMEM;
 	}
 
 	*fhp = fh;
 
-	D_RWLOCK_UNLOCK(&base->gah_rwlock);
-
 	IOF_TRACE_INFO(fh, GAH_PRINT_FULL_STR, GAH_PRINT_FULL_VAL(fh->gah));
 
 	return 0;
 }
 
+/* Drop references on a file handle.
+ *
+ * This does not take any locks, the last reference is identified by the
+ * atomic update of the reference count, and only that caller closes the
+ * file and deallocates the GAH.
+ */
 void ios_fh_decref(struct ionss_file_handle *fh, int count)
 {
 	struct ios_projection *projection = fh->projection;
-	struct ios_base *base = base = projection->base;
+	struct ios_base *base = projection->base;
 	uint oldref;
 	int rc;
 
-	D_RWLOCK_WRLOCK(&base->gah_rwlock);
-
 	oldref = atomic_fetch_sub(&fh->ref, count);
 
-	D_ASSERTF(oldref != 0, "Unexpected fh refcount: %d\n", oldref);
+	D_ASSERTF(oldref >= count, "Unexpected fh refcount: %d\n", oldref);
 
 	IOF_TRACE_DEBUG(fh, GAH_PRINT_STR " decref %d to %d",
 			GAH_PRINT_VAL(fh->gah), count, oldref - count);
 
 	if (oldref != count)
-		D_GOTO(out, 0);
+		return;
+
+	if (fh->fd_cached) {
+		struct ios_fd_cache *cache = &projection->fd_cache;
+
+		D_MUTEX_LOCK(&cache->lock);
+		if (fh->fd != -1) {
+			d_list_del(&fh->fd_lru);
+			cache->open_count--;
+		}
+		fh->fd_cached = false;
+		D_MUTEX_UNLOCK(&cache->lock);
+	}
 
-	IOF_TRACE_DEBUG(fh, "Closing %d", fh->fd);
+	if (fh->fd != -1) {
+		IOF_TRACE_DEBUG(fh, "Closing %d", fh->fd);
 
-	rc = close(fh->fd);
-	if (rc != 0)
-		IOF_TRACE_ERROR(fh, "Failed to close file %d", fh->fd);
+		rc = close(fh->fd);
+		if (rc != 0)
+			IOF_TRACE_ERROR(fh, "Failed to close file %d", fh->fd);
+		fh->fd = -1;
+	}
 
 	rc = ios_gah_deallocate(base->gs, &fh->gah);
 	if (rc)
 		IOF_TRACE_ERROR(fh, "Failed to deallocate GAH %d", rc);
 
 	iof_pool_release(projection->fh_pool, fh);
-
-out:
-	D_RWLOCK_UNLOCK(&base->gah_rwlock);
 }
 
+/* Find a file handle from a GAH, and take a reference on it.
+ *
+ * The GAH lookup is lock-free so may race with the last reference being
+ * dropped.  File handles are pool descriptors so the memory remains valid,
+ * however a reference is only taken if the count is non-zero, and the GAH is
+ * then re-checked to ensure the handle was not recycled in the meantime.
+ */
 struct ionss_file_handle *
 ios_fh_find(struct ios_base *base, struct ios_gah *gah)
 {
 	struct ionss_file_handle *fh = NULL;
+	struct ionss_file_handle *check = NULL;
 	uint oldref;
 	int rc;
 
-	D_RWLOCK_RDLOCK(&base->gah_rwlock);
-
 	rc = ios_gah_get_info(base->gs, gah, (void **)&fh);
-	if (rc || !fh) {
-		IOF_TRACE_ERROR(&base,
-				"Failed to load fh from " GAH_PRINT_FULL_STR " %d -%s",
-				GAH_PRINT_FULL_VAL(*gah), rc, d_errstr(rc));
-		D_GOTO(out, fh = NULL);
+	if (rc || !fh)
+		D_GOTO(err, 0);
+
+	do {
+		oldref = atomic_load_consume(&fh->ref);
+		if (oldref == 0)
+			D_GOTO(err, rc = -DER_NONEXIST);
+	} while (!atomic_compare_exchange(&fh->ref, oldref, oldref + 1));
+
+	rc = ios_gah_get_info(base->gs, gah, (void **)&check);
+	if (rc || check != fh) {
+		ios_fh_decref(fh, 1);
+		D_GOTO(err, rc = rc ? rc : -DER_NONEXIST);
 	}
 
-	oldref = atomic_fetch_add(&fh->ref, 1);
-
 	IOF_TRACE_DEBUG(fh, GAH_PRINT_STR " addref to %d",
 			GAH_PRINT_VAL(fh->gah), oldref + 1);
 
-out:
-	D_RWLOCK_UNLOCK(&base->gah_rwlock);
-
 	return fh;
+
+err:
+	IOF_TRACE_ERROR(base,
+			"Failed to load fh from " GAH_PRINT_FULL_STR " %d -%s",
+			GAH_PRINT_FULL_VAL(*gah), rc, d_errstr(rc));
+	return NULL;
 }
 
 struct ionss_dir_handle *
@@ -141,8 +172,6 @@ ios_dirh_find(struct ios_base *base, struct ios_gah *gah)
 	struct ionss_dir_handle *dirh = NULL;
 	int rc;
 
-	D_RWLOCK_RDLOCK(&base->gah_rwlock);
-
 	rc = ios_gah_get_info(base->gs, gah, (void **)&dirh);
 	if (rc || !dirh) {
 		IOF_TRACE_ERROR(&base,
@@ -154,7 +183,296 @@ ios_dirh_find(struct ios_base *base, struct ios_gah *gah)
 	IOF_TRACE_DEBUG(dirh, GAH_PRINT_STR, GAH_PRINT_VAL(*gah));
 
 out:
-	D_RWLOCK_UNLOCK(&base->gah_rwlock);
-
 	return dirh;
 }
+
+static uint64_t
+fd_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int ios_fd_cache_init(struct ios_projection *projection)
+{
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	struct ionss_file_handle *root = projection->root;
+	int fd;
+	int rc;
+
+	D_INIT_LIST_HEAD(&cache->lru);
+	cache->open_count = 0;
+	cache->enabled = false;
+
+	rc = D_MUTEX_INIT(&cache->lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	rc = pthread_cond_init(&cache->cond, NULL);
+	if (rc != 0) {
+		D_MUTEX_DESTROY(&cache->lock);
+		return -DER_MISC;
+	}
+
+	if (projection->fd_cache_size == 0 || !root->khandle)
+		D_GOTO(out, 0);
+
+	/* Check that a handle can be both created and opened for the root of
+	 * the projection, open_by_handle_at() will fail with EPERM if the
+	 * process does not have CAP_DAC_READ_SEARCH.
+	 */
+	root->khandle->handle_bytes = MAX_HANDLE_SZ;
+	errno = 0;
+	rc = name_to_handle_at(root->fd, "", root->khandle, &cache->mount_id,
+			       AT_EMPTY_PATH);
+	if (rc != 0) {
+		IOF_TRACE_WARNING(projection,
+				  "Could not create file handle %d", errno);
+		D_GOTO(out, 0);
+	}
+
+	errno = 0;
+	fd = open_by_handle_at(root->fd, root->khandle, O_PATH);
+	if (fd == -1) {
+		IOF_TRACE_WARNING(projection,
+				  "Could not open file handle %d", errno);
+		D_GOTO(out, 0);
+	}
+	close(fd);
+
+	cache->enabled = true;
+
+out:
+	IOF_TRACE_INFO(projection, "fd cache %s, size %d",
+		       cache->enabled ? "enabled" : "disabled",
+		       projection->fd_cache_size);
+
+	return -DER_SUCCESS;
+}
+
+void ios_fd_cache_fini(struct ios_projection *projection)
+{
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	uint64_t lookups = cache->hits + cache->misses;
+
+	IOF_TRACE_INFO(projection,
+		       "fd cache hits %lu misses %lu (hit rate %lu%%) "
+		       "evictions %lu reopen errors %lu",
+		       cache->hits, cache->misses,
+		       lookups ? cache->hits * 100 / lookups : 100,
+		       cache->evictions, cache->reopen_errors);
+	IOF_TRACE_INFO(projection,
+		       "fd cache reopen time avg %lu max %lu nanoseconds",
+		       cache->misses ? cache->reopen_time / cache->misses : 0,
+		       cache->reopen_time_max);
+	IOF_TRACE_INFO(projection,
+		       "fd cache lazy lookups %lu, of which opened %lu",
+		       cache->lazy, cache->materialized);
+
+	pthread_cond_destroy(&cache->cond);
+	D_MUTEX_DESTROY(&cache->lock);
+}
+
+/* Close the least recently used fds until the cache is within budget.  Fds
+ * which are currently in use are skipped.  Called with the lock held.
+ */
+static void
+fd_cache_evict(struct ios_projection *projection)
+{
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	struct ionss_file_handle *fh, *next;
+
+	d_list_for_each_entry_safe(fh, next, &cache->lru, fd_lru) {
+		if (cache->open_count <= projection->fd_cache_size)
+			break;
+
+		if (fh->fd_pin)
+			continue;
+
+		IOF_TRACE_DEBUG(fh, "Evicting fd %d", fh->fd);
+
+		d_list_del_init(&fh->fd_lru);
+		close(fh->fd);
+		fh->fd = -1;
+		cache->open_count--;
+		cache->evictions++;
+	}
+}
+
+void ios_fh_fd_track(struct ionss_file_handle *fh)
+{
+	struct ios_projection *projection = fh->projection;
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	int mount_id;
+	int rc;
+
+	if (!cache->enabled || !fh->khandle || fh->mf.type != inode_handle)
+		return;
+
+	fh->khandle->handle_bytes = MAX_HANDLE_SZ;
+	rc = name_to_handle_at(fh->fd, "", fh->khandle, &mount_id,
+			       AT_EMPTY_PATH);
+
+	/* If the file is on a different mount then the projection root cannot
+	 * be used to re-open it, so keep it open.
+	 */
+	if (rc != 0 || mount_id != cache->mount_id)
+		return;
+
+	D_MUTEX_LOCK(&cache->lock);
+	fh->fd_cached = true;
+	fh->fd_pin = 0;
+	d_list_add_tail(&fh->fd_lru, &cache->lru);
+	cache->open_count++;
+	fd_cache_evict(projection);
+	D_MUTEX_UNLOCK(&cache->lock);
+}
+
+bool ios_fh_fd_lazy(struct ionss_file_handle *fh, int dirfd,
+		    const char *name)
+{
+	struct ios_projection *projection = fh->projection;
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	int mount_id;
+	int rc;
+
+	if (!cache->enabled || !fh->khandle || fh->mf.type != inode_handle)
+		return false;
+
+	/* Symlinks are not followed, to match the O_NOFOLLOW used for opening
+	 * inode handles.
+	 */
+	fh->khandle->handle_bytes = MAX_HANDLE_SZ;
+	rc = name_to_handle_at(dirfd, name, fh->khandle, &mount_id, 0);
+	if (rc != 0 || mount_id != cache->mount_id)
+		return false;
+
+	fh->fd = -1;
+	fh->fd_cached = true;
+	fh->fd_lazy = true;
+	fh->fd_pin = 0;
+
+	D_MUTEX_LOCK(&cache->lock);
+	cache->lazy++;
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	return true;
+}
+
+int ios_fh_fd_get(struct ionss_file_handle *fh)
+{
+	struct ios_projection *projection = fh->projection;
+	struct ios_fd_cache *cache = &projection->fd_cache;
+	struct stat stbuf;
+	uint64_t start;
+	uint64_t elapsed;
+	bool changed = false;
+	bool lazy;
+	int fd;
+	int rc = 0;
+
+	if (!fh->fd_cached)
+		return 0;
+
+	D_MUTEX_LOCK(&cache->lock);
+
+	/* Wait for a re-open of this handle by another thread */
+	while (fh->fd_opening)
+		pthread_cond_wait(&cache->cond, &cache->lock);
+
+	if (fh->fd_stale)
+		D_GOTO(unlock, rc = ESTALE);
+
+	if (fh->fd != -1) {
+		cache->hits++;
+		d_list_move_tail(&fh->fd_lru, &cache->lru);
+		fh->fd_pin++;
+		D_GOTO(unlock, 0);
+	}
+
+	/* Re-open without the lock held, so that other handles can be used
+	 * in the meantime.  Other users of this handle wait for the re-open
+	 * to complete.
+	 */
+	fh->fd_opening = true;
+	lazy = fh->fd_lazy;
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	start = fd_cache_now();
+	errno = 0;
+	fd = open_by_handle_at(projection->root->fd, fh->khandle,
+			       fh->mf.flags & ~O_NOFOLLOW);
+	elapsed = fd_cache_now() - start;
+
+	if (fd == -1) {
+		rc = errno ? errno : EIO;
+	} else if (lazy) {
+		/* The name may have been replaced between the stat and
+		 * creating the file handle in lookup, so check that this is
+		 * the inode which was reported to the client.  If not then
+		 * mark the handle stale so that the next lookup of the inode
+		 * creates a new handle rather than finding this one.
+		 */
+		if (fstat(fd, &stbuf) != 0 ||
+		    stbuf.st_ino != fh->mf.inode_no) {
+			close(fd);
+			fd = -1;
+			changed = true;
+			rc = ESTALE;
+		}
+	}
+
+	D_MUTEX_LOCK(&cache->lock);
+	fh->fd_opening = false;
+	pthread_cond_broadcast(&cache->cond);
+
+	if (changed) {
+		IOF_TRACE_WARNING(fh, "Inode changed on first open");
+		fh->fd_stale = true;
+		D_GOTO(unlock, 0);
+	}
+
+	if (fd == -1) {
+		cache->reopen_errors++;
+		IOF_TRACE_WARNING(fh, "Failed to re-open fd %d", rc);
+		D_GOTO(unlock, 0);
+	}
+
+	if (lazy) {
+		fh->fd_lazy = false;
+		cache->materialized++;
+	} else {
+		cache->misses++;
+		cache->reopen_time += elapsed;
+		if (elapsed > cache->reopen_time_max)
+			cache->reopen_time_max = elapsed;
+	}
+
+	IOF_TRACE_DEBUG(fh, "Re-opened as %d", fd);
+
+	fh->fd = fd;
+	snprintf(fh->proc_fd_name, 64, "/proc/self/fd/%d", fh->fd);
+	d_list_add_tail(&fh->fd_lru, &cache->lru);
+	cache->open_count++;
+	fh->fd_pin++;
+	fd_cache_evict(projection);
+unlock:
+	D_MUTEX_UNLOCK(&cache->lock);
+	return rc;
+}
+
+void ios_fh_fd_put(struct ionss_file_handle *fh)
+{
+	struct ios_projection *projection = fh->projection;
+	struct ios_fd_cache *cache = &projection->fd_cache;
+
+	if (!fh->fd_cached)
+		return;
+
+	D_MUTEX_LOCK(&cache->lock);
+	D_ASSERTF(fh->fd_pin > 0, "Unexpected fd pin count\n");
+	fh->fd_pin--;
+	D_MUTEX_UNLOCK(&cache->lock);
+}
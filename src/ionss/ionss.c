@@ -120,7 +120,15 @@ static struct ios_base base;
 
 void shutdown_impl(void)
 {
+	int i;
+
 	IOF_LOG_DEBUG("Shutting Down");
+
+	/* Release any clients waiting for changes */
+	for (i = 0; i < base.projection_count; i++)
+		if (base.projection_array[i].active)
+			ios_watch_stop(&base.projection_array[i]);
+
 	shutdown = 1;
 }
 
@@ -215,6 +223,9 @@ fh_compare(struct d_hash_table *htable, d_list_t *rlink,
 	if (fh->mf.inode_no != mf->inode_no)
 		return false;
 
+	if (fh->fd_stale)
+		return false;
+
 	if (fh->mf.type != mf->type)
 		return false;
 
@@ -293,12 +304,18 @@ iof_getattr_handler(crt_rpc_t *rpc)
 	if (out->err)
 		goto out;
 
+	out->rc = ios_fh_fd_get(handle);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = fstat(handle->fd, &out->stat);
 
 	if (rc)
 		out->rc = errno;
 
+	ios_fh_fd_put(handle);
+
 out:
 	IOF_LOG_DEBUG("result err %d rc %d",
 		      out->err, out->rc);
@@ -311,13 +328,17 @@ out:
 		ios_fh_decref(handle, 1);
 }
 
+/* Open a directory.  The change token is only written for opendir_token, as
+ * the reply to opendir does not have space for it.
+ */
 static void
-iof_opendir_handler(crt_rpc_t *rpc)
+opendir_common(crt_rpc_t *rpc, bool token)
 {
 	struct iof_gah_in		*in = crt_req_get(rpc);
 	struct iof_opendir_out		*out = crt_reply_get(rpc);
 	struct ionss_file_handle	*parent;
 	struct ionss_dir_handle		*local_handle;
+	struct stat			stbuf;
 	int rc;
 	int fd;
 
@@ -327,11 +348,27 @@ iof_opendir_handler(crt_rpc_t *rpc)
 
 	IOF_TRACE_DEBUG(parent, GAH_PRINT_STR, GAH_PRINT_VAL(in->gah));
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	fd = open(parent->proc_fd_name, O_DIRECTORY | O_RDONLY);
+	if (fd == -1)
+		out->rc = errno;
+
+	ios_fh_fd_put(parent);
 
 	if (fd == -1)
-		D_GOTO(out, out->rc = errno);
+		goto out;
+
+	/* Report the ctime of the directory so that clients caching the
+	 * contents can tell if it has changed since the last open.  Any
+	 * modification of the entries updates the ctime.
+	 */
+	if (token && fstat(fd, &stbuf) == 0)
+		out->token = stbuf.st_ctim.tv_sec * 1000000000ULL +
+			stbuf.st_ctim.tv_nsec;
 
 	D_ALLOC_PTR(local_handle);
 	if (!local_handle) {
@@ -339,17 +376,23 @@ iof_opendir_handler(crt_rpc_t *rpc)
 		D_GOTO(out, out->err = -DER_NOMEM);
 	}
 
+	rc = D_MUTEX_INIT(&local_handle->lock, NULL);
+	if (rc != -DER_SUCCESS) {
+		close(fd);
+		D_FREE(local_handle);
+		D_GOTO(out, out->err = rc);
+	}
+
 	local_handle->projection = parent->projection;
 	local_handle->fd = fd;
 	local_handle->h_dir = fdopendir(local_handle->fd);
 	local_handle->offset = 0;
 
-	D_RWLOCK_WRLOCK(&base.gah_rwlock);
 	rc = ios_gah_allocate(base.gs, &out->gah, local_handle);
-	D_RWLOCK_UNLOCK(&base.gah_rwlock);
 
 	if (rc != -DER_SUCCESS) {
 		closedir(local_handle->h_dir);
+		D_MUTEX_DESTROY(&local_handle->lock);
 		D_FREE(local_handle);
 		D_GOTO(out, out->err = rc);
 	}
@@ -368,9 +411,64 @@ out:
 		ios_fh_decref(parent, 1);
 }
 
+static void
+iof_opendir_handler(crt_rpc_t *rpc)
+{
+	opendir_common(rpc, false);
+}
+
+static void
+iof_opendir_token_handler(crt_rpc_t *rpc)
+{
+	opendir_common(rpc, true);
+}
+
+/* GAHs taken for the entries of a readdir reply, which are released if
+ * the reply does not reach the client.
+ */
+struct readdir_gahs {
+	struct ios_gah	*gah;
+	int		count;
+};
+
+/* Drop the reference passed to the client with a GAH, as a close would */
+static void
+readdir_gah_release(struct ios_gah *gah)
+{
+	struct ionss_file_handle *handle;
+
+	handle = ios_fh_find(&base, gah);
+	if (!handle)
+		return;
+
+	ios_fh_decref(handle, 1);
+	d_hash_rec_decref(&handle->projection->file_ht, &handle->clist);
+}
+
+static void
+readdir_gahs_release(struct readdir_gahs *gahs)
+{
+	int i;
+
+	for (i = 0; i < gahs->count; i++)
+		readdir_gah_release(&gahs->gah[i]);
+	gahs->count = 0;
+}
+
+static void
+readdir_gahs_free(struct readdir_gahs *gahs)
+{
+	if (!gahs)
+		return;
+
+	D_FREE(gahs->gah);
+	D_FREE(gahs);
+}
+
 int iof_readdir_bulk_cb(const struct crt_bulk_cb_info *cb_info)
 {
 	struct iof_readdir_out *out = crt_reply_get(cb_info->bci_bulk_desc->bd_rpc);
+	struct readdir_gahs *gahs = cb_info->bci_arg;
 	d_iov_t iov = {0};
 	d_sg_list_t sgl = {0};
 	int rc;
@@ -402,45 +500,392 @@ out:
 	if (rc)
 		IOF_LOG_ERROR("response not sent, ret = %d", rc);
 
+	if (gahs) {
+		if (rc || out->err)
+			readdir_gahs_release(gahs);
+		readdir_gahs_free(gahs);
+	}
+
 	crt_req_decref(cb_info->bci_bulk_desc->bd_rpc);
 
 	return 0;
 }
 
+/* Reply buffer for a readdir RPC, holding either an array of
+ * struct iof_readdir_entry or the packed encoding.
+ */
+struct readdir_buf {
+	struct ionss_dir_handle	*handle;
+	struct readdir_gahs	*gahs;
+	char			*buf;
+	size_t			len;
+	size_t			used;
+	int			count;
+	int			max_count;
+	off_t			prev_off;
+	uint32_t		flags;
+};
+
+/* Number of entries read from the directory before fetching their
+ * attributes and GAHs in parallel.
+ */
+#define IONSS_READDIR_BATCH (64)
+
+static bool
+lookup_lazy_stat(struct ios_projection *projection, int dfd, const char *name,
+		 struct ionss_mini_file *mf, struct iof_entry_out *out);
+
+static void find_and_insert_lookup(struct ios_projection *projection,
+				   int fd,
+				   struct ionss_mini_file *mf,
+				   struct iof_entry_out *out);
+
+/* Take a GAH for a directory entry, as a lookup would but using the
+ * attributes already read for the entry.  On failure the entry is sent
+ * without a GAH and the client will look it up if required.
+ */
+static void
+readdir_entry_gah(struct ionss_dir_handle *handle,
+		  struct iof_readdir_reply *reply)
+{
+	struct ionss_mini_file mf = {.type = inode_handle,
+				     .flags = O_PATH | O_NOATIME | O_NOFOLLOW | O_RDONLY};
+	struct iof_entry_out out = {0};
+	int fd;
+
+	out.stat = reply->stat;
+
+	if (!lookup_lazy_stat(handle->projection, handle->fd, reply->d_name,
+			      &mf, &out)) {
+		fd = openat(handle->fd, reply->d_name, mf.flags);
+		if (fd == -1) {
+			IOF_LOG_DEBUG("No gah for '%s' %d", reply->d_name,
+				      errno);
+			return;
+		}
+		find_and_insert_lookup(handle->projection, fd, &mf, &out);
+	}
+
+	if (out.rc || out.err) {
+		IOF_LOG_DEBUG("No gah for '%s' %d %d", reply->d_name, out.rc,
+			      out.err);
+		return;
+	}
+
+	/* If the file was opened the entry may have been replaced since it
+	 * was read so use the attributes for the inode the GAH refers to.
+	 */
+	reply->stat = out.stat;
+	reply->gah = out.gah;
+	reply->gah_valid = 1;
+}
+
+struct readdir_gah_batch {
+	struct ionss_dir_handle		*handle;
+	struct iof_readdir_reply	*replies;
+	int				*idx;
+};
+
+static void
+readdir_gah_one(void *arg, int i)
+{
+	struct readdir_gah_batch *gb = arg;
+
+	readdir_entry_gah(gb->handle, &gb->replies[gb->idx[i]]);
+}
+
+/* Append an entry to the reply, returns false if there is not space */
+static bool
+readdir_add(struct readdir_buf *rb, struct iof_readdir_reply *reply)
+{
+	size_t used;
+
+	if (rb->count >= rb->max_count)
+		return false;
+
+	if (rb->flags & IOF_READDIR_PACKED) {
+		if (iof_readdir_pack(reply, 1, rb->prev_off, rb->flags,
+				     rb->buf + rb->used, rb->len - rb->used,
+				     &used) != 1)
+			return false;
+	} else {
+		used = sizeof(struct iof_readdir_entry);
+		if (rb->used + used > rb->len)
+			return false;
+		iof_readdir_entry_set((struct iof_readdir_entry *)
+				      (rb->buf + rb->used), reply);
+	}
+
+	if (reply->gah_valid)
+		rb->gahs->gah[rb->gahs->count++] = reply->gah;
+
+	rb->used += used;
+	rb->prev_off = reply->nextoff;
+	rb->count++;
+	return true;
+}
+
+/* Append a batch of entries to the reply, returns false if not all of them
+ * fit.
+ *
+ * GAHs are only taken for entries which are known to fit, as entries which
+ * are dropped here will be requested again, and are taken in parallel
+ * using the attributes already read.  Space is allowed for an entry
+ * changing to a device node, which needs space for rdev, and if entries
+ * do not fit after all then their GAHs are released.
+ */
+static bool
+readdir_add_batch(struct readdir_buf *rb, struct iof_readdir_reply *replies,
+		  int count)
+{
+	struct readdir_gah_batch gb;
+	int gah_idx[IONSS_READDIR_BATCH];
+	off_t prev_off = rb->prev_off;
+	size_t used = rb->used;
+	size_t len;
+	int gah_count = 0;
+	int fit;
+	int i;
+
+	for (fit = 0; fit < count && rb->count + fit < rb->max_count; fit++) {
+		struct iof_readdir_reply *reply = &replies[fit];
+		bool gah = false;
+
+		if ((rb->flags & IOF_READDIR_GAH) && !reply->read_rc &&
+		    !reply->stat_rc) {
+			reply->gah_valid = 1;
+			gah = true;
+		}
+
+		if (rb->flags & IOF_READDIR_PACKED)
+			len = iof_readdir_packed_size(reply, prev_off,
+						      rb->flags);
+		else
+			len = sizeof(struct iof_readdir_entry);
+
+		reply->gah_valid = 0;
+
+		if (used + len + (gah ? sizeof(uint64_t) : 0) > rb->len)
+			break;
+
+		if (gah)
+			gah_idx[gah_count++] = fit;
+		used += len;
+		prev_off = reply->nextoff;
+	}
+
+	if (gah_count) {
+		gb.handle = rb->handle;
+		gb.replies = replies;
+		gb.idx = gah_idx;
+		ios_meta_parallel(rb->handle->projection, gah_count,
+				  readdir_gah_one, &gb);
+	}
+
+	for (i = 0; i < fit; i++) {
+		if (!readdir_add(rb, &replies[i]))
+			break;
+	}
+
+	if (i == fit)
+		return fit == count;
+
+	for (; i < fit; i++) {
+		if (replies[i].gah_valid)
+			readdir_gah_release(&replies[i].gah);
+	}
+	return false;
+}
+
+/* Fill the reply from a directory snapshot.
+ *
+ * Returns true if the end of the directory was reached.
+ */
+static bool
+readdir_from_snapshot(struct ionss_dir_handle *handle, off_t offset,
+		      struct readdir_buf *rb)
+{
+	struct iof_readdir_reply replies[IONSS_READDIR_BATCH];
+	bool last;
+	int count;
+
+	while ((count = ios_dir_cache_fill(handle->snap, offset, replies,
+					   IONSS_READDIR_BATCH, &last))) {
+		if (!readdir_add_batch(rb, replies, count))
+			return false;
+
+		if (last)
+			return true;
+		offset = replies[count - 1].nextoff;
+	}
+	return true;
+}
+
+struct readdir_stat_batch {
+	struct iof_readdir_reply	*replies;
+	int				*idx;
+	int				fd;
+};
+
+static void
+readdir_stat_one(void *arg, int i)
+{
+	struct readdir_stat_batch *sb = arg;
+	struct iof_readdir_reply *reply = &sb->replies[sb->idx[i]];
+
+	if (fstatat(sb->fd, reply->d_name, &reply->stat,
+		    AT_SYMLINK_NOFOLLOW) != 0)
+		reply->stat_rc = errno;
+}
+
+/* Fill the reply by reading the directory stream.
+ *
+ * Entries are read in batches and the attributes for each batch fetched
+ * in parallel, unless the client only requires names and the file type
+ * is available from readdir().  Entries which do not fit in the reply are
+ * dropped, and the next RPC will request them again by offset.
+ *
+ * Returns true if the end of the directory was reached.
+ */
+static bool
+readdir_from_dir(struct ionss_dir_handle *handle, off_t offset,
+		 struct readdir_buf *rb)
+{
+	struct iof_readdir_reply replies[IONSS_READDIR_BATCH];
+	int stat_idx[IONSS_READDIR_BATCH];
+	struct readdir_stat_batch sb;
+	struct dirent *dir_entry;
+	bool eof = false;
+	int read_rc = 0;
+	int stat_count;
+	int count;
+
+	if (handle->offset != offset) {
+		IOF_LOG_DEBUG("Changing offset %zi %zi",
+			      handle->offset, offset);
+		seekdir(handle->h_dir, offset);
+		handle->offset = offset;
+	}
+
+	sb.replies = replies;
+	sb.idx = stat_idx;
+	sb.fd = handle->fd;
+
+	while (!eof && !read_rc) {
+		count = 0;
+		stat_count = 0;
+
+		while (count < IONSS_READDIR_BATCH &&
+		       rb->count + count < rb->max_count) {
+			errno = 0;
+			dir_entry = readdir(handle->h_dir);
+
+			if (!dir_entry) {
+				if (errno == 0) {
+					IOF_LOG_DEBUG("Last entry %d",
+						      rb->count + count);
+					eof = true;
+				} else {
+					read_rc = errno;
+				}
+				break;
+			}
+
+			if (strncmp(".", dir_entry->d_name, 2) == 0)
+				continue;
+
+			if (strncmp("..", dir_entry->d_name, 3) == 0)
+				continue;
+
+			memset(&replies[count], 0, sizeof(replies[count]));
+			handle->offset = telldir(handle->h_dir);
+			replies[count].nextoff = handle->offset;
+
+			/* TODO: Check this */
+			strncpy(replies[count].d_name, dir_entry->d_name,
+				NAME_MAX);
+
+			IOF_LOG_DEBUG("File '%s' nextoff %zi",
+				      dir_entry->d_name, handle->offset);
+
+			if ((rb->flags & IOF_READDIR_NO_ATTR) &&
+			    dir_entry->d_type != DT_UNKNOWN) {
+				replies[count].stat.st_ino = dir_entry->d_ino;
+				replies[count].stat.st_mode =
+					DTTOIF(dir_entry->d_type);
+			} else {
+				stat_idx[stat_count++] = count;
+			}
+			count++;
+		}
+
+		if (count == 0 && !eof && !read_rc)
+			return false;
+
+		ios_meta_parallel(handle->projection, stat_count,
+				  readdir_stat_one, &sb);
+
+		if (!readdir_add_batch(rb, replies, count))
+			return false;
+	}
+
+	if (read_rc) {
+		/* An error occoured */
+		memset(&replies[0], 0, sizeof(replies[0]));
+		replies[0].read_rc = read_rc;
+		readdir_add(rb, &replies[0]);
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Read dirent from a directory and reply to the origin.
  *
+ * The directory handle lock serialises access to the directory stream and
+ * snapshot, as RPCs for one handle may be served by several progress
+ * threads.  flags are from iof_readdir_in for readdir_packed, and zero for
+ * readdir, which does not send them.
+ *
  * TODO:
- * Use readdir_r().  This code is not thread safe.
  * Parse GAH better.  If a invalid GAH is passed then it's handled but we
  * really should pass this back to the client properly so it doesn't retry.
  *
  */
 static void
-iof_readdir_handler(crt_rpc_t *rpc)
+readdir_common(crt_rpc_t *rpc, uint32_t flags)
 {
 	struct iof_readdir_in *in = crt_req_get(rpc);
 	struct iof_readdir_out *out = crt_reply_get(rpc);
 	struct ionss_dir_handle *handle;
-	struct iof_readdir_reply *replies = NULL;
-	int max_reply_count;
-	struct dirent *dir_entry;
+	struct readdir_buf rb = {0};
 	struct crt_bulk_desc bulk_desc = {0};
 	crt_bulk_t local_bulk_hdl = {0};
 	d_sg_list_t sgl = {0};
 	d_iov_t iov = {0};
 	size_t len = 0;
-	int reply_idx = 0;
+	bool last;
 	int rc;
 
 	VALIDATE_ARGS_GAH_DIR(rpc, in, out, handle);
 
-	IOF_LOG_INFO(GAH_PRINT_STR " offset %zi rpc %p",
-		     GAH_PRINT_VAL(in->gah), in->offset, rpc);
+	IOF_LOG_INFO(GAH_PRINT_STR " offset %zi flags %#x rpc %p",
+		     GAH_PRINT_VAL(in->gah), in->offset, flags, rpc);
 
 	if (out->err)
 		goto out;
 
+	rb.flags = flags;
+	rb.handle = handle;
+
+	/* GAHs can only be returned with the packed encoding, and require
+	 * attributes for the inode number.
+	 */
+	if (!(rb.flags & IOF_READDIR_PACKED) ||
+	    (rb.flags & IOF_READDIR_NO_ATTR))
+		rb.flags &= ~IOF_READDIR_GAH;
+
 	if (in->bulk) {
 		rc = crt_bulk_get_len(in->bulk, &len);
 		if (rc || !len) {
@@ -453,121 +898,132 @@ iof_readdir_handler(crt_rpc_t *rpc)
 			len = handle->projection->readdir_size;
 		}
 
-		max_reply_count = len / sizeof(struct iof_readdir_reply);
+		rb.max_count = len / ((rb.flags & IOF_READDIR_PACKED) ?
+				      IOF_READDIR_PACKED_MIN :
+				      sizeof(struct iof_readdir_entry));
 	} else {
 		IOF_LOG_INFO("No bulk descriptor, replying inline");
-		max_reply_count = IONSS_READDIR_ENTRIES_PER_RPC;
-		len = sizeof(struct iof_readdir_reply) * max_reply_count;
+		rb.max_count = IONSS_READDIR_ENTRIES_PER_RPC;
+		len = sizeof(struct iof_readdir_entry) * rb.max_count;
 	}
 
-	IOF_LOG_DEBUG("max_replies %d len %zi bulk %p", max_reply_count, len,
+	IOF_LOG_DEBUG("max_replies %d len %zi bulk %p", rb.max_count, len,
 		      in->bulk);
 
-	D_ALLOC_ARRAY(replies, max_reply_count);
-	if (!replies) {
+	D_ALLOC(rb.buf, len);
+	if (!rb.buf) {
 		out->err = -DER_NOMEM;
 		goto out;
 	}
+	rb.len = len;
+	rb.prev_off = in->offset;
 
-	if (handle->offset != in->offset) {
-		IOF_LOG_DEBUG("Changing offset %zi %zi",
-			      handle->offset, in->offset);
-		seekdir(handle->h_dir, in->offset);
-		handle->offset = in->offset;
-	}
-
-	reply_idx = 0;
-	do {
-		errno = 0;
-		dir_entry = readdir(handle->h_dir);
-
-		if (!dir_entry) {
-			if (errno == 0) {
-				IOF_LOG_DEBUG("Last entry %d", reply_idx);
-				/* End of directory */
-				out->last = 1;
-			} else {
-				/* An error occoured */
-				replies[reply_idx].read_rc = errno;
-				reply_idx++;
-			}
-
-			goto out;
+	/* Record the GAHs taken so they can be released if the reply is not
+	 * sent, or send the entries without GAHs if this is not possible.
+	 */
+	if (rb.flags & IOF_READDIR_GAH) {
+		D_ALLOC_PTR(rb.gahs);
+		if (rb.gahs)
+			D_ALLOC_ARRAY(rb.gahs->gah, rb.max_count);
+		if (!rb.gahs || !rb.gahs->gah) {
+			readdir_gahs_free(rb.gahs);
+			rb.gahs = NULL;
+			rb.flags &= ~IOF_READDIR_GAH;
 		}
+	}
 
-		if (strncmp(".", dir_entry->d_name, 2) == 0)
-			continue;
-
-		if (strncmp("..", dir_entry->d_name, 3) == 0)
-			continue;
-
-		handle->offset = telldir(handle->h_dir);
-		replies[reply_idx].nextoff = handle->offset;
+	D_MUTEX_LOCK(&handle->lock);
 
-		/* TODO: Check this */
-		strncpy(replies[reply_idx].d_name, dir_entry->d_name, NAME_MAX);
+	/* A read from the start of the directory, including after a
+	 * rewinddir(), picks up a current snapshot if there is one.
+	 */
+	if (in->offset == 0) {
+		if (handle->snap)
+			ios_dir_cache_put(handle->projection, handle->snap);
+		handle->snap = ios_dir_cache_get(handle);
+	}
 
-		IOF_LOG_DEBUG("File '%s' nextoff %zi", dir_entry->d_name,
-			      handle->offset);
+	if (handle->snap)
+		last = readdir_from_snapshot(handle, in->offset, &rb);
+	else
+		last = readdir_from_dir(handle, in->offset, &rb);
 
-		errno = 0;
-		rc = fstatat(handle->fd,
-			     replies[reply_idx].d_name,
-			     &replies[reply_idx].stat,
-			     AT_SYMLINK_NOFOLLOW);
-		if (rc != 0)
-			replies[reply_idx].stat_rc = errno;
+	D_MUTEX_UNLOCK(&handle->lock);
 
-		reply_idx++;
-	} while (reply_idx < (max_reply_count));
+	if (last)
+		out->last = 1;
 
 out:
 
-	IOF_LOG_INFO("Sending %d replies", reply_idx);
+	IOF_LOG_INFO("Sending %d replies, %zi bytes", rb.count, rb.used);
 
-	if (reply_idx > IONSS_READDIR_ENTRIES_PER_RPC) {
+	if (rb.count > IONSS_READDIR_ENTRIES_PER_RPC) {
 		crt_req_addref(rpc);
 
-		iov.iov_len = sizeof(struct iof_readdir_reply) * reply_idx;
-		iov.iov_buf = replies;
-		iov.iov_buf_len = sizeof(struct iof_readdir_reply) * reply_idx;
+		iov.iov_len = rb.used;
+		iov.iov_buf = rb.buf;
+		iov.iov_buf_len = rb.used;
 		sgl.sg_iovs = &iov;
 		sgl.sg_nr = 1;
 
 		rc = crt_bulk_create(rpc->cr_ctx, &sgl, CRT_BULK_RO,
 				     &local_bulk_hdl);
 		if (rc) {
+			crt_req_decref(rpc);
 			out->err = rc;
-			goto out;
+			goto send;
 		}
 
 		bulk_desc.bd_rpc = rpc;
 		bulk_desc.bd_bulk_op = CRT_BULK_PUT;
 		bulk_desc.bd_remote_hdl = in->bulk;
 		bulk_desc.bd_local_hdl = local_bulk_hdl;
-		bulk_desc.bd_len = sizeof(struct iof_readdir_reply) * reply_idx;
+		bulk_desc.bd_len = rb.used;
 
-		out->bulk_count = reply_idx;
+		out->bulk_count = rb.count;
 
 		rc = crt_bulk_transfer(&bulk_desc, iof_readdir_bulk_cb,
-				       NULL, NULL);
+				       rb.gahs, NULL);
 		if (rc) {
+			crt_bulk_free(local_bulk_hdl);
+			crt_req_decref(rpc);
+			out->bulk_count = 0;
 			out->err = rc;
-			goto out;
+			goto send;
 		}
 
 		return;
-	} else if (reply_idx) {
-		out->iov_count = reply_idx;
-		d_iov_set(&out->replies, &replies[0],
-			  sizeof(struct iof_readdir_reply) * reply_idx);
+	} else if (rb.count) {
+		out->iov_count = rb.count;
+		d_iov_set(&out->replies, rb.buf, rb.used);
 	}
 
+send:
 	rc = crt_reply_send(rpc);
 	if (rc)
 		IOF_LOG_ERROR(" response not sent, rc = %d", rc);
 
-	D_FREE(replies);
+	if (rb.gahs) {
+		if (rc || out->err)
+			readdir_gahs_release(rb.gahs);
+		readdir_gahs_free(rb.gahs);
+	}
+
+	D_FREE(rb.buf);
+}
+
+static void
+iof_readdir_handler(crt_rpc_t *rpc)
+{
+	readdir_common(rpc, 0);
+}
+
+static void
+iof_readdir_packed_handler(crt_rpc_t *rpc)
+{
+	struct iof_readdir_in *in = crt_req_get(rpc);
+
+	readdir_common(rpc, in->flags | IOF_READDIR_PACKED);
 }
 
 static void
@@ -586,16 +1042,17 @@ iof_closedir_handler(crt_rpc_t *rpc)
 
 	if (handle) {
 		IOF_LOG_DEBUG("Closing %p", handle->h_dir);
+		if (handle->snap)
+			ios_dir_cache_put(handle->projection, handle->snap);
 		rc = closedir(handle->h_dir);
 		if (rc != 0)
 			IOF_LOG_DEBUG("Failed to close directory %p",
 				      handle->h_dir);
+		D_MUTEX_DESTROY(&handle->lock);
 		D_FREE(handle);
 	}
 
-	D_RWLOCK_WRLOCK(&base.gah_rwlock);
 	ios_gah_deallocate(base.gs, &in->gah);
-	D_RWLOCK_UNLOCK(&base.gah_rwlock);
 
 	rc = crt_reply_send(rpc);
 	if (rc)
@@ -669,33 +1126,38 @@ htable_mf_find(struct ios_projection *projection,
 	return handle;
 }
 
-/* Create a new handle based on mf and fd, insert into hash table whilst
- * checking for existing entries.  Will return either handle with
+/* Create a new handle based on mf, without a fd.  Returns the handle with
  * reference held, or NULL for ENOMEM.
- *
- * If entry already exists in hash table existing handle will be returned
- * and the fd provided will be closed.
  */
 static struct ionss_file_handle	*
-htable_mf_insert(struct ios_projection *projection,
-		 struct ionss_mini_file *mf, int fd)
+htable_mf_new(struct ios_projection *projection, struct ionss_mini_file *mf)
 {
 	struct ionss_file_handle *handle = NULL;
-	d_list_t *rlink;
 	int rc;
 
 	rc = ios_fh_alloc(projection, &handle);
 	if (rc || !handle)
 		return NULL;
 
-	handle->fd = fd;
 	handle->projection = projection;
 	handle->mf.flags = mf->flags;
 	handle->mf.inode_no = mf->inode_no;
 	handle->mf.type = mf->type;
-	snprintf(handle->proc_fd_name, 64, "/proc/self/fd/%d", handle->fd);
 	atomic_fetch_add(&handle->ht_ref, 1);
 
+	return handle;
+}
+
+/* Insert a handle created by htable_mf_new() into the hash table, returning
+ * either the handle or an existing one for the same file, in which case
+ * the new handle is released.
+ */
+static struct ionss_file_handle	*
+htable_mf_add(struct ios_projection *projection,
+	      struct ionss_mini_file *mf, struct ionss_file_handle *handle)
+{
+	d_list_t *rlink;
+
 	rlink = d_hash_rec_find_insert(&projection->file_ht, mf, sizeof(*mf),
 				       &handle->clist);
 	if (rlink != &handle->clist) {
@@ -715,11 +1177,36 @@ htable_mf_insert(struct ios_projection *projection,
 	return handle;
 }
 
-/* Take a newly opened file and locate or create a handle for it.
+/* Create a new handle based on mf and fd, insert into hash table whilst
+ * checking for existing entries.  Will return either handle with
+ * reference held, or NULL for ENOMEM.
  *
- * If the file is already opened then take a reference on the existing
- * hash table entry and re-use the current GAH, if the file is new then
- * allcoate a new handle.
+ * If entry already exists in hash table existing handle will be returned
+ * and the fd provided will be closed.
+ */
+static struct ionss_file_handle	*
+htable_mf_insert(struct ios_projection *projection,
+		 struct ionss_mini_file *mf, int fd)
+{
+	struct ionss_file_handle *handle;
+
+	handle = htable_mf_new(projection, mf);
+	if (!handle)
+		return NULL;
+
+	handle->fd = fd;
+	snprintf(handle->proc_fd_name, 64, "/proc/self/fd/%d", handle->fd);
+
+	ios_fh_fd_track(handle);
+
+	return htable_mf_add(projection, mf, handle);
+}
+
+/* Take a newly opened file and locate or create a handle for it.
+ *
+ * If the file is already opened then take a reference on the existing
+ * hash table entry and re-use the current GAH, if the file is new then
+ * allcoate a new handle.
  */
 static void find_and_insert(struct ios_projection *projection,
 			    int fd,
@@ -874,6 +1361,116 @@ static void find_and_insert_create(struct ios_projection *projection,
 	out->gah = handle->gah;
 }
 
+/* Lookup a name without opening it.
+ *
+ * Most looked up inodes are only ever stat'ed, so rather than opening a fd
+ * for each, use fstatat() for the reply and check for an existing handle,
+ * and if there is none then create one which holds only a kernel file
+ * handle.  The fd is opened by ios_fh_fd_get() on first use.
+ *
+ * dfd is the fd of the parent directory.  Returns false if a lazy handle
+ * could not be created, in which case the caller should open the file.
+ */
+static bool
+lookup_lazy(struct ios_projection *projection, int dfd, const char *name,
+	    struct ionss_mini_file *mf, struct iof_entry_out *out)
+{
+	int rc;
+
+	if (!projection->fd_cache.enabled)
+		return false;
+
+	errno = 0;
+	rc = fstatat(dfd, name, &out->stat, AT_SYMLINK_NOFOLLOW);
+	if (rc) {
+		out->rc = errno;
+		if (!out->rc)
+			out->err = -DER_MISC;
+		return true;
+	}
+
+	return lookup_lazy_stat(projection, dfd, name, mf, out);
+}
+
+/* As lookup_lazy(), for a name whose attributes are already in out->stat */
+static bool
+lookup_lazy_stat(struct ios_projection *projection, int dfd, const char *name,
+		 struct ionss_mini_file *mf, struct iof_entry_out *out)
+{
+	struct ionss_file_handle *handle;
+
+	if (!projection->fd_cache.enabled)
+		return false;
+
+	if (projection->dev_no != out->stat.st_dev) {
+		out->rc = EACCES;
+		return true;
+	}
+
+	mf->inode_no = out->stat.st_ino;
+
+	handle = htable_mf_find(projection, mf);
+	if (handle)
+		D_GOTO(out, 0);
+
+	handle = htable_mf_new(projection, mf);
+	if (!handle) {
+		out->err = -DER_NOMEM;
+		return true;
+	}
+
+	if (!ios_fh_fd_lazy(handle, dfd, name)) {
+		ios_fh_decref(handle, 1);
+		return false;
+	}
+
+	handle = htable_mf_add(projection, mf, handle);
+
+out:
+	out->gah = handle->gah;
+	return true;
+}
+
+/* Lookup a name in the directory dfd, filling in gah and stat in out, or an
+ * error code.
+ */
+static void
+lookup_at(struct ios_projection *projection, int dfd, const char *name,
+	  struct ionss_mini_file *mf, struct iof_entry_out *out)
+{
+	int fd;
+
+	if (lookup_lazy(projection, dfd, name, mf, out))
+		return;
+
+	errno = 0;
+	fd = openat(dfd, name, mf->flags);
+	if (fd == -1) {
+		out->rc = errno;
+		if (!out->rc)
+			out->err = -DER_MISC;
+		return;
+	}
+
+	find_and_insert_lookup(projection, fd, mf, out);
+}
+
+/* Resolve a single name in a parent directory, filling in gah and stat
+ * in out, or an error code.
+ */
+static void
+lookup_one(struct ionss_file_handle *parent, const char *name,
+	   struct ionss_mini_file *mf, struct iof_entry_out *out)
+{
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		return;
+
+	lookup_at(parent->projection, parent->fd, name, mf, out);
+
+	ios_fh_fd_put(parent);
+}
+
 static void
 lookup_common(crt_rpc_t *rpc, struct iof_gah_string_in *in,
 	      struct iof_entry_out *out, struct ionss_file_handle *parent)
@@ -881,23 +1478,15 @@ lookup_common(crt_rpc_t *rpc, struct iof_gah_string_in *in,
 	struct ios_projection		*projection = NULL;
 	struct ionss_mini_file		mf = {.type = inode_handle,
 					      .flags = O_PATH | O_NOATIME | O_NOFOLLOW | O_RDONLY};
-	int				fd;
 
 	if (out->err || out->rc)
 		goto out;
 
 	projection = parent->projection;
 
-	errno = 0;
-	fd = openat(parent->fd, in->name.name, mf.flags);
-	if (fd == -1) {
-		out->rc = errno;
-		if (!out->rc)
-			out->err = -DER_MISC;
+	lookup_one(parent, in->name.name, &mf, out);
+	if (out->err || out->rc)
 		goto out;
-	}
-
-	find_and_insert_lookup(projection, fd, &mf, out);
 
 	IOF_TRACE_INFO(rpc, "'%s' ino:%lu " GAH_PRINT_STR,
 		       in->name.name, mf.inode_no, GAH_PRINT_VAL(out->gah));
@@ -929,6 +1518,123 @@ out:
 	lookup_common(rpc, in, out, parent);
 }
 
+/* Resolve a relative path one component at a time.
+ *
+ * Every resolved component is returned to the client, along with a GAH
+ * reference for it, so once an entry has been added here the reply must
+ * be sent without an error code, otherwise the client would not take
+ * ownership of the GAHs.  Errors are therefore only reported if the first
+ * component could not be resolved, and in all other cases the walk simply
+ * stops, leaving the kernel to resolve the remainder of the path and
+ * report any errors with normal lookups.
+ *
+ * Symbolic links and "." and ".." components also stop the walk as these
+ * need to be resolved by the kernel.
+ */
+static void
+iof_lookup_path_handler(crt_rpc_t *rpc)
+{
+	struct iof_lookup_path_in	*in = crt_req_get(rpc);
+	struct iof_lookup_path_out	*out = crt_reply_get(rpc);
+	struct ios_projection		*projection = NULL;
+	struct ionss_file_handle	*parent = NULL;
+	struct ionss_file_handle	*dir = NULL;
+	struct iof_path_entry		*entries = NULL;
+	char				*path = NULL;
+	char				*name;
+	char				*saveptr = NULL;
+	int				count = 0;
+	int				rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, parent);
+	if (out->err)
+		goto out;
+
+	IOF_TRACE_UP(rpc, parent, "lookup_path");
+
+	projection = parent->projection;
+
+	if (!in->path)
+		D_GOTO(out, out->rc = EINVAL);
+
+	D_STRNDUP(path, in->path, IOF_MAX_PATH_LEN);
+	D_ALLOC_ARRAY(entries, IOF_LOOKUP_PATH_MAX);
+	if (!path || !entries)
+		D_GOTO(out, out->err = -DER_NOMEM);
+
+	dir = parent;
+	for (name = strtok_r(path, "/", &saveptr);
+	     name && count < IOF_LOOKUP_PATH_MAX;
+	     name = strtok_r(NULL, "/", &saveptr)) {
+		struct ionss_mini_file mf = {.type = inode_handle,
+					     .flags = O_PATH | O_NOATIME | O_NOFOLLOW | O_RDONLY};
+		struct iof_entry_out eout = {0};
+		struct ionss_file_handle *next;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			break;
+
+		if (strnlen(name, NAME_MAX + 1) > NAME_MAX) {
+			if (count == 0)
+				out->rc = ENAMETOOLONG;
+			break;
+		}
+
+		if (count > 0 && !S_ISDIR(entries[count - 1].stat.st_mode))
+			break;
+
+		lookup_one(dir, name, &mf, &eout);
+		if (eout.rc || eout.err) {
+			if (count == 0) {
+				out->rc = eout.rc;
+				out->err = eout.err;
+			}
+			break;
+		}
+
+		entries[count].gah = eout.gah;
+		entries[count].stat = eout.stat;
+		count++;
+
+		IOF_TRACE_DEBUG(rpc, "'%s' ino:%lu " GAH_PRINT_STR, name,
+				mf.inode_no, GAH_PRINT_VAL(eout.gah));
+
+		/* Take a further reference on the new handle to use as the
+		 * parent for the next component, the reference from
+		 * lookup_one() is passed to the client.
+		 */
+		next = ios_fh_find(&base, &eout.gah);
+		if (!next)
+			break;
+
+		if (dir != parent)
+			ios_fh_decref(dir, 1);
+		dir = next;
+	}
+
+	if (count)
+		d_iov_set(&out->entries, entries,
+			  count * sizeof(struct iof_path_entry));
+
+	IOF_TRACE_INFO(rpc, "Resolved %d components", count);
+
+out:
+	IOF_TRACE_INFO(rpc, "Sending reply %d %d", out->rc, out->err);
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_TRACE_ERROR(rpc, "response not sent, ret = %d", rc);
+
+	if (dir && dir != parent)
+		ios_fh_decref(dir, 1);
+	if (projection)
+		iof_pool_restock(projection->fh_pool);
+	if (parent)
+		ios_fh_decref(parent, 1);
+	D_FREE(entries);
+	D_FREE(path);
+	IOF_TRACE_DOWN(rpc);
+}
+
 static void
 iof_open_handler(crt_rpc_t *rpc)
 {
@@ -955,11 +1661,23 @@ iof_open_handler(crt_rpc_t *rpc)
 	IOF_TRACE_DEBUG(parent, GAH_PRINT_STR " flags 0%o",
 			GAH_PRINT_VAL(in->gah), in->flags);
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	fd = open(parent->proc_fd_name, in->flags);
-	if (fd == -1) {
+	if (fd == -1)
 		out->rc = errno;
+
+	ios_fh_fd_put(parent);
+
+	if (fd == -1)
 		goto out;
+
+	if (in->flags & O_TRUNC) {
+		ios_ra_invalidate(projection, parent->mf.inode_no);
+		ios_watch_notify(projection, rpc, parent->mf.inode_no, NULL);
 	}
 
 	mf.flags = in->flags;
@@ -1008,13 +1726,26 @@ iof_create_handler(crt_rpc_t *rpc)
 	IOF_TRACE_DEBUG(rpc, "path %s flags 0%o mode 0%o",
 			in->common.name.name, in->flags, in->mode);
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	fd = openat(parent->fd, in->common.name.name, in->flags, in->mode);
 	if (fd == -1) {
 		out->rc = errno;
-		goto out;
+	} else {
+		ios_dir_cache_invalidate(parent->projection,
+					 parent->mf.inode_no);
+		ios_watch_notify(parent->projection, rpc, parent->mf.inode_no,
+				 in->common.name.name);
 	}
 
+	ios_fh_fd_put(parent);
+
+	if (fd == -1)
+		goto out;
+
 	mf.flags = in->flags;
 
 	D_ASPRINTF(path, "/proc/self/fd/%d", fd);
@@ -1034,6 +1765,10 @@ iof_create_handler(crt_rpc_t *rpc)
 	}
 	imf.flags |= O_NOFOLLOW;
 	find_and_insert_create(parent->projection, fd, ifd, &mf, &imf, out);
+	if (in->flags & O_TRUNC && out->rc == 0 && out->err == 0) {
+		ios_ra_invalidate(parent->projection, mf.inode_no);
+		ios_watch_notify(parent->projection, rpc, mf.inode_no, NULL);
+	}
 
 out:
 	IOF_TRACE_DEBUG(rpc, "path %s flags 0%o mode 0%o 0%o",
@@ -1098,7 +1833,14 @@ iof_imigrate_handler(crt_rpc_t *rpc)
 	if (in->name.name[0] == '\0')
 		D_GOTO(out, out->rc = ENOENT);
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	fd = openat(parent->fd, in->name.name, mf.flags);
+
+	ios_fh_fd_put(parent);
+
 	if (fd == -1) {
 		IOF_TRACE_DEBUG(rpc,
 				"No file at location '%s'",
@@ -1171,6 +1913,60 @@ iof_close_handler(crt_rpc_t *rpc)
 	d_hash_rec_decref(&handle->projection->file_ht, &handle->clist);
 }
 
+/* State for an fsync or fdatasync request whilst the sync is in progress */
+struct ionss_sync_desc {
+	struct ios_aio_op		op;
+	crt_rpc_t			*rpc;
+	struct ionss_file_handle	*handle;
+};
+
+/* Completion callback for fsync and fdatasync, sends the reply */
+static void
+iof_sync_cb(struct ios_aio_op *op, ssize_t res)
+{
+	struct ionss_sync_desc *sd = (void *)op -
+		offsetof(struct ionss_sync_desc, op);
+	struct iof_status_out *out = crt_reply_get(sd->rpc);
+	int rc;
+
+	if (res < 0)
+		out->rc = -res;
+
+	IOF_LOG_DEBUG("result err %d rc %d", out->err, out->rc);
+
+	rc = crt_reply_send(sd->rpc);
+	if (rc)
+		IOF_LOG_ERROR("response not sent, ret = %d", rc);
+
+	crt_req_decref(sd->rpc);
+	ios_fh_decref(sd->handle, 1);
+	D_FREE(sd);
+}
+
+/* Submit a sync operation for a handle, with the reply being sent once it
+ * completes.  Takes ownership of the handle reference on success.
+ */
+static int
+iof_sync_submit(crt_rpc_t *rpc, struct ionss_file_handle *handle,
+		enum ios_aio_opcode opcode)
+{
+	struct ionss_sync_desc *sd;
+
+	D_ALLOC_PTR(sd);
+	if (!sd)
+		return -DER_NOMEM;
+
+	sd->rpc = rpc;
+	sd->handle = handle;
+	sd->op.opcode = opcode;
+	sd->op.cb = iof_sync_cb;
+	sd->op.fd = handle->fd;
+
+	crt_req_addref(rpc);
+	ios_aio_submit(handle->projection->base, &sd->op);
+	return -DER_SUCCESS;
+}
+
 static void
 iof_fsync_handler(crt_rpc_t *rpc)
 {
@@ -1187,10 +1983,10 @@ iof_fsync_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
-	errno = 0;
-	rc = fsync(handle->fd);
-	if (rc)
-		out->rc = errno;
+	rc = iof_sync_submit(rpc, handle, IOS_AIO_FSYNC);
+	if (rc == -DER_SUCCESS)
+		return;
+	out->err = rc;
 
 out:
 	IOF_LOG_DEBUG("result err %d rc %d",
@@ -1220,10 +2016,10 @@ iof_fdatasync_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
-	errno = 0;
-	rc = fdatasync(handle->fd);
-	if (rc)
-		out->rc = errno;
+	rc = iof_sync_submit(rpc, handle, IOS_AIO_FDATASYNC);
+	if (rc == -DER_SUCCESS)
+		return;
+	out->err = rc;
 
 out:
 	IOF_LOG_DEBUG("result err %d rc %d",
@@ -1243,8 +2039,95 @@ _Static_assert(sizeof(struct ionss_io_req_desc) <=
 	       "struct iof_readx_out needs to be large enough to contain"
 	       " struct ionss_io_req_desc");
 
+/* Merge the result of one active descriptor into the reply.
+ *
+ * If the descriptor is part of a group then the result is accumulated there
+ * and false is returned, unless this was the last descriptor of the group in
+ * which case the merged result is copied to the reply and the group freed.
+ *
+ * start and end are the range handled by the descriptor and len the number of
+ * bytes completed from start.  Only data which is contiguous from the start
+ * of the request is reported, so if any range is incomplete the length stops
+ * at the end of the first incomplete range.
+ */
+static bool
+iof_io_group_done(struct ionss_io_group *group, uint64_t start, uint64_t end,
+		  uint64_t len, int rc, int err,
+		  uint64_t *out_len, int *out_rc, int *out_err)
+{
+	bool last;
+
+	if (!group) {
+		*out_len = len;
+		*out_rc = rc;
+		*out_err = err;
+		return true;
+	}
+
+	D_MUTEX_LOCK(&group->lock);
+	group->len += len;
+	if (start + len < end && start + len < group->short_end)
+		group->short_end = start + len;
+	if (!group->rc)
+		group->rc = rc;
+	if (!group->err)
+		group->err = err;
+	last = (--group->count == 0);
+	D_MUTEX_UNLOCK(&group->lock);
+
+	if (!last)
+		return false;
+
+	*out_len = group->len;
+	if (group->short_end < group->len)
+		*out_len = group->short_end;
+	*out_rc = group->rc;
+	*out_err = group->err;
+	D_MUTEX_DESTROY(&group->lock);
+	D_FREE(group);
+	return true;
+}
+
+/* Allocate a group for splitting a request of segs segments, returns NULL
+ * if the request is too small to split or on failure.
+ */
+static struct ionss_io_group *
+iof_io_group_alloc(uint64_t segs)
+{
+	struct ionss_io_group *group;
+	int rc;
+
+	if (segs < 2)
+		return NULL;
+
+	D_ALLOC_PTR(group);
+	if (!group)
+		return NULL;
+
+	rc = D_MUTEX_INIT(&group->lock, NULL);
+	if (rc != -DER_SUCCESS) {
+		D_FREE(group);
+		return NULL;
+	}
+	group->short_end = UINT64_MAX;
+	return group;
+}
+
+/* Release a group which was not used as no extra descriptors were available
+ */
+static void
+iof_io_group_free(struct ionss_io_group *group)
+{
+	D_MUTEX_DESTROY(&group->lock);
+	D_FREE(group);
+}
+
 static int iof_read_bulk_cb(const struct crt_bulk_cb_info *cb_info);
-static void iof_process_read_bulk(struct ionss_active_read *ard);
+static void iof_read_start(struct ionss_active_read *ard);
+static void iof_read_fill(struct ionss_active_read *ard);
+static void iof_read_next(struct ionss_active_read *ard);
+static void iof_read_pump(struct ionss_active_read *ard);
+static void iof_read_complete(struct ionss_active_read *ard);
 
 void iof_read_check_and_send(struct ios_projection *projection)
 {
@@ -1289,85 +2172,486 @@ void iof_read_check_and_send(struct ios_projection *projection)
 	/* Reset the borrowed output to 0 */
 	memset(rrd, 0, sizeof(*rrd));
 
-	iof_process_read_bulk(ard);
+	iof_read_start(ard);
 }
 
-/* Process a read request
+/* Start a read request, splitting it across idle descriptors if possible.
  *
- * This function processes a single rrd and either submits a bulk read with
- * the result of completes and frees the request
+ * A large contiguous read is divided into ranges of whole max_read_size
+ * segments, and each range is handled by a separate descriptor so that
+ * several reads can be outstanding against the backing filesystem.  Extra
+ * descriptors are only taken if no other reads are waiting for one.
  */
 static void
-iof_process_read_bulk(struct ionss_active_read *ard)
+iof_read_start(struct ionss_active_read *ard)
 {
 	struct ionss_file_handle *handle = ard->handle;
+	struct ios_projection *projection = handle->projection;
 	struct iof_readx_in *in = crt_req_get(ard->rpc);
-	struct iof_readx_out *out = crt_reply_get(ard->rpc);
-	struct ios_projection *projection = ard->handle->projection;
-	struct crt_bulk_desc bulk_desc = {0};
-	size_t count;
-	off_t offset;
-	bool more_to_do = false;
-	int rc;
+	struct ionss_io_group *group = NULL;
+	struct ionss_active_read *part, *next;
+	d_list_t parts;
+	uint64_t segs;
+	int count = 1;
+	int i = 1;
+
+	ard->end_offset = in->xtvec.xt_len;
+
+	segs = (in->xtvec.xt_len + projection->max_read_size - 1) /
+		projection->max_read_size;
+	if (in->xtvec_len == 0)
+		group = iof_io_group_alloc(segs);
+	if (!group) {
+		iof_read_fill(ard);
+		return;
+	}
 
-	count = in->xtvec.xt_len - ard->segment_offset;
-	/* Only read max_read_size at a time */
-	if (count > projection->max_read_size)
-		count = projection->max_read_size;
-	ard->req_len = count;
-	offset = in->xtvec.xt_off + ard->segment_offset;
+	D_INIT_LIST_HEAD(&parts);
 
-	IOF_TRACE_DEBUG(ard, "Reading from fd=%d %#zx-%#zx", handle->fd, offset,
-			offset + count - 1);
+	D_MUTEX_LOCK(&projection->lock);
+	while (count < segs && d_list_empty(&projection->read_list)) {
+		part = iof_pool_acquire(projection->ar_pool);
+		if (!part)
+			break;
+		projection->current_read_count++;
+		IOF_TRACE_UP(part, handle, "ard");
+		d_list_add_tail(&part->list, &parts);
+		count++;
+	}
+	D_MUTEX_UNLOCK(&projection->lock);
 
-	errno = 0;
-	ard->read_len = pread(handle->fd, ard->local_bulk.buf, count, offset);
-	if (ard->read_len == -1) {
-		out->rc = errno;
-		goto out;
-	} else if (ard->read_len <= projection->max_iov_read_size) {
-		/* Can send last bit in immediate data */
-		out->iov_len = ard->read_len;
-		d_iov_set(&out->data, ard->local_bulk.buf,
-			  ard->read_len);
-		goto out;
+	if (count == 1) {
+		iof_io_group_free(group);
+		iof_read_fill(ard);
+		return;
+	}
+
+	IOF_TRACE_DEBUG(ard, "Splitting read of %#lx across %d descriptors",
+			in->xtvec.xt_len, count);
+
+	group->count = count;
+	ard->group = group;
+	ard->end_offset = (segs / count) * projection->max_read_size;
+
+	d_list_for_each_entry(part, &parts, list) {
+		part->rpc = ard->rpc;
+		part->handle = handle;
+		part->group = group;
+		part->data_offset = (i * segs / count) *
+			projection->max_read_size;
+		part->start_offset = part->data_offset;
+		part->segment_offset = part->data_offset;
+		part->end_offset = ((i + 1) * segs / count) *
+			projection->max_read_size;
+		if (part->end_offset > in->xtvec.xt_len)
+			part->end_offset = in->xtvec.xt_len;
+		i++;
+	}
+
+	/* The parts may complete, and be released, as soon as they start */
+	d_list_for_each_entry_safe(part, next, &parts, list) {
+		d_list_del(&part->list);
+		iof_read_fill(part);
 	}
+	iof_read_fill(ard);
+}
+
+/* Returns true if there is more data to be read for this request */
+static bool
+iof_read_more(struct ionss_active_read *ard)
+{
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+
+	if (ard->stop)
+		return false;
+
+	if (in->xtvec_len > 0)
+		return ard->xt_index < in->xtvec_len;
+
+	return ard->segment_offset < ard->end_offset;
+}
+
+/* Completion callback for fetching the extent list of a xtvec read.
+ *
+ * Validate the list against the requested length and then start the read.
+ */
+static int
+iof_read_xtvec_cb(const struct crt_bulk_cb_info *cb_info)
+{
+	struct ionss_active_read *ard = cb_info->bci_arg;
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct iof_xtvec *xtvec = ard->xtvec_bulk.buf;
+	uint64_t total = 0;
+	int i;
+
+	if (cb_info->bci_rc) {
+		ard->err = cb_info->bci_rc;
+		iof_read_complete(ard);
+		return 0;
+	}
+
+	for (i = 0; i < in->xtvec_len; i++) {
+		if (xtvec[i].xt_len > in->bulk_len - total) {
+			IOF_TRACE_WARNING(ard, "Extent %d exceeds bulk_len %#lx",
+					  i, in->bulk_len);
+			ard->err = -DER_INVAL;
+			iof_read_complete(ard);
+			return 0;
+		}
+		total += xtvec[i].xt_len;
+	}
+
+	IOF_TRACE_DEBUG(ard, "Received %lu extents, %#lx bytes",
+			in->xtvec_len, total);
+
+	ard->xtvec_valid = true;
+	iof_read_fill(ard);
+	return 0;
+}
+
+/* Fill a buffer from the extent list of a xtvec read.
+ *
+ * Extents are read in order with one pread() each, up to max_read_size
+ * bytes at a time, and the read stops early at end of file.  The length
+ * requested is saved in the buffer so that a short read can be detected.
+ * Returns 0 or errno on failure.
+ */
+static int
+iof_read_xtvec_fill(struct ionss_active_read *ard, struct ionss_io_buf *buf)
+{
+	struct ionss_file_handle *handle = ard->handle;
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct ios_projection *projection = handle->projection;
+	struct iof_xtvec *xtvec = ard->xtvec_bulk.buf;
+	struct iof_xtvec *xt;
+	size_t req_len = 0;
+	size_t count;
+	ssize_t rc;
+	off_t offset;
+
+	while (ard->xt_index < in->xtvec_len &&
+	       req_len < projection->max_read_size) {
+		xt = &xtvec[ard->xt_index];
+
+		count = xt->xt_len - ard->xt_offset;
+		if (count > projection->max_read_size - req_len)
+			count = projection->max_read_size - req_len;
+		offset = xt->xt_off + ard->xt_offset;
+		req_len += count;
+
+		IOF_TRACE_DEBUG(ard, "Reading extent %lu from fd=%d %#zx-%#zx",
+				ard->xt_index, handle->fd, offset,
+				offset + count - 1);
+
+		errno = 0;
+		rc = pread(handle->fd, buf->bulk.buf + buf->len, count, offset);
+		if (rc == -1)
+			return errno;
+
+		buf->len += rc;
+		ard->xt_offset += rc;
+		if (ard->xt_offset == xt->xt_len) {
+			ard->xt_index++;
+			ard->xt_offset = 0;
+		}
+
+		if (rc < count)
+			break;
+	}
+
+	buf->op.len = req_len;
+	return 0;
+}
+
+/* Continue processing a read after the state of a buffer has changed.
+ *
+ * Called with the lock held, unless another thread is already filling
+ * buffers then become the filling thread.  Drops the lock before returning.
+ */
+static void
+iof_read_next(struct ionss_active_read *ard)
+{
+	if (ard->filling) {
+		D_MUTEX_UNLOCK(&ard->lock);
+		return;
+	}
+	ard->filling = true;
+	iof_read_pump(ard);
+}
+
+/* Handle completion of the disk read for one buffer.
+ *
+ * res is the number of bytes read or a negative errno.  The data is sent to
+ * the client, either as a bulk transfer or in the reply if this is the final
+ * segment of the request and small enough.  May be called from the thread
+ * filling buffers or, for asynchronous i/o, from the completion thread.
+ */
+static void
+iof_read_done(struct ionss_active_read *ard, struct ionss_io_buf *buf,
+	      ssize_t res)
+{
+	struct ionss_file_handle *handle = ard->handle;
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct iof_readx_out *out = crt_reply_get(ard->rpc);
+	struct ios_projection *projection = handle->projection;
+	struct crt_bulk_desc bulk_desc = {0};
+	bool last;
+	int rc;
+
+	D_MUTEX_LOCK(&ard->lock);
+	if (res < 0) {
+		ard->rc = -res;
+		ard->stop = true;
+		if (buf->data_offset < ard->short_end)
+			ard->short_end = buf->data_offset;
+		buf->busy = false;
+		ard->inflight--;
+		iof_read_next(ard);
+		return;
+	}
+
+	buf->len = res;
+	if (buf->len < buf->op.len) {
+		ard->stop = true;
+		if (buf->data_offset + buf->len < ard->short_end)
+			ard->short_end = buf->data_offset + buf->len;
+	}
+
+	if (buf->len == 0) {
+		buf->busy = false;
+		ard->inflight--;
+		iof_read_next(ard);
+		return;
+	}
+
+	/* Can send last bit in immediate data, as long as it directly
+	 * follows all data sent by bulk.  Split requests always use bulk
+	 * as the reply may be sent after this descriptor, and its buffers,
+	 * have been released.
+	 */
+	last = ard->stop ||
+		buf->data_offset + buf->op.len == ard->end_offset;
+	if (in->xtvec_len == 0 && !ard->group && last &&
+	    ard->end_offset == in->xtvec.xt_len &&
+	    buf->len <= projection->max_iov_read_size) {
+		out->iov_len = buf->len;
+		d_iov_set(&out->data, buf->bulk.buf, buf->len);
+		ard->stop = true;
+		ard->inflight--;
+		iof_read_next(ard);
+		return;
+	}
+
+	/* Hold an extra count so that the request cannot complete before
+	 * readahead has been updated.
+	 */
+	ard->inflight++;
+	D_MUTEX_UNLOCK(&ard->lock);
 
 	bulk_desc.bd_rpc = ard->rpc;
 	bulk_desc.bd_bulk_op = CRT_BULK_PUT;
 	bulk_desc.bd_remote_hdl = in->data_bulk;
-	bulk_desc.bd_remote_off = ard->data_offset;
-	bulk_desc.bd_local_hdl = ard->local_bulk.handle;
-	bulk_desc.bd_len = ard->read_len;
+	bulk_desc.bd_remote_off = buf->data_offset;
+	bulk_desc.bd_local_hdl = buf->bulk.handle;
+	bulk_desc.bd_len = buf->len;
 
-	IOF_TRACE_DEBUG(ard, "Sending bulk " GAH_PRINT_STR,
+	IOF_TRACE_DEBUG(ard, "Sending bulk %#lx-%#lx " GAH_PRINT_STR,
+			buf->data_offset, buf->data_offset + buf->len - 1,
 			GAH_PRINT_VAL(in->gah));
 
-	ard->data_offset += ard->req_len;
-	ard->segment_offset += ard->req_len;
+	rc = crt_bulk_transfer(&bulk_desc, iof_read_bulk_cb, buf, NULL);
 
-	if (ard->segment_offset < in->xtvec.xt_len &&
-	    ard->read_len == ard->req_len)
-		more_to_do = true;
+	/* Prefetch any following data whilst the bulk transfer is in
+	 * progress.  Split requests are not sequential so do not feed the
+	 * detector.
+	 */
+	if (rc == -DER_SUCCESS && in->xtvec_len == 0 && !ard->group)
+		ios_ra_update(handle, buf->op.offset, buf->len);
 
-	rc = crt_bulk_transfer(&bulk_desc, iof_read_bulk_cb, ard, NULL);
+	D_MUTEX_LOCK(&ard->lock);
 	if (rc != -DER_SUCCESS) {
-		out->err = rc;
+		ard->err = rc;
 		ard->failed = true;
-		goto out;
+		ard->stop = true;
+		buf->busy = false;
+		ard->inflight--;
 	}
+	ard->inflight--;
+	iof_read_next(ard);
+}
+
+/* Completion callback for asynchronous disk reads */
+static void
+iof_read_aio_cb(struct ios_aio_op *op, ssize_t res)
+{
+	struct ionss_io_buf *buf = (void *)op - offsetof(struct ionss_io_buf, op);
+
+	iof_read_done(buf->desc, buf, res);
+}
+
+/* Start reading the next segment of a request into a buffer.
+ *
+ * Called without the lock held, but only by the thread which set the
+ * filling flag so the read position is not shared.  Reads which are served
+ * from the readahead cache, or from an extent list, are completed before
+ * returning, other reads may complete asynchronously.
+ */
+static void
+iof_read_segment(struct ionss_active_read *ard, struct ionss_io_buf *buf)
+{
+	struct ionss_file_handle *handle = ard->handle;
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct ios_projection *projection = handle->projection;
+	size_t count;
+	off_t offset;
+	ssize_t res;
+	int rc;
 
-	if (more_to_do)
+	buf->data_offset = ard->data_offset;
+	buf->len = 0;
+
+	if (in->xtvec_len > 0) {
+		rc = iof_read_xtvec_fill(ard, buf);
+		ard->data_offset += buf->len;
+		iof_read_done(ard, buf, rc ? -rc : buf->len);
 		return;
+	}
 
-	/* Do not call crt_reply_send() in this case as it'll be done in the
-	 * bulk handler however it's safe to drop the handle as the read
-	 * has completed at this point.
-	 */
-	ios_fh_decref(handle, 1);
+	count = ard->end_offset - ard->segment_offset;
+	/* Only read max_read_size at a time */
+	if (count > projection->max_read_size)
+		count = projection->max_read_size;
+	offset = in->xtvec.xt_off + ard->segment_offset;
 
-	return;
-out:
+	ard->data_offset += count;
+	ard->segment_offset += count;
+
+	buf->op.opcode = IOS_AIO_READ;
+	buf->op.cb = iof_read_aio_cb;
+	buf->op.fd = handle->fd;
+	buf->op.buf = buf->bulk.buf;
+	buf->op.len = count;
+	buf->op.offset = offset;
+
+	IOF_TRACE_DEBUG(ard, "Reading from fd=%d %#zx-%#zx", handle->fd, offset,
+			offset + count - 1);
+
+	res = ios_ra_read(handle, buf->bulk.buf, count, offset);
+	if (res != -1) {
+		iof_read_done(ard, buf, res);
+		return;
+	}
+
+	ios_aio_submit(projection->base, &buf->op);
+}
+
+/* Start reading a request, or continue after a buffer has been freed.
+ *
+ * Only one thread fills buffers at a time, if another thread is already
+ * doing so then it will pick up any buffers released in the meantime.
+ */
+static void
+iof_read_fill(struct ionss_active_read *ard)
+{
+	D_MUTEX_LOCK(&ard->lock);
+	iof_read_next(ard);
+}
+
+/* Process a read request
+ *
+ * Called with the lock held and the filling flag set, starts reading
+ * segments into free buffers, with each being sent to the client as its read
+ * completes.  This allows the next segment to be read from disk whilst the
+ * previous one is being sent.  The reply is sent once there is nothing left
+ * to read and no reads or transfers are in progress.  Drops the lock before
+ * returning.
+ */
+static void
+iof_read_pump(struct ionss_active_read *ard)
+{
+	struct iof_readx_in *in = crt_req_get(ard->rpc);
+	struct ios_projection *projection = ard->handle->projection;
+	struct crt_bulk_desc bulk_desc = {0};
+	struct ionss_io_buf *buf;
+	bool done;
+	int rc;
+	int i;
+
+	if (in->xtvec_len > 0 && !ard->xtvec_valid) {
+		/* Fetch the extent list from the client first */
+		bulk_desc.bd_rpc = ard->rpc;
+		bulk_desc.bd_bulk_op = CRT_BULK_GET;
+		bulk_desc.bd_remote_hdl = in->xtvec_bulk;
+		bulk_desc.bd_local_hdl = ard->xtvec_bulk.handle;
+		bulk_desc.bd_len = in->xtvec_len * sizeof(struct iof_xtvec);
+
+		ard->filling = false;
+		D_MUTEX_UNLOCK(&ard->lock);
+
+		rc = crt_bulk_transfer(&bulk_desc, iof_read_xtvec_cb, ard,
+				       NULL);
+		if (rc != -DER_SUCCESS) {
+			ard->err = rc;
+			iof_read_complete(ard);
+		}
+		return;
+	}
+
+	while (iof_read_more(ard)) {
+		buf = NULL;
+		for (i = 0; i < projection->io_depth; i++) {
+			if (!ard->buf[i].busy) {
+				buf = &ard->buf[i];
+				break;
+			}
+		}
+		/* All buffers are in use, so continue from the callback */
+		if (!buf)
+			break;
+
+		buf->busy = true;
+		ard->inflight++;
+		D_MUTEX_UNLOCK(&ard->lock);
+
+		iof_read_segment(ard, buf);
+
+		D_MUTEX_LOCK(&ard->lock);
+	}
+
+	ard->filling = false;
+	done = (ard->inflight == 0 && !iof_read_more(ard));
+	D_MUTEX_UNLOCK(&ard->lock);
+
+	if (done)
+		iof_read_complete(ard);
+}
+
+/* Send the reply for a read request and release all resources, including
+ * the handle reference.
+ */
+static void
+iof_read_complete(struct ionss_active_read *ard)
+{
+	struct ionss_file_handle *handle = ard->handle;
+	struct ios_projection *projection = handle->projection;
+	struct iof_readx_out *out = crt_reply_get(ard->rpc);
+	uint64_t len = ard->len;
+	int rc;
+
+	/* Data after a short or failed buffer may have been sent, but is not
+	 * contiguous so is not included.
+	 */
+	if (ard->short_end - ard->start_offset < len)
+		len = ard->short_end - ard->start_offset;
+
+	if (!iof_io_group_done(ard->group, ard->start_offset, ard->end_offset,
+			       len, ard->rc, ard->err,
+			       &out->bulk_len, &out->rc, &out->err)) {
+		/* Other parts of the request are still in progress */
+		iof_pool_release(projection->ar_pool, ard);
+		iof_read_check_and_send(projection);
+		return;
+	}
 
 	rc = crt_reply_send(ard->rpc);
 
@@ -1385,42 +2669,31 @@ out:
 
 /* Completion callback for bulk read request
  *
- * This function is called when a put to the client has completed for a bulk
- * read.
+ * This function is called when a put to the client has completed for one
+ * buffer of a bulk read.  The buffer is released and, unless another thread
+ * is already doing so, the next segment is read into it.
  */
 static int
 iof_read_bulk_cb(const struct crt_bulk_cb_info *cb_info)
 {
-	struct ionss_active_read *ard = cb_info->bci_arg;
-	struct ios_projection *projection = ard->handle->projection;
-	struct iof_readx_out *out = crt_reply_get(ard->rpc);
-	struct iof_readx_in *in = crt_req_get(ard->rpc);
-	int rc;
+	struct ionss_io_buf *buf = cb_info->bci_arg;
+	struct ionss_active_read *ard = buf->desc;
 
+	D_MUTEX_LOCK(&ard->lock);
 	if (cb_info->bci_rc) {
-		out->err = cb_info->bci_rc;
+		ard->err = cb_info->bci_rc;
 		ard->failed = true;
+		ard->stop = true;
+		if (buf->data_offset < ard->short_end)
+			ard->short_end = buf->data_offset;
 	} else {
-		out->bulk_len += ard->read_len;
-	}
-
-	if (ard->segment_offset < in->xtvec.xt_len &&
-	    ard->read_len == ard->req_len) {
-		/* Get the next segment */
-		iof_process_read_bulk(ard);
-		return 0;
+		ard->len += buf->len;
 	}
 
-	rc = crt_reply_send(ard->rpc);
-
-	if (rc)
-		IOF_TRACE_ERROR(ard, "response not sent, ret = %d", rc);
-
-	crt_req_decref(ard->rpc);
+	buf->busy = false;
+	ard->inflight--;
 
-	iof_pool_release(projection->ar_pool, ard);
-
-	iof_read_check_and_send(projection);
+	iof_read_next(ard);
 	return 0;
 }
 
@@ -1448,10 +2721,10 @@ iof_readx_handler(crt_rpc_t *rpc)
 	if (out->err)
 		goto out;
 
-	/* TODO: Only immediate xtvec supported for now */
-	if (in->xtvec_len > 0) {
-		IOF_LOG_WARNING("xtvec not yet supported for read");
-		out->err = -DER_NOSYS;
+	if (in->xtvec_len > IOF_XTVEC_MAX) {
+		IOF_TRACE_WARNING(handle, "Too many extents %lu",
+				  in->xtvec_len);
+		out->err = -DER_INVAL;
 		goto out;
 	}
 
@@ -1474,7 +2747,7 @@ iof_readx_handler(crt_rpc_t *rpc)
 		D_MUTEX_UNLOCK(&projection->lock);
 		ard->rpc = rpc;
 		ard->handle = handle;
-		iof_process_read_bulk(ard);
+		iof_read_start(ard);
 	} else {
 		/* Piggyback the output descriptor space to store the read
 		 * descriptor whilst in the read queue
@@ -1522,6 +2795,16 @@ iof_rename_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		D_GOTO(out, 0);
 
+	out->rc = ios_fh_fd_get(old_parent);
+	if (out->rc)
+		D_GOTO(out, 0);
+
+	out->rc = ios_fh_fd_get(new_parent);
+	if (out->rc) {
+		ios_fh_fd_put(old_parent);
+		D_GOTO(out, 0);
+	}
+
 	errno = 0;
 
 #if 1
@@ -1538,8 +2821,21 @@ iof_rename_handler(crt_rpc_t *rpc)
 		       new_parent->fd, in->new_name.name,
 		       in->flags);
 #endif
-	if (rc)
+	if (rc) {
 		out->rc = errno;
+	} else {
+		ios_dir_cache_invalidate(old_parent->projection,
+					 old_parent->mf.inode_no);
+		ios_dir_cache_invalidate(new_parent->projection,
+					 new_parent->mf.inode_no);
+		ios_watch_notify(old_parent->projection, rpc,
+				 old_parent->mf.inode_no, in->old_name.name);
+		ios_watch_notify(new_parent->projection, rpc,
+				 new_parent->mf.inode_no, in->new_name.name);
+	}
+
+	ios_fh_fd_put(old_parent);
+	ios_fh_fd_put(new_parent);
 
 out:
 	if (out->rc == ENOTSUP)
@@ -1580,11 +2876,23 @@ iof_symlink_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = symlinkat(in->oldpath, parent->fd, in->common.name.name);
 
-	if (rc)
+	if (rc) {
 		out->rc = errno;
+	} else {
+		ios_dir_cache_invalidate(parent->projection,
+					 parent->mf.inode_no);
+		ios_watch_notify(parent->projection, rpc, parent->mf.inode_no,
+				 in->common.name.name);
+	}
+
+	ios_fh_fd_put(parent);
 
 out:
 	lookup_common(rpc, &in->common, out, parent);
@@ -1610,11 +2918,23 @@ iof_mkdir_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = mkdirat(parent->fd, in->common.name.name, in->mode);
 
-	if (rc)
+	if (rc) {
 		out->rc = errno;
+	} else {
+		ios_dir_cache_invalidate(parent->projection,
+					 parent->mf.inode_no);
+		ios_watch_notify(parent->projection, rpc, parent->mf.inode_no,
+				 in->common.name.name);
+	}
+
+	ios_fh_fd_put(parent);
 
 	IOF_TRACE_DEBUG(parent, "dir '%s' rc %d",
 			in->common.name.name, out->rc);
@@ -1639,6 +2959,10 @@ iof_readlink_handler(crt_rpc_t *rpc)
 	if (out->err)
 		goto out;
 
+	out->rc = ios_fh_fd_get(file);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = readlinkat(file->fd, "", reply, IOF_MAX_PATH_LEN);
 
@@ -1647,6 +2971,8 @@ iof_readlink_handler(crt_rpc_t *rpc)
 	else
 		out->path = (d_string_t)reply;
 
+	ios_fh_fd_put(file);
+
 out:
 	rc = crt_reply_send(rpc);
 	if (rc)
@@ -1671,11 +2997,23 @@ static void iof_unlink_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
+	out->rc = ios_fh_fd_get(parent);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = unlinkat(parent->fd, in->name.name, in->flags ? AT_REMOVEDIR : 0);
 
-	if (rc)
+	if (rc) {
 		out->rc = errno;
+	} else {
+		ios_dir_cache_invalidate(parent->projection,
+					 parent->mf.inode_no);
+		ios_watch_notify(parent->projection, rpc, parent->mf.inode_no,
+				 in->name.name);
+	}
+
+	ios_fh_fd_put(parent);
 
 	IOF_TRACE_DEBUG(parent, "%s '%s' rc %d",
 			in->flags ? "dir" : "file", in->name.name, out->rc);
@@ -1697,7 +3035,15 @@ out:
 			out->err = -DER_MISC;				\
 			break;						\
 		}							\
-		if (xtlen != ((in)->bulk_len + (in)->data.iov_len)) {	\
+		if ((in)->xtvec_len > 0) {				\
+			/* Extent lists carry all data via bulk */	\
+			if ((in)->xtvec_len > IOF_XTVEC_MAX ||		\
+			    (in)->data.iov_len != 0) {			\
+				out->err = -DER_INVAL;			\
+				break;					\
+			}						\
+		} else if (xtlen != ((in)->bulk_len +			\
+				     (in)->data.iov_len)) {		\
 			out->err = -DER_MISC;				\
 			break;						\
 		}							\
@@ -1720,14 +3066,16 @@ _Static_assert(sizeof(struct ionss_io_req_desc) <=
 	       " struct ionss_io_req_desc");
 
 static int iof_write_bulk(const struct crt_bulk_cb_info *cb_info);
-static void iof_process_write(struct ionss_active_write *awd);
+static void iof_write_start(struct ionss_active_write *awd);
+static void iof_write_fill(struct ionss_active_write *awd);
+static void iof_write_pump(struct ionss_active_write *awd);
+static void iof_write_complete(struct ionss_active_write *awd);
 
 void iof_write_check_and_send(struct ios_projection *projection)
 {
 	struct ionss_io_req_desc *wrd;
 	struct ionss_active_write *awd;
 	struct iof_writex_in *in;
-	struct iof_writex_out *out;
 
 	D_MUTEX_LOCK(&projection->lock);
 	if (d_list_empty(&projection->write_list)) {
@@ -1764,78 +3112,474 @@ void iof_write_check_and_send(struct ios_projection *projection)
 	awd->rpc = wrd->rpc;
 	awd->handle = wrd->handle;
 
-	in = crt_req_get(awd->rpc);
-	out = crt_reply_get(awd->rpc);
+	in = crt_req_get(awd->rpc);
+
+	/* Reset the borrowed output to 0 */
+	memset(wrd, 0, sizeof(*wrd));
+
+	if (in->xtvec.xt_len == 0 && in->xtvec_len == 0)
+		awd->err = -DER_NOSYS;
+
+	iof_write_start(awd);
+}
+
+/* Start a write request, splitting it across idle descriptors if possible.
+ *
+ * As for reads, the bulk data of a large contiguous write is divided into
+ * ranges of whole max_write_size segments with one descriptor per range.
+ * Any immediate data is written by the descriptor handling the final range.
+ */
+static void
+iof_write_start(struct ionss_active_write *awd)
+{
+	struct ionss_file_handle *handle = awd->handle;
+	struct ios_projection *projection = handle->projection;
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct ionss_io_group *group = NULL;
+	struct ionss_active_write *part, *next;
+	d_list_t parts;
+	uint64_t segs;
+	int count = 1;
+	int i = 1;
+
+	awd->end_offset = in->bulk_len;
+
+	segs = (in->bulk_len + projection->max_write_size - 1) /
+		projection->max_write_size;
+	if (in->xtvec_len == 0 && !awd->err)
+		group = iof_io_group_alloc(segs);
+	if (!group) {
+		iof_write_fill(awd);
+		return;
+	}
+
+	D_INIT_LIST_HEAD(&parts);
+
+	D_MUTEX_LOCK(&projection->lock);
+	while (count < segs && d_list_empty(&projection->write_list)) {
+		part = iof_pool_acquire(projection->aw_pool);
+		if (!part)
+			break;
+		projection->current_write_count++;
+		IOF_TRACE_UP(part, handle, "awd");
+		d_list_add_tail(&part->list, &parts);
+		count++;
+	}
+	D_MUTEX_UNLOCK(&projection->lock);
+
+	if (count == 1) {
+		iof_io_group_free(group);
+		iof_write_fill(awd);
+		return;
+	}
+
+	IOF_TRACE_DEBUG(awd, "Splitting write of %#lx across %d descriptors",
+			in->bulk_len, count);
+
+	group->count = count;
+	awd->group = group;
+	awd->end_offset = (segs / count) * projection->max_write_size;
+
+	d_list_for_each_entry(part, &parts, list) {
+		part->rpc = awd->rpc;
+		part->handle = handle;
+		part->group = group;
+		part->data_offset = (i * segs / count) *
+			projection->max_write_size;
+		part->start_offset = part->data_offset;
+		part->end_offset = ((i + 1) * segs / count) *
+			projection->max_write_size;
+		if (part->end_offset > in->bulk_len)
+			part->end_offset = in->bulk_len;
+		i++;
+	}
+
+	/* The parts may complete, and be released, as soon as they start */
+	d_list_for_each_entry_safe(part, next, &parts, list) {
+		d_list_del(&part->list);
+		iof_write_fill(part);
+	}
+	iof_write_fill(awd);
+}
+
+static int
+xtvec_cmp(const void *a, const void *b)
+{
+	const struct iof_xtvec *xa = a;
+	const struct iof_xtvec *xb = b;
+
+	if (xa->xt_off < xb->xt_off)
+		return -1;
+	return xa->xt_off > xb->xt_off;
+}
+
+/* Check that no two extents of a write overlap.
+ *
+ * Buffers of packed data are written as they arrive, so the result of
+ * writing overlapping extents would depend on the order the buffers
+ * complete in.
+ */
+static bool
+xtvec_overlaps(struct iof_xtvec *xtvec, uint64_t count)
+{
+	struct iof_xtvec *sorted;
+	bool overlaps = false;
+	uint64_t end = 0;
+	uint64_t i;
+
+	D_ALLOC_ARRAY(sorted, count);
+	if (!sorted)
+		return true;
+
+	memcpy(sorted, xtvec, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), xtvec_cmp);
+
+	for (i = 0; i < count; i++) {
+		if (sorted[i].xt_len == 0)
+			continue;
+		if (sorted[i].xt_off < end) {
+			overlaps = true;
+			break;
+		}
+		end = sorted[i].xt_off + sorted[i].xt_len;
+	}
+
+	D_FREE(sorted);
+	return overlaps;
+}
+
+/* Completion callback for fetching the extent list of a xtvec write.
+ *
+ * Validate the list against the bulk length and then start the write.
+ * Overlapping extents are rejected.
+ */
+static int
+iof_write_xtvec_cb(const struct crt_bulk_cb_info *cb_info)
+{
+	struct ionss_active_write *awd = cb_info->bci_arg;
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct iof_xtvec *xtvec = awd->xtvec_bulk.buf;
+	uint64_t total = 0;
+	int i;
+
+	if (cb_info->bci_rc) {
+		awd->err = cb_info->bci_rc;
+		iof_write_complete(awd);
+		return 0;
+	}
+
+	for (i = 0; i < in->xtvec_len; i++) {
+		if (xtvec[i].xt_len > in->bulk_len - total)
+			break;
+		total += xtvec[i].xt_len;
+	}
+
+	if (total != in->bulk_len) {
+		IOF_TRACE_WARNING(awd, "Extents do not match bulk_len %#lx",
+				  in->bulk_len);
+		awd->err = -DER_INVAL;
+		iof_write_complete(awd);
+		return 0;
+	}
+
+	if (xtvec_overlaps(xtvec, in->xtvec_len)) {
+		IOF_TRACE_WARNING(awd, "Overlapping extents in write");
+		awd->err = -DER_INVAL;
+		iof_write_complete(awd);
+		return 0;
+	}
+
+	IOF_TRACE_DEBUG(awd, "Received %lu extents, %#lx bytes",
+			in->xtvec_len, total);
+
+	awd->xtvec_valid = true;
+	iof_write_fill(awd);
+	return 0;
+}
+
+/* Write one buffer of packed data to the extents it covers.
+ *
+ * The first extent is located from the offset of the buffer in the packed
+ * data, as buffers may complete in any order.  Runs of extents which are
+ * contiguous in the file are written with a single pwrite(), as the data for
+ * them is also contiguous in the buffer.  Returns the number of bytes
+ * written, which is short if any write was, or -1 with errno set on failure.
+ */
+static ssize_t
+iof_write_xtvec_apply(struct ionss_active_write *awd, struct ionss_io_buf *buf)
+{
+	struct ionss_file_handle *handle = awd->handle;
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct iof_xtvec *xtvec = awd->xtvec_bulk.buf;
+	size_t consumed = 0;
+	size_t count;
+	size_t avail;
+	size_t take;
+	size_t written;
+	ssize_t rc;
+	uint64_t xt_index = 0;
+	uint64_t xt_offset = buf->data_offset;
+	uint64_t i;
+	uint64_t run_offset;
+	off_t offset;
+
+	while (xt_index < in->xtvec_len &&
+	       xt_offset >= xtvec[xt_index].xt_len) {
+		xt_offset -= xtvec[xt_index].xt_len;
+		xt_index++;
+	}
+
+	while (consumed < buf->len) {
+		while (xt_index < in->xtvec_len && xtvec[xt_index].xt_len == 0)
+			xt_index++;
+
+		if (xt_index == in->xtvec_len)
+			break;
+
+		/* Find the run of file-contiguous extents */
+		offset = xtvec[xt_index].xt_off + xt_offset;
+		count = 0;
+		i = xt_index;
+		run_offset = xt_offset;
+		while (i < in->xtvec_len) {
+			avail = xtvec[i].xt_len - run_offset;
+			take = buf->len - consumed - count;
+			if (take > avail)
+				take = avail;
+			count += take;
+			if (take < avail)
+				break;
+			i++;
+			run_offset = 0;
+			if (i < in->xtvec_len &&
+			    xtvec[i].xt_off !=
+			    xtvec[i - 1].xt_off + xtvec[i - 1].xt_len)
+				break;
+		}
+
+		IOF_TRACE_DEBUG(awd, "Writing extent %lu to fd=%d %#zx-%#zx",
+				xt_index, handle->fd, offset,
+				offset + count - 1);
+
+		errno = 0;
+		rc = pwrite(handle->fd, buf->bulk.buf + consumed, count,
+			    offset);
+		if (rc == -1)
+			return -1;
+
+		consumed += rc;
+
+		/* Move past the bytes written in each extent of the run */
+		written = rc;
+		while (written > 0) {
+			avail = xtvec[xt_index].xt_len - xt_offset;
+			take = written;
+			if (take > avail)
+				take = avail;
+			xt_offset += take;
+			written -= take;
+			if (xt_offset == xtvec[xt_index].xt_len) {
+				xt_index++;
+				xt_offset = 0;
+			}
+		}
+
+		if (rc < count)
+			break;
+	}
+
+	return consumed;
+}
+
+/* Returns true if there is more data to be fetched for this request */
+static bool
+iof_write_more(struct ionss_active_write *awd)
+{
+	if (awd->stop)
+		return false;
+
+	return awd->data_offset < awd->end_offset;
+}
+
+/* Start processing a write request, or continue after a buffer has been
+ * freed.
+ *
+ * Only one thread fetches buffers at a time, if another thread is already
+ * doing so then it will pick up any buffers released in the meantime.
+ */
+static void
+iof_write_fill(struct ionss_active_write *awd)
+{
+	D_MUTEX_LOCK(&awd->lock);
+	if (awd->filling) {
+		D_MUTEX_UNLOCK(&awd->lock);
+		return;
+	}
+	awd->filling = true;
+	iof_write_pump(awd);
+}
+
+/* Write any immediate data once all bulk data has been written, this follows
+ * the bulk data in the file.
+ */
+static void
+iof_write_immediate(struct ionss_active_write *awd)
+{
+	struct ionss_file_handle *handle = awd->handle;
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct ios_projection *projection = handle->projection;
+	ssize_t bytes_written;
+	off_t offset;
+
+	offset = in->xtvec.xt_off + in->bulk_len;
+	IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", handle->fd,
+			offset, offset + in->data.iov_len - 1);
+	errno = 0;
+	bytes_written = pwrite(handle->fd, in->data.iov_buf, in->data.iov_len,
+			       offset);
+	if (bytes_written == -1) {
+		awd->rc = errno;
+	} else {
+		ios_ra_invalidate(projection, handle->mf.inode_no);
+		awd->len += bytes_written;
+	}
+}
+
+/* Process a write request
+ *
+ * Called with the lock held and the filling flag set, submits a bulk pull
+ * into each free buffer so that data for the next segment is being fetched
+ * whilst the previous one is written to disk.  The reply is sent once all
+ * data has been fetched and written.  Drops the lock before returning.
+ */
+static void
+iof_write_pump(struct ionss_active_write *awd)
+{
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct ios_projection *projection = awd->handle->projection;
+	struct crt_bulk_desc bulk_desc = {0};
+	struct ionss_io_buf *buf;
+	bool done;
+	int rc;
+	int i;
+
+	if (awd->err)
+		awd->stop = true;
+
+	if (!awd->stop && in->xtvec_len > 0 && !awd->xtvec_valid) {
+		/* Fetch the extent list from the client first */
+		bulk_desc.bd_rpc = awd->rpc;
+		bulk_desc.bd_bulk_op = CRT_BULK_GET;
+		bulk_desc.bd_remote_hdl = in->xtvec_bulk;
+		bulk_desc.bd_local_hdl = awd->xtvec_bulk.handle;
+		bulk_desc.bd_len = in->xtvec_len * sizeof(struct iof_xtvec);
+
+		awd->filling = false;
+		D_MUTEX_UNLOCK(&awd->lock);
+
+		rc = crt_bulk_transfer(&bulk_desc, iof_write_xtvec_cb, awd,
+				       NULL);
+		if (rc) {
+			awd->err = rc;
+			iof_write_complete(awd);
+		}
+		return;
+	}
+
+	while (iof_write_more(awd)) {
+		buf = NULL;
+		for (i = 0; i < projection->io_depth; i++) {
+			if (!awd->buf[i].busy) {
+				buf = &awd->buf[i];
+				break;
+			}
+		}
+		/* All buffers are in use, so continue from the callback */
+		if (!buf)
+			break;
+
+		buf->busy = true;
+		buf->data_offset = awd->data_offset;
+		buf->len = awd->end_offset - awd->data_offset;
+		/* Only write max_write_size at a time */
+		if (buf->len > projection->max_write_size)
+			buf->len = projection->max_write_size;
+		awd->data_offset += buf->len;
+		awd->inflight++;
+
+		bulk_desc.bd_rpc = awd->rpc;
+		bulk_desc.bd_bulk_op = CRT_BULK_GET;
+		bulk_desc.bd_remote_hdl = in->data_bulk;
+		bulk_desc.bd_remote_off = buf->data_offset;
+		bulk_desc.bd_local_hdl = buf->bulk.handle;
+		bulk_desc.bd_len = buf->len;
+
+		IOF_TRACE_DEBUG(awd, "Fetching bulk %#lx-%#lx " GAH_PRINT_STR,
+				buf->data_offset,
+				buf->data_offset + buf->len - 1,
+				GAH_PRINT_VAL(in->gah));
+
+		D_MUTEX_UNLOCK(&awd->lock);
+
+		rc = crt_bulk_transfer(&bulk_desc, iof_write_bulk, buf, NULL);
+
+		D_MUTEX_LOCK(&awd->lock);
+		if (rc) {
+			awd->err = rc;
+			awd->failed = true;
+			awd->stop = true;
+			awd->inflight--;
+			buf->busy = false;
+			break;
+		}
+	}
+
+	awd->filling = false;
+	done = (awd->inflight == 0 && !iof_write_more(awd));
+	D_MUTEX_UNLOCK(&awd->lock);
 
-	/* Reset the borrowed output to 0 */
-	memset(wrd, 0, sizeof(*wrd));
+	if (!done)
+		return;
 
-	if (in->xtvec.xt_len == 0)
-		out->err = -DER_NOSYS;
+	if (!awd->stop && in->data.iov_len > 0 &&
+	    awd->end_offset == in->bulk_len)
+		iof_write_immediate(awd);
 
-	iof_process_write(awd);
+	iof_write_complete(awd);
 }
 
-/* Process a write request
- *
- * This function submits a bulk pull to get the data to write
+/* Send the reply for a write request and release all resources, including
+ * the handle reference.
  */
 static void
-iof_process_write(struct ionss_active_write *awd)
+iof_write_complete(struct ionss_active_write *awd)
 {
 	struct ionss_file_handle *handle = awd->handle;
-	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	struct ios_projection *projection = handle->projection;
 	struct iof_writex_out *out = crt_reply_get(awd->rpc);
-	struct ios_projection *projection = awd->handle->projection;
-	struct crt_bulk_desc bulk_desc = {0};
-	ssize_t bytes_written;
-	off_t offset;
+	uint64_t len = awd->len;
 	int rc;
 
-	if (out->err)
-		D_GOTO(out, 0);
-
-	if (in->bulk_len == 0 || awd->segment_offset == in->bulk_len) {
-		offset = in->xtvec.xt_off + awd->segment_offset;
-		IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", handle->fd,
-				offset, offset + in->data.iov_len - 1);
-		errno = 0;
-		bytes_written = pwrite(handle->fd, in->data.iov_buf,
-				       in->data.iov_len, offset);
-		if (bytes_written == -1)
-			out->rc = errno;
-		else
-			out->len += bytes_written;
-		D_GOTO(out, 0);
-	}
-
-	awd->req_len = in->xtvec.xt_len - awd->segment_offset;
-	/* Only write max_write_size at a time */
-	if (awd->req_len > projection->max_write_size)
-		awd->req_len = projection->max_write_size;
-
-	bulk_desc.bd_rpc = awd->rpc;
-	bulk_desc.bd_bulk_op = CRT_BULK_GET;
-	bulk_desc.bd_remote_hdl = in->data_bulk;
-	bulk_desc.bd_remote_off = awd->data_offset;
-	bulk_desc.bd_local_hdl = awd->local_bulk.handle;
-	bulk_desc.bd_len = awd->req_len;
-
-	IOF_TRACE_DEBUG(awd, "Fetching bulk " GAH_PRINT_STR,
-			GAH_PRINT_VAL(in->gah));
-
-	rc = crt_bulk_transfer(&bulk_desc, iof_write_bulk, awd, NULL);
-	if (rc) {
-		awd->failed = true;
-		D_GOTO(out, out->err = rc);
-	}
-
-	/* Do not call crt_reply_send() in this case as it'll be done in the
-	 * bulk handler
+	/* Buffers complete in any order, so data after a short or failed
+	 * buffer may have been written, but is not contiguous so is not
+	 * included.
 	 */
+	if (awd->short_end - awd->start_offset < len)
+		len = awd->short_end - awd->start_offset;
+
+	if (!iof_io_group_done(awd->group, awd->start_offset, awd->end_offset,
+			       len, awd->rc, awd->err,
+			       &out->len, &out->rc, &out->err)) {
+		/* Other parts of the request are still in progress */
+		iof_pool_release(projection->aw_pool, awd);
+		iof_write_check_and_send(projection);
+		return;
+	}
 
-	return;
-out:
+	/* Report the change once for the whole request */
+	if (out->len > 0)
+		ios_watch_notify(projection, awd->rpc, handle->mf.inode_no,
+				 NULL);
 
 	rc = crt_reply_send(awd->rpc);
 
@@ -1851,52 +3595,100 @@ out:
 	iof_write_check_and_send(projection);
 }
 
-static int iof_write_bulk(const struct crt_bulk_cb_info *cb_info)
+/* Handle completion of the disk write for one buffer.
+ *
+ * res is the number of bytes written or a negative errno.  The buffer is
+ * released and, unless another thread is already doing so, used to fetch
+ * the next segment.  May be called from a bulk completion callback or, for
+ * asynchronous i/o, from the completion thread.
+ */
+static void
+iof_write_done(struct ionss_active_write *awd, struct ionss_io_buf *buf,
+	       ssize_t res)
 {
-	struct ionss_active_write *awd = cb_info->bci_arg;
 	struct ionss_file_handle *handle = awd->handle;
-	struct ios_projection *projection = handle->projection;
-	struct iof_writex_out *out = crt_reply_get(awd->rpc);
-	struct iof_writex_in *in = crt_req_get(awd->rpc);
-	ssize_t bytes_written;
-	off_t offset;
-	int rc;
 
-	if (cb_info->bci_rc)
-		D_GOTO(out, out->err = cb_info->bci_rc);
+	if (res > 0)
+		ios_ra_invalidate(handle->projection, handle->mf.inode_no);
 
-	offset = in->xtvec.xt_off + awd->segment_offset;
-	IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", handle->fd,
-			offset, offset + awd->req_len - 1);
-	errno = 0;
-	bytes_written = pwrite(handle->fd, awd->local_bulk.buf,
-			       awd->req_len, offset);
-	if (bytes_written == -1) {
-		D_GOTO(out, out->rc = errno);
+	D_MUTEX_LOCK(&awd->lock);
+	if (res < 0) {
+		awd->rc = -res;
+		awd->stop = true;
+		if (buf->data_offset < awd->short_end)
+			awd->short_end = buf->data_offset;
 	} else {
-		out->len += bytes_written;
-		if (out->len < in->xtvec.xt_len) {
-			awd->segment_offset += awd->req_len;
-			awd->data_offset += awd->req_len;
-			iof_process_write(awd);
-			return 0;
+		awd->len += res;
+		if (res < buf->len) {
+			awd->stop = true;
+			if (buf->data_offset + res < awd->short_end)
+				awd->short_end = buf->data_offset + res;
 		}
 	}
 
-out:
-	rc = crt_reply_send(awd->rpc);
+	buf->busy = false;
+	awd->inflight--;
 
-	if (rc)
-		IOF_TRACE_ERROR(awd, "response not sent, ret = %d", rc);
+	if (awd->filling) {
+		D_MUTEX_UNLOCK(&awd->lock);
+		return;
+	}
+	awd->filling = true;
+	iof_write_pump(awd);
+}
 
-	crt_req_decref(awd->rpc);
+/* Completion callback for asynchronous disk writes */
+static void
+iof_write_aio_cb(struct ios_aio_op *op, ssize_t res)
+{
+	struct ionss_io_buf *buf = (void *)op - offsetof(struct ionss_io_buf, op);
 
-	iof_pool_release(projection->aw_pool, awd);
+	iof_write_done(buf->desc, buf, res);
+}
 
-	ios_fh_decref(handle, 1);
+/* Completion callback for bulk write request
+ *
+ * This function is called when a pull from the client has completed for one
+ * buffer of a bulk write.  The data is then written to disk, contiguous
+ * writes are submitted as a single operation which may complete
+ * asynchronously.
+ */
+static int iof_write_bulk(const struct crt_bulk_cb_info *cb_info)
+{
+	struct ionss_io_buf *buf = cb_info->bci_arg;
+	struct ionss_active_write *awd = buf->desc;
+	struct ionss_file_handle *handle = awd->handle;
+	struct iof_writex_in *in = crt_req_get(awd->rpc);
+	ssize_t bytes_written;
 
-	iof_write_check_and_send(projection);
+	if (cb_info->bci_rc) {
+		D_MUTEX_LOCK(&awd->lock);
+		awd->err = cb_info->bci_rc;
+		awd->stop = true;
+		D_MUTEX_UNLOCK(&awd->lock);
+		iof_write_done(awd, buf, 0);
+		return 0;
+	}
+
+	if (in->xtvec_len > 0) {
+		bytes_written = iof_write_xtvec_apply(awd, buf);
+		if (bytes_written == -1)
+			bytes_written = -errno;
+		iof_write_done(awd, buf, bytes_written);
+		return 0;
+	}
+
+	buf->op.opcode = IOS_AIO_WRITE;
+	buf->op.cb = iof_write_aio_cb;
+	buf->op.fd = handle->fd;
+	buf->op.buf = buf->bulk.buf;
+	buf->op.len = buf->len;
+	buf->op.offset = in->xtvec.xt_off + buf->data_offset;
+
+	IOF_TRACE_DEBUG(awd, "Writing to fd=%d %#zx-%#zx", handle->fd,
+			buf->op.offset, buf->op.offset + buf->len - 1);
 
+	ios_aio_submit(handle->projection->base, &buf->op);
 	return 0;
 }
 
@@ -1925,14 +3717,6 @@ iof_writex_handler(crt_rpc_t *rpc)
 	if (out->err)
 		D_GOTO(out, 0);
 
-	/* TODO: Only immediate xtvec supported for now */
-	if (in->xtvec_len > 0) {
-		IOF_TRACE_WARNING(projection,
-				  "xtvec not yet supported for write");
-		out->err = -DER_NOSYS;
-		goto out;
-	}
-
 	crt_req_addref(rpc);
 
 	D_MUTEX_LOCK(&projection->lock);
@@ -1950,7 +3734,7 @@ iof_writex_handler(crt_rpc_t *rpc)
 		D_MUTEX_UNLOCK(&projection->lock);
 		awd->rpc = rpc;
 		awd->handle = handle;
-		iof_process_write(awd);
+		iof_write_start(awd);
 	} else {
 		/* Piggyback the output descriptor space to store the write
 		 * descriptor whilst in the write queue
@@ -1982,6 +3766,7 @@ static void iof_setattr_handler(crt_rpc_t *rpc)
 	struct iof_setattr_in *in = crt_req_get(rpc);
 	struct iof_attr_out *out = crt_reply_get(rpc);
 	struct ionss_file_handle *handle;
+	bool pinned = false;
 	int fd = -1;
 	int rc;
 
@@ -1993,6 +3778,11 @@ static void iof_setattr_handler(crt_rpc_t *rpc)
 	if (out->err || out->rc)
 		goto out;
 
+	out->rc = ios_fh_fd_get(handle);
+	if (out->rc)
+		goto out;
+	pinned = true;
+
 	if (handle->mf.type == inode_handle) {
 		int e;
 
@@ -2081,6 +3871,8 @@ static void iof_setattr_handler(crt_rpc_t *rpc)
 		if (rc)
 			D_GOTO(out, out->rc = errno);
 
+		ios_ra_invalidate(handle->projection, handle->mf.inode_no);
+
 		in->to_set &= ~(FUSE_SET_ATTR_SIZE);
 	}
 
@@ -2134,6 +3926,8 @@ static void iof_setattr_handler(crt_rpc_t *rpc)
 	if (rc)
 		out->rc = errno;
 
+	ios_watch_notify(handle->projection, rpc, handle->mf.inode_no, NULL);
+
 out:
 	IOF_TRACE_DEBUG(handle, "set %#x err %d rc %d",
 			in->to_set, out->err, out->rc);
@@ -2146,6 +3940,9 @@ out:
 		if (handle->mf.type == inode_handle && fd != -1)
 			close(fd);
 
+		if (pinned)
+			ios_fh_fd_put(handle);
+
 		ios_fh_decref(handle, 1);
 	}
 }
@@ -2162,13 +3959,19 @@ static void iof_statfs_handler(crt_rpc_t *rpc)
 	if (out->err)
 		goto out;
 
+	out->rc = ios_fh_fd_get(handle);
+	if (out->rc)
+		goto out;
+
 	errno = 0;
 	rc = fstatvfs(handle->fd, &buf);
-
-	if (rc) {
+	if (rc)
 		out->rc = errno;
+
+	ios_fh_fd_put(handle);
+
+	if (out->rc)
 		goto out;
-	}
 
 	/* Fuse ignores these three values on the client so zero them
 	 * out here first
@@ -2187,6 +3990,27 @@ out:
 		ios_fh_decref(handle, 1);
 }
 
+static void
+iof_watch_handler(crt_rpc_t *rpc)
+{
+	struct iof_watch_in		*in = crt_req_get(rpc);
+	struct iof_watch_out		*out = crt_reply_get(rpc);
+	struct ionss_file_handle	*handle;
+	int rc;
+
+	VALIDATE_ARGS_GAH_FILE(rpc, in, out, handle);
+	if (out->err) {
+		rc = crt_reply_send(rpc);
+		if (rc)
+			IOF_LOG_ERROR("response not sent, ret = %d", rc);
+	} else {
+		ios_watch_add(handle->projection, rpc);
+	}
+
+	if (handle)
+		ios_fh_decref(handle, 1);
+}
+
 #define X(a, b, c) iof_##a##_handler,
 
 static crt_rpc_cb_t handlers[] = {
@@ -2195,14 +4019,74 @@ static crt_rpc_cb_t handlers[] = {
 
 #undef X
 
+/* Metadata RPCs are passed to the worker pool of the projection */
+#define X(name, type, field)						\
+	static void iof_##name##_dispatch(crt_rpc_t *rpc)		\
+	{								\
+		struct iof_##type *in = crt_req_get(rpc);		\
+									\
+		ios_meta_dispatch(&base, rpc, &in->field,		\
+				  iof_##name##_handler,			\
+				  IOS_META_OP_##name);			\
+	}
+
+IOS_META_OPS
+
+#undef X
+
+/* Reads from the start of a directory may build a snapshot of it, which
+ * stats every entry, so pass them to the worker pool if the directory cache
+ * is enabled.  Later reads are served from the snapshot, or stream the
+ * directory one buffer at a time, so are handled directly.
+ */
+static void
+iof_readdir_dispatch_common(crt_rpc_t *rpc, crt_rpc_cb_t fn)
+{
+	struct iof_readdir_in *in = crt_req_get(rpc);
+	struct ionss_dir_handle *handle = NULL;
+	int rc;
+
+	if (in->offset != 0)
+		D_GOTO(direct, 0);
+
+	rc = ios_gah_get_info(base.gs, &in->gah, (void **)&handle);
+	if (rc || !handle || handle->projection->dir_cache.max_bytes == 0)
+		D_GOTO(direct, 0);
+
+	ios_meta_queue(handle->projection, rpc, fn, IOS_META_OP_readdir);
+	return;
+
+direct:
+	fn(rpc);
+}
+
+static void
+iof_readdir_dispatch(crt_rpc_t *rpc)
+{
+	iof_readdir_dispatch_common(rpc, iof_readdir_handler);
+}
+
+static void
+iof_readdir_packed_dispatch(crt_rpc_t *rpc)
+{
+	iof_readdir_dispatch_common(rpc, iof_readdir_packed_handler);
+}
+
 static int iof_register_handlers(void)
 {
+#define X(name, ...) handlers[DEF_RPC_TYPE(name)] = iof_##name##_dispatch;
+	IOS_META_OPS
+	X(readdir)
+	X(readdir_packed)
+#undef X
+
 	return iof_register(NULL, handlers);
 }
 
 /*
  * Process filesystem query from CNSS
- * This function currently uses dummy data to send back to CNSS
+ *
+ * Only the fields of the original reply format are set, see iof_psr_query.
  */
 static void
 iof_query_handler(crt_rpc_t *query_rpc)
@@ -2211,10 +4095,33 @@ iof_query_handler(crt_rpc_t *query_rpc)
 	int ret;
 
 	query->poll_interval = base.cnss_poll_interval;
+	query->count = base.projection_count;
+	d_iov_set(&query->query_list, base.fs_list,
+		  base.projection_count * sizeof(struct iof_fs_info));
+
+	ret = crt_reply_send(query_rpc);
+	if (ret)
+		IOF_LOG_ERROR("query rpc response not sent, ret = %d", ret);
+
+	atomic_fetch_add(&cnss_count, 1);
+}
+
+/* Process an extended filesystem query from CNSS */
+static void
+iof_query_ext_handler(crt_rpc_t *query_rpc)
+{
+	struct iof_psr_query *query = crt_reply_get(query_rpc);
+	int ret;
+
+	query->poll_interval = base.cnss_poll_interval;
+	query->ctx_count = base.ctx_count;
+	query->proto_version = IOF_PROTO_VERSION;
 	query->progress_callback = base.progress_callback;
 	query->count = base.projection_count;
 	d_iov_set(&query->query_list, base.fs_list,
 		  base.projection_count * sizeof(struct iof_fs_info));
+	d_iov_set(&query->fs_ext, base.fs_ext,
+		  base.projection_count * sizeof(struct iof_fs_ext));
 
 	ret = crt_reply_send(query_rpc);
 	if (ret)
@@ -2234,6 +4141,13 @@ int ionss_register(void)
 		return ret;
 	}
 
+	ret = crt_rpc_srv_register(QUERY_EXT_OP, CRT_RPC_FEAT_NO_TIMEOUT,
+				   &QUERY_EXT_RPC_FMT, iof_query_ext_handler);
+	if (ret) {
+		IOF_LOG_ERROR("Cannot register query RPC, ret = %d", ret);
+		return ret;
+	}
+
 	ret = crt_rpc_srv_register(DETACH_OP, CRT_RPC_FEAT_NO_TIMEOUT,
 				   NULL, cnss_detach_handler);
 	if (ret) {
@@ -2271,15 +4185,16 @@ static int check_shutdown(void *arg)
 	return *valuep;
 }
 
+/* Progress a single context, arg points to the context to use */
 static void *progress_thread(void *arg)
 {
 	int			rc;
-	struct ios_base *b = (struct ios_base *)arg;
+	crt_context_t		crt_ctx = *(crt_context_t *)arg;
 
 	/* progress loop */
 	do {
-		rc = crt_progress(b->crt_ctx, b->poll_interval,
-				  b->callback_fn, &shutdown);
+		rc = crt_progress(crt_ctx, base.poll_interval,
+				  base.callback_fn, &shutdown);
 		if (rc != 0 && rc != -DER_TIMEDOUT) {
 			IOF_LOG_ERROR("crt_progress failed rc: %d", rc);
 			break;
@@ -2294,7 +4209,7 @@ static void *progress_thread(void *arg)
 	 * the sender.
 	 */
 	for (;;) {
-		rc = crt_progress(b->crt_ctx, 1000, NULL, NULL);
+		rc = crt_progress(crt_ctx, 1000, NULL, NULL);
 		if (rc == -DER_TIMEDOUT)
 			break;
 		if (rc != 0) {
@@ -2471,12 +4386,18 @@ static void show_help(const char *prog)
 	"# CNSS polling interval (in microseconds) for CART progress\n"
 	"cnss_poll_interval:     10000\n"
 	"\n"
-	"# Number of threads to be used on the IONSS\n"
+	"# Number of threads to be used on the IONSS.  Each thread progresses\n"
+	"# its own CART context\n"
 	"thread_count:           2\n"
 	"\n"
 	"# Enable/disable use of CART progress callback function on IONSS\n"
 	"progress_callback:      true\n"
 	"\n"
+	"# Submit file i/o through io_uring so that slow storage does not\n"
+	"# block CART progress.  Falls back to synchronous i/o if io_uring\n"
+	"# is not available\n"
+	"io_uring:               false\n"
+	"\n"
 	"# The following options can be specified either per projection or\n"
 	"# globally. If both are specified, the value specified for that\n"
 	"# projection takes precedence\n"
@@ -2494,6 +4415,21 @@ static void show_help(const char *prog)
 	"# true: 'ioc_ll_write_buf'; false: 'ioc_ll_write'\n"
 	"fuse_write_buf:         true\n"
 	"\n"
+	"# Allow the client kernel to cache directory contents between\n"
+	"# opens.  The cache is dropped when the directory has changed\n"
+	"# since it was last opened on that client\n"
+	"cache_readdir:          false\n"
+	"\n"
+	"# Cache writes on the client and send them to the IONSS in the\n"
+	"# background, merging adjacent writes into max_write sized\n"
+	"# requests.  Write errors are reported on a later write, flush\n"
+	"# or fsync rather than by the write that caused them\n"
+	"writeback_cache:        false\n"
+	"\n"
+	"# Reset and preallocate descriptors on a background thread on\n"
+	"# both the IONSS and the client rather than after each request\n"
+	"pool_thread:            false\n"
+	"\n"
 	"# Controls whether a client fails over to a new primary service\n"
 	"# rank (PSR) in case the current PSR gets evicted. Valid values\n"
 	"# are \"auto\" and \"disable\". If \"auto\" is specified, fail-over\n"
@@ -2525,6 +4461,46 @@ static void show_help(const char *prog)
 	"# Size of the buffer to be used for a bulk write operation\n"
 	"max_write_size:              1M\n"
 	"\n"
+	"# Number of max_read_size segments to prefetch ahead of a\n"
+	"# sequential reader, 0 disables readahead\n"
+	"readahead_count:             2\n"
+	"\n"
+	"# Total memory for cached readahead data, per projection.\n"
+	"# Cache hit, miss and eviction counts are logged at shutdown\n"
+	"readahead_cache_size:        16M\n"
+	"\n"
+	"# Number of buffers per active read or write, allowing disk i/o\n"
+	"# to overlap with bulk transfers.  1 disables pipelining, max 4\n"
+	"io_depth:                    2\n"
+	"\n"
+	"# Number of threads per projection for metadata operations, such\n"
+	"# as lookup, create and rename.  0 runs these in the progress\n"
+	"# thread.  Per-operation queue depth, wait and service times are\n"
+	"# logged at shutdown\n"
+	"meta_threads:                4\n"
+	"\n"
+	"# Number of looked-up inodes to keep open, per projection.  Beyond\n"
+	"# this the least recently used are closed and re-opened by handle\n"
+	"# on next use, which requires CAP_DAC_READ_SEARCH.  0 keeps all\n"
+	"# open.  Hit rate and re-open latency are logged at shutdown\n"
+	"fd_cache_size:               65536\n"
+	"\n"
+	"# Memory for cached directory contents and attributes, shared\n"
+	"# by all clients reading the same directory, per projection.\n"
+	"# 0 disables the cache\n"
+	"dircache_size:               16M\n"
+	"\n"
+	"# Maximum age in seconds of a cached directory.  Directories are\n"
+	"# re-read sooner if their mtime or ctime changes\n"
+	"dircache_ttl:                5\n"
+	"\n"
+	"# Time in milliseconds for which clients may cache entries and\n"
+	"# attributes without asking the IONSS, and failed lookups.  Clients\n"
+	"# are notified of changes made by other clients, 0 disables caching\n"
+	"entry_timeout:               0\n"
+	"attr_timeout:                0\n"
+	"negative_timeout:            0\n"
+	"\n"
 	"# Size of the buffer to be used for a direct read operation\n"
 	"max_iov_read_size:           64\n"
 	"\n"
@@ -2553,9 +4529,65 @@ fh_reset(void *arg)
 
 	fh->ht_ref = 0;
 	fh->ref = 0;
+	fh->ra_next_offset = 0;
+	fh->ra_streak = 0;
+	fh->fd = -1;
+	fh->fd_pin = 0;
+	fh->fd_cached = false;
+	fh->fd_lazy = false;
+	fh->fd_stale = false;
+	fh->fd_opening = false;
 	atomic_fetch_add(&fh->ref, 1);
 	memset(&fh->proc_fd_name, 0, 64);
 
+	/* Without a kernel handle the fd is simply not cached, so do not fail
+	 * the reset if the allocation fails.
+	 */
+	if (!fh->khandle)
+		D_ALLOC(fh->khandle, sizeof(*fh->khandle) + MAX_HANDLE_SZ);
+
+	return true;
+}
+
+static void
+fh_release(void *arg)
+{
+	struct ionss_file_handle *fh = arg;
+
+	D_FREE(fh->khandle);
+}
+
+/* Free all i/o buffers of an active descriptor */
+static void
+io_bufs_free(struct ionss_io_buf *bufs)
+{
+	int i;
+
+	for (i = 0; i < IONSS_MAX_IO_DEPTH; i++) {
+		if (bufs[i].bulk.buf)
+			IOF_BULK_FREE(&bufs[i], bulk);
+	}
+}
+
+/* Allocate io_depth i/o buffers for an active descriptor, returns false on
+ * failure.
+ */
+static bool
+io_bufs_alloc(struct ios_projection *projection, struct ionss_io_buf *bufs,
+	      size_t len, bool read_only)
+{
+	int i;
+
+	for (i = 0; i < projection->io_depth; i++) {
+		bufs[i].busy = false;
+		bufs[i].len = 0;
+		if (bufs[i].bulk.buf)
+			continue;
+		IOF_BULK_ALLOC(projection->base->crt_ctx, &bufs[i], bulk, len,
+			       read_only);
+		if (!bufs[i].bulk.buf)
+			return false;
+	}
 	return true;
 }
 
@@ -2563,8 +4595,12 @@ static void
 ar_init(void *arg, void *handle)
 {
 	struct ionss_active_read *ard = arg;
+	int i;
 
 	ard->projection = handle;
+	for (i = 0; i < IONSS_MAX_IO_DEPTH; i++)
+		ard->buf[i].desc = ard;
+	D_MUTEX_INIT(&ard->lock, NULL);
 }
 
 static bool
@@ -2574,19 +4610,36 @@ ar_reset(void *arg)
 
 	ard->data_offset = 0;
 	ard->segment_offset = 0;
+	ard->xt_index = 0;
+	ard->xt_offset = 0;
+	ard->start_offset = 0;
+	ard->end_offset = 0;
+	ard->short_end = UINT64_MAX;
+	ard->len = 0;
+	ard->rc = 0;
+	ard->err = 0;
+	ard->group = NULL;
+	ard->inflight = 0;
+	ard->xtvec_valid = false;
+	ard->filling = false;
+	ard->stop = false;
 
 	if (ard->failed) {
-		IOF_BULK_FREE(ard, local_bulk);
+		io_bufs_free(ard->buf);
 		ard->failed = false;
 	}
 
-	if (!ard->local_bulk.buf) {
+	if (!io_bufs_alloc(ard->projection, ard->buf,
+			   ard->projection->max_read_size, true))
+		return false;
+
+	if (!ard->xtvec_bulk.buf) {
 		IOF_BULK_ALLOC(ard->projection->base->crt_ctx,
 			       ard,
-			       local_bulk,
-			       ard->projection->max_read_size,
-			       true);
-		if (!ard->local_bulk.buf)
+			       xtvec_bulk,
+			       IOF_XTVEC_MAX * sizeof(struct iof_xtvec),
+			       false);
+		if (!ard->xtvec_bulk.buf)
 			return false;
 	}
 
@@ -2598,15 +4651,22 @@ ar_release(void *arg)
 {
 	struct ionss_active_read *ard = arg;
 
-	IOF_BULK_FREE(ard, local_bulk);
+	io_bufs_free(ard->buf);
+	if (ard->xtvec_bulk.buf)
+		IOF_BULK_FREE(ard, xtvec_bulk);
+	D_MUTEX_DESTROY(&ard->lock);
 }
 
 static void
 aw_init(void *arg, void *handle)
 {
 	struct ionss_active_write *awd = arg;
+	int i;
 
 	awd->projection = handle;
+	for (i = 0; i < IONSS_MAX_IO_DEPTH; i++)
+		awd->buf[i].desc = awd;
+	D_MUTEX_INIT(&awd->lock, NULL);
 }
 
 static bool
@@ -2615,20 +4675,34 @@ aw_reset(void *arg)
 	struct ionss_active_write *awd = arg;
 
 	awd->data_offset = 0;
-	awd->segment_offset = 0;
+	awd->start_offset = 0;
+	awd->end_offset = 0;
+	awd->len = 0;
+	awd->short_end = UINT64_MAX;
+	awd->rc = 0;
+	awd->err = 0;
+	awd->group = NULL;
+	awd->inflight = 0;
+	awd->xtvec_valid = false;
+	awd->filling = false;
+	awd->stop = false;
 
 	if (awd->failed) {
-		IOF_BULK_FREE(awd, local_bulk);
+		io_bufs_free(awd->buf);
 		awd->failed = false;
 	}
 
-	if (!awd->local_bulk.buf) {
+	if (!io_bufs_alloc(awd->projection, awd->buf,
+			   awd->projection->max_write_size, false))
+		return false;
+
+	if (!awd->xtvec_bulk.buf) {
 		IOF_BULK_ALLOC(awd->projection->base->crt_ctx,
 			       awd,
-			       local_bulk,
-			       awd->projection->max_write_size,
+			       xtvec_bulk,
+			       IOF_XTVEC_MAX * sizeof(struct iof_xtvec),
 			       false);
-		if (!awd->local_bulk.buf)
+		if (!awd->xtvec_bulk.buf)
 			return false;
 	}
 
@@ -2640,7 +4714,10 @@ aw_release(void *arg)
 {
 	struct ionss_active_write *awd = arg;
 
-	IOF_BULK_FREE(awd, local_bulk);
+	io_bufs_free(awd->buf);
+	if (awd->xtvec_bulk.buf)
+		IOF_BULK_FREE(awd, xtvec_bulk);
+	D_MUTEX_DESTROY(&awd->lock);
 }
 
 int main(int argc, char **argv)
@@ -2657,8 +4734,6 @@ int main(int argc, char **argv)
 	iof_log_init("ION", "IONSS", NULL);
 	IOF_LOG_INFO("IONSS version: %s", version);
 
-	D_RWLOCK_INIT(&base.gah_rwlock, NULL);
-
 	while (1) {
 		static struct option long_options[] = {
 			{"help", no_argument, 0, 'h'},
@@ -2725,6 +4800,12 @@ int main(int argc, char **argv)
 		goto cleanup;
 	}
 
+	D_ALLOC_ARRAY(base.fs_ext, base.projection_count);
+	if (!base.fs_ext) {
+		ret = -DER_NOMEM;
+		goto cleanup;
+	}
+
 	IOF_LOG_INFO("Projecting %d exports", base.projection_count);
 
 	/*initialize CaRT*/
@@ -2764,6 +4845,7 @@ int main(int argc, char **argv)
 		struct stat buf = {0};
 		struct iof_pool_reg fhp = {.init = fh_init,
 					   .reset = fh_reset,
+					   .release = fh_release,
 					   POOL_TYPE_INIT(ionss_file_handle,
 							  clist)};
 		int fd;
@@ -2775,6 +4857,14 @@ int main(int argc, char **argv)
 			goto cleanup;
 		}
 
+		if (projection->pool_thread) {
+			ret = iof_pool_start_thread(&projection->pool);
+			if (ret != -DER_SUCCESS) {
+				err = 1;
+				goto cleanup;
+			}
+		}
+
 		fd = open(projection->full_path,
 			  O_DIRECTORY | O_PATH | O_NOATIME | O_RDONLY);
 		if (fd == -1) {
@@ -2804,13 +4894,38 @@ int main(int argc, char **argv)
 		D_INIT_LIST_HEAD(&projection->read_list);
 		D_INIT_LIST_HEAD(&projection->write_list);
 
+		if (projection->io_depth < 1)
+			projection->io_depth = 1;
+		if (projection->io_depth > IONSS_MAX_IO_DEPTH) {
+			IOF_LOG_WARNING("io_depth %d too large, using %d",
+					projection->io_depth,
+					IONSS_MAX_IO_DEPTH);
+			projection->io_depth = IONSS_MAX_IO_DEPTH;
+		}
+
+		rc = ios_ra_init(projection);
+		if (rc != -DER_SUCCESS)
+			continue;
+
+		rc = ios_meta_init(projection);
+		if (rc != -DER_SUCCESS)
+			goto stop_ra;
+
+		rc = ios_dir_cache_init(projection);
+		if (rc != -DER_SUCCESS)
+			goto stop_meta;
+
+		rc = ios_watch_init(projection);
+		if (rc != -DER_SUCCESS)
+			goto stop_dir_cache;
+
 		errno = 0;
 		rc = fstat(fd, &buf);
 		if (rc) {
 			IOF_LOG_ERROR("Could not stat export path %s %d",
 				      projection->full_path, errno);
 			err = 1;
-			continue;
+			goto stop_watch;
 		}
 
 		projection->dev_no = buf.st_dev;
@@ -2826,11 +4941,11 @@ int main(int argc, char **argv)
 		projection->fh_pool = iof_pool_register(&projection->pool,
 							&fhp);
 		if (!projection->fh_pool)
-			continue;
+			goto stop_watch;
 
 		rc = ios_fh_alloc(projection, &projection->root);
 		if (rc != 0)
-			continue;
+			goto stop_watch;
 
 		projection->root->fd = fd;
 		projection->root->mf.inode_no = buf.st_ino;
@@ -2845,15 +4960,32 @@ int main(int argc, char **argv)
 				       &projection->root->clist, 0);
 		if (rc != 0) {
 			IOF_LOG_ERROR("Could not insert into hash table");
-			continue;
+			goto stop_watch;
 		}
 
+		rc = ios_fd_cache_init(projection);
+		if (rc != -DER_SUCCESS)
+			goto stop_watch;
+
 		IOF_LOG_INFO("Projecting %s", projection->full_path);
 		IOF_LOG_INFO("Access: Read-%s; Failover: %s",
 			     projection->writeable ? "Write" : "Only",
 			     projection->failover ? "Enabled" : "Disabled");
 		projection->active = true;
 		projection->id = i;
+		continue;
+
+		/* Stop the threads and free the caches started above for a
+		 * projection which is not going to be used.
+		 */
+stop_watch:
+		ios_watch_fini(projection);
+stop_dir_cache:
+		ios_dir_cache_fini(projection);
+stop_meta:
+		ios_meta_fini(projection);
+stop_ra:
+		ios_ra_fini(projection);
 	}
 	if (err) {
 		ret = 1;
@@ -2872,6 +5004,36 @@ int main(int argc, char **argv)
 		goto cleanup;
 	}
 
+	/* Create one context per progress thread so that threads are not
+	 * contending on a single context.  Clients select a context by
+	 * setting the endpoint tag, so the count is returned in the query
+	 * reply.  CaRT limits the number of contexts so if creation fails
+	 * then share the contexts which were created between the threads.
+	 */
+	D_ALLOC_ARRAY(base.crt_ctx_list, base.thread_count);
+	if (!base.crt_ctx_list)
+		D_GOTO(cleanup, ret = 1);
+
+	base.crt_ctx_list[0] = base.crt_ctx;
+	base.ctx_count = 1;
+	while (base.ctx_count < base.thread_count) {
+		ret = crt_context_create(&base.crt_ctx_list[base.ctx_count]);
+		if (ret) {
+			IOF_LOG_WARNING("Could not create context %d, rc = %d",
+					base.ctx_count, ret);
+			break;
+		}
+		base.ctx_count++;
+	}
+	IOF_LOG_INFO("Using %d contexts for %d threads", base.ctx_count,
+		     base.thread_count);
+
+	ret = ios_aio_init(&base);
+	if (ret) {
+		IOF_LOG_ERROR("Could not start async i/o %d", ret);
+		goto cleanup;
+	}
+
 	for (i = 0; i < base.projection_count; i++) {
 		struct ios_projection *projection = &base.projection_array[i];
 
@@ -2921,6 +5083,9 @@ int main(int argc, char **argv)
 		base.fs_list[i].max_write = projection->max_write_size;
 		base.fs_list[i].max_iov_write = projection->max_iov_write_size;
 		base.fs_list[i].htable_size = projection->inode_htable_size;
+		base.fs_ext[i].entry_timeout = projection->entry_timeout;
+		base.fs_ext[i].attr_timeout = projection->attr_timeout;
+		base.fs_ext[i].negative_timeout = projection->negative_timeout;
 
 		base.fs_list[i].flags = IOF_FS_DEFAULT;
 		if (projection->failover)
@@ -2933,6 +5098,12 @@ int main(int argc, char **argv)
 			base.fs_list[i].flags |= IOF_FUSE_READ_BUF;
 		if (projection->fuse_write_buf)
 			base.fs_list[i].flags |= IOF_FUSE_WRITE_BUF;
+		if (projection->cache_readdir)
+			base.fs_list[i].flags |= IOF_CACHE_READDIR;
+		if (projection->writeback_cache)
+			base.fs_list[i].flags |= IOF_WRITEBACK_CACHE;
+		if (projection->pool_thread)
+			base.fs_list[i].flags |= IOF_POOL_THREAD;
 
 		base.fs_list[i].gah = projection->root->gah;
 		base.fs_list[i].id = projection->id;
@@ -2980,7 +5151,9 @@ int main(int argc, char **argv)
 		for (thread = 0; thread < base.thread_count; thread++) {
 			IOF_LOG_INFO("Starting thread %d", thread);
 			ret = pthread_create(&progress_tids[thread], NULL,
-					     progress_thread, &base);
+					     progress_thread,
+					     &base.crt_ctx_list[thread %
+								base.ctx_count]);
 		}
 
 		for (thread = 0; thread < base.thread_count; thread++) {
@@ -2997,6 +5170,9 @@ int main(int argc, char **argv)
 
 cleanup:
 
+	/* Wait for any outstanding file i/o before releasing resources */
+	ios_aio_fini(&base);
+
 	/* After shutdown has been invoked close all files and free any memory,
 	 * in normal operation all files should be closed as a result of CNSS
 	 * requests prior to shutdown being triggered however perform a full
@@ -3017,8 +5193,18 @@ cleanup:
 
 		IOF_TRACE_DEBUG(projection, "Stopping projection");
 
+		ios_meta_fini(projection);
+
 		release_projection_resources(projection);
 
+		ios_fd_cache_fini(projection);
+
+		ios_ra_fini(projection);
+
+		ios_dir_cache_fini(projection);
+
+		ios_watch_fini(projection);
+
 		rc = pthread_mutex_destroy(&projection->lock);
 		if (rc != 0)
 			IOF_TRACE_WARNING(projection,
@@ -3030,7 +5216,12 @@ cleanup:
 		iof_pool_destroy(&projection->pool);
 	}
 
-	D_RWLOCK_DESTROY(&base.gah_rwlock);
+	for (i = 1; i < base.ctx_count; i++) {
+		ret = crt_context_destroy(base.crt_ctx_list[i], 0);
+		if (ret)
+			IOF_LOG_ERROR("Could not destroy context %d", i);
+	}
+	D_FREE(base.crt_ctx_list);
 
 	ret = crt_context_destroy(base.crt_ctx, 0);
 	if (ret)
@@ -3050,6 +5241,7 @@ cleanup:
 		IOF_LOG_ERROR("Could not finalize cart");
 
 	D_FREE(base.fs_list);
+	D_FREE(base.fs_ext);
 
 	ret = ios_gah_destroy(base.gs);
 	if (ret)
@@ -39,6 +39,7 @@
 #define __IONSS_H__
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <stdbool.h>
 #include "iof_atomic.h"
@@ -54,6 +55,7 @@
 struct ios_base {
 	struct ios_projection	*projection_array;
 	struct iof_fs_info	*fs_list;
+	struct iof_fs_ext	*fs_ext;
 	struct ios_gah_store	*gs;
 	struct proto		*proto;
 	uint32_t		projection_count;
@@ -61,13 +63,18 @@ struct ios_base {
 	d_rank_t		my_rank;
 	uint32_t		num_ranks;
 	crt_context_t		crt_ctx;
-	pthread_rwlock_t	gah_rwlock;
+	/* One context per progress thread, crt_ctx_list[0] is crt_ctx */
+	crt_context_t		*crt_ctx_list;
+	uint32_t		ctx_count;
+	/* Asynchronous i/o engine, NULL if i/o is synchronous */
+	struct ios_aio		*aio;
 	/* Global tunable options */
 	char			*group_name;
 	uint32_t		poll_interval;
 	uint32_t		cnss_poll_interval;
 	uint32_t		thread_count;
 	bool			progress_callback;
+	bool			io_uring;
 	crt_progress_cond_cb_t  callback_fn;
 };
 
@@ -113,6 +120,10 @@ struct ionss_mini_file {
  * The last instance of file close will result in decref to zero in the ht which
  * will then call fh_decref(), which will then release the GAH and recycle the
  * descriptor.
+ *
+ * For inode handles the fd may be closed by the fd cache when not in use, so
+ * any access to fd or proc_fd_name should be bracketed by ios_fh_fd_get() and
+ * ios_fh_fd_put().
  */
 struct ionss_file_handle {
 	struct ios_gah		 gah;
@@ -120,9 +131,227 @@ struct ionss_file_handle {
 	d_list_t		 clist;
 	struct ionss_mini_file	 mf;
 	char			 proc_fd_name[64];
-	uint			 fd;
+	int			 fd;
 	ATOMIC uint		 ht_ref;
 	ATOMIC uint		 ref;
+	/* fd cache state, protected by the fd_cache lock */
+	struct file_handle	*khandle;
+	d_list_t		 fd_lru;
+	uint			 fd_pin;
+	bool			 fd_cached;
+	/* Created by lookup without a fd, which has never been opened */
+	bool			 fd_lazy;
+	/* The inode changed before a lazy handle was first opened, so the
+	 * handle is no longer matched by hash table lookups.
+	 */
+	bool			 fd_stale;
+	/* Set whilst the fd is being re-opened without the lock held */
+	bool			 fd_opening;
+	/* Sequential stream detection, used to drive readahead */
+	off_t			 ra_next_offset;
+	uint32_t		 ra_streak;
+};
+
+/* Number of inode hash buckets in the readahead cache */
+#define IOS_RA_BUCKETS (64)
+
+/* Readahead cache.
+ *
+ * A bounded, per-projection cache of file data which is populated by
+ * prefetching the segments following a sequential stream of reads on a
+ * file handle.  Entries are keyed on inode number so are shared between
+ * all handles, and clients, which access the same file.
+ *
+ * Entries are allocated on demand up to the configured budget, and after
+ * that the least recently used entry is recycled.  Any write or truncate
+ * to a file discards all cached data for that inode.
+ */
+struct ios_ra_cache {
+	pthread_mutex_t		lock;
+	/* List of entries, most recently used first */
+	d_list_t		lru;
+	/* Entries which are filling or valid, hashed by inode number */
+	d_list_t		buckets[IOS_RA_BUCKETS];
+	uint32_t		entry_count;
+	uint32_t		max_entries;
+	/* Statistics */
+	uint64_t		hits;
+	uint64_t		misses;
+	uint64_t		evictions;
+	uint64_t		prefetches;
+	uint64_t		invalidations;
+};
+
+/* Metadata operations which are handled by the worker pool, with the input
+ * type and the field containing the GAH used to locate the projection.
+ */
+#define IOS_META_OPS					\
+	X(lookup,	gah_string_in,	gah)		\
+	X(create,	create_in,	common.gah)	\
+	X(mkdir,	create_in,	common.gah)	\
+	X(unlink,	unlink_in,	gah)		\
+	X(rename,	rename_in,	old_gah)	\
+	X(setattr,	setattr_in,	gah)		\
+	X(statfs,	gah_in,		gah)		\
+	X(lookup_path,	lookup_path_in,	gah)
+
+#define X(name, ...) IOS_META_OP_##name,
+enum ios_meta_op {
+	IOS_META_OPS
+	/* Directory reads which may build a snapshot, these are queued by
+	 * iof_readdir_dispatch() as the GAH is for a directory handle.
+	 */
+	IOS_META_OP_readdir,
+	IOS_META_OP_COUNT
+};
+#undef X
+
+/* Per-opcode statistics for the metadata worker pool, times are in
+ * nanoseconds.
+ */
+struct ios_meta_stats {
+	uint64_t		count;
+	uint64_t		wait_total;
+	uint64_t		wait_max;
+	uint64_t		service_total;
+	uint64_t		service_max;
+};
+
+/* Metadata worker pool.
+ *
+ * Metadata RPCs for a projection are queued here and executed by a fixed
+ * number of worker threads, so that slow metadata operations on the backing
+ * filesystem do not hold up the progress threads.  The handlers send the
+ * reply directly from the worker thread.
+ */
+struct ios_meta_pool {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	d_list_t		queue;
+	pthread_t		*threads;
+	uint32_t		thread_count;
+	uint32_t		depth;
+	uint32_t		depth_hwm;
+	/* RPCs handled on the progress thread as the queue was full */
+	uint64_t		overflow;
+	bool			stop;
+	struct ios_meta_stats	stats[IOS_META_OP_COUNT];
+	/* Parallel batches, and the total items in them */
+	uint64_t		batches;
+	uint64_t		batch_items;
+};
+
+/* Minimum number of items per worker when splitting a parallel batch */
+#define IOS_META_BATCH_MIN (8)
+
+/* Maximum number of queued RPCs per metadata worker.  Once the queue is full
+ * RPCs are handled directly on the progress thread, which stops any more
+ * being received until the backlog has reduced.
+ */
+#define IOS_META_QUEUE_PER_THREAD (64)
+
+/* File descriptor cache.
+ *
+ * Inode handles are created for every name a client looks up, so to bound
+ * the number of open files the fds for these are treated as a cache.  A
+ * kernel file handle is saved for each, and once more than fd_cache_size are
+ * open the least recently used fds are closed, to be reopened with
+ * open_by_handle_at() on next use.  Requires CAP_DAC_READ_SEARCH, if that is
+ * not available then the cache is disabled and fds are kept open.
+ */
+struct ios_fd_cache {
+	pthread_mutex_t		lock;
+	/* Signalled when a re-open completes */
+	pthread_cond_t		cond;
+	d_list_t		lru;
+	uint32_t		open_count;
+	int			mount_id;
+	bool			enabled;
+	uint64_t		hits;
+	uint64_t		misses;
+	uint64_t		evictions;
+	uint64_t		reopen_errors;
+	uint64_t		reopen_time;	/* Total, in nanoseconds */
+	uint64_t		reopen_time_max;
+	uint64_t		lazy;
+	uint64_t		materialized;
+};
+
+/* Directory snapshot cache.
+ *
+ * The contents of directories, and the attributes of each entry, are read
+ * once and shared between all directory handles and clients which read the
+ * same directory.  Snapshots are keyed on inode number and are reused whilst
+ * the mtime and ctime of the directory are unchanged, up to dircache_ttl
+ * seconds old, after which they are rebuilt.  The ttl also bounds how long
+ * changes to the attributes of entries may go unnoticed, as these do not
+ * update the directory itself.
+ *
+ * Snapshots are evicted least recently used first once the total size
+ * exceeds dircache_size, and directories larger than half of this are not
+ * cached but read directly.
+ */
+struct ios_dir_cache {
+	pthread_mutex_t		lock;
+	/* Signalled when a snapshot has been built */
+	pthread_cond_t		cond;
+	/* List of snapshots, most recently used first */
+	d_list_t		lru;
+	size_t			bytes;
+	size_t			max_bytes;
+	uint64_t		ttl;	/* In nanoseconds */
+	/* Statistics */
+	uint64_t		hits;
+	uint64_t		misses;
+	uint64_t		waits;
+	uint64_t		scans;
+	uint64_t		too_large;
+	uint64_t		evictions;
+	uint64_t		invalidations;
+};
+
+/* Change notification.
+ *
+ * Changes made through the IONSS are recorded in a per-projection ring of
+ * events, each with a sequence number.  Clients which cache entries keep a
+ * watch RPC outstanding, which is replied to as soon as there are events
+ * newer than those the client has seen, or with no events after
+ * IOS_WATCH_TIMEOUT seconds.  A client which falls more than
+ * IOS_WATCH_EVENTS behind is told that events have been lost.
+ */
+#define IOS_WATCH_EVENTS 256
+#define IOS_WATCH_TIMEOUT 10
+
+/* Changes to attributes or contents are held back for IOS_WATCH_DELAY_MS
+ * before waking watchers, and repeats of one of the last IOS_WATCH_COALESCE
+ * events which have not been sent are dropped.  Clients are not sent their
+ * own changes.
+ */
+#define IOS_WATCH_DELAY_MS 50
+#define IOS_WATCH_COALESCE 16
+
+struct ios_watch {
+	pthread_mutex_t		lock;
+	/* Signalled to stop the expiry thread */
+	pthread_cond_t		cond;
+	pthread_t		thread;
+	/* List of outstanding watch RPCs */
+	d_list_t		waiters;
+	struct iof_watch_event	*events;
+	/* Sequence number of the next event, starting at 1 */
+	uint64_t		seq;
+	/* Highest sequence number sent to any client */
+	uint64_t		delivered;
+	/* Time at which held back events are sent */
+	struct timespec		delay_until;
+	bool			delay_pending;
+	bool			started;
+	bool			stop;
+	/* Statistics */
+	uint64_t		notified;
+	uint64_t		coalesced;
+	uint64_t		replies;
+	uint64_t		lost;
 };
 
 struct ios_projection {
@@ -146,12 +375,25 @@ struct ios_projection {
 	uint32_t		max_write_count;
 	uint32_t		inode_htable_size;
 	uint32_t		readdir_size;
+	uint32_t		readahead_count;
+	uint32_t		readahead_cache_size;
+	uint32_t		io_depth;
+	uint32_t		meta_threads;
+	uint32_t		fd_cache_size;
+	uint32_t		dircache_size;
+	uint32_t		dircache_ttl;
+	uint32_t		entry_timeout;
+	uint32_t		attr_timeout;
+	uint32_t		negative_timeout;
 	char			*mount_path;
 
 	/* Per-projection tunable flags */
 	bool			cnss_threads;
 	bool			fuse_read_buf;
 	bool			fuse_write_buf;
+	bool			cache_readdir;
+	bool			writeback_cache;
+	bool			pool_thread;
 	bool			writeable;
 	bool			failover;
 
@@ -162,13 +404,26 @@ struct ios_projection {
 	d_list_t		read_list;
 	int			current_write_count;
 	d_list_t		write_list;
+	struct ios_ra_cache	ra_cache;
+	struct ios_meta_pool	meta;
+	struct ios_fd_cache	fd_cache;
+	struct ios_dir_cache	dir_cache;
+	struct ios_watch	watch;
 };
 
+struct ios_dir_snap;
+
+/* If snap is set then the handle is reading from a directory snapshot and
+ * offsets are indexes into it, otherwise they are telldir() values for
+ * h_dir.  The lock protects h_dir, offset and snap.
+ */
 struct ionss_dir_handle {
 	struct ios_projection	*projection;
+	pthread_mutex_t		lock;
 	DIR			*h_dir;
 	uint			fd;
 	off_t			offset;
+	struct ios_dir_snap	*snap;
 };
 
 #define IONSS_READDIR_ENTRIES_PER_RPC (2)
@@ -189,21 +444,103 @@ struct ionss_io_req_desc {
 	d_list_t			list;
 };
 
+enum ios_aio_opcode {
+	IOS_AIO_READ,
+	IOS_AIO_WRITE,
+	IOS_AIO_FSYNC,
+	IOS_AIO_FDATASYNC,
+};
+
+/* Asynchronous file operation
+ *
+ * The callback is passed the number of bytes transferred, or zero for sync
+ * operations, or a negative errno on failure.
+ */
+struct ios_aio_op {
+	void				(*cb)(struct ios_aio_op *, ssize_t);
+	void				*buf;
+	size_t				len;
+	off_t				offset;
+	int				fd;
+	enum ios_aio_opcode		opcode;
+};
+
+/* Maximum number of buffers per active descriptor */
+#define IONSS_MAX_IO_DEPTH (4)
+
+/* I/O buffer
+ *
+ * Each active descriptor owns io_depth of these, so that disk i/o for one
+ * segment of a request can proceed whilst the bulk transfer for another
+ * segment is in flight.
+ */
+struct ionss_io_buf {
+	struct iof_local_bulk		bulk;
+	/* Disk i/o for this buffer */
+	struct ios_aio_op		op;
+	/* The active descriptor which owns this buffer */
+	void				*desc;
+	/* Offset of this segment in the client bulk buffer */
+	uint64_t			data_offset;
+	ssize_t				len;
+	bool				busy;
+};
+
+/* Group of active descriptors serving a single request
+ *
+ * A large contiguous request may be split into disjoint ranges, each of which
+ * is handled by a separate active descriptor.  Results are merged here and
+ * the reply is sent by whichever descriptor completes last.
+ */
+struct ionss_io_group {
+	pthread_mutex_t			lock;
+	uint64_t			len;
+	/* End of the first range which was not completed in full */
+	uint64_t			short_end;
+	int				count;
+	int				rc;
+	int				err;
+};
+
 /* Active read descriptor
  *
  * Used to describe an in-progress read request.  These consume resources so
  * are limited to a fixed number.
+ *
+ * Segments are read into any free buffer and sent to the client, with the
+ * request completing once all bulk transfers have finished.  Only one thread
+ * at a time reads segments, this is tracked by the filling flag, and lock
+ * protects the remaining state against the bulk completion callbacks.
  */
 struct ionss_active_read {
 	struct ios_projection		*projection;
 	crt_rpc_t			*rpc;
 	struct ionss_file_handle	*handle;
-	struct iof_local_bulk		local_bulk;
+	struct ionss_io_buf		buf[IONSS_MAX_IO_DEPTH];
+	/* Extent list, only used if xtvec_len is set in the request */
+	struct iof_local_bulk		xtvec_bulk;
+	/* Set if this descriptor handles only part of the request */
+	struct ionss_io_group		*group;
 	d_list_t			list;
-	ssize_t				read_len;
+	pthread_mutex_t			lock;
 	uint64_t			data_offset;
-	uint64_t			req_len;
 	uint64_t			segment_offset;
+	/* Range handled by this descriptor */
+	uint64_t			start_offset;
+	uint64_t			end_offset;
+	/* End of the first buffer which was short or failed */
+	uint64_t			short_end;
+	/* Result of this descriptor, merged into the reply on completion */
+	uint64_t			len;
+	int				rc;
+	int				err;
+	/* Current extent, and offset within it, for xtvec requests */
+	uint64_t			xt_index;
+	uint64_t			xt_offset;
+	int				inflight;
+	bool				xtvec_valid;
+	bool				filling;
+	bool				stop;
 	bool				failed;
 };
 
@@ -211,20 +548,39 @@ struct ionss_active_read {
  *
  * Used to describe an in-progress write request.  These consume resources so
  * are limited to a fixed number.
+ *
+ * Segments are fetched into any free buffer, and written to disk from the
+ * bulk completion callback.  Locking follows the active read descriptor.
  */
 struct ionss_active_write {
 	struct ios_projection		*projection;
 	crt_rpc_t			*rpc;
 	struct ionss_file_handle	*handle;
-	struct iof_local_bulk		local_bulk;
+	struct ionss_io_buf		buf[IONSS_MAX_IO_DEPTH];
+	/* Extent list for xtvec requests */
+	struct iof_local_bulk		xtvec_bulk;
+	/* Set if this descriptor handles only part of the request */
+	struct ionss_io_group		*group;
+	pthread_mutex_t			lock;
 	uint64_t			data_offset;
-	uint64_t			req_len;
-	uint64_t			segment_offset;
+	/* Range handled by this descriptor */
+	uint64_t			start_offset;
+	uint64_t			end_offset;
+	/* End of the first buffer which was short or failed */
+	uint64_t			short_end;
+	/* Result of this descriptor, merged into the reply on completion */
+	uint64_t			len;
+	int				rc;
+	int				err;
 	d_list_t			list;
+	int				inflight;
+	bool				xtvec_valid;
+	bool				filling;
+	bool				stop;
 	bool				failed;
 };
 
-/* From fs.c */
+/* From fh.c */
 
 /* Create a new fh.
  *
@@ -248,6 +604,150 @@ ios_fh_find(struct ios_base *, struct ios_gah *);
 struct ionss_dir_handle *
 ios_dirh_find(struct ios_base *, struct ios_gah *);
 
+/* Setup and teardown of the per-projection fd cache.  Must be called after
+ * the projection root handle is created, as it is used to check that the
+ * file handle syscalls are usable.
+ */
+int ios_fd_cache_init(struct ios_projection *);
+void ios_fd_cache_fini(struct ios_projection *);
+
+/* Add a newly created inode handle to the fd cache, if possible */
+void ios_fh_fd_track(struct ionss_file_handle *);
+
+/* Setup a newly created inode handle for name in the directory dirfd,
+ * without opening it.  Returns false if this is not possible, in which case
+ * the caller should open the file and use ios_fh_fd_track() instead.
+ */
+bool ios_fh_fd_lazy(struct ionss_file_handle *, int, const char *);
+
+/* Ensure the fd of a handle is open, reopening it if required, and prevent
+ * it from being closed until ios_fh_fd_put() is called.  Must be called
+ * with a reference held on the handle.
+ *
+ * Returns 0 on success or an errno value.
+ */
+int ios_fh_fd_get(struct ionss_file_handle *);
+void ios_fh_fd_put(struct ionss_file_handle *);
+
 int parse_config(char *path, struct ios_base *base);
 
+/* From readahead.c */
+
+/* Setup and teardown of the per-projection readahead cache.  The cache is
+ * disabled if readahead_count is zero or the cache size is smaller than a
+ * single max_read_size segment.
+ */
+int ios_ra_init(struct ios_projection *);
+void ios_ra_fini(struct ios_projection *);
+
+/* Attempt to serve a read from the cache.
+ *
+ * Returns the number of bytes copied into buf, or -1 on a cache miss.
+ */
+ssize_t ios_ra_read(struct ionss_file_handle *, void *, size_t, off_t);
+
+/* Update the sequential detector for a read of len bytes at offset, and if
+ * the handle is being read sequentially then submit reads of the following
+ * segments into the cache through ios_aio_submit().  Must be called with a
+ * reference held on the handle.
+ */
+void ios_ra_update(struct ionss_file_handle *, off_t, size_t);
+
+/* Discard any cached data for an inode */
+void ios_ra_invalidate(struct ios_projection *, ino_t);
+
+/* From dircache.c */
+
+struct iof_readdir_reply;
+
+/* Setup and teardown of the per-projection directory cache, which is
+ * disabled if dircache_size is zero.
+ */
+int ios_dir_cache_init(struct ios_projection *);
+void ios_dir_cache_fini(struct ios_projection *);
+
+/* Return a snapshot of the directory open on handle, with a reference held,
+ * reading the directory if there is no valid cached copy.  Returns NULL if
+ * the directory should be read directly, in which case the directory
+ * stream may have been rewound.
+ */
+struct ios_dir_snap *ios_dir_cache_get(struct ionss_dir_handle *);
+
+/* Release a reference taken by ios_dir_cache_get() */
+void ios_dir_cache_put(struct ios_projection *, struct ios_dir_snap *);
+
+/* Copy up to max_replies entries starting at offset from a snapshot, and
+ * set last if the end of the directory was reached.  Returns the number of
+ * entries copied.
+ */
+int ios_dir_cache_fill(struct ios_dir_snap *, off_t,
+		       struct iof_readdir_reply *, int, bool *);
+
+/* Discard any cached snapshot of a directory */
+void ios_dir_cache_invalidate(struct ios_projection *, ino_t);
+
+/* From watch.c */
+
+/* Setup and teardown of the per-projection change notification */
+int ios_watch_init(struct ios_projection *);
+void ios_watch_fini(struct ios_projection *);
+
+/* Reply to all outstanding watch RPCs, and any received after this, so
+ * that clients are not left waiting at shutdown.
+ */
+void ios_watch_stop(struct ios_projection *);
+
+/* Record a change to the entry name in directory inode_no, or if name is
+ * NULL to the attributes or contents of inode_no, and wake any watchers.
+ * rpc is the request which made the change, used to avoid sending it to
+ * the client which made it.
+ */
+void ios_watch_notify(struct ios_projection *, crt_rpc_t *, ino_t,
+		      const char *);
+
+/* Process a watch RPC, the reply is sent once there are events newer than
+ * the sequence number in the request.
+ */
+void ios_watch_add(struct ios_projection *, crt_rpc_t *);
+
+/* From aio.c
+ *
+ * File i/o on the data path is submitted through this interface so that it
+ * can be performed by io_uring, if built in and enabled by the io_uring
+ * option, rather than blocking the calling thread.  Completions are handled
+ * by a dedicated thread.  Otherwise, or if the submission queue is full,
+ * the operation is performed synchronously and the callback invoked before
+ * ios_aio_submit() returns.
+ */
+int ios_aio_init(struct ios_base *);
+void ios_aio_fini(struct ios_base *);
+void ios_aio_submit(struct ios_base *, struct ios_aio_op *);
+
+/* From meta.c */
+
+/* Start the metadata worker threads for a projection, if enabled by the
+ * meta_threads option.
+ */
+int ios_meta_init(struct ios_projection *);
+
+/* Stop the worker threads once the queue has drained, and log statistics */
+void ios_meta_fini(struct ios_projection *);
+
+/* Queue a metadata RPC for the projection owning gah, or call the handler
+ * directly if there is no worker pool.
+ */
+void ios_meta_dispatch(struct ios_base *, crt_rpc_t *, struct ios_gah *,
+		       crt_rpc_cb_t, enum ios_meta_op);
+
+/* As ios_meta_dispatch(), for a known projection */
+void ios_meta_queue(struct ios_projection *, crt_rpc_t *, crt_rpc_cb_t,
+		    enum ios_meta_op);
+
+/* Call fn(arg, i) for each i in [0, count), sharing the items between the
+ * calling thread and the metadata worker threads, and return once all
+ * have completed.  Items must be independent of each other.
+ */
+void ios_meta_parallel(struct ios_projection *, int,
+		       void (*fn)(void *, int), void *);
+
 #endif
@@ -0,0 +1,395 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "iof_common.h"
+#include "ionss.h"
+#include "log.h"
+
+/* A queued metadata RPC, or if rpc is NULL a share of a parallel batch */
+struct ios_meta_req {
+	d_list_t		list;
+	crt_rpc_t		*rpc;
+	crt_rpc_cb_t		fn;
+	struct ios_meta_batch	*batch;
+	enum ios_meta_op	op;
+	uint64_t		queued;
+};
+
+/* A set of independent items to be processed in parallel.
+ *
+ * Items are claimed one at a time by the caller and by any workers which
+ * pick up a share of the batch, so the caller never waits for a worker
+ * which has not yet started.  The batch is freed by whichever of these
+ * drops the last reference, as workers may start after all items are done.
+ */
+struct ios_meta_batch {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	void			(*fn)(void *, int);
+	void			*arg;
+	int			count;
+	ATOMIC int		next;
+	ATOMIC int		done;
+	ATOMIC int		ref;
+};
+
+#define X(name, ...) #name,
+static const char * const meta_op_names[] = {
+	IOS_META_OPS
+	"readdir",
+};
+#undef X
+
+static uint64_t
+meta_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+meta_batch_decref(struct ios_meta_batch *batch)
+{
+	if (atomic_fetch_sub(&batch->ref, 1) != 1)
+		return;
+
+	pthread_cond_destroy(&batch->cond);
+	pthread_mutex_destroy(&batch->lock);
+	D_FREE(batch);
+}
+
+/* Process items from a batch until none are left */
+static void
+meta_batch_run(struct ios_meta_batch *batch)
+{
+	int done = 0;
+	int idx;
+
+	while ((idx = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+		batch->fn(batch->arg, idx);
+		done++;
+	}
+
+	if (done && atomic_fetch_add(&batch->done, done) + done ==
+	    batch->count) {
+		D_MUTEX_LOCK(&batch->lock);
+		pthread_cond_signal(&batch->cond);
+		D_MUTEX_UNLOCK(&batch->lock);
+	}
+}
+
+static void *
+meta_worker(void *arg)
+{
+	struct ios_projection *projection = arg;
+	struct ios_meta_pool *pool = &projection->meta;
+	struct ios_meta_stats *stats;
+	struct ios_meta_req *req;
+	uint64_t start;
+	uint64_t wait;
+	uint64_t service;
+
+	D_MUTEX_LOCK(&pool->lock);
+	while (true) {
+		while (d_list_empty(&pool->queue) && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		if (d_list_empty(&pool->queue))
+			break;
+
+		req = d_list_entry(pool->queue.next, struct ios_meta_req, list);
+		d_list_del(&req->list);
+		pool->depth--;
+		D_MUTEX_UNLOCK(&pool->lock);
+
+		if (!req->rpc) {
+			meta_batch_run(req->batch);
+			meta_batch_decref(req->batch);
+			D_FREE(req);
+			D_MUTEX_LOCK(&pool->lock);
+			continue;
+		}
+
+		start = meta_now();
+		req->fn(req->rpc);
+		service = meta_now() - start;
+		wait = start - req->queued;
+
+		crt_req_decref(req->rpc);
+
+		D_MUTEX_LOCK(&pool->lock);
+		stats = &pool->stats[req->op];
+		stats->count++;
+		stats->wait_total += wait;
+		if (wait > stats->wait_max)
+			stats->wait_max = wait;
+		stats->service_total += service;
+		if (service > stats->service_max)
+			stats->service_max = service;
+		D_FREE(req);
+	}
+	D_MUTEX_UNLOCK(&pool->lock);
+
+	return NULL;
+}
+
+int ios_meta_init(struct ios_projection *projection)
+{
+	struct ios_meta_pool *pool = &projection->meta;
+	int rc;
+	int i;
+
+	D_INIT_LIST_HEAD(&pool->queue);
+	pool->thread_count = 0;
+	pool->depth = 0;
+	pool->depth_hwm = 0;
+	pool->overflow = 0;
+	pool->stop = false;
+
+	rc = D_MUTEX_INIT(&pool->lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	rc = pthread_cond_init(&pool->cond, NULL);
+	if (rc) {
+		D_MUTEX_DESTROY(&pool->lock);
+		return -DER_MISC;
+	}
+
+	if (projection->meta_threads == 0)
+		return -DER_SUCCESS;
+
+	D_ALLOC_ARRAY(pool->threads, projection->meta_threads);
+	if (!pool->threads) {
+		pthread_cond_destroy(&pool->cond);
+		D_MUTEX_DESTROY(&pool->lock);
+		return -DER_NOMEM;
+	}
+
+	for (i = 0; i < projection->meta_threads; i++) {
+		rc = pthread_create(&pool->threads[i], NULL, meta_worker,
+				    projection);
+		if (rc) {
+			IOF_TRACE_ERROR(projection,
+					"Could not start metadata thread %d",
+					rc);
+			break;
+		}
+		pool->thread_count++;
+	}
+
+	IOF_TRACE_INFO(projection, "Started %d metadata threads",
+		       pool->thread_count);
+
+	return -DER_SUCCESS;
+}
+
+void ios_meta_fini(struct ios_projection *projection)
+{
+	struct ios_meta_pool *pool = &projection->meta;
+	struct ios_meta_stats *stats;
+	int i;
+
+	D_MUTEX_LOCK(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	D_MUTEX_UNLOCK(&pool->lock);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+	D_FREE(pool->threads);
+	pool->thread_count = 0;
+
+	for (i = 0; i < IOS_META_OP_COUNT; i++) {
+		stats = &pool->stats[i];
+		if (!stats->count)
+			continue;
+		IOF_TRACE_INFO(projection,
+			       "%s count %lu "
+			       "wait avg %lu max %lu service avg %lu max %lu ns",
+			       meta_op_names[i], stats->count,
+			       stats->wait_total / stats->count,
+			       stats->wait_max,
+			       stats->service_total / stats->count,
+			       stats->service_max);
+	}
+
+	IOF_TRACE_INFO(projection, "queue depth hwm %u overflow %lu",
+		       pool->depth_hwm, pool->overflow);
+
+	if (pool->batches)
+		IOF_TRACE_INFO(projection,
+			       "parallel batches %lu items avg %lu",
+			       pool->batches,
+			       pool->batch_items / pool->batches);
+
+	pthread_cond_destroy(&pool->cond);
+	D_MUTEX_DESTROY(&pool->lock);
+}
+
+void ios_meta_dispatch(struct ios_base *base, crt_rpc_t *rpc,
+		       struct ios_gah *gah, crt_rpc_cb_t fn,
+		       enum ios_meta_op op)
+{
+	struct ionss_file_handle *handle;
+	int rc;
+
+	/* Only the projection is needed here, and the handler looks up the
+	 * handle itself, so do not take a reference.  Handles are pool
+	 * descriptors which belong to a single projection, so the projection
+	 * is valid even if the handle is being released.  Any errors are
+	 * reported by the handler.
+	 */
+	rc = ios_gah_get_info(base->gs, gah, (void **)&handle);
+	if (rc || !handle) {
+		fn(rpc);
+		return;
+	}
+
+	ios_meta_queue(handle->projection, rpc, fn, op);
+}
+
+void ios_meta_queue(struct ios_projection *projection, crt_rpc_t *rpc,
+		    crt_rpc_cb_t fn, enum ios_meta_op op)
+{
+	struct ios_meta_pool *pool = &projection->meta;
+	struct ios_meta_req *req;
+
+	if (pool->thread_count == 0)
+		D_GOTO(direct, 0);
+
+	D_ALLOC_PTR(req);
+	if (!req)
+		D_GOTO(direct, 0);
+
+	req->rpc = rpc;
+	req->fn = fn;
+	req->op = op;
+	req->queued = meta_now();
+
+	D_MUTEX_LOCK(&pool->lock);
+	if (pool->depth >= pool->thread_count * IOS_META_QUEUE_PER_THREAD) {
+		pool->overflow++;
+		D_MUTEX_UNLOCK(&pool->lock);
+		D_FREE(req);
+		D_GOTO(direct, 0);
+	}
+
+	crt_req_addref(rpc);
+	d_list_add_tail(&req->list, &pool->queue);
+	pool->depth++;
+	if (pool->depth > pool->depth_hwm)
+		pool->depth_hwm = pool->depth;
+	pthread_cond_signal(&pool->cond);
+	D_MUTEX_UNLOCK(&pool->lock);
+	return;
+
+direct:
+	fn(rpc);
+}
+
+void ios_meta_parallel(struct ios_projection *projection, int count,
+		       void (*fn)(void *, int), void *arg)
+{
+	struct ios_meta_pool *pool = &projection->meta;
+	struct ios_meta_batch *batch;
+	struct ios_meta_req *req;
+	int helpers;
+	int i;
+
+	helpers = count / IOS_META_BATCH_MIN;
+	if (helpers > pool->thread_count)
+		helpers = pool->thread_count;
+
+	if (helpers == 0)
+		D_GOTO(direct, 0);
+
+	D_ALLOC_PTR(batch);
+	if (!batch)
+		D_GOTO(direct, 0);
+
+	if (D_MUTEX_INIT(&batch->lock, NULL) != -DER_SUCCESS) {
+		D_FREE(batch);
+		D_GOTO(direct, 0);
+	}
+
+	if (pthread_cond_init(&batch->cond, NULL) != 0) {
+		D_MUTEX_DESTROY(&batch->lock);
+		D_FREE(batch);
+		D_GOTO(direct, 0);
+	}
+
+	batch->fn = fn;
+	batch->arg = arg;
+	batch->count = count;
+	atomic_store_release(&batch->ref, 1);
+
+	D_MUTEX_LOCK(&pool->lock);
+	for (i = 0; i < helpers; i++) {
+		D_ALLOC_PTR(req);
+		if (!req)
+			break;
+		req->batch = batch;
+		atomic_fetch_add(&batch->ref, 1);
+		d_list_add_tail(&req->list, &pool->queue);
+		pool->depth++;
+	}
+	pool->batches++;
+	pool->batch_items += count;
+	pthread_cond_broadcast(&pool->cond);
+	D_MUTEX_UNLOCK(&pool->lock);
+
+	meta_batch_run(batch);
+
+	D_MUTEX_LOCK(&batch->lock);
+	while (atomic_load_consume(&batch->done) < count)
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	D_MUTEX_UNLOCK(&batch->lock);
+
+	meta_batch_decref(batch);
+	return;
+
+direct:
+	for (i = 0; i < count; i++)
+		fn(arg, i);
+}
@@ -0,0 +1,390 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iof_common.h"
+#include "ionss.h"
+#include "log.h"
+
+enum ios_ra_state {
+	RA_FREE,
+	RA_FILLING,
+	RA_VALID,
+};
+
+/* A single cached segment of file data.
+ *
+ * Entries are max_read_size in length and are filled by a single read
+ * so the cached data may be shorter than this at the end of a file, in
+ * which case eof is set.
+ */
+struct ios_ra_entry {
+	d_list_t		list;
+	/* Link in the inode hash bucket whilst filling or valid */
+	d_list_t		ino_list;
+	struct ios_aio_op	op;
+	/* The handle being read from, whilst filling */
+	struct ionss_file_handle *handle;
+	char			*buf;
+	ino_t			inode_no;
+	off_t			offset;
+	size_t			len;
+	enum ios_ra_state	state;
+	/* Set if the entry was invalidated whilst being filled */
+	bool			discard;
+	bool			eof;
+};
+
+int ios_ra_init(struct ios_projection *projection)
+{
+	struct ios_ra_cache *cache = &projection->ra_cache;
+	int i;
+	int rc;
+
+	D_INIT_LIST_HEAD(&cache->lru);
+	for (i = 0; i < IOS_RA_BUCKETS; i++)
+		D_INIT_LIST_HEAD(&cache->buckets[i]);
+	cache->entry_count = 0;
+	cache->max_entries = 0;
+
+	rc = D_MUTEX_INIT(&cache->lock, NULL);
+	if (rc != -DER_SUCCESS)
+		return rc;
+
+	if (projection->readahead_count > 0)
+		cache->max_entries = projection->readahead_cache_size /
+			projection->max_read_size;
+
+	IOF_TRACE_INFO(projection, "Readahead %d segments, cache %d entries",
+		       cache->max_entries ? projection->readahead_count : 0,
+		       cache->max_entries);
+
+	return -DER_SUCCESS;
+}
+
+void ios_ra_fini(struct ios_projection *projection)
+{
+	struct ios_ra_cache *cache = &projection->ra_cache;
+	struct ios_ra_entry *entry, *next;
+
+	IOF_TRACE_INFO(projection,
+		       "Readahead hits %lu misses %lu evictions %lu "
+		       "prefetches %lu invalidations %lu",
+		       cache->hits, cache->misses, cache->evictions,
+		       cache->prefetches, cache->invalidations);
+
+	d_list_for_each_entry_safe(entry, next, &cache->lru, list) {
+		d_list_del(&entry->list);
+		D_FREE(entry->buf);
+		D_FREE(entry);
+	}
+	cache->entry_count = 0;
+
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static d_list_t *
+ra_bucket(struct ios_ra_cache *cache, ino_t inode_no)
+{
+	return &cache->buckets[inode_no % IOS_RA_BUCKETS];
+}
+
+/* Return an entry to the free state, and make it the next to be recycled.
+ *
+ * Should be called with the cache lock held.
+ */
+static void
+ra_free_entry(struct ios_ra_cache *cache, struct ios_ra_entry *entry)
+{
+	entry->state = RA_FREE;
+	d_list_del_init(&entry->ino_list);
+	d_list_move_tail(&entry->list, &cache->lru);
+}
+
+ssize_t ios_ra_read(struct ionss_file_handle *handle, void *buf,
+		    size_t count, off_t offset)
+{
+	struct ios_ra_cache *cache = &handle->projection->ra_cache;
+	struct ios_ra_entry *entry;
+	size_t avail;
+
+	if (cache->max_entries == 0)
+		return -1;
+
+	D_MUTEX_LOCK(&cache->lock);
+	d_list_for_each_entry(entry, ra_bucket(cache, handle->mf.inode_no),
+			      ino_list) {
+		if (entry->state != RA_VALID)
+			continue;
+
+		if (entry->inode_no != handle->mf.inode_no)
+			continue;
+
+		if (offset < entry->offset ||
+		    offset >= entry->offset + entry->len)
+			continue;
+
+		/* Only serve partial data if the entry reaches end of file,
+		 * otherwise the client would see a short read.
+		 */
+		avail = entry->offset + entry->len - offset;
+		if (avail < count && !entry->eof)
+			continue;
+
+		if (avail > count)
+			avail = count;
+
+		memcpy(buf, entry->buf + (offset - entry->offset), avail);
+		d_list_move(&entry->list, &cache->lru);
+		cache->hits++;
+		D_MUTEX_UNLOCK(&cache->lock);
+
+		IOF_TRACE_DEBUG(handle, "Readahead hit %#zx-%#zx", offset,
+				offset + avail - 1);
+		return avail;
+	}
+	cache->misses++;
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	return -1;
+}
+
+/* Find an entry which holds, or is being filled with, data at offset.
+ *
+ * Should be called with the cache lock held.
+ */
+static struct ios_ra_entry *
+ra_find(struct ios_ra_cache *cache, ino_t inode_no, off_t offset)
+{
+	struct ios_ra_entry *entry;
+
+	d_list_for_each_entry(entry, ra_bucket(cache, inode_no), ino_list) {
+		if (entry->inode_no != inode_no)
+			continue;
+
+		if (offset >= entry->offset &&
+		    offset < entry->offset + entry->len)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Obtain an entry to fill, either allocating a new one if under budget or
+ * recycling the least recently used entry which is not being filled.
+ *
+ * Should be called with the cache lock held.
+ */
+static struct ios_ra_entry *
+ra_get_entry(struct ios_projection *projection)
+{
+	struct ios_ra_cache *cache = &projection->ra_cache;
+	struct ios_ra_entry *entry;
+
+	if (cache->entry_count < cache->max_entries) {
+		D_ALLOC_PTR(entry);
+		if (!entry)
+			return NULL;
+
+		D_ALLOC(entry->buf, projection->max_read_size);
+		if (!entry->buf) {
+			D_FREE(entry);
+			return NULL;
+		}
+		cache->entry_count++;
+		d_list_add(&entry->list, &cache->lru);
+		D_INIT_LIST_HEAD(&entry->ino_list);
+		return entry;
+	}
+
+	d_list_for_each_entry_reverse(entry, &cache->lru, list) {
+		if (entry->state == RA_FILLING)
+			continue;
+
+		if (entry->state == RA_VALID)
+			cache->evictions++;
+
+		d_list_del_init(&entry->ino_list);
+		d_list_move(&entry->list, &cache->lru);
+		return entry;
+	}
+	return NULL;
+}
+
+/* Completion of a prefetch, called from the aio completion thread or from
+ * ios_aio_submit() if the read was performed synchronously.
+ */
+static void
+ra_fill_cb(struct ios_aio_op *op, ssize_t rc)
+{
+	struct ios_ra_entry *entry = container_of(op, struct ios_ra_entry, op);
+	struct ionss_file_handle *handle = entry->handle;
+	struct ios_projection *projection = handle->projection;
+	struct ios_ra_cache *cache = &projection->ra_cache;
+
+	D_MUTEX_LOCK(&cache->lock);
+	entry->handle = NULL;
+	if (rc <= 0 || entry->discard) {
+		ra_free_entry(cache, entry);
+	} else {
+		entry->len = rc;
+		entry->state = RA_VALID;
+		entry->eof = (rc < projection->max_read_size);
+		cache->prefetches++;
+	}
+	D_MUTEX_UNLOCK(&cache->lock);
+
+	ios_fh_fd_put(handle);
+	ios_fh_decref(handle, 1);
+}
+
+void ios_ra_update(struct ionss_file_handle *handle, off_t offset, size_t len)
+{
+	struct ios_projection *projection = handle->projection;
+	struct ios_ra_cache *cache = &projection->ra_cache;
+	struct ios_ra_entry *entry;
+	off_t window_end;
+	off_t pos;
+	int fill_count = 0;
+
+	if (cache->max_entries == 0 || len == 0)
+		return;
+
+	D_MUTEX_LOCK(&cache->lock);
+
+	/* A read from the start of the file is treated as the beginning of
+	 * a sequential stream, otherwise require two contiguous reads before
+	 * starting to prefetch.
+	 */
+	if (offset == 0 || offset == handle->ra_next_offset)
+		handle->ra_streak++;
+	else
+		handle->ra_streak = 0;
+
+	pos = offset + len;
+	handle->ra_next_offset = pos;
+
+	if (handle->ra_streak == 0) {
+		D_MUTEX_UNLOCK(&cache->lock);
+		return;
+	}
+
+	window_end = pos + (off_t)projection->readahead_count *
+		projection->max_read_size;
+
+	/* Walk the window, skipping over segments which are already cached
+	 * or in flight and submitting reads for any gaps.  In steady state
+	 * only the last segment of the window needs to be read.  The reads
+	 * complete asynchronously, so segments past the end of the file are
+	 * only detected once the entry at end of file is valid, and any
+	 * reads beyond it fail harmlessly.
+	 */
+	while (pos < window_end && fill_count < projection->readahead_count) {
+		entry = ra_find(cache, handle->mf.inode_no, pos);
+		if (entry) {
+			if (entry->state == RA_VALID && entry->eof)
+				break;
+			pos = entry->offset + projection->max_read_size;
+			continue;
+		}
+
+		entry = ra_get_entry(projection);
+		if (!entry)
+			break;
+
+		/* Keep the handle, and its fd, open until the read completes */
+		if (ios_fh_fd_get(handle) != 0) {
+			ra_free_entry(cache, entry);
+			break;
+		}
+		atomic_fetch_add(&handle->ref, 1);
+
+		entry->handle = handle;
+		entry->inode_no = handle->mf.inode_no;
+		entry->offset = pos;
+		entry->len = projection->max_read_size;
+		entry->state = RA_FILLING;
+		entry->discard = false;
+		entry->eof = false;
+		d_list_add(&entry->ino_list,
+			   ra_bucket(cache, entry->inode_no));
+
+		entry->op.cb = ra_fill_cb;
+		entry->op.buf = entry->buf;
+		entry->op.len = projection->max_read_size;
+		entry->op.offset = pos;
+		entry->op.fd = handle->fd;
+		entry->op.opcode = IOS_AIO_READ;
+		D_MUTEX_UNLOCK(&cache->lock);
+
+		IOF_TRACE_DEBUG(handle, "Prefetching fd=%d %#zx-%#zx",
+				handle->fd, pos,
+				pos + projection->max_read_size - 1);
+
+		ios_aio_submit(projection->base, &entry->op);
+
+		D_MUTEX_LOCK(&cache->lock);
+		fill_count++;
+		pos += projection->max_read_size;
+	}
+	D_MUTEX_UNLOCK(&cache->lock);
+}
+
+void ios_ra_invalidate(struct ios_projection *projection, ino_t inode_no)
+{
+	struct ios_ra_cache *cache = &projection->ra_cache;
+	struct ios_ra_entry *entry, *next;
+
+	if (cache->max_entries == 0)
+		return;
+
+	D_MUTEX_LOCK(&cache->lock);
+	d_list_for_each_entry_safe(entry, next, ra_bucket(cache, inode_no),
+				   ino_list) {
+		if (entry->inode_no != inode_no)
+			continue;
+
+		cache->invalidations++;
+
+		if (entry->state == RA_FILLING) {
+			entry->discard = true;
+			continue;
+		}
+
+		ra_free_entry(cache, entry);
+	}
+	D_MUTEX_UNLOCK(&cache->lock);
+}
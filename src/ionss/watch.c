@@ -0,0 +1,471 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include "iof_common.h"
+#include "ionss.h"
+#include "log.h"
+
+/* A watch RPC waiting for events.  seq starts as the sequence number in
+ * the request, and is moved past events made by the client itself, which it
+ * is not sent.
+ */
+struct ios_watch_waiter {
+	d_list_t		list;
+	crt_rpc_t		*rpc;
+	uint64_t		seq;
+	uint64_t		client;
+	time_t			expires;
+};
+
+/* Return the client an RPC was received from, as for iof_watch_client(),
+ * or zero if this is not known.  The endpoint of a received RPC identifies
+ * the sender.
+ */
+static uint64_t
+watch_origin(crt_rpc_t *rpc)
+{
+	d_rank_t rank;
+
+	if (!rpc || crt_req_src_rank_get(rpc, &rank) != 0)
+		return 0;
+
+	return iof_watch_client(rpc->cr_ep.ep_grp ?
+				rpc->cr_ep.ep_grp->cg_grpid : NULL, rank);
+}
+
+static time_t
+watch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/* Fill in the reply to a watch RPC with any events after seq which were not
+ * made by client.  Called with the lock held.
+ */
+static void
+watch_fill(struct ios_watch *watch, crt_rpc_t *rpc, uint64_t seq,
+	   uint64_t client)
+{
+	struct iof_watch_out *out = crt_reply_get(rpc);
+	struct iof_watch_event *events;
+	struct iof_watch_event *event;
+	uint64_t count;
+	uint64_t sent = 0;
+	uint64_t i;
+
+	out->seq = watch->seq;
+	watch->delivered = watch->seq;
+
+	/* A new client, or one which has reconnected after failover */
+	if (seq == 0)
+		return;
+
+	if (seq > watch->seq || watch->seq - seq > IOS_WATCH_EVENTS) {
+		watch->lost++;
+		out->lost = 1;
+		return;
+	}
+
+	count = watch->seq - seq;
+	if (count == 0)
+		return;
+
+	if (count > IOF_WATCH_MAX)
+		count = IOF_WATCH_MAX;
+
+	D_ALLOC_ARRAY(events, count);
+	if (!events) {
+		out->lost = 1;
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		event = &watch->events[(seq + i) % IOS_WATCH_EVENTS];
+		if (client && event->origin == client)
+			continue;
+		events[sent++] = *event;
+	}
+
+	if (sent)
+		d_iov_set(&out->events, events, sent * sizeof(*events));
+	else
+		D_FREE(events);
+	out->seq = seq + count;
+}
+
+/* Check if a waiter has any events to be sent, moving it past any which
+ * were made by the client itself.  Called with the lock held.
+ */
+static bool
+watch_pending(struct ios_watch *watch, struct ios_watch_waiter *waiter)
+{
+	struct iof_watch_event *event;
+
+	if (waiter->seq > watch->seq ||
+	    watch->seq - waiter->seq > IOS_WATCH_EVENTS)
+		return true;
+
+	while (waiter->seq < watch->seq) {
+		event = &watch->events[waiter->seq % IOS_WATCH_EVENTS];
+		if (!waiter->client || event->origin != waiter->client)
+			return true;
+		waiter->seq++;
+	}
+	return false;
+}
+
+/* Move waiters with events to be sent onto list, filling in their replies.
+ * Called with the lock held.
+ */
+static void
+watch_wake(struct ios_watch *watch, d_list_t *list)
+{
+	struct ios_watch_waiter *waiter, *next;
+
+	d_list_for_each_entry_safe(waiter, next, &watch->waiters, list) {
+		if (!watch_pending(watch, waiter))
+			continue;
+		watch_fill(watch, waiter->rpc, waiter->seq, waiter->client);
+		d_list_move_tail(&waiter->list, list);
+		watch->replies++;
+	}
+}
+
+static void
+watch_reply(crt_rpc_t *rpc)
+{
+	struct iof_watch_out *out = crt_reply_get(rpc);
+	int rc;
+
+	rc = crt_reply_send(rpc);
+	if (rc)
+		IOF_LOG_ERROR("response not sent, rc = %d", rc);
+
+	D_FREE(out->events.iov_buf);
+}
+
+/* Send the replies to a list of waiters, and free them */
+static void
+watch_reply_list(d_list_t *list)
+{
+	struct ios_watch_waiter *waiter, *next;
+
+	d_list_for_each_entry_safe(waiter, next, list, list) {
+		d_list_del(&waiter->list);
+		watch_reply(waiter->rpc);
+		crt_req_decref(waiter->rpc);
+		D_FREE(waiter);
+	}
+}
+
+/* Reply to watch RPCs once changes to attributes or contents have been
+ * held back for IOS_WATCH_DELAY_MS, and to those which have waited for
+ * longer than IOS_WATCH_TIMEOUT so that clients can notice if the IONSS has
+ * gone away.
+ */
+static void *
+watch_thread(void *arg)
+{
+	struct ios_watch *watch = arg;
+	struct ios_watch_waiter *waiter, *next;
+	struct timespec ts;
+	d_list_t expired;
+	time_t now;
+
+	D_MUTEX_LOCK(&watch->lock);
+	while (!watch->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		if (watch->delay_pending &&
+		    (watch->delay_until.tv_sec < ts.tv_sec ||
+		     (watch->delay_until.tv_sec == ts.tv_sec &&
+		      watch->delay_until.tv_nsec < ts.tv_nsec)))
+			ts = watch->delay_until;
+		pthread_cond_timedwait(&watch->cond, &watch->lock, &ts);
+
+		D_INIT_LIST_HEAD(&expired);
+
+		if (watch->delay_pending) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			if (ts.tv_sec > watch->delay_until.tv_sec ||
+			    (ts.tv_sec == watch->delay_until.tv_sec &&
+			     ts.tv_nsec >= watch->delay_until.tv_nsec)) {
+				watch->delay_pending = false;
+				watch_wake(watch, &expired);
+			}
+		}
+
+		now = watch_now();
+		d_list_for_each_entry_safe(waiter, next, &watch->waiters,
+					   list) {
+			if (waiter->expires > now)
+				continue;
+			watch_fill(watch, waiter->rpc, waiter->seq,
+				   waiter->client);
+			d_list_move_tail(&waiter->list, &expired);
+			watch->replies++;
+		}
+
+		if (d_list_empty(&expired))
+			continue;
+
+		D_MUTEX_UNLOCK(&watch->lock);
+		watch_reply_list(&expired);
+		D_MUTEX_LOCK(&watch->lock);
+	}
+	D_MUTEX_UNLOCK(&watch->lock);
+
+	return NULL;
+}
+
+int ios_watch_init(struct ios_projection *projection)
+{
+	struct ios_watch *watch = &projection->watch;
+	int rc;
+
+	D_INIT_LIST_HEAD(&watch->waiters);
+	watch->seq = 1;
+	watch->delivered = 0;
+	watch->stop = false;
+	watch->started = false;
+	watch->delay_pending = false;
+
+	/* Clients only watch for changes if they cache entries, attributes or
+	 * directory contents, see ioc_watch_start(), so otherwise do not
+	 * record events, and fail watch RPCs.
+	 */
+	if (projection->entry_timeout == 0 &&
+	    projection->attr_timeout == 0 &&
+	    projection->negative_timeout == 0 &&
+	    !projection->cache_readdir)
+		return -DER_SUCCESS;
+
+	D_ALLOC_ARRAY(watch->events, IOS_WATCH_EVENTS);
+	if (!watch->events)
+		return -DER_NOMEM;
+
+	rc = D_MUTEX_INIT(&watch->lock, NULL);
+	if (rc != -DER_SUCCESS) {
+		D_FREE(watch->events);
+		return rc;
+	}
+
+	rc = pthread_cond_init(&watch->cond, NULL);
+	if (rc) {
+		D_MUTEX_DESTROY(&watch->lock);
+		D_FREE(watch->events);
+		return -DER_MISC;
+	}
+
+	rc = pthread_create(&watch->thread, NULL, watch_thread, watch);
+	if (rc)
+		IOF_TRACE_ERROR(projection, "Could not start watch thread %d",
+				rc);
+	else
+		watch->started = true;
+
+	return -DER_SUCCESS;
+}
+
+void ios_watch_stop(struct ios_projection *projection)
+{
+	struct ios_watch *watch = &projection->watch;
+	d_list_t list;
+
+	if (!watch->events)
+		return;
+
+	D_INIT_LIST_HEAD(&list);
+
+	D_MUTEX_LOCK(&watch->lock);
+	watch->stop = true;
+	d_list_splice_init(&watch->waiters, &list);
+	pthread_cond_broadcast(&watch->cond);
+	D_MUTEX_UNLOCK(&watch->lock);
+
+	watch_reply_list(&list);
+}
+
+void ios_watch_fini(struct ios_projection *projection)
+{
+	struct ios_watch *watch = &projection->watch;
+
+	if (!watch->events)
+		return;
+
+	ios_watch_stop(projection);
+
+	if (watch->started)
+		pthread_join(watch->thread, NULL);
+	watch->started = false;
+
+	IOF_TRACE_INFO(projection,
+		       "watch events %lu coalesced %lu replies %lu lost %lu",
+		       watch->notified, watch->coalesced, watch->replies,
+		       watch->lost);
+
+	pthread_cond_destroy(&watch->cond);
+	D_MUTEX_DESTROY(&watch->lock);
+	D_FREE(watch->events);
+}
+
+void ios_watch_notify(struct ios_projection *projection, crt_rpc_t *rpc,
+		      ino_t inode_no, const char *name)
+{
+	struct ios_watch *watch = &projection->watch;
+	struct iof_watch_event *event;
+	uint64_t origin;
+	uint64_t seq;
+	d_list_t list;
+
+	if (!watch->events)
+		return;
+
+	/* Clients use inode number 1 for the root of the projection */
+	if (projection->root && inode_no == projection->root->mf.inode_no)
+		inode_no = 1;
+
+	if (!name)
+		name = "";
+
+	origin = watch_origin(rpc);
+
+	D_INIT_LIST_HEAD(&list);
+
+	D_MUTEX_LOCK(&watch->lock);
+
+	/* Coalesce repeated events from the same client, such as a stream of
+	 * writes to a file, with any recent one which no client has been sent
+	 * yet.
+	 */
+	for (seq = watch->seq - 1;
+	     seq > watch->delivered && seq > 0 &&
+	     watch->seq - seq <= IOS_WATCH_COALESCE; seq--) {
+		event = &watch->events[seq % IOS_WATCH_EVENTS];
+		if (event->ino == inode_no && event->origin == origin &&
+		    strncmp(event->name.name, name, NAME_MAX) == 0) {
+			watch->coalesced++;
+			D_MUTEX_UNLOCK(&watch->lock);
+			return;
+		}
+	}
+
+	event = &watch->events[watch->seq % IOS_WATCH_EVENTS];
+	event->ino = inode_no;
+	event->origin = origin;
+	strncpy(event->name.name, name, NAME_MAX);
+	event->name.name[NAME_MAX] = '\0';
+	watch->seq++;
+	watch->notified++;
+
+	/* Changes to entries are sent at once, but changes to attributes or
+	 * contents are held back for a short time, so that a stream of them
+	 * is sent to waiters as a single reply.
+	 */
+	if (name[0] != '\0') {
+		watch->delay_pending = false;
+		watch_wake(watch, &list);
+	} else if (!watch->delay_pending) {
+		clock_gettime(CLOCK_REALTIME, &watch->delay_until);
+		watch->delay_until.tv_nsec += IOS_WATCH_DELAY_MS * 1000000L;
+		if (watch->delay_until.tv_nsec >= 1000000000L) {
+			watch->delay_until.tv_sec++;
+			watch->delay_until.tv_nsec -= 1000000000L;
+		}
+		watch->delay_pending = true;
+		pthread_cond_signal(&watch->cond);
+	}
+
+	D_MUTEX_UNLOCK(&watch->lock);
+
+	watch_reply_list(&list);
+}
+
+void ios_watch_add(struct ios_projection *projection, crt_rpc_t *rpc)
+{
+	struct ios_watch *watch = &projection->watch;
+	struct iof_watch_in *in = crt_req_get(rpc);
+	struct iof_watch_out *out = crt_reply_get(rpc);
+	struct ios_watch_waiter check = {0};
+	struct ios_watch_waiter *waiter;
+
+	if (!watch->events) {
+		out->err = -DER_NOSYS;
+		watch_reply(rpc);
+		return;
+	}
+
+	check.seq = in->seq;
+	check.client = in->client;
+
+	D_MUTEX_LOCK(&watch->lock);
+
+	/* Reply at once if there is anything to report, or if the IONSS is
+	 * shutting down.
+	 */
+	if (watch->stop || check.seq == 0 || watch_pending(watch, &check)) {
+		watch_fill(watch, rpc, check.seq, check.client);
+		watch->replies++;
+		D_MUTEX_UNLOCK(&watch->lock);
+		watch_reply(rpc);
+		return;
+	}
+
+	D_ALLOC_PTR(waiter);
+	if (!waiter) {
+		D_MUTEX_UNLOCK(&watch->lock);
+		out->err = -DER_NOMEM;
+		watch_reply(rpc);
+		return;
+	}
+
+	crt_req_addref(rpc);
+	waiter->rpc = rpc;
+	waiter->seq = check.seq;
+	waiter->client = check.client;
+	waiter->expires = watch_now() + IOS_WATCH_TIMEOUT;
+	d_list_add_tail(&waiter->list, &watch->waiters);
+
+	D_MUTEX_UNLOCK(&watch->lock);
+}
@@ -182,6 +182,72 @@ static void gah_test(void)
 	WRITE_LOG("stop gah_test");
 }
 
+static int lookup_path(int fd, const char *path)
+{
+	struct iof_lookup_path_info info = {0};
+
+	info.version = IOF_IOCTL_VERSION;
+	strncpy(info.path, path, IOF_IOCTL_PATH_LEN - 1);
+
+	return ioctl(fd, IOF_IOCTL_LOOKUP_PATH, &info);
+}
+
+static void lookup_path_test(void)
+{
+	struct iof_lookup_path_info info = {0};
+	struct stat stbuf;
+	char dir_a[BUF_SIZE];
+	char dir_b[BUF_SIZE];
+	int fd;
+	int rc;
+
+	WRITE_LOG("starting lookup_path_test");
+	snprintf(dir_a, BUF_SIZE, "%s/lp_a", mount_dir);
+	snprintf(dir_b, BUF_SIZE, "%s/lp_a/lp_b", mount_dir);
+
+	rmdir(dir_b);
+	rmdir(dir_a);
+	CU_ASSERT_EQUAL_FATAL(mkdir(dir_a, 0700), 0);
+	CU_ASSERT_EQUAL_FATAL(mkdir(dir_b, 0700), 0);
+
+	fd = open(mount_dir, O_RDONLY | O_DIRECTORY);
+	CU_ASSERT_NOT_EQUAL_FATAL(fd, -1);
+
+	/* Both components are resolved and then used by stat() */
+	rc = lookup_path(fd, "lp_a/lp_b");
+	CU_ASSERT_EQUAL(rc, 2);
+	rc = stat(dir_b, &stbuf);
+	CU_ASSERT_EQUAL(rc, 0);
+	CU_ASSERT(S_ISDIR(stbuf.st_mode));
+
+	/* A partial chain is returned without an error */
+	rc = lookup_path(fd, "lp_a/lp_missing");
+	CU_ASSERT_EQUAL(rc, 1);
+
+	/* An error is only returned if the first component fails */
+	rc = lookup_path(fd, "lp_missing/lp_b");
+	CU_ASSERT_EQUAL(rc, -1);
+	CU_ASSERT_EQUAL(errno, ENOENT);
+
+	/* Requests with the wrong version are rejected */
+	info.version = IOF_IOCTL_VERSION + 1;
+	rc = ioctl(fd, IOF_IOCTL_LOOKUP_PATH, &info);
+	CU_ASSERT_EQUAL(rc, -1);
+	CU_ASSERT_EQUAL(errno, EINVAL);
+
+	rc = close(fd);
+	CU_ASSERT_EQUAL(rc, 0);
+
+	/* Cached names must not outlive the directories */
+	CU_ASSERT_EQUAL(rmdir(dir_b), 0);
+	CU_ASSERT_EQUAL(rmdir(dir_a), 0);
+	rc = stat(dir_b, &stbuf);
+	CU_ASSERT_EQUAL(rc, -1);
+	CU_ASSERT_EQUAL(errno, ENOENT);
+
+	WRITE_LOG("stop lookup_path_test");
+}
+
 static void do_write_tests(int fd, char *buf, size_t len)
 {
 	struct iovec iov[2];
@@ -611,6 +677,8 @@ int main(int argc, char **argv)
 	}
 
 	if (!CU_add_test(pSuite, "gah ioctl test", gah_test) ||
+	    !CU_add_test(pSuite, "lookup_path ioctl test",
+			 lookup_path_test) ||
 	    !CU_add_test(pSuite, "libioil sanity test", sanity)) {
 		CU_cleanup_registry();
 		printf("CU_add_test() failed\n");
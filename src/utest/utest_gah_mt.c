@@ -0,0 +1,225 @@
+/* Copyright (C) 2017-2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Multi-threaded test and microbenchmark for the GAH store.
+ *
+ * Each thread keeps a window of GAHs allocated, and for every iteration
+ * replaces the oldest one and looks up the others, checking that stale GAHs
+ * are rejected.  The throughput is reported for a range of thread counts to
+ * show how the store scales.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <CUnit/Basic.h>
+
+#include <ios_gah.h>
+
+int init_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+int clean_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+#define MAX_THREADS 16
+#define WINDOW 64
+#define LOOKUPS 4
+#define ITERATIONS (1024 * 64)
+
+struct thread_info {
+	struct ios_gah_store	*gs;
+	pthread_barrier_t	*barrier;
+	struct ios_gah		gah[WINDOW];
+	int			value[WINDOW];
+	int			fails;
+};
+
+static void *thread_func(void *arg)
+{
+	struct thread_info *tpd = arg;
+	struct ios_gah stale;
+	void *info;
+	int slot;
+	int i;
+	int j;
+	int rc;
+
+	for (i = 0; i < WINDOW; i++) {
+		rc = ios_gah_allocate(tpd->gs, &tpd->gah[i], &tpd->value[i]);
+		if (rc != -DER_SUCCESS)
+			tpd->fails++;
+	}
+
+	pthread_barrier_wait(tpd->barrier);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		slot = i % WINDOW;
+
+		stale = tpd->gah[slot];
+		rc = ios_gah_deallocate(tpd->gs, &tpd->gah[slot]);
+		if (rc != -DER_SUCCESS)
+			tpd->fails++;
+
+		rc = ios_gah_allocate(tpd->gs, &tpd->gah[slot],
+				      &tpd->value[slot]);
+		if (rc != -DER_SUCCESS)
+			tpd->fails++;
+
+		if (ios_gah_get_info(tpd->gs, &stale, &info) == -DER_SUCCESS &&
+		    info == &tpd->value[slot])
+			tpd->fails++;
+
+		for (j = 1; j <= LOOKUPS; j++) {
+			int idx = (slot + j * 7) % WINDOW;
+
+			rc = ios_gah_get_info(tpd->gs, &tpd->gah[idx], &info);
+			if (rc != -DER_SUCCESS || info != &tpd->value[idx])
+				tpd->fails++;
+		}
+	}
+
+	pthread_barrier_wait(tpd->barrier);
+
+	for (i = 0; i < WINDOW; i++) {
+		rc = ios_gah_deallocate(tpd->gs, &tpd->gah[i]);
+		if (rc != -DER_SUCCESS)
+			tpd->fails++;
+	}
+
+	return NULL;
+}
+
+static double run_threads(int count)
+{
+	struct ios_gah_store *gs;
+	pthread_barrier_t barrier;
+	pthread_t thread[MAX_THREADS];
+	struct thread_info *tpd;
+	struct timespec start;
+	struct timespec end;
+	double elapsed;
+	int fails = 0;
+	int i;
+	int rc;
+
+	gs = ios_gah_init(0);
+	CU_ASSERT_FATAL(gs != NULL);
+
+	tpd = calloc(count, sizeof(*tpd));
+	CU_ASSERT_FATAL(tpd != NULL);
+
+	/* Include the main thread so it can time the run */
+	pthread_barrier_init(&barrier, NULL, count + 1);
+
+	for (i = 0; i < count; i++) {
+		tpd[i].gs = gs;
+		tpd[i].barrier = &barrier;
+		rc = pthread_create(&thread[i], NULL, thread_func, &tpd[i]);
+		CU_ASSERT_FATAL(rc == 0);
+	}
+
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < count; i++) {
+		rc = pthread_join(thread[i], NULL);
+		CU_ASSERT(rc == 0);
+		fails += tpd[i].fails;
+	}
+
+	CU_ASSERT(fails == 0);
+	CU_ASSERT(ios_gah_destroy(gs) == -DER_SUCCESS);
+
+	pthread_barrier_destroy(&barrier);
+	free(tpd);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	/* Each iteration is an allocate, deallocate and LOOKUPS + 1 lookups */
+	return (double)count * ITERATIONS * (LOOKUPS + 3) / elapsed;
+}
+
+/** Run the workload with increasing thread counts and report throughput */
+static void test_ios_gah_scaling(void)
+{
+	double base = 0;
+	double rate;
+	int count;
+
+	printf("\n");
+	for (count = 1; count <= MAX_THREADS; count *= 2) {
+		rate = run_threads(count);
+		if (count == 1)
+			base = rate;
+		printf("%2d threads: %8.2f Mops/s (%.2fx)\n", count,
+		       rate / 1e6, rate / base);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CU_initialize_registry() != CUE_SUCCESS)
+		return CU_get_error();
+	pSuite = CU_add_suite("GAH multi-threaded test", init_suite,
+			      clean_suite);
+	if (!pSuite) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	if (!CU_add_test(pSuite, "ios_gah scaling test",
+			 test_ios_gah_scaling)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+
+	return CU_get_error();
+}
@@ -0,0 +1,473 @@
+/* Copyright (C) 2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gurt/list.h>
+#include <CUnit/Basic.h>
+
+#include "log.h"
+#include "iof_pool.h"
+
+int init_suite(void)
+{
+	iof_log_init("pool", "iof_pool_test", NULL);
+	return CUE_SUCCESS;
+}
+
+int clean_suite(void)
+{
+	iof_log_close();
+	return CUE_SUCCESS;
+}
+
+#define ENTRIES 1000
+#define NUM_THREADS 16
+#define ITERATIONS 100000
+#define BATCH 4
+
+struct item {
+	d_list_t link;
+	int tid;
+	int value;
+};
+
+static ATOMIC int init_calls;
+static ATOMIC int release_calls;
+
+static void
+item_init(void *arg, void *handle)
+{
+	struct item *item = arg;
+
+	item->tid = -1;
+	atomic_inc(&init_calls);
+}
+
+static bool
+item_reset(void *arg)
+{
+	struct item *item = arg;
+
+	item->tid = -1;
+	item->value = 0;
+	return true;
+}
+
+static void
+item_release(void *arg)
+{
+	atomic_inc(&release_calls);
+}
+
+static struct iof_pool_reg item_reg = {
+	.init = item_init,
+	.reset = item_reset,
+	.release = item_release,
+	POOL_TYPE_INIT(item, link)
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCKED_ASSERT(cond)                  \
+	do {                                 \
+		pthread_mutex_lock(&lock);   \
+		CU_ASSERT(cond)              \
+		pthread_mutex_unlock(&lock); \
+	} while (0)
+
+/* Check the counters of a type which no thread holds magazines for */
+static void
+check_idle(struct iof_pool_type *type)
+{
+	CU_ASSERT(type->in_use == 0);
+	CU_ASSERT(type->mag_count == 0);
+	CU_ASSERT(type->count == type->free_count + type->pending_count);
+}
+
+/** Basic single threaded acquire, release and restock */
+static void test_iof_pool(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct item *items[ENTRIES];
+	int i;
+
+	init_calls = release_calls = 0;
+
+	CU_ASSERT_FATAL(iof_pool_init(&pool, NULL) == 0);
+	type = iof_pool_register(&pool, &item_reg);
+	CU_ASSERT_FATAL(type != NULL);
+
+	for (i = 0; i < ENTRIES; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->tid == -1);
+		items[i]->tid = 0;
+		items[i]->value = i;
+	}
+	CU_ASSERT(type->in_use == ENTRIES);
+	CU_ASSERT(type->in_use_hwm == ENTRIES);
+
+	for (i = 0; i < ENTRIES; i++) {
+		CU_ASSERT(items[i]->value == i);
+		iof_pool_release(type, items[i]);
+	}
+	CU_ASSERT(type->in_use == 0);
+
+	iof_pool_restock(type);
+	CU_ASSERT(type->no_restock == 0);
+	CU_ASSERT(type->no_restock_hwm >= ENTRIES);
+
+	/* Released objects must be reset before being handed out again */
+	for (i = 0; i < ENTRIES; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->tid == -1);
+	}
+	for (i = 0; i < ENTRIES; i++)
+		iof_pool_release(type, items[i]);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+	iof_pool_destroy(&pool);
+	CU_ASSERT(init_calls == release_calls);
+}
+
+/** Objects cached by a thread must still be usable at the max_desc limit */
+static void test_iof_pool_limit(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct iof_pool_reg reg = item_reg;
+	struct item *items[BATCH];
+	int i;
+
+	init_calls = release_calls = 0;
+	reg.max_desc = BATCH;
+
+	CU_ASSERT_FATAL(iof_pool_init(&pool, NULL) == 0);
+	type = iof_pool_register(&pool, &reg);
+	CU_ASSERT_FATAL(type != NULL);
+
+	for (i = 0; i < BATCH; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+	}
+	CU_ASSERT(iof_pool_acquire(type) == NULL);
+
+	for (i = 0; i < BATCH; i++)
+		iof_pool_release(type, items[i]);
+
+	/* The released objects are now held in the magazine of this thread
+	 * so acquiring them again has to go via the reset path.
+	 */
+	for (i = 0; i < BATCH; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->tid == -1);
+	}
+	CU_ASSERT(type->count == BATCH);
+	CU_ASSERT(iof_pool_reclaim(&pool));
+
+	for (i = 0; i < BATCH; i++)
+		iof_pool_release(type, items[i]);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+	check_idle(type);
+	iof_pool_destroy(&pool);
+	CU_ASSERT(init_calls == release_calls);
+}
+
+/** Magazines hold no more than the limits set for a type */
+static void test_iof_pool_mag_limit(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct iof_pool_reg reg = item_reg;
+	struct item *items[ENTRIES];
+	int i;
+
+	init_calls = release_calls = 0;
+	reg.max_mag_desc = 2;
+	reg.max_mag_total = 1;
+
+	CU_ASSERT_FATAL(iof_pool_init(&pool, NULL) == 0);
+	type = iof_pool_register(&pool, &reg);
+	CU_ASSERT_FATAL(type != NULL);
+	CU_ASSERT(type->mag_size == 2);
+	CU_ASSERT(type->mag_total == 1);
+
+	for (i = 0; i < ENTRIES; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(type->mag_count <= 1);
+	}
+	for (i = 0; i < ENTRIES; i++) {
+		iof_pool_release(type, items[i]);
+		CU_ASSERT(type->mag_count <= 1);
+	}
+
+	iof_pool_restock(type);
+	CU_ASSERT(type->mag_count <= 1);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+	check_idle(type);
+	iof_pool_destroy(&pool);
+	CU_ASSERT(init_calls == release_calls);
+}
+
+struct thread_info {
+	struct iof_pool_type *type;
+	pthread_barrier_t *barrier;
+	int tid;
+	int fails;
+};
+
+static void *thread_func(void *arg)
+{
+	struct thread_info *tpd = arg;
+	struct item *items[BATCH];
+	int i;
+	int j;
+
+	pthread_barrier_wait(tpd->barrier);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		for (j = 0; j < BATCH; j++) {
+			items[j] = iof_pool_acquire(tpd->type);
+			if (!items[j] || items[j]->tid != -1) {
+				tpd->fails++;
+				goto out;
+			}
+			items[j]->tid = tpd->tid;
+			items[j]->value = i;
+		}
+		for (j = 0; j < BATCH; j++) {
+			if (items[j]->tid != tpd->tid || items[j]->value != i)
+				tpd->fails++;
+			iof_pool_release(tpd->type, items[j]);
+		}
+		/* Restock at the rate a request path would */
+		if ((i & 0xff) == 0)
+			iof_pool_restock(tpd->type);
+	}
+
+out:
+	pthread_barrier_wait(tpd->barrier);
+
+	return NULL;
+}
+
+/* Many threads acquiring and releasing from a single type.  Reports the
+ * achieved rate so that changes to the locking can be compared.
+ */
+static void run_threaded(bool pool_thread)
+{
+	pthread_barrier_t barrier;
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	pthread_t thread[NUM_THREADS];
+	struct thread_info tpd[NUM_THREADS];
+	struct timespec start;
+	struct timespec end;
+	double secs;
+	int i;
+	int rc;
+
+	init_calls = release_calls = 0;
+
+	CU_ASSERT_FATAL(iof_pool_init(&pool, NULL) == 0);
+	if (pool_thread)
+		CU_ASSERT_FATAL(iof_pool_start_thread(&pool) == 0);
+	type = iof_pool_register(&pool, &item_reg);
+	CU_ASSERT_FATAL(type != NULL);
+
+	pthread_barrier_init(&barrier, NULL, NUM_THREADS + 1);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		tpd[i].type = type;
+		tpd[i].barrier = &barrier;
+		tpd[i].tid = i;
+		tpd[i].fails = 0;
+		rc = pthread_create(&thread[i], NULL, thread_func, &tpd[i]);
+		LOCKED_ASSERT(rc == 0);
+	}
+
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		rc = pthread_join(thread[i], NULL);
+		LOCKED_ASSERT(rc == 0);
+		CU_ASSERT(tpd[i].fails == 0);
+	}
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("\n%d threads%s, %.0f acquire/release pairs per second\n",
+	       NUM_THREADS, pool_thread ? " and pool thread" : "",
+	       (double)NUM_THREADS * ITERATIONS * BATCH / secs);
+	printf("%d objects created, %d on-path init, %d on-path reset\n",
+	       type->count, type->op_init, type->op_reset);
+	/* The pool thread should do nearly all of the resets, however how
+	 * many depends on scheduling, so this is reported rather than checked.
+	 */
+	if (pool_thread)
+		printf("%d pool thread restocks, %d resets\n",
+		       type->thread_restock, type->reset_count);
+
+	/* Thread exit returns magazine contents to the type */
+	check_idle(type);
+	CU_ASSERT(type->in_use_hwm <= NUM_THREADS * BATCH);
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+
+	pthread_barrier_destroy(&barrier);
+	iof_pool_destroy(&pool);
+	CU_ASSERT(init_calls == release_calls);
+}
+
+/** test iof_pool() with many threads */
+static void test_iof_pool_threaded(void)
+{
+	run_threaded(false);
+}
+
+/** test iof_pool() with many threads and a restock thread */
+static void test_iof_pool_restock_threaded(void)
+{
+	run_threaded(true);
+}
+
+/** Objects are reset by the pool thread rather than by restock() */
+static void test_iof_pool_restock_thread(void)
+{
+	struct iof_pool pool;
+	struct iof_pool_type *type;
+	struct item *items[ENTRIES];
+	bool done = false;
+	int op_init;
+	int op_reset;
+	int i;
+
+	init_calls = release_calls = 0;
+
+	CU_ASSERT_FATAL(iof_pool_init(&pool, NULL) == 0);
+	CU_ASSERT_FATAL(iof_pool_start_thread(&pool) == 0);
+	type = iof_pool_register(&pool, &item_reg);
+	CU_ASSERT_FATAL(type != NULL);
+
+	for (i = 0; i < ENTRIES; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+	}
+	for (i = 0; i < ENTRIES; i++)
+		iof_pool_release(type, items[i]);
+
+	iof_pool_restock(type);
+
+	/* Wait for up to five seconds for the pool thread to reset all of the
+	 * released objects.  The thread may also have been woken by acquire()
+	 * and release() so can run more than once.
+	 */
+	for (i = 0; i < 5000 && !done; i++) {
+		pthread_mutex_lock(&type->lock);
+		done = type->pending_count == 0 &&
+			type->free_count + type->mag_count == type->count;
+		pthread_mutex_unlock(&type->lock);
+		if (!done)
+			usleep(1000);
+	}
+	CU_ASSERT(done);
+
+	pthread_mutex_lock(&type->lock);
+	CU_ASSERT(type->thread_restock >= 1);
+	CU_ASSERT(type->count > ENTRIES);
+	op_init = type->op_init;
+	op_reset = type->op_reset;
+	pthread_mutex_unlock(&type->lock);
+
+	for (i = 0; i < ENTRIES; i++) {
+		items[i] = iof_pool_acquire(type);
+		CU_ASSERT_FATAL(items[i] != NULL);
+		CU_ASSERT(items[i]->tid == -1);
+	}
+	CU_ASSERT(type->op_init == op_init);
+	CU_ASSERT(type->op_reset == op_reset);
+	for (i = 0; i < ENTRIES; i++)
+		iof_pool_release(type, items[i]);
+
+	CU_ASSERT(!iof_pool_reclaim(&pool));
+	iof_pool_destroy(&pool);
+	CU_ASSERT(init_calls == release_calls);
+}
+
+int main(int argc, char **argv)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CU_initialize_registry() != CUE_SUCCESS)
+		return CU_get_error();
+	pSuite = CU_add_suite("iof_pool API test", init_suite, clean_suite);
+	if (!pSuite) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	if (!CU_add_test(pSuite, "iof_pool test", test_iof_pool) ||
+	    !CU_add_test(pSuite, "iof_pool limit test", test_iof_pool_limit) ||
+	    !CU_add_test(pSuite, "iof_pool magazine limit test",
+			 test_iof_pool_mag_limit) ||
+	    !CU_add_test(pSuite, "iof_pool threaded test",
+			 test_iof_pool_threaded) ||
+	    !CU_add_test(pSuite, "iof_pool restock thread test",
+			 test_iof_pool_restock_thread) ||
+	    !CU_add_test(pSuite, "iof_pool threaded restock thread test",
+			 test_iof_pool_restock_threaded)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+
+	return CU_get_error();
+}
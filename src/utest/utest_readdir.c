@@ -0,0 +1,349 @@
+/* Copyright (C) 2016-2018 Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted for any purpose (including commercial purposes)
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the
+ *    documentation and/or materials provided with the distribution.
+ *
+ * 3. In addition, redistributions of modified forms of the source or binary
+ *    code must carry prominent notices stating that the original code was
+ *    changed and the date of the change.
+ *
+ *  4. All publications or advertising materials mentioning features or use of
+ *     this software are asked, but not required, to acknowledge that it was
+ *     developed by Intel Corporation and credit the contributors.
+ *
+ * 5. Neither the name of Intel Corporation, nor the name of any Contributor
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/Basic.h>
+
+#include <iof_common.h>
+
+#define ENTRY_COUNT 64
+
+int init_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+int clean_suite(void)
+{
+	return CUE_SUCCESS;
+}
+
+static void fill_reply(struct iof_readdir_reply *reply, int i, off_t nextoff)
+{
+	memset(reply, 0, sizeof(*reply));
+	snprintf(reply->d_name, sizeof(reply->d_name), "file_%d", i);
+	reply->nextoff = nextoff;
+	reply->stat.st_ino = 1000 + i;
+	reply->stat.st_size = i * 4096;
+	reply->stat.st_blocks = i * 8;
+	reply->stat.st_mode = S_IFREG | 0644;
+	reply->stat.st_nlink = 1;
+	reply->stat.st_uid = 100 + i;
+	reply->stat.st_gid = 200 + i;
+	reply->stat.st_blksize = 4096;
+	reply->stat.st_mtim.tv_sec = 1500000000 + i;
+	reply->stat.st_mtim.tv_nsec = i;
+	reply->stat.st_ctim.tv_sec = 1500000001 + i;
+	reply->stat.st_atim.tv_sec = 1500000002 + i;
+}
+
+static void check_reply(struct iof_readdir_reply *a,
+			struct iof_readdir_reply *b)
+{
+	CU_ASSERT_STRING_EQUAL(a->d_name, b->d_name);
+	CU_ASSERT_EQUAL(a->nextoff, b->nextoff);
+	CU_ASSERT_EQUAL(a->read_rc, b->read_rc);
+	CU_ASSERT_EQUAL(a->stat_rc, b->stat_rc);
+	CU_ASSERT_EQUAL(a->stat.st_ino, b->stat.st_ino);
+	CU_ASSERT_EQUAL(a->stat.st_size, b->stat.st_size);
+	CU_ASSERT_EQUAL(a->stat.st_blocks, b->stat.st_blocks);
+	CU_ASSERT_EQUAL(a->stat.st_mode, b->stat.st_mode);
+	CU_ASSERT_EQUAL(a->stat.st_nlink, b->stat.st_nlink);
+	CU_ASSERT_EQUAL(a->stat.st_uid, b->stat.st_uid);
+	CU_ASSERT_EQUAL(a->stat.st_gid, b->stat.st_gid);
+	CU_ASSERT_EQUAL(a->stat.st_rdev, b->stat.st_rdev);
+	CU_ASSERT_EQUAL(a->stat.st_blksize, b->stat.st_blksize);
+	CU_ASSERT_EQUAL(a->stat.st_mtim.tv_sec, b->stat.st_mtim.tv_sec);
+	CU_ASSERT_EQUAL(a->stat.st_mtim.tv_nsec, b->stat.st_mtim.tv_nsec);
+	CU_ASSERT_EQUAL(a->stat.st_ctim.tv_sec, b->stat.st_ctim.tv_sec);
+	CU_ASSERT_EQUAL(a->stat.st_atim.tv_sec, b->stat.st_atim.tv_sec);
+}
+
+/** Pack and unpack entries with sequential and arbitrary offsets */
+static void test_readdir_roundtrip(void)
+{
+	struct iof_readdir_reply in[ENTRY_COUNT];
+	struct iof_readdir_reply out[ENTRY_COUNT];
+	char buf[ENTRY_COUNT * sizeof(struct iof_readdir_reply)];
+	size_t used;
+	int count;
+	int i;
+
+	for (i = 0; i < ENTRY_COUNT; i++)
+		fill_reply(&in[i], i, (i % 2) ? 11 + i : (off_t)i * 977 + 5);
+
+	/* Device files carry rdev, and failed stats carry no attributes */
+	in[3].stat.st_mode = S_IFCHR | 0600;
+	in[3].stat.st_rdev = 0x0501;
+	in[5].stat_rc = ENOENT;
+	memset(&in[5].stat, 0, sizeof(in[5].stat));
+
+	count = iof_readdir_pack(in, ENTRY_COUNT, 10, 0, buf, sizeof(buf),
+				 &used);
+	CU_ASSERT_EQUAL(count, ENTRY_COUNT);
+	CU_ASSERT(used < sizeof(buf) / 3);
+	CU_ASSERT_EQUAL(used % 8, 0);
+
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, count, 10, out),
+			-DER_SUCCESS);
+	for (i = 0; i < ENTRY_COUNT; i++)
+		check_reply(&in[i], &out[i]);
+}
+
+/** Delta encoded offsets do not use space in the record */
+static void test_readdir_delta(void)
+{
+	struct iof_readdir_reply reply;
+	size_t delta;
+	size_t full;
+
+	fill_reply(&reply, 1, 8);
+
+	delta = iof_readdir_packed_size(&reply, 7, 0);
+	full = iof_readdir_packed_size(&reply, 100, 0);
+	CU_ASSERT_EQUAL(full - delta, sizeof(uint64_t));
+}
+
+/** Only the inode number and type are sent if attributes are not needed */
+static void test_readdir_no_attr(void)
+{
+	struct iof_readdir_reply in[ENTRY_COUNT];
+	struct iof_readdir_reply out[ENTRY_COUNT];
+	char buf[ENTRY_COUNT * sizeof(struct iof_readdir_reply)];
+	size_t attr_used;
+	size_t used;
+	int count;
+	int i;
+
+	for (i = 0; i < ENTRY_COUNT; i++)
+		fill_reply(&in[i], i, i + 1);
+
+	iof_readdir_pack(in, ENTRY_COUNT, 0, 0, buf, sizeof(buf), &attr_used);
+	count = iof_readdir_pack(in, ENTRY_COUNT, 0, IOF_READDIR_NO_ATTR, buf,
+				 sizeof(buf), &used);
+	CU_ASSERT_EQUAL(count, ENTRY_COUNT);
+	CU_ASSERT(used < attr_used / 2);
+
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, count, 0, out),
+			-DER_SUCCESS);
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		CU_ASSERT_STRING_EQUAL(out[i].d_name, in[i].d_name);
+		CU_ASSERT_EQUAL(out[i].nextoff, in[i].nextoff);
+		CU_ASSERT_EQUAL(out[i].stat.st_ino, in[i].stat.st_ino);
+		CU_ASSERT_EQUAL(out[i].stat.st_mode, in[i].stat.st_mode);
+		CU_ASSERT_EQUAL(out[i].stat.st_size, 0);
+	}
+}
+
+/** GAHs are only sent for entries which have one */
+static void test_readdir_gah(void)
+{
+	struct iof_readdir_reply in[ENTRY_COUNT];
+	struct iof_readdir_reply out[ENTRY_COUNT];
+	char buf[ENTRY_COUNT * sizeof(struct iof_readdir_reply)];
+	size_t used;
+	int count;
+	int i;
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		fill_reply(&in[i], i, i + 1);
+		if (i % 3 == 0)
+			continue;
+		in[i].gah.root = 1;
+		in[i].gah.fid = 100 + i;
+		in[i].gah.revision = i;
+		in[i].gah_valid = 1;
+	}
+
+	CU_ASSERT_EQUAL(iof_readdir_packed_size(&in[1], 1, 0) -
+			iof_readdir_packed_size(&in[0], 0, 0),
+			sizeof(struct ios_gah));
+
+	count = iof_readdir_pack(in, ENTRY_COUNT, 0, IOF_READDIR_GAH, buf,
+				 sizeof(buf), &used);
+	CU_ASSERT_EQUAL(count, ENTRY_COUNT);
+
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, count, 0, out),
+			-DER_SUCCESS);
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		check_reply(&in[i], &out[i]);
+		CU_ASSERT_EQUAL(out[i].gah_valid, in[i].gah_valid);
+		if (!in[i].gah_valid)
+			continue;
+		CU_ASSERT_EQUAL(memcmp(&out[i].gah, &in[i].gah,
+				       sizeof(in[i].gah)), 0);
+	}
+}
+
+/** Packing stops at the first entry which does not fit */
+static void test_readdir_short_buffer(void)
+{
+	struct iof_readdir_reply in[ENTRY_COUNT];
+	struct iof_readdir_reply out[ENTRY_COUNT];
+	char buf[1024];
+	size_t used;
+	size_t len = 0;
+	int expected = 0;
+	int count;
+	int i;
+
+	for (i = 0; i < ENTRY_COUNT; i++)
+		fill_reply(&in[i], i, i + 1);
+
+	for (i = 0; i < ENTRY_COUNT; i++) {
+		len += iof_readdir_packed_size(&in[i], i, 0);
+		if (len > sizeof(buf))
+			break;
+		expected++;
+	}
+
+	count = iof_readdir_pack(in, ENTRY_COUNT, 0, 0, buf, sizeof(buf),
+				 &used);
+	CU_ASSERT_EQUAL(count, expected);
+	CU_ASSERT(used <= sizeof(buf));
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, count, 0, out),
+			-DER_SUCCESS);
+	CU_ASSERT_STRING_EQUAL(out[count - 1].d_name, in[count - 1].d_name);
+}
+
+/** A readdir() error is returned as a record with no name */
+static void test_readdir_read_error(void)
+{
+	struct iof_readdir_reply in[2];
+	struct iof_readdir_reply out[2];
+	char buf[1024];
+	size_t used;
+	int count;
+
+	fill_reply(&in[0], 0, 1);
+	memset(&in[1], 0, sizeof(in[1]));
+	in[1].read_rc = EIO;
+
+	count = iof_readdir_pack(in, 2, 0, 0, buf, sizeof(buf), &used);
+	CU_ASSERT_EQUAL(count, 2);
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, count, 0, out),
+			-DER_SUCCESS);
+	CU_ASSERT_EQUAL(out[1].read_rc, EIO);
+	CU_ASSERT_STRING_EQUAL(out[1].d_name, "");
+}
+
+/** Malformed buffers are rejected */
+static void test_readdir_malformed(void)
+{
+	struct iof_readdir_reply in;
+	struct iof_readdir_reply out[2];
+	struct iof_readdir_packed *rec;
+	char buf[1024];
+	size_t used;
+
+	fill_reply(&in, 0, 1);
+	CU_ASSERT_EQUAL(iof_readdir_pack(&in, 1, 0, 0, buf, sizeof(buf), &used),
+			1);
+
+	/* More entries than the buffer holds */
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, 2, 0, out),
+			-DER_PROTO);
+
+	/* Truncated buffer */
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used - 8, 1, 0, out),
+			-DER_PROTO);
+
+	/* Record length too short for its contents */
+	rec = (struct iof_readdir_packed *)buf;
+	rec->rec_len = 16;
+	CU_ASSERT_EQUAL(iof_readdir_unpack(buf, used, 1, 0, out),
+			-DER_PROTO);
+}
+
+/** Entries in the original format convert without the GAH */
+static void test_readdir_entry(void)
+{
+	struct iof_readdir_entry entry;
+	struct iof_readdir_reply in;
+	struct iof_readdir_reply out;
+
+	fill_reply(&in, 0, 42);
+	in.stat_rc = EACCES;
+	in.gah_valid = 1;
+
+	memset(&entry, 0xff, sizeof(entry));
+	iof_readdir_entry_set(&entry, &in);
+	memset(&out, 0xff, sizeof(out));
+	iof_readdir_entry_get(&entry, &out);
+
+	check_reply(&in, &out);
+	CU_ASSERT_EQUAL(out.gah_valid, 0);
+}
+
+int main(int argc, char **argv)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CU_initialize_registry() != CUE_SUCCESS)
+		return CU_get_error();
+	pSuite = CU_add_suite("Packed readdir test", init_suite, clean_suite);
+	if (!pSuite) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	if (!CU_add_test(pSuite, "Pack and unpack test",
+			 test_readdir_roundtrip) ||
+	    !CU_add_test(pSuite, "Delta offset test", test_readdir_delta) ||
+	    !CU_add_test(pSuite, "No attributes test",
+			 test_readdir_no_attr) ||
+	    !CU_add_test(pSuite, "GAH test", test_readdir_gah) ||
+	    !CU_add_test(pSuite, "Short buffer test",
+			 test_readdir_short_buffer) ||
+	    !CU_add_test(pSuite, "Read error test",
+			 test_readdir_read_error) ||
+	    !CU_add_test(pSuite, "Malformed buffer test",
+			 test_readdir_malformed) ||
+	    !CU_add_test(pSuite, "Original entry test",
+			 test_readdir_entry)) {
+		CU_cleanup_registry();
+		return CU_get_error();
+	}
+
+	CU_basic_set_mode(CU_BRM_VERBOSE);
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+
+	return CU_get_error();
+}